@@ -0,0 +1,423 @@
+#!/usr/bin/env python3
+"""
+SD-Programmer host link tool.
+
+Transfers images to and from the SD-Programmer, and programs and verifies the device,
+using the binary host link on the USB (CDC) serial port. The shell 'phost' command is
+sent to start the link. The protocol is described in
+`sw/pico/src/app/deviceops/include/hostlink.h`.
+
+    sdhost.py -p /dev/ttyACM0 status
+    sdhost.py -p /dev/ttyACM0 upload image.bin [--addr A] [--size S] [--program] [--verify]
+    sdhost.py -p /dev/ttyACM0 download image.bin [--addr A] [--len N]
+    sdhost.py -p /dev/ttyACM0 program
+    sdhost.py -p /dev/ttyACM0 verify
+    sdhost.py -p /dev/ttyACM0 stream image.bin
+    sdhost.py -p /dev/ttyACM0 dump device.bin [--addr A] [--len N]
+
+Requires pyserial.
+
+Copyright 2023-25 AESilky
+SPDX-License-Identifier: MIT License
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+SYNC = b'\xA5\x5A'
+PAYLOAD_MAX = 1024
+
+# Frame types
+CMD_STATUS = 0x01
+CMD_UPLOAD = 0x02
+CMD_DOWNLOAD = 0x03
+CMD_PROGRAM = 0x04
+CMD_VERIFY = 0x05
+CMD_EXIT = 0x06
+CMD_STREAM = 0x07
+CMD_DUMP = 0x08
+DATA = 0x40
+ACK = 0x41
+NAK = 0x42
+CREDIT = 0x43
+RSP = 0x80
+PROGRESS = 0x81
+
+STATUS_NAMES = ['OK', 'bad command', 'bad argument', 'no image', 'image error', 'no device',
+                'device error', 'verify failed', 'transfer timeout', 'aborted']
+
+_HDR = struct.Struct('<BBH')
+_STATUS_RSP = struct.Struct('<BBHIBBBBI')
+_PROGRAM_RSP = struct.Struct('<IBBBBBIII')
+_STREAM_RSP = struct.Struct('<IIIBBI')
+
+XFER_TIMEOUT = 1.0
+XFER_RETRIES = 10
+STREAM_TIMEOUT = 2.0      # The device erases and programs without sending while the host waits for credit
+
+
+class LinkError(Exception):
+    pass
+
+
+def crc32(data, crc=0):
+    return zlib.crc32(data, crc) & 0xFFFFFFFF
+
+
+def status_name(st):
+    return STATUS_NAMES[st] if st < len(STATUS_NAMES) else 'status %d' % st
+
+
+class HostLink:
+    """The host end of the link. `port` needs `read(n)`, `write(b)`, and `in_waiting`."""
+
+    def __init__(self, port, progress=None):
+        self.port = port
+        self.progress = progress
+        self.rx = bytearray()
+        self.cmdseq = 0
+        self.window = 8
+        self.payload_max = PAYLOAD_MAX
+
+    def send(self, ftype, seq, payload=b''):
+        body = _HDR.pack(ftype, seq & 0xFF, len(payload)) + payload
+        self.port.write(SYNC + body + struct.pack('<I', crc32(body)))
+
+    def recv(self, timeout):
+        """Receive a frame. Returns (type, seq, payload), or None if nothing good arrived in time."""
+        end = time.monotonic() + timeout
+        while True:
+            i = self.rx.find(SYNC)
+            if i < 0:
+                # Keep a trailing sync byte (the start of a frame)
+                del self.rx[:max(0, len(self.rx) - 1)]
+            else:
+                del self.rx[:i]
+                if len(self.rx) >= 2 + _HDR.size:
+                    ftype, seq, ln = _HDR.unpack_from(self.rx, 2)
+                    flen = 2 + _HDR.size + ln + 4
+                    if ln > PAYLOAD_MAX:
+                        del self.rx[:2]
+                        continue
+                    if len(self.rx) >= flen:
+                        body = bytes(self.rx[2:flen - 4])
+                        (crc,) = struct.unpack_from('<I', self.rx, flen - 4)
+                        if crc != crc32(body):
+                            del self.rx[:2]
+                            continue
+                        del self.rx[:flen]
+                        return ftype, seq, body[_HDR.size:]
+            now = time.monotonic()
+            if now >= end:
+                return None
+            data = self.port.read(max(1, self.port.in_waiting))
+            if data:
+                self.rx.extend(data)
+
+    def _rsp(self, cmd, timeout):
+        """Wait for the response to a command. HL_PROGRESS frames restart the timeout."""
+        end = time.monotonic() + timeout
+        while True:
+            f = self.recv(max(0, end - time.monotonic()))
+            if f is None:
+                return None
+            ftype, seq, payload = f
+            if ftype == PROGRESS and len(payload) >= 4:
+                end = time.monotonic() + timeout
+                if self.progress:
+                    self.progress(struct.unpack_from('<I', payload)[0])
+            elif ftype == RSP and len(payload) >= 2 and payload[0] == cmd and seq == self.cmdseq:
+                return payload[1], payload[2:]
+
+    def command(self, cmd, args=b'', timeout=2.0, tries=3):
+        """Send a command and get the response (sending it again if there isn't one)."""
+        self.cmdseq = (self.cmdseq + 1) & 0xFF
+        for _ in range(tries):
+            self.send(cmd, self.cmdseq, args)
+            rsp = self._rsp(cmd, timeout)
+            if rsp is not None:
+                return rsp
+        raise LinkError('no response (command 0x%02X)' % cmd)
+
+    def start(self, tries=10):
+        """Start the link (from the shell) and get the device status."""
+        self.port.write(b'\rphost\r')
+        for _ in range(tries):
+            try:
+                return self.status(tries=1)
+            except LinkError:
+                pass
+        raise LinkError('the device did not start the host link')
+
+    def status(self, tries=3):
+        st, res = self.command(CMD_STATUS, timeout=1.0, tries=tries)
+        (version, window, payload_max, imgsize, mfgid, devid, sectcnt, _, devsize) = _STATUS_RSP.unpack_from(res)
+        self.window = window
+        self.payload_max = payload_max
+        return dict(version=version, window=window, payload_max=payload_max, imgsize=imgsize,
+                    mfgid=mfgid, devid=devid, sectcnt=sectcnt, devsize=devsize)
+
+    def exit(self):
+        try:
+            self.command(CMD_EXIT, timeout=1.0, tries=1)
+        except LinkError:
+            pass    # The link ends (when it is idle) in any case
+
+    def _check(self, st, what):
+        if st != 0:
+            raise LinkError('%s: %s' % (what, status_name(st)))
+
+    def upload(self, data, addr=0, imgsize=0):
+        """Send data into the image (opening it, erased, to imgsize if that isn't 0)."""
+        st, _ = self.command(CMD_UPLOAD, struct.pack('<III', imgsize, addr, len(data)))
+        self._check(st, 'upload')
+        pmax = self.payload_max
+        nframes = (len(data) + pmax - 1) // pmax
+        base = nxt = hi = 0     # hi: one past the last frame sent (nxt goes back for a resend)
+        retries = 0
+        while True:
+            while nxt < nframes and (nxt - base) < self.window:
+                self.send(DATA, nxt, data[nxt * pmax:(nxt + 1) * pmax])
+                nxt += 1
+                hi = max(hi, nxt)
+            f = self.recv(XFER_TIMEOUT)
+            if f is None:
+                retries += 1
+                if retries > XFER_RETRIES:
+                    raise LinkError('upload: transfer timeout')
+                if base == nframes:
+                    # All of the data was received, but the response wasn't. Ask for it again.
+                    self.send(ACK, nxt)
+                nxt = base
+                continue
+            ftype, seq, payload = f
+            if ftype == RSP and len(payload) >= 2 and payload[0] == CMD_UPLOAD:
+                self._check(payload[1], 'upload')
+                crc, ln = struct.unpack_from('<II', payload, 2)
+                if crc != crc32(data) or ln != len(data):
+                    raise LinkError('upload: CRC mismatch')
+                return crc
+            if ftype in (ACK, NAK):
+                acked = (seq - base) & 0xFF
+                if acked <= (hi - base):
+                    base += acked
+                    if acked:
+                        retries = 0
+                    if ftype == NAK or nxt < base:
+                        nxt = base
+
+    def download(self, addr, length):
+        """Read data from the image."""
+        return self._receive(CMD_DOWNLOAD, addr, length, 'download')
+
+    def dump(self, addr=0, length=None):
+        """Read data from the device (to the end of the device if the length isn't given)."""
+        if length is None:
+            length = self.status()['devsize'] - addr
+        return self._receive(CMD_DUMP, addr, length, 'dump')
+
+    def _receive(self, cmd, addr, length, what):
+        """Run a command that sends data (DATA frames) to the host."""
+        st, _ = self.command(cmd, struct.pack('<II', addr, length))
+        self._check(st, what)
+        out = bytearray()
+        expect = 0
+        unacked = 0
+        naked = False
+        retries = 0
+        while True:
+            f = self.recv(XFER_TIMEOUT)
+            if f is None:
+                retries += 1
+                if retries > XFER_RETRIES:
+                    raise LinkError('%s: transfer timeout' % what)
+                self.send(NAK, expect)
+                continue
+            ftype, seq, payload = f
+            if ftype == RSP and len(payload) >= 2 and payload[0] == cmd:
+                if len(payload) == 2 and payload[1] == 0:
+                    continue    # The response that accepted the command (sent again)
+                self._check(payload[1], what)
+                crc, ln = struct.unpack_from('<II', payload, 2)
+                if crc != crc32(bytes(out)) or ln != len(out):
+                    raise LinkError('%s: CRC mismatch' % what)
+                return bytes(out)
+            if ftype != DATA:
+                continue
+            if seq == (expect & 0xFF):
+                out.extend(payload)
+                expect += 1
+                naked = False
+                retries = 0
+                unacked += 1
+                if unacked >= self.window // 2 or len(out) >= length:
+                    self.send(ACK, expect)
+                    unacked = 0
+            elif ((seq - expect) & 0xFF) >= 0x80:
+                self.send(ACK, expect)
+            elif not naked:
+                self.send(NAK, expect)
+                naked = True
+
+    def stream(self, data):
+        """Program the device from address 0 with the data (sent as fast as the device programs it)."""
+        st, _ = self.command(CMD_STREAM, struct.pack('<I', len(data)), timeout=5.0)
+        self._check(st, 'stream')
+        pmax = self.payload_max
+        nframes = (len(data) + pmax - 1) // pmax
+        base = nxt = hi = 0
+        limit = 0               # The frames the device has given credit for
+        retries = 0
+        while True:
+            while nxt < min(nframes, limit):
+                self.send(DATA, nxt, data[nxt * pmax:(nxt + 1) * pmax])
+                nxt += 1
+                hi = max(hi, nxt)
+            f = self.recv(STREAM_TIMEOUT)
+            if f is None:
+                retries += 1
+                if retries > XFER_RETRIES:
+                    raise LinkError('stream: transfer timeout')
+                if base == nframes:
+                    # All of the data was received, but the response wasn't. Ask for it again.
+                    self.send(ACK, nxt)
+                nxt = base
+                continue
+            ftype, seq, payload = f
+            if ftype == RSP and len(payload) >= 2 and payload[0] == CMD_STREAM:
+                if len(payload) < 2 + _STREAM_RSP.size:
+                    self._check(payload[1], 'stream')
+                    continue    # The response that accepted the command (sent again)
+                crc, ln, failaddr, pdstat, erased, elapsed = _STREAM_RSP.unpack_from(payload, 2)
+                if payload[1] != 0:
+                    raise LinkError('stream: %s (device status %d at %05X)' % (status_name(payload[1]), pdstat, failaddr))
+                if crc != crc32(data) or ln != len(data):
+                    raise LinkError('stream: CRC mismatch')
+                return dict(erased=erased, elapsed_ms=elapsed)
+            if ftype == PROGRESS:
+                retries = 0
+                if self.progress and len(payload) >= 4:
+                    self.progress(struct.unpack_from('<I', payload)[0])
+            elif ftype in (CREDIT, NAK):
+                acked = (seq - base) & 0xFF
+                if acked <= (hi - base):
+                    base += acked
+                    if ftype == CREDIT and len(payload) >= 2:
+                        limit = max(limit, base + struct.unpack_from('<H', payload)[0])
+                    retries = 0
+                    if ftype == NAK or nxt < base:
+                        nxt = base
+
+    def program(self):
+        st, res = self.command(CMD_PROGRAM, timeout=20.0)
+        (failaddr, pdstat, clean, inplace, erased, chiperase, programmed, skipped, elapsed) = _PROGRAM_RSP.unpack_from(res)
+        if st != 0:
+            raise LinkError('program: %s (device status %d at %05X)' % (status_name(st), pdstat, failaddr))
+        return dict(clean=clean, inplace=inplace, erased=erased, chiperase=bool(chiperase),
+                    programmed=programmed, skipped=skipped, elapsed_ms=elapsed)
+
+    def verify(self):
+        st, res = self.command(CMD_VERIFY, timeout=10.0)
+        (failaddr,) = struct.unpack_from('<I', res)
+        if st != 0:
+            raise LinkError('verify: %s at %05X' % (status_name(st), failaddr))
+
+
+def _int(s):
+    return int(s, 0)
+
+
+def _dots(v):
+    sys.stdout.write('.')
+    sys.stdout.flush()
+
+
+def main(argv=None):
+    ap = argparse.ArgumentParser(description='SD-Programmer host link tool')
+    ap.add_argument('-p', '--port', required=True, help='the USB serial port')
+    sub = ap.add_subparsers(dest='cmd', required=True)
+    sub.add_parser('status', help='show the device and image status')
+    p = sub.add_parser('upload', help='send a binary file into the image')
+    p.add_argument('input')
+    p.add_argument('--addr', type=_int, default=0, help='image address for the data')
+    p.add_argument('--size', type=_int, help='image size (default: the device size, 0 to keep the open image)')
+    p.add_argument('--program', action='store_true', help='program the device after the upload')
+    p.add_argument('--verify', action='store_true', help='verify the device after the upload (and program)')
+    p = sub.add_parser('download', help='read the image into a binary file')
+    p.add_argument('output')
+    p.add_argument('--addr', type=_int, default=0)
+    p.add_argument('--len', type=_int, help='length (default: to the end of the image)')
+    sub.add_parser('program', help='make the device match the image')
+    sub.add_parser('verify', help='compare the device to the image')
+    p = sub.add_parser('dump', help='read the device into a binary file')
+    p.add_argument('output')
+    p.add_argument('--addr', type=_int, default=0)
+    p.add_argument('--len', type=_int, help='length (default: to the end of the device)')
+    p = sub.add_parser('stream', help='program the device directly from a binary file (the image is closed)')
+    p.add_argument('input')
+    args = ap.parse_args(argv)
+
+    import serial
+    port = serial.Serial(args.port, timeout=0.05)
+    link = HostLink(port, _dots)
+    try:
+        st = link.start()
+        if args.cmd == 'status':
+            print('Host link v%d (window %d x %d bytes)' % (st['version'], st['window'], st['payload_max']))
+            print('Image: %s' % ('%dK' % (st['imgsize'] // 1024) if st['imgsize'] else 'not open'))
+            if st['mfgid']:
+                print('Device: %02X:%02X  %dK (%d sectors)' % (st['mfgid'], st['devid'], st['devsize'] // 1024, st['sectcnt']))
+            else:
+                print('Device: not identified')
+        elif args.cmd == 'upload':
+            with open(args.input, 'rb') as f:
+                data = f.read()
+            size = args.size if args.size is not None else st['devsize']
+            t = time.monotonic()
+            crc = link.upload(data, args.addr, size)
+            t = time.monotonic() - t
+            print('Uploaded %d bytes CRC:%08X in %.2fs (%.0f KB/s)' % (len(data), crc, t, len(data) / 1024 / max(t, 1e-6)))
+        elif args.cmd == 'download':
+            length = args.len if args.len is not None else st['imgsize'] - args.addr
+            t = time.monotonic()
+            data = link.download(args.addr, length)
+            t = time.monotonic() - t
+            with open(args.output, 'wb') as f:
+                f.write(data)
+            print('Downloaded %d bytes in %.2fs (%.0f KB/s)' % (len(data), t, len(data) / 1024 / max(t, 1e-6)))
+        elif args.cmd == 'dump':
+            t = time.monotonic()
+            data = link.dump(args.addr, args.len)
+            t = time.monotonic() - t
+            with open(args.output, 'wb') as f:
+                f.write(data)
+            print('Read %d bytes CRC:%08X in %.2fs (%.0f KB/s)' % (len(data), crc32(data), t, len(data) / 1024 / max(t, 1e-6)))
+        elif args.cmd == 'stream':
+            with open(args.input, 'rb') as f:
+                data = f.read()
+            t = time.monotonic()
+            r = link.stream(data)
+            t = time.monotonic() - t
+            print('\nProgrammed %d bytes in %.2fs (%.0f KB/s). Sectors erased:%d' % (
+                len(data), t, len(data) / 1024 / max(t, 1e-6), r['erased']))
+        if args.cmd == 'program' or (args.cmd == 'upload' and args.program):
+            r = link.program()
+            print('\nDevice synced (%d ms). Sectors - clean:%d in-place:%d erased:%d%s' % (
+                r['elapsed_ms'], r['clean'], r['inplace'], r['erased'], ' (chip erase)' if r['chiperase'] else ''))
+        if args.cmd == 'verify' or (args.cmd == 'upload' and args.verify):
+            link.verify()
+            print('\nDevice matches the image.')
+        link.exit()
+    except LinkError as e:
+        print('\n%s: %s' % (args.port, e), file=sys.stderr)
+        return 1
+    finally:
+        port.close()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
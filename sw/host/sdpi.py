@@ -0,0 +1,286 @@
+#!/usr/bin/env python3
+"""
+SD-Programmer Image container (.sdpi) tool.
+
+Converts binary device images to .sdpi files (and back), and shows the information
+in an .sdpi file. The file format is described in `sw/pico/src/app/deviceops/include/sdpi.h`
+and the packing in `lzpack.h`.
+
+    sdpi.py pack image.bin image.sdpi --device SST39SF040 --name "Boot ROM v2"
+    sdpi.py unpack image.sdpi image.bin
+    sdpi.py info image.sdpi
+
+Copyright 2023-25 AESilky
+SPDX-License-Identifier: MIT License
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+SDPI_MAGIC = b'SDPI'
+SDPI_VERSION = 1
+SDPI_FLG_PACKED = 0x01
+SDPI_NAME_MAX = 32
+SECT_MAX = 128
+BITMAP_SIZE = SECT_MAX // 8
+SECTSIZE_MAX = 64 * 1024
+
+# magic, version, flags, mfgid, devid, size, sectsize, sectcnt, reserved1, crc, name, reserved2
+_HDR = struct.Struct('<4sBBBBIIHHI32sI')
+_SECT = struct.Struct('<II')
+
+# Device: (mfgid, devid, size, sector count)
+DEVICES = {
+    'Am29F040': (0x01, 0xA4, 512 * 1024, 8),
+    'MX29F040': (0xC2, 0xA4, 512 * 1024, 8),
+    'SST39SF010': (0xBF, 0xB5, 128 * 1024, 32),
+    'SST39SF020': (0xBF, 0xB6, 256 * 1024, 64),
+    'SST39SF040': (0xBF, 0xB7, 512 * 1024, 128),
+}
+
+# lzpack item tags and limits
+_FILL_TAG = 0x80
+_MATCH_TAG = 0xC0
+_LIT_MAX = 128
+_FILL_MIN = 4
+_FILL_MAX = (0x3F << 8 | 0xFF) + _FILL_MIN
+_MATCH_MIN = 4
+_MATCH_MAX = 0x3F + _MATCH_MIN
+_MATCH_OFF_MAX = 0xFFFF
+
+
+def lzp_pack(data):
+    """Pack a block (up to 64K) in the `lzpack` format."""
+    out = bytearray()
+    lits = bytearray()
+    last = {}   # Position of the last occurrence of each 4 byte sequence
+    n = len(data)
+
+    def flush_lits():
+        i = 0
+        while i < len(lits):
+            chunk = lits[i:i + _LIT_MAX]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+            i += _LIT_MAX
+        lits.clear()
+
+    i = 0
+    while i < n:
+        # Fill run
+        v = data[i]
+        r = i + 1
+        while r < n and (r - i) < _FILL_MAX and data[r] == v:
+            r += 1
+        run = r - i
+        if run >= _FILL_MIN:
+            flush_lits()
+            ln = run - _FILL_MIN
+            out.extend((_FILL_TAG | (ln >> 8), ln & 0xFF, v))
+            for k in range(i, min(r, n - 3)):
+                last[data[k:k + 4]] = k
+            i = r
+            continue
+        # Match
+        mlen = 0
+        if i + _MATCH_MIN <= n:
+            key = data[i:i + 4]
+            p = last.get(key)
+            if p is not None and (i - p) <= _MATCH_OFF_MAX:
+                m = 4
+                while i + m < n and m < _MATCH_MAX and data[p + m] == data[i + m]:
+                    m += 1
+                mlen = m
+            last[key] = i
+        if mlen >= _MATCH_MIN:
+            flush_lits()
+            off = i - p
+            out.extend((_MATCH_TAG | (mlen - _MATCH_MIN), off & 0xFF, off >> 8))
+            for k in range(i + 1, min(i + mlen, n - 3)):
+                last[data[k:k + 4]] = k
+            i += mlen
+            continue
+        lits.append(v)
+        i += 1
+    flush_lits()
+    return bytes(out)
+
+
+def lzp_unpack(src, length):
+    """Unpack a block in the `lzpack` format."""
+    out = bytearray()
+    i = 0
+    while i < len(src):
+        t = src[i]
+        i += 1
+        if t < _FILL_TAG:
+            out.extend(src[i:i + t + 1])
+            i += t + 1
+        elif t < _MATCH_TAG:
+            ln = ((t & 0x3F) << 8 | src[i]) + _FILL_MIN
+            out.extend(bytes([src[i + 1]]) * ln)
+            i += 2
+        else:
+            ln = (t & 0x3F) + _MATCH_MIN
+            off = src[i] | (src[i + 1] << 8)
+            i += 2
+            if off == 0 or off > len(out):
+                raise ValueError('invalid match offset')
+            for _ in range(ln):
+                out.append(out[-off])
+    if len(out) != length:
+        raise ValueError('unpacked length mismatch')
+    return bytes(out)
+
+
+def crc32(data, crc=0):
+    return zlib.crc32(data, crc) & 0xFFFFFFFF
+
+
+def pack(image, sectcnt, mfgid=0, devid=0, name='', packed=True):
+    """Build an .sdpi file from an image."""
+    size = len(image)
+    if sectcnt < 1 or sectcnt > SECT_MAX or size % sectcnt:
+        raise ValueError('the image size must be a multiple of the sector count (1-%d)' % SECT_MAX)
+    sectsize = size // sectcnt
+    if sectsize > SECTSIZE_MAX:
+        raise ValueError('the sector size is larger than %dK' % (SECTSIZE_MAX // 1024))
+    blank = b'\xFF' * sectsize
+    bitmap = bytearray(BITMAP_SIZE)
+    table = bytearray()
+    payloads = bytearray()
+    for s in range(sectcnt):
+        data = image[s * sectsize:(s + 1) * sectsize]
+        payload = b''
+        if data != blank:
+            bitmap[s // 8] |= 1 << (s % 8)
+            payload = data
+            if packed:
+                p = lzp_pack(data)
+                if len(p) < sectsize:
+                    payload = p
+        table.extend(_SECT.pack(crc32(data), len(payload)))
+        payloads.extend(payload)
+    nm = name.encode('utf-8')[:SDPI_NAME_MAX - 1]
+    hdr = _HDR.pack(SDPI_MAGIC, SDPI_VERSION, (SDPI_FLG_PACKED if packed else 0), mfgid, devid,
+                    size, sectsize, sectcnt, 0, crc32(image), nm, 0)
+    hdr_crc = crc32(bytes(table), crc32(bytes(bitmap), crc32(hdr)))
+    return hdr + struct.pack('<I', hdr_crc) + bytes(bitmap) + bytes(table) + bytes(payloads)
+
+
+def parse(sdpi):
+    """Parse an .sdpi file. Returns the header (dict), and a list of (crc, plen, payload) for each sector."""
+    if len(sdpi) < _HDR.size + 4 + BITMAP_SIZE:
+        raise ValueError('file too short')
+    (magic, version, flags, mfgid, devid, size, sectsize, sectcnt, _, crc, name, _) = _HDR.unpack_from(sdpi, 0)
+    if magic != SDPI_MAGIC or version != SDPI_VERSION:
+        raise ValueError('not an .sdpi file (or unsupported version)')
+    if sectcnt < 1 or sectcnt > SECT_MAX or sectsize * sectcnt != size:
+        raise ValueError('invalid geometry')
+    (hdr_crc,) = struct.unpack_from('<I', sdpi, _HDR.size)
+    pos = _HDR.size + 4
+    bitmap = sdpi[pos:pos + BITMAP_SIZE]
+    pos += BITMAP_SIZE
+    table = sdpi[pos:pos + sectcnt * _SECT.size]
+    pos += sectcnt * _SECT.size
+    if crc32(table, crc32(bitmap, crc32(sdpi[:_HDR.size]))) != hdr_crc:
+        raise ValueError('header CRC mismatch')
+    sects = []
+    for s in range(sectcnt):
+        scrc, plen = _SECT.unpack_from(table, s * _SECT.size)
+        if bool(bitmap[s // 8] & (1 << (s % 8))) != (plen != 0):
+            raise ValueError('sector %d: bitmap and table disagree' % s)
+        sects.append((scrc, plen, sdpi[pos:pos + plen]))
+        pos += plen
+    hdr = dict(flags=flags, mfgid=mfgid, devid=devid, size=size, sectsize=sectsize, sectcnt=sectcnt,
+               crc=crc, name=name.split(b'\0', 1)[0].decode('utf-8', 'replace'))
+    return hdr, sects
+
+
+def unpack(sdpi):
+    """Rebuild the image from an .sdpi file (checking the CRCs)."""
+    hdr, sects = parse(sdpi)
+    sectsize = hdr['sectsize']
+    image = bytearray()
+    for s, (scrc, plen, payload) in enumerate(sects):
+        if plen == 0:
+            data = b'\xFF' * sectsize
+        elif plen == sectsize:
+            data = payload
+        else:
+            data = lzp_unpack(payload, sectsize)
+        if crc32(data) != scrc:
+            raise ValueError('sector %d: CRC mismatch' % s)
+        image.extend(data)
+    if crc32(bytes(image)) != hdr['crc']:
+        raise ValueError('image CRC mismatch')
+    return bytes(image)
+
+
+def _int(s):
+    return int(s, 0)
+
+
+def main(argv=None):
+    ap = argparse.ArgumentParser(description='SD-Programmer Image (.sdpi) tool')
+    sub = ap.add_subparsers(dest='cmd', required=True)
+    p = sub.add_parser('pack', help='convert a binary image to .sdpi')
+    p.add_argument('input')
+    p.add_argument('output')
+    p.add_argument('--device', choices=sorted(DEVICES), help='target device (sets the IDs and sectors)')
+    p.add_argument('--sectors', type=_int, help='sector count (if no device is given)')
+    p.add_argument('--mfgid', type=_int, help='manufacturer ID (0 for any)')
+    p.add_argument('--devid', type=_int, help='device ID (0 for any)')
+    p.add_argument('--name', default='', help='image name (up to %d characters)' % (SDPI_NAME_MAX - 1))
+    p.add_argument('--no-pack', action='store_true', help="don't pack the sector payloads")
+    p = sub.add_parser('unpack', help='convert an .sdpi file to a binary image')
+    p.add_argument('input')
+    p.add_argument('output')
+    p = sub.add_parser('info', help='show the information in an .sdpi file')
+    p.add_argument('input')
+    args = ap.parse_args(argv)
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+    try:
+        if args.cmd == 'pack':
+            mfgid = devid = 0
+            sectcnt = args.sectors
+            if args.device:
+                mfgid, devid, size, sectcnt = DEVICES[args.device]
+                if len(data) > size:
+                    raise ValueError('the image is larger than the device')
+                data = data + b'\xFF' * (size - len(data))
+            if sectcnt is None:
+                raise ValueError('a device or the sector count is needed')
+            if args.mfgid is not None:
+                mfgid = args.mfgid
+            if args.devid is not None:
+                devid = args.devid
+            out = pack(data, sectcnt, mfgid, devid, args.name, not args.no_pack)
+            with open(args.output, 'wb') as f:
+                f.write(out)
+            print('%s: %d bytes (image %d bytes)' % (args.output, len(out), len(data)))
+        elif args.cmd == 'unpack':
+            image = unpack(data)
+            with open(args.output, 'wb') as f:
+                f.write(image)
+            print('%s: %d bytes' % (args.output, len(image)))
+        else:
+            hdr, sects = parse(data)
+            blank = sum(1 for s in sects if s[1] == 0)
+            packed = sum(1 for s in sects if 0 < s[1] < hdr['sectsize'])
+            print("'%s' for %02X:%02X  %dK (%d x %dK sectors) CRC:%08X" % (
+                hdr['name'], hdr['mfgid'], hdr['devid'], hdr['size'] // 1024, hdr['sectcnt'],
+                hdr['sectsize'] // 1024, hdr['crc']))
+            print('Sectors - blank:%d packed:%d  Payload: %d bytes' % (blank, packed, sum(s[1] for s in sects)))
+    except ValueError as e:
+        print('%s: %s' % (args.input, e), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""
+Tests of the .sdpi tool (`sdpi.py`).
+
+Images (random, all 0xFF, sparse, repetitive, and mostly random) are packed and unpacked
+and compared, for the 64K and 4K sector geometries. The firmware's unpacker is tested with
+these files by `sw/pico/test/test_lzpack`.
+
+    python3 -m unittest test_sdpi
+
+Copyright 2023-25 AESilky
+SPDX-License-Identifier: MIT License
+"""
+
+import random
+import unittest
+
+import sdpi
+
+_GEOMETRIES = ((8, 64 * 1024), (32, 4 * 1024))
+
+
+def _image(kind, size, rnd):
+    if kind == 'random':
+        return bytes(rnd.getrandbits(8) for _ in range(size))
+    if kind == 'blank':
+        return b'\xFF' * size
+    if kind == 'sparse':
+        img = bytearray(b'\xFF' * size)
+        for r in range(64):
+            at = rnd.randrange(size)
+            n = rnd.randint(1, 300)
+            for i in range(at, min(at + n, size)):
+                img[i] = 0 if r & 1 else rnd.getrandbits(8)
+        return bytes(img)
+    if kind == 'repetitive':
+        return bytes(((i % 251) ^ ((i // 4096) & 0x0F)) for i in range(size))
+    if kind == 'mostly-random':
+        return bytes((0 if (i % 1024) < 24 else rnd.getrandbits(8)) for i in range(size))
+    raise ValueError(kind)
+
+
+class TestSdpi(unittest.TestCase):
+
+    def _roundtrip(self, kind, packed=True):
+        rnd = random.Random(kind)
+        for sectcnt, sectsize in _GEOMETRIES:
+            with self.subTest(kind=kind, sectcnt=sectcnt, packed=packed):
+                img = _image(kind, sectcnt * sectsize, rnd)
+                f = sdpi.pack(img, sectcnt, 0xBF, 0xB7, 'Test ' + kind, packed)
+                self.assertEqual(sdpi.unpack(f), img)
+                hdr, sects = sdpi.parse(f)
+                self.assertEqual((hdr['size'], hdr['sectsize'], hdr['sectcnt']), (len(img), sectsize, sectcnt))
+                self.assertEqual(hdr['name'], 'Test ' + kind)
+                for s, (scrc, plen, payload) in enumerate(sects):
+                    data = img[s * sectsize:(s + 1) * sectsize]
+                    self.assertEqual(scrc, sdpi.crc32(data))
+                    self.assertEqual(plen == 0, data == b'\xFF' * sectsize)
+                    self.assertLessEqual(plen, sectsize)
+                    if not packed and plen:
+                        self.assertEqual(plen, sectsize)
+        return f
+
+    def test_random(self):
+        self._roundtrip('random')
+
+    def test_blank(self):
+        f = self._roundtrip('blank')
+        _, sects = sdpi.parse(f)
+        self.assertTrue(all(plen == 0 for _, plen, _ in sects))
+
+    def test_sparse(self):
+        self._roundtrip('sparse')
+        self._roundtrip('sparse', packed=False)
+
+    def test_repetitive(self):
+        f = self._roundtrip('repetitive')
+        self.assertLess(len(f), 32 * 1024)
+
+    def test_mostly_random(self):
+        self._roundtrip('mostly-random')
+
+    def test_block(self):
+        rnd = random.Random(1)
+        blocks = [b'', b'\x00', b'\xFF' * 5, b'ab' * 3000, bytes(range(256)) * 256,
+                  bytes(rnd.getrandbits(8) for _ in range(5000)),
+                  b'\x00' * (sdpi._FILL_MAX + 1), b'xyz' * (sdpi._MATCH_MAX + 1)]
+        for blk in blocks:
+            with self.subTest(length=len(blk)):
+                self.assertEqual(sdpi.lzp_unpack(sdpi.lzp_pack(blk), len(blk)), blk)
+
+    def test_corrupt(self):
+        img = _image('sparse', 8 * 64 * 1024, random.Random(2))
+        f = bytearray(sdpi.pack(img, 8))
+        f[-1] ^= 0x01
+        with self.assertRaises(ValueError):
+            sdpi.unpack(bytes(f))
+        f = bytearray(sdpi.pack(img, 8))
+        f[70] ^= 0x01
+        with self.assertRaises(ValueError):
+            sdpi.parse(bytes(f))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -17,11 +17,20 @@
 #include "shell/cmd/cmd_t.h"
 
 #include <ctype.h>
+#include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 
+#include "../include/hostlink.h"
+#include "../include/image.h"
+#include "../include/imgcache.h"
+#include "../include/journal.h"
+#include "../include/loader.h"
 #include "../include/pdops.h"
 #include "../include/prog_device.h"
+#include "../include/sdpi.h"
+#include "../include/usbdrive.h"
+#include "../include/xmodem.h"
 
 #define DDRDWR_REPEAT_MS 10
 
@@ -38,11 +47,14 @@ static uint8_t _sect;  // Sector (set from address conversion or directly)
 static bool _repeat;
 static rptop_t _rptop;
 static bool _rptdlyip; // True if a repeat delay has been scheduled and not received.
+static bool _aerase_ip; // True if an erase was started in the background (by a command).
 
 
 const cmd_handler_entry_t cmds_addrtosect_entry;
+const cmd_handler_entry_t cmds_devbus_entry;
 const cmd_handler_entry_t cmds_devaddr_entry;
 const cmd_handler_entry_t cmds_devaddr_n_entry;
+const cmd_handler_entry_t cmds_devdrive_entry;
 const cmd_handler_entry_t cmds_devdump_entry;
 const cmd_handler_entry_t cmds_deverase_entry;
 const cmd_handler_entry_t cmds_devinfo_entry;
@@ -50,12 +62,24 @@ const cmd_handler_entry_t cmds_devmt_entry;
 const cmd_handler_entry_t cmds_devpwr_entry;
 const cmd_handler_entry_t cmds_devrd_entry;
 const cmd_handler_entry_t cmds_devrd_n_entry;
+const cmd_handler_entry_t cmds_devsdpi_entry;
 const cmd_handler_entry_t cmds_devsectaddr_entry;
 const cmd_handler_entry_t cmds_devsecterase_entry;
 const cmd_handler_entry_t cmds_devsectmt_entry;
+const cmd_handler_entry_t cmds_devsync_entry;
+const cmd_handler_entry_t cmds_devtiming_entry;
 const cmd_handler_entry_t cmds_devwr_entry;
 const cmd_handler_entry_t cmds_devwr_n_entry;
 const cmd_handler_entry_t cmds_devwrval_entry;
+const cmd_handler_entry_t cmds_host_entry;
+const cmd_handler_entry_t cmds_img_entry;
+const cmd_handler_entry_t cmds_imgcache_entry;
+const cmd_handler_entry_t cmds_imgld_entry;
+const cmd_handler_entry_t cmds_imgrd_entry;
+const cmd_handler_entry_t cmds_xmrecv_entry;
+const cmd_handler_entry_t cmds_xmsend_entry;
+const cmd_handler_entry_t cmds_ymrecv_entry;
+const cmd_handler_entry_t cmds_ymsend_entry;
 
 
 static void _progress(uint32_t v) {
@@ -119,6 +143,34 @@ static bool _get_addr(char* addrstr) {
     return (true);
 }
 
+/**
+ * @brief Message handler for `MSG_PD_OP_DONE`
+ *
+ * Reports the result of an erase that was started in the background and turns
+ * the device power off.
+ *
+ * @param msg The op_done data has the operation, status, and elapsed time.
+ */
+static void _pd_op_done_handler(cmt_msg_t* msg) {
+    if (!_aerase_ip) {
+        return; // Not started by one of our commands
+    }
+    _aerase_ip = false;
+    const op_done_data_t* od = &msg->data.op_done;
+    char sectstr[16] = "Device";
+    if (od->op == PD_AOP_ERASE_SECT) {
+        snprintf(sectstr, sizeof(sectstr), "Sector %hu", (uint16_t)od->arg);
+    }
+    if (od->status != PD_OP_OK) {
+        shell_printf("\nError erasing %s: (%d)\n", sectstr, od->status);
+    }
+    else {
+        shell_printf("\n%s erased (%lu ms).\n", sectstr, od->elapsed_ms);
+    }
+    // Try to turn the power off
+    pdo_request_pwr_on(false);
+}
+
 static void _repeat_handler(cmt_msg_t *msg) {
     _rptdlyip = false;  // Delay completed
     // Do the operation
@@ -262,12 +314,46 @@ _finally:
     return (retval);
 }
 
+static int _exec_bus(int argc, char** argv, const char* unparsed) {
+    if (argc > 2) {
+        // We only take 0 or 1 argument.
+        cmd_help_display(&cmds_devbus_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    if (argc > 1) {
+        // Argument is 'GPIO' or 'PIO' or 'CLR' (clear the statistics)
+        if (strcasecmp(argv[1], "CLR") == 0) {
+            pdo_latch_stats_clear();
+        }
+        else if (strcasecmp(argv[1], "GPIO") == 0) {
+            pdo_bus_backend_set(PDO_BUS_GPIO);
+        }
+        else if (strcasecmp(argv[1], "PIO") == 0) {
+            pdo_bus_backend_set(PDO_BUS_PIO);
+        }
+        else {
+            cmd_help_display(&cmds_devbus_entry, HELP_DISP_USAGE);
+            return (-1);
+        }
+    }
+    const pdo_latch_stats_t* stats = pdo_latch_stats();
+    shell_printf("Device Bus: %s\n", (pdo_bus_backend() == PDO_BUS_PIO ? "PIO" : "GPIO"));
+    shell_printf("Address latch loads: %u  saved: %u\n", stats->loads, stats->saved);
+
+    return (0);
+}
+
 static int _exec_derase_all(int argc, char** argv, const char* unparsed) {
-    if (argc != 1) {
-        // We don't take any arguments
+    bool async = (argc == 2 && strcasecmp(argv[1], "A") == 0);
+    if (argc != 1 && !async) {
+        // We only take the optional 'A'
         cmd_help_display(&cmds_deverase_entry, HELP_DISP_USAGE);
         return (-1);
     }
+    if (pd_async_busy()) {
+        shell_printferr("A background erase is in progress.\n");
+        return (-1);
+    }
     int retval = 0;
     // Try to turn the power on
     ERRORNO = 0;
@@ -285,12 +371,22 @@ static int _exec_derase_all(int argc, char** argv, const char* unparsed) {
         goto _finally;
     }
     shell_puts("erasing device...");
+    if (async) {
+        pd_op_status_t stat = pd_erase_device_async(info);
+        if (stat != PD_OP_OK) {
+            shell_printf("\nError erasing device: (%d)\n", stat);
+            goto _finally;
+        }
+        _aerase_ip = true;
+        shell_puts(" (background)\n");
+        return (0); // Leave the power on. The completion handler turns it off.
+    }
     pd_op_status_t stat = pd_erase_device(info);
     if (stat != PD_OP_OK) {
         shell_printf("\nError erasing device: (%d)\n", stat);
     }
     else {
-        shell_puts("\nDevice erased.\n");
+        shell_printf("\nDevice erased (%lu ms).\n", pd_op_elapsed_us() / 1000);
     }
 _finally:
     // Try to turn the power off
@@ -300,11 +396,16 @@ _finally:
 }
 
 static int _exec_derase_sect(int argc, char** argv, const char* unparsed) {
-    if (argc != 2) {
-        // We take exactly 1 argument: sector
+    bool async = (argc == 3 && strcasecmp(argv[2], "A") == 0);
+    if (argc < 2) {
+        // We take 1 or more arguments: sector(s), or a sector and the optional 'A'
         cmd_help_display(&cmds_devsecterase_entry, HELP_DISP_USAGE);
         return (-1);
     }
+    if (pd_async_busy()) {
+        shell_printferr("A background erase is in progress.\n");
+        return (-1);
+    }
     int retval = 0;
     // Try to turn the power on
     ERRORNO = 0;
@@ -321,21 +422,48 @@ static int _exec_derase_sect(int argc, char** argv, const char* unparsed) {
         retval = -1;
         goto _finally;
     }
-    // Get the sector number
-    bool success;
-    uint8_t sect = (uint16_t)uint_from_str(argv[1], &success);
-    if (!success || sect >= info->sectcnt) {
-        shell_printferr("Value error - '%s' is not valid. Must be 0-%hu.\n", argv[1], (uint16_t)(info->sectcnt - 1));
-        retval = -1;
+    // Get the sector number(s)
+    pd_sectmap_t sectmap;
+    pd_sectmap_clr(&sectmap);
+    uint8_t sect = 0;
+    for (int i = 1; i < (async ? 2 : argc); i++) {
+        bool success;
+        sect = (uint16_t)uint_from_str(argv[i], &success);
+        if (!success || sect >= info->sectcnt) {
+            shell_printferr("Value error - '%s' is not valid. Must be 0-%hu.\n", argv[i], (uint16_t)(info->sectcnt - 1));
+            retval = -1;
+            goto _finally;
+        }
+        pd_sectmap_set(&sectmap, sect);
+    }
+    if (argc > 2 && !async) {
+        shell_puts("erasing sectors...");
+        pd_op_status_t stat = pd_erase_sectors(info, &sectmap);
+        if (stat != PD_OP_OK) {
+            shell_printf("\nError erasing sectors: (%d)\n", stat);
+        }
+        else {
+            shell_printf("\nSectors erased (%lu ms).\n", pd_op_elapsed_us() / 1000);
+        }
         goto _finally;
     }
     shell_printf("erasing sector %hu...", sect);
+    if (async) {
+        pd_op_status_t stat = pd_erase_sect_async(info, sect);
+        if (stat != PD_OP_OK) {
+            shell_printf("\nError erasing sector %hu: (%d)\n", sect, stat);
+            goto _finally;
+        }
+        _aerase_ip = true;
+        shell_puts(" (background)\n");
+        return (0); // Leave the power on. The completion handler turns it off.
+    }
     pd_op_status_t stat = pd_erase_sect(info, sect);
     if (stat != PD_OP_OK) {
         shell_printf("\nError erasing sector %hu: (%d)\n", sect, stat);
     }
     else {
-        shell_printf("\nSector %hu erased.\n", sect);
+        shell_printf("\nSector %hu erased (%lu ms).\n", sect, pd_op_elapsed_us() / 1000);
     }
 _finally:
     // Try to turn the power off
@@ -344,6 +472,36 @@ _finally:
     return (retval);
 }
 
+static int _exec_drive(int argc, char** argv, const char* unparsed) {
+    if (argc > 2 || (argc == 2 && strcasecmp(argv[1], "RO") != 0)) {
+        // We take 0 or 1 argument: RO
+        cmd_help_display(&cmds_devdrive_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    bool readonly = (argc == 2);
+    shell_printf("USB drive started%s (eject it on the PC, or press ESC to end)...\n", (readonly ? " (read only)" : ""));
+    term_input_suspend(true);
+    ud_result_t result;
+    ud_status_t stat = ud_run(readonly, &result);
+    term_input_suspend(false);
+    if (stat == UD_NO_DEVICE) {
+        shell_printferr("No device (or it isn't recognized).\n");
+        return (-1);
+    }
+    if (stat == UD_PD_BUSY) {
+        shell_printferr("A device operation is running.\n");
+        return (-1);
+    }
+    shell_printf("USB drive ended. Written: %lu bytes  Ignored: %lu bytes  Time: %lu ms\n", result.written, result.ignored, result.elapsed_ms);
+    shell_printf("Sectors synced: %hu (clean: %hu  in place: %hu  erased: %hu)  Programmed: %lu bytes\n",
+        result.synced, result.clean, result.inplace, result.erased, result.programmed);
+    if (stat != UD_OK) {
+        shell_printferr("Error programming device: (%d) at %05lX\n", result.pdstat, result.failaddr);
+        return (-1);
+    }
+    return (0);
+}
+
 static int _exec_dump(int argc, char** argv, const char* unparsed) {
     static uint16_t _dump_len = 256; // Display 256 bytes unless told otherwise
 
@@ -390,6 +548,10 @@ static int _exec_dump(int argc, char** argv, const char* unparsed) {
     }
     int len = 0;
     uint8_t v[16];
+    if (!pdo_stream_begin(_addr)) {
+        retval = -1;
+        goto _finally;
+    }
     while (len < _dump_len) {
         // Read and display rows of up to 16 bytes
         //
@@ -399,7 +561,7 @@ static int _exec_dump(int argc, char** argv, const char* unparsed) {
         for (i = 0; i < 16; i++) {
             j = i;
             // Read the data from the device
-            v[i] = pdo_data_get();
+            v[i] = pdo_stream_next();
             if (ERRORNO) {
                 retval = -1;
                 goto _finally;
@@ -408,11 +570,6 @@ static int _exec_dump(int argc, char** argv, const char* unparsed) {
             shell_printf("%02X ", v[i]);
             len++;
             _addr++;
-            pdo_addr_set(_addr);
-            if (ERRORNO) {
-                retval = -1;
-                goto _finally;
-            }
             if (len == _dump_len) {
                 i++;
                 break; // We've reached the number of bytes requested.
@@ -430,7 +587,11 @@ static int _exec_dump(int argc, char** argv, const char* unparsed) {
         }
         shell_printf("\n");
     };
+    pdo_stream_end();
+    // Leave the device address at the next location
+    pdo_addr_set(_addr);
 _finally:
+    pdo_stream_end();
     // Try to turn the power off
     pdo_request_pwr_on(false);
 
@@ -603,6 +764,32 @@ static int _exec_dpwr(int argc, char** argv, const char* unparsed) {
     return (0);
 }
 
+static int _exec_dtiming(int argc, char** argv, const char* unparsed) {
+    if (argc > 2) {
+        // We only take 0 or 1 argument.
+        cmd_help_display(&cmds_devtiming_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    if (argc > 1) {
+        // Argument is 'SAFE' or 'DEV'
+        if (strcasecmp(argv[1], "SAFE") == 0) {
+            pdo_timing_safe_force(true);
+        }
+        else if (strcasecmp(argv[1], "DEV") == 0) {
+            pdo_timing_safe_force(false);
+        }
+        else {
+            cmd_help_display(&cmds_devtiming_entry, HELP_DISP_USAGE);
+            return (-1);
+        }
+    }
+    const pdo_timing_t* t = pdo_timing();
+    shell_printf("Bus Timing: %s\n", (pdo_timing_safe_forced() ? "SAFE (forced)" : "DEV (SAFE until a device is identified)"));
+    shell_printf("Access: %hu ns  Write Pulse: %hu ns  Latch: %hu ns  Power-Up: %hu us\n", t->tacc_ns, t->twp_ns, t->tls_ns, t->tpwr_us);
+
+    return (0);
+}
+
 static int _exec_rd(int argc, char** argv, const char* unparsed) {
     if (argc > 2) {
         // We only take 0 or 1 argument.
@@ -865,6 +1052,465 @@ _finally:
     return (retval);
 }
 
+static int _exec_host(int argc, char** argv, const char* unparsed) {
+    if (argc > 1) {
+        // We don't take any arguments.
+        cmd_help_display(&cmds_host_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    shell_puts("host link started (the shell is suspended)...\n");
+    term_input_suspend(true);
+    bool ended = hl_run();
+    term_input_suspend(false);
+    shell_printf("\nHost link %s.\n", (ended ? "ended" : "timed out"));
+    return (0);
+}
+
+static int _exec_img(int argc, char** argv, const char* unparsed) {
+    if (argc > 2) {
+        // We take 0 or 1 argument: size or CLOSE
+        cmd_help_display(&cmds_img_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    if (argc == 2) {
+        if (strcasecmp(argv[1], "CLOSE") == 0) {
+            img_close();
+        }
+        else {
+            uint32_t ksize;
+            if (!_get_val(&ksize, argv[1], IMG_SIZE_MAX / ONE_K, false, "size (K)")) {
+                return (-1);
+            }
+            img_status_t stat = img_open(ksize * ONE_K);
+            if (stat != IMG_OK) {
+                shell_printferr("Error opening image: (%d)\n", stat);
+                return (-1);
+            }
+        }
+    }
+    if (!img_is_open()) {
+        shell_puts("No image open.\n");
+    }
+    else {
+        img_stats_t stats;
+        img_stats(&stats);
+        shell_printf("Image: %luK  Pages - RAM:%hu packed:%hu (%luK pool) SD:%hu blank:%hu\n",
+            img_size() / ONE_K, (uint16_t)stats.ram_pages, (uint16_t)stats.packed_pages,
+            (stats.pool_used + ONE_K - 1) / ONE_K, (uint16_t)stats.sd_pages, (uint16_t)stats.blank_pages);
+    }
+    return (0);
+}
+
+static int _exec_imgld(int argc, char** argv, const char* unparsed) {
+    if (argc < 2 || argc > 4) {
+        // We take 1 to 3 arguments: the file name, optional format, optional offset
+        cmd_help_display(&cmds_imgld_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    if (!img_is_open()) {
+        shell_printferr("No image open (use 'pimg' to open one).\n");
+        return (-1);
+    }
+    ld_format_t format = LD_FMT_AUTO;
+    int32_t offset = 0;
+    for (int i = 2; i < argc; i++) {
+        char* arg = argv[i];
+        if (strcasecmp(arg, "AUTO") == 0) {
+            format = LD_FMT_AUTO;
+        }
+        else if (strcasecmp(arg, "BIN") == 0) {
+            format = LD_FMT_BIN;
+        }
+        else if (strcasecmp(arg, "HEX") == 0) {
+            format = LD_FMT_HEX;
+        }
+        else if (strcasecmp(arg, "SREC") == 0) {
+            format = LD_FMT_SREC;
+        }
+        else {
+            // Offset (hex, can be negative to move the data down)
+            bool neg = (*arg == '-');
+            uint32_t v = 0;
+            if (!_get_val(&v, (neg ? arg + 1 : arg), 0x7FFFFFFF, true, "offset")) {
+                return (-1);
+            }
+            offset = (neg ? -(int32_t)v : (int32_t)v);
+        }
+    }
+    ld_result_t result;
+    shell_printf("loading '%s'...", argv[1]);
+    ld_status_t stat = ld_load(argv[1], format, offset, (4 * ONE_K), &result);
+    const ld_decoder_t* decoder = ld_decoder(result.format);
+    const char* fmtname = (decoder ? decoder->name : "?");
+    if (stat != LD_OK) {
+        shell_printferr("\nError loading %s file: (%d) at line %lu\n", fmtname, stat, result.line);
+        return (-1);
+    }
+    uint16_t tcnt = 0;
+    for (uint8_t i = 0; i < PD_SECT_MAX; i++) {
+        tcnt += pd_sectmap_isset(&result.touched, i);
+    }
+    shell_printf("\n%s: Loaded %lu bytes (%lu records) %05lX-%05lX CRC:%08lX in %lu ms. 4K blocks loaded: %hu\n",
+        fmtname, result.bytes, result.records, result.addr_low, (result.addr_high ? result.addr_high - 1 : 0),
+        result.crc, result.elapsed_ms, tcnt);
+    if (result.start_addr != LD_NO_START) {
+        shell_printf("Start address: %08lX\n", result.start_addr);
+    }
+    return (0);
+}
+
+static int _exec_imgrd(int argc, char** argv, const char* unparsed) {
+    static uint8_t _rdbuf[4 * ONE_K];
+
+    if (argc > 1) {
+        // We don't take any arguments.
+        cmd_help_display(&cmds_imgrd_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    int retval = 0;
+    // Try to turn the power on
+    ERRORNO = 0;
+    pdo_request_pwr_on(true);
+    if (ERRORNO) {
+        shell_printferr("Cannot select device.");
+        retval = -1;
+        goto _finally;
+    }
+    const md_info_t* info = pd_info();
+    if (!info) {
+        shell_printferr("Device cannot be determined.\n");
+        retval = -1;
+        goto _finally;
+    }
+    uint32_t size = pd_size(info);
+    img_status_t istat = img_open(size);
+    if (istat != IMG_OK) {
+        shell_printferr("Error opening image: (%d)\n", istat);
+        retval = -1;
+        goto _finally;
+    }
+    shell_puts("reading device into image...");
+    for (uint32_t addr = 0; addr < size; addr += sizeof(_rdbuf)) {
+        pd_op_status_t stat = pd_read_block(info, addr, _rdbuf, sizeof(_rdbuf), NULL);
+        if (stat != PD_OP_OK) {
+            shell_printf("\nError reading device: (%d)\n", stat);
+            retval = -1;
+            goto _finally;
+        }
+        istat = img_write_at(addr, _rdbuf, sizeof(_rdbuf));
+        if (istat != IMG_OK) {
+            shell_printf("\nError writing image: (%d)\n", istat);
+            retval = -1;
+            goto _finally;
+        }
+        _progress(addr);
+    }
+    shell_printf("\nImage loaded from device (%luK).\n", size / ONE_K);
+_finally:
+    // Try to turn the power off
+    pdo_request_pwr_on(false);
+
+    return (retval);
+}
+
+/**
+ * @brief Sync the device to an image (see `pd_sync`), displaying the results.
+ *
+ * @param sectdatafn The image sector data provider
+ * @param size The size of the image
+ * @return int 0 if successful
+ */
+static int _dev_sync(pd_sect_data_fn sectdatafn, uint32_t size) {
+    if (pd_async_busy()) {
+        shell_printferr("A background erase is in progress.\n");
+        return (-1);
+    }
+    int retval = 0;
+    // Try to turn the power on
+    ERRORNO = 0;
+    pdo_request_pwr_on(true);
+    if (ERRORNO) {
+        shell_printferr("Cannot select device.");
+        retval = -1;
+        goto _finally;
+    }
+    const md_info_t* info = pd_info();
+    if (!info) {
+        shell_printferr("Device cannot be determined.\n");
+        retval = -1;
+        goto _finally;
+    }
+    if (size != pd_size(info)) {
+        shell_printferr("Image size (%luK) doesn't match the device (%luK).\n", size / ONE_K, pd_size(info) / ONE_K);
+        retval = -1;
+        goto _finally;
+    }
+    // The image identity (for the journal) is the CRC of the image.
+    uint32_t sectsize = pd_sectsize(info);
+    uint32_t imgid = 0;
+    for (uint8_t sect = 0; sect < info->sectcnt; sect++) {
+        const uint8_t* data = sectdatafn(sect, sectsize);
+        if (!data) {
+            shell_printferr("The image data couldn't be read.\n");
+            retval = -1;
+            goto _finally;
+        }
+        imgid = crc32_update(imgid, data, sectsize);
+    }
+    pd_sectmap_t done;
+    int resumed = jnl_open(imgid, size, info, &done);
+    if (resumed > 0) {
+        shell_printf("resuming (%d sectors already done)...", resumed);
+    }
+    shell_puts("syncing device to image...");
+    pd_sync_stats_t stats;
+    uint32_t failaddr;
+    pd_op_status_t stat = pd_sync(info, sectdatafn, &done, (resumed >= 0 ? jnl_update : NULL), _progress, &stats, &failaddr);
+    jnl_close(stat == PD_OP_OK);
+    if (stat != PD_OP_OK) {
+        shell_printf("\nError syncing device: (%d) at %05lX\n", stat, failaddr);
+        retval = -1;
+        goto _finally;
+    }
+    shell_printf("\nDevice synced (%lu ms). Sectors - clean:%hu in-place:%hu erased:%hu%s\n",
+        stats.elapsed_ms, (uint16_t)stats.clean, (uint16_t)stats.inplace, (uint16_t)stats.erased,
+        (stats.chiperase ? " (chip erase)" : ""));
+    shell_printf("Bytes - programmed:%lu skipped:%lu\n", stats.programmed, stats.skipped);
+_finally:
+    // Try to turn the power off
+    pdo_request_pwr_on(false);
+
+    return (retval);
+}
+
+static int _exec_sync(int argc, char** argv, const char* unparsed) {
+    if (argc > 1) {
+        // We don't take any arguments.
+        cmd_help_display(&cmds_devsync_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    if (!img_is_open()) {
+        shell_printferr("No image open.\n");
+        return (-1);
+    }
+    return (_dev_sync(img_sector_ptr, img_size()));
+}
+
+static int _exec_sdpi(int argc, char** argv, const char* unparsed) {
+    if (argc < 2 || argc > 3) {
+        // We take a file name and an optional operation
+        cmd_help_display(&cmds_devsdpi_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    bool verify = false;
+    if (argc == 3) {
+        if (strcasecmp(argv[2], "INFO") == 0) {
+            sdpi_info_t si;
+            sdpi_status_t stat = sdpi_info(argv[1], &si);
+            if (stat != SDPI_OK) {
+                shell_printferr("Error reading '%s': (%d)\n", argv[1], stat);
+                return (-1);
+            }
+            shell_printf("'%s' for %02hX:%02hX  %luK (%hu x %luK sectors) CRC:%08lX\n", si.hdr.name,
+                (uint16_t)si.hdr.mfgid, (uint16_t)si.hdr.devid, si.hdr.size / ONE_K, si.hdr.sectcnt,
+                si.hdr.sectsize / ONE_K, si.hdr.crc);
+            shell_printf("Sectors - blank:%hu packed:%hu  Payload: %lu bytes\n", (uint16_t)si.blank, (uint16_t)si.packed, si.payload);
+            return (0);
+        }
+        if (strcasecmp(argv[2], "VERIFY") != 0) {
+            cmd_help_display(&cmds_devsdpi_entry, HELP_DISP_USAGE);
+            return (-1);
+        }
+        verify = true;
+    }
+    if (pd_async_busy()) {
+        shell_printferr("A background erase is in progress.\n");
+        return (-1);
+    }
+    int retval = 0;
+    // Try to turn the power on
+    ERRORNO = 0;
+    pdo_request_pwr_on(true);
+    if (ERRORNO) {
+        shell_printferr("Cannot select device.");
+        retval = -1;
+        goto _finally;
+    }
+    const md_info_t* info = pd_info();
+    if (!info) {
+        shell_printferr("Device cannot be determined.\n");
+        retval = -1;
+        goto _finally;
+    }
+    sdpi_status_t stat;
+    if (verify) {
+        pd_sectmap_t badmap;
+        shell_puts("verifying device...");
+        stat = sdpi_verify(argv[1], info, _progress, &badmap);
+        if (stat == SDPI_VERIFY_FAILED) {
+            shell_puts("\nSectors that don't match:");
+            for (uint8_t i = 0; i < info->sectcnt; i++) {
+                if (pd_sectmap_isset(&badmap, i)) {
+                    shell_printf(" %hu", (uint16_t)i);
+                }
+            }
+            shell_putc('\n');
+            retval = -1;
+            goto _finally;
+        }
+        if (stat != SDPI_OK) {
+            shell_printferr("\nError verifying device: (%d)\n", stat);
+            retval = -1;
+            goto _finally;
+        }
+        shell_puts("\nDevice matches.\n");
+        goto _finally;
+    }
+    // The image identity (for the journal) is the image CRC from the file.
+    sdpi_info_t si;
+    stat = sdpi_info(argv[1], &si);
+    if (stat != SDPI_OK) {
+        shell_printferr("Error reading '%s': (%d)\n", argv[1], stat);
+        retval = -1;
+        goto _finally;
+    }
+    pd_sectmap_t done;
+    int resumed = jnl_open(si.hdr.crc, si.hdr.size, info, &done);
+    if (resumed > 0) {
+        shell_printf("resuming (%d sectors already done)...", resumed);
+    }
+    shell_puts("programming device...");
+    pd_sync_stats_t stats;
+    uint32_t failaddr;
+    stat = sdpi_program(argv[1], info, &done, (resumed >= 0 ? jnl_update : NULL), _progress, &stats, &failaddr);
+    jnl_close(stat == SDPI_OK);
+    if (stat != SDPI_OK) {
+        shell_printf("\nError programming device: (%d) at %05lX\n", stat, failaddr);
+        retval = -1;
+        goto _finally;
+    }
+    shell_printf("\nDevice programmed (%lu ms). Sectors - clean:%hu blank-programmed:%hu erased:%hu\n",
+        stats.elapsed_ms, (uint16_t)stats.clean, (uint16_t)stats.inplace, (uint16_t)stats.erased);
+    shell_printf("Bytes - programmed:%lu skipped:%lu\n", stats.programmed, stats.skipped);
+_finally:
+    // Try to turn the power off
+    pdo_request_pwr_on(false);
+
+    return (retval);
+}
+
+static int _exec_cache(int argc, char** argv, const char* unparsed) {
+    if (argc != 1 && argc != 3) {
+        // We take no arguments, or an operation and a name or slot
+        cmd_help_display(&cmds_imgcache_entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    if (!imc_available()) {
+        shell_printferr("The image cache isn't available (the firmware uses the cache region).\n");
+        return (-1);
+    }
+    if (argc == 1) {
+        for (uint8_t i = 0; i < IMC_SLOTS; i++) {
+            const imc_slot_info_t* si = imc_slot_info(i);
+            if (si->used) {
+                shell_printf("%hu: %-24s %4luK CRC:%08lX (erased %lu)\n", (uint16_t)i, si->name, si->size / ONE_K, si->crc, si->erases);
+            }
+            else {
+                shell_printf("%hu: (empty) (erased %lu)\n", (uint16_t)i, si->erases);
+            }
+        }
+        return (0);
+    }
+    imc_status_t stat;
+    if (strcasecmp(argv[1], "SAVE") == 0) {
+        uint8_t slot;
+        shell_puts("saving image...");
+        stat = imc_save(argv[2], &slot);
+        if (stat == IMC_OK) {
+            shell_printf("\nImage saved in slot %hu.\n", (uint16_t)slot);
+        }
+    }
+    else {
+        uint32_t slot;
+        if (!_get_val(&slot, argv[2], IMC_SLOTS - 1, false, "slot number")) {
+            return (-1);
+        }
+        if (strcasecmp(argv[1], "LOAD") == 0) {
+            stat = imc_load(slot);
+        }
+        else if (strcasecmp(argv[1], "RM") == 0) {
+            stat = imc_remove(slot);
+        }
+        else if (strcasecmp(argv[1], "SYNC") == 0) {
+            stat = imc_select(slot);
+            if (stat == IMC_OK) {
+                return (_dev_sync(imc_sector_ptr, imc_slot_info(slot)->size));
+            }
+        }
+        else {
+            cmd_help_display(&cmds_imgcache_entry, HELP_DISP_USAGE);
+            return (-1);
+        }
+    }
+    if (stat != IMC_OK) {
+        shell_printferr("\nImage cache error: (%d)\n", stat);
+        return (-1);
+    }
+    return (0);
+}
+
+/**
+ * @brief Run an XMODEM/YMODEM transfer (see `xm_receive` and `xm_send`), displaying the results.
+ *
+ * The argument is the file (the directory for a YMODEM receive, which can be left out for
+ * the current directory), or '-i' for the image.
+ *
+ * @return int 0 if successful
+ */
+static int _xm_xfer(const cmd_handler_entry_t* entry, bool send, bool ymodem, int argc, char** argv) {
+    if (argc > 2 || (argc < 2 && (send || !ymodem))) {
+        cmd_help_display(entry, HELP_DISP_USAGE);
+        return (-1);
+    }
+    const char* path = (argc > 1 ? argv[1] : "");
+    if (strcmp(path, "-i") == 0) {
+        path = NULL;
+        if (!img_is_open()) {
+            shell_printferr("No image open (use 'pimg' to open one).\n");
+            return (-1);
+        }
+    }
+    const char* proto = (ymodem ? "YMODEM" : "XMODEM");
+    shell_printf("Start the %s %s on the terminal (Ctrl-X to cancel)...\n", proto, (send ? "receive" : "send"));
+    term_input_suspend(true);
+    xm_result_t result;
+    xm_status_t stat = (send ? xm_send(ymodem, path, &result) : xm_receive(ymodem, path, &result));
+    term_input_suspend(false);
+    if (stat != XM_OK) {
+        shell_printferr("\n%s transfer error: (%d)\n", proto, stat);
+        return (-1);
+    }
+    shell_printf("\n%s %lu bytes (%hu files) in %lu ms. Blocks resent: %hu\n", (send ? "Sent" : "Received"),
+        result.bytes, result.files, result.elapsed_ms, result.errors);
+    return (0);
+}
+
+static int _exec_rx(int argc, char** argv, const char* unparsed) {
+    return (_xm_xfer(&cmds_xmrecv_entry, false, false, argc, argv));
+}
+
+static int _exec_ry(int argc, char** argv, const char* unparsed) {
+    return (_xm_xfer(&cmds_ymrecv_entry, false, true, argc, argv));
+}
+
+static int _exec_sx(int argc, char** argv, const char* unparsed) {
+    return (_xm_xfer(&cmds_xmsend_entry, true, false, argc, argv));
+}
+
+static int _exec_sy(int argc, char** argv, const char* unparsed) {
+    return (_xm_xfer(&cmds_ymsend_entry, true, true, argc, argv));
+}
+
 const cmd_handler_entry_t cmds_addrtosect_entry = {
     _exec_atos,
     5,
@@ -873,6 +1519,14 @@ const cmd_handler_entry_t cmds_addrtosect_entry = {
     "Convert an address to a Device Sector#.",
 };
 
+const cmd_handler_entry_t cmds_devbus_entry = {
+    _exec_bus,
+    4,
+    "pbus",
+    "[GPIO|PIO|CLR]",
+    "Show the device bus backend and latch statistics. Optionally set the backend\n(GPIO bit-bang or PIO+DMA) or clear the statistics.",
+};
+
 const cmd_handler_entry_t cmds_devaddr_entry = {
     _exec_addr,
     4,
@@ -893,8 +1547,16 @@ const cmd_handler_entry_t cmds_deverase_entry = {
     _exec_derase_all,
     6,
     "perase",
-    NULL,
-    "Erase the device.",
+    "[A]",
+    "Erase the device. 'A' erases in the background (a message is displayed when done).",
+};
+
+const cmd_handler_entry_t cmds_devdrive_entry = {
+    _exec_drive,
+    3,
+    "pdrive",
+    "[RO]",
+    "Run a USB drive with the device as DEVICE.BIN. Writing to it, or copying a file to\nthe drive, programs the device. 'RO' for read only. The image is closed.",
 };
 
 const cmd_handler_entry_t cmds_devdump_entry = {
@@ -945,6 +1607,14 @@ const cmd_handler_entry_t cmds_devrd_n_entry = {
     "Advance the address and read device data.",
 };
 
+const cmd_handler_entry_t cmds_devsdpi_entry = {
+    _exec_sdpi,
+    4,
+    "psdpi",
+    "filename [INFO|VERIFY]",
+    "Program the device from an .sdpi image file (only the sectors that differ are changed).\nA file with packed sectors closes the image.\nINFO shows the file information. VERIFY checks the device against the sector CRCs.",
+};
+
 const cmd_handler_entry_t cmds_devsectaddr_entry = {
     _exec_dsect_addr,
     6,
@@ -957,8 +1627,8 @@ const cmd_handler_entry_t cmds_devsecterase_entry = {
     _exec_derase_sect,
     10,
     "psecterase",
-    "sectno(dec)",
-    "Erase device sector. 0-based sector number.",
+    "sectno(dec) [A] | sectno(dec) sectno(dec)...",
+    "Erase device sector(s). 0-based sector number.\n'A' erases a sector in the background (a message is displayed when done).",
 };
 
 const cmd_handler_entry_t cmds_devsectmt_entry = {
@@ -969,6 +1639,22 @@ const cmd_handler_entry_t cmds_devsectmt_entry = {
     "Check if device sector is empty. 0-based sector number.",
 };
 
+const cmd_handler_entry_t cmds_devsync_entry = {
+    _exec_sync,
+    5,
+    "psync",
+    NULL,
+    "Make the device match the image, erasing and programming only what is needed.",
+};
+
+const cmd_handler_entry_t cmds_devtiming_entry = {
+    _exec_dtiming,
+    3,
+    "ptiming",
+    "[SAFE|DEV]",
+    "Show the device bus timing. Optionally force the conservative SAFE timing,\nor use the timing of the identified device (DEV).",
+};
+
 const cmd_handler_entry_t cmds_devwr_entry = {
     _exec_wr,
     4,
@@ -993,11 +1679,85 @@ const cmd_handler_entry_t cmds_devwrval_entry = {
     "Write one or more values to the specified address. Device location(s) must be empty.",
 };
 
+const cmd_handler_entry_t cmds_host_entry = {
+    _exec_host,
+    5,
+    "phost",
+    NULL,
+    "Run the binary host link on the USB connection (used by the 'sdhost.py' host tool).\nThe shell is suspended until the host ends the link.",
+};
+
+const cmd_handler_entry_t cmds_img_entry = {
+    _exec_img,
+    4,
+    "pimg",
+    "[size(K)|CLOSE]",
+    "Show the image. Optionally open (create) an erased image of a size, or close it.",
+};
+
+const cmd_handler_entry_t cmds_imgcache_entry = {
+    _exec_cache,
+    6,
+    "pcache",
+    "[SAVE name | LOAD|SYNC|RM slot(dec)]",
+    "List the images cached in Flash. Optionally save the image to the cache, load a cached\nimage into the image, sync the device to a cached image, or remove a cached image.",
+};
+
+const cmd_handler_entry_t cmds_imgld_entry = {
+    _exec_imgld,
+    6,
+    "pimgld",
+    "filename [AUTO|BIN|HEX|SREC] [[-]offset(hex)]",
+    "Load a file into the image (over the current content). The format is detected if not given.\nThe offset is added to the file addresses (binary files load at the offset).",
+};
+
+const cmd_handler_entry_t cmds_imgrd_entry = {
+    _exec_imgrd,
+    6,
+    "pimgrd",
+    NULL,
+    "Read the device into the image (the image is opened to the device size).",
+};
+
+const cmd_handler_entry_t cmds_xmrecv_entry = {
+    _exec_rx,
+    2,
+    "rx",
+    "filename|-i",
+    "Receive a file (XMODEM-1K) from the terminal into a file, or into the image ('-i').\nXMODEM pads the data to a multiple of the block size.",
+};
+
+const cmd_handler_entry_t cmds_xmsend_entry = {
+    _exec_sx,
+    2,
+    "sx",
+    "filename|-i",
+    "Send a file, or the image ('-i'), to the terminal (XMODEM-1K).",
+};
+
+const cmd_handler_entry_t cmds_ymrecv_entry = {
+    _exec_ry,
+    2,
+    "ry",
+    "[dir|-i]",
+    "Receive files (YMODEM batch) from the terminal into a directory (default the current one),\nor one file into the image ('-i').",
+};
+
+const cmd_handler_entry_t cmds_ymsend_entry = {
+    _exec_sy,
+    2,
+    "sy",
+    "filename|-i",
+    "Send a file, or the image ('-i' as '" XM_IMG_NAME "'), to the terminal (YMODEM).",
+};
+
 
 void pdcmds_minit(void) {
     cmd_register(&cmds_addrtosect_entry);
+    cmd_register(&cmds_devbus_entry);
     cmd_register(&cmds_devaddr_entry);
     cmd_register(&cmds_devaddr_n_entry);
+    cmd_register(&cmds_devdrive_entry);
     cmd_register(&cmds_devdump_entry);
     cmd_register(&cmds_deverase_entry);
     cmd_register(&cmds_devinfo_entry);
@@ -1005,10 +1765,24 @@ void pdcmds_minit(void) {
     cmd_register(&cmds_devpwr_entry);
     cmd_register(&cmds_devrd_entry);
     cmd_register(&cmds_devrd_n_entry);
+    cmd_register(&cmds_devsdpi_entry);
     cmd_register(&cmds_devsectaddr_entry);
     cmd_register(&cmds_devsecterase_entry);
     cmd_register(&cmds_devsectmt_entry);
+    cmd_register(&cmds_devsync_entry);
+    cmd_register(&cmds_devtiming_entry);
     cmd_register(&cmds_devwr_entry);
     cmd_register(&cmds_devwr_n_entry);
     cmd_register(&cmds_devwrval_entry);
+    cmd_register(&cmds_host_entry);
+    cmd_register(&cmds_img_entry);
+    cmd_register(&cmds_imgcache_entry);
+    cmd_register(&cmds_imgld_entry);
+    cmd_register(&cmds_imgrd_entry);
+    cmd_register(&cmds_xmrecv_entry);
+    cmd_register(&cmds_xmsend_entry);
+    cmd_register(&cmds_ymrecv_entry);
+    cmd_register(&cmds_ymsend_entry);
+
+    cmt_msg_hdlr_add(MSG_PD_OP_DONE, _pd_op_done_handler);
 }
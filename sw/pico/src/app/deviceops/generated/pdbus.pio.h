@@ -0,0 +1,89 @@
+// ---------------------------------------------------------------- //
+// This file is autogenerated by pioasm version 2.2.0; do not edit! //
+// ---------------------------------------------------------------- //
+
+#pragma once
+
+#if !PICO_NO_HARDWARE
+#include "hardware/pio.h"
+#endif
+
+// ----- //
+// pdbus //
+// ----- //
+
+#define pdbus_wrap_target 14
+#define pdbus_wrap 29
+#define pdbus_pio_version 0
+
+#define pdbus_OP_NONE 8
+#define pdbus_OP_NONE_LL 0
+#define pdbus_OP_ADDRL_LD 10
+#define pdbus_OP_ADDRM_LD 11
+#define pdbus_OP_ADDRH_LD 12
+#define pdbus_OP_SEL 13
+#define pdbus_OP_SEL_LL 5
+#define pdbus_SIDE_IDLE 3
+#define pdbus_SIDE_RD 2
+#define pdbus_SIDE_WR 1
+#define pdbus_T_LATCH 1
+#define pdbus_T_ACCESS 3
+#define pdbus_T_WRPULSE 2
+#define pdbus_T_SYNC 2
+
+#define pdbus_offset_start 14u
+
+static const uint16_t pdbus_program_instructions[] = {
+    0xb809, //  0: mov    pins, ~x         side 3
+    0xf90a, //  1: set    pins, 10         side 3 [1]
+    0xf808, //  2: set    pins, 8          side 3
+    0xb8e3, //  3: mov    osr, null        side 3
+    0x7888, //  4: out    pindirs, 8       side 3
+    0xfb0d, //  5: set    pins, 13         side 3 [3]
+    0xf905, //  6: set    pins, 5          side 3 [1]
+    0xf80d, //  7: set    pins, 13         side 3
+    0xf208, //  8: set    pins, 8          side 2 [2]
+    0x5008, //  9: in     pins, 8          side 2
+    0xb8eb, // 10: mov    osr, ~null       side 3
+    0x7888, // 11: out    pindirs, 8       side 3
+    0x184d, // 12: jmp    x--, 13          side 3
+    0x1880, // 13: jmp    y--, 0           side 3
+            //     .wrap_target
+    0x98a0, // 14: pull   block            side 3
+    0x7828, // 15: out    x, 8             side 3
+    0x7848, // 16: out    y, 8             side 3
+    0x7808, // 17: out    pins, 8          side 3
+    0xf90b, // 18: set    pins, 11         side 3 [1]
+    0xf80c, // 19: set    pins, 12         side 3
+    0x7a08, // 20: out    pins, 8          side 3 [2]
+    0xf808, // 21: set    pins, 8          side 3
+    0x18c0, // 22: jmp    pin, 0           side 3
+    0xb809, // 23: mov    pins, ~x         side 3
+    0xf90a, // 24: set    pins, 10         side 3 [1]
+    0xf800, // 25: set    pins, 0          side 3
+    0xb902, // 26: mov    pins, y          side 3 [1]
+    0xe908, // 27: set    pins, 8          side 1 [1]
+    0xea0d, // 28: set    pins, 13         side 1 [2]
+    0xe808, // 29: set    pins, 8          side 1
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program pdbus_program = {
+    .instructions = pdbus_program_instructions,
+    .length = 30,
+    .origin = -1,
+    .pio_version = pdbus_pio_version,
+#if PICO_PIO_VERSION > 0
+    .used_gpio_ranges = 0x0
+#endif
+};
+
+static inline pio_sm_config pdbus_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + pdbus_wrap_target, offset + pdbus_wrap);
+    sm_config_set_sideset(&c, 2, false, false);
+    return c;
+}
+#endif
+
@@ -0,0 +1,202 @@
+/**
+ * Intel HEX format decoder (for the `loader`).
+ *
+ * The text is decoded as a stream (there is no line buffer) and the hex digits are
+ * decoded using a lookup table. Only the data bytes of the current record are held
+ * until the record checksum is validated.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "hexload.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define _ST_MARK    0   // Waiting for the ':' that starts a record
+#define _ST_REC     1   // Decoding the bytes of a record
+#define _ST_DONE    2   // The EOF record has been decoded
+
+#define _REC_DATA       0x00
+#define _REC_EOF        0x01
+#define _REC_EXT_SEG    0x02
+#define _REC_START_SEG  0x03
+#define _REC_EXT_LIN    0x04
+#define _REC_START_LIN  0x05
+
+/**
+ * @brief Decoder state.
+ */
+typedef struct hex_decoder_ {
+    uint8_t state;
+    bool hiheld;            // The high nibble of the byte being decoded has been decoded
+    uint8_t hinib;          // The high nibble of the byte being decoded
+    uint16_t idx;           // Index of the byte being decoded in the record
+    uint8_t len;
+    uint8_t type;
+    uint16_t offset;
+    uint8_t sum;
+    uint32_t base;          // The base address from the last Extended Address record
+    ld_sink_t* sink;
+    uint8_t data[256];      // The data of the record being decoded
+} hex_decoder_t;
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+static hex_decoder_t _dec;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+/**
+ * @brief Process a record that has been decoded (and the checksum validated).
+ */
+static ld_status_t _rec_process() {
+    const uint8_t* d = _dec.data;
+    uint8_t len = _dec.len;
+    ld_result_t* result = _dec.sink->result;
+    switch (_dec.type) {
+        case _REC_DATA:
+            if (len == 0) {
+                break;
+            }
+            return (ld_sink_write(_dec.sink, _dec.base + _dec.offset, d, len));
+        case _REC_EOF:
+            if (len != 0) {
+                return (LD_SYNTAX_ERROR);
+            }
+            _dec.state = _ST_DONE;
+            break;
+        case _REC_EXT_SEG:
+        case _REC_EXT_LIN:
+            if (len != 2) {
+                return (LD_SYNTAX_ERROR);
+            }
+            _dec.base = ((uint32_t)d[0] << 8 | d[1]) << (_dec.type == _REC_EXT_SEG ? 4 : 16);
+            break;
+        case _REC_START_SEG:
+            if (len != 4) {
+                return (LD_SYNTAX_ERROR);
+            }
+            // CS:IP
+            result->start_addr = (((uint32_t)d[0] << 8 | d[1]) << 4) + ((uint32_t)d[2] << 8 | d[3]);
+            break;
+        case _REC_START_LIN:
+            if (len != 4) {
+                return (LD_SYNTAX_ERROR);
+            }
+            result->start_addr = (uint32_t)d[0] << 24 | (uint32_t)d[1] << 16 | (uint32_t)d[2] << 8 | d[3];
+            break;
+        default:
+            return (LD_RECTYPE_ERROR);
+    }
+    return (LD_OK);
+}
+
+static void _begin(ld_sink_t* sink) {
+    memset(&_dec, 0, sizeof(hex_decoder_t));
+    _dec.state = _ST_MARK;
+    _dec.sink = sink;
+}
+
+static ld_status_t _end() {
+    return (LD_NO_END);
+}
+
+static ld_status_t _feed(const uint8_t* buf, uint32_t len) {
+    const uint8_t* p = buf;
+    const uint8_t* end = p + len;
+    while (p < end) {
+        uint8_t c = *p++;
+        if (_dec.state == _ST_REC) {
+            uint8_t v = ld_hexval[c];
+            if (!(v & LD_HEX_VALID)) {
+                return (LD_SYNTAX_ERROR);
+            }
+            if (!_dec.hiheld) {
+                _dec.hinib = (uint8_t)(v << 4);
+                _dec.hiheld = true;
+                continue;
+            }
+            _dec.hiheld = false;
+            uint8_t b = _dec.hinib | (v & 0x0F);
+            _dec.sum += b;
+            uint16_t i = _dec.idx++;
+            if (i == 0) {
+                _dec.len = b;
+            }
+            else if (i <= 2) {
+                _dec.offset = (uint16_t)((_dec.offset << 8) | b);
+            }
+            else if (i == 3) {
+                _dec.type = b;
+            }
+            else if (i < (4u + _dec.len)) {
+                _dec.data[i - 4] = b;
+            }
+            else {
+                // Checksum (the sum of all of the bytes, including the checksum, is 0)
+                if (_dec.sum != 0) {
+                    return (LD_CHECKSUM_ERROR);
+                }
+                _dec.state = _ST_MARK;
+                ld_status_t status = _rec_process();
+                if (status != LD_OK) {
+                    return (status);
+                }
+                if (_dec.state == _ST_DONE) {
+                    return (LD_OK);
+                }
+            }
+        }
+        else if (_dec.state == _ST_MARK) {
+            if (c == ':') {
+                _dec.state = _ST_REC;
+                _dec.idx = 0;
+                _dec.hiheld = false;
+                _dec.sum = 0;
+                _dec.offset = 0;
+            }
+            else if (c == '\n') {
+                _dec.sink->result->line++;
+            }
+            else if (c != '\r' && c != ' ' && c != '\t') {
+                return (LD_SYNTAX_ERROR);
+            }
+        }
+        else {
+            return (LD_OK);     // Anything after the EOF record is ignored
+        }
+    }
+    return (_dec.state == _ST_DONE ? LD_OK : LD_MORE);
+}
+
+/**
+ * @brief A HEX file starts with a ':' followed by a hex digit (after any whitespace).
+ */
+static bool _sniff(const uint8_t* buf, uint32_t len) {
+    uint32_t i = 0;
+    while (i < len && (buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\r' || buf[i] == '\n')) {
+        i++;
+    }
+    return ((i + 1) < len && buf[i] == ':' && (ld_hexval[buf[i + 1]] & LD_HEX_VALID));
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+const ld_decoder_t ld_hex_decoder = {
+    LD_FMT_HEX,
+    "HEX",
+    _sniff,
+    _begin,
+    _feed,
+    _end,
+};
@@ -0,0 +1,1052 @@
+/**
+ * Host Link - Binary framed transfer protocol over the USB CDC link.
+ *
+ * The frames are read and written directly through the USB STDIO driver (not the STDIO
+ * functions), so the input isn't taken by the terminal and the output isn't copied to
+ * the UART or translated (CR/LF). Input is read in bulk into a buffer and the frames are
+ * parsed from it.
+ *
+ * Data received (UPLOAD) is written into the image as each frame arrives in order, so
+ * nothing is buffered for the window. Data sent (DOWNLOAD) is read again from its source
+ * when frames need to be resent.
+ *
+ * Data streamed to the device (STREAM) is received into two sector buffers (the image RAM,
+ * or one buffer if the sectors are too large for two). While a sector is programmed, the
+ * frames for the next one are received into the other buffer (from the programming progress
+ * callback), and while the rest of a sector is received the sector is erased.
+ *
+ * Device data sent (DUMP) is read ahead: the bus read (DMA) of the next frame is started
+ * before a frame is sent, so it is ready when the frame has gone out.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "hostlink.h"
+#include "image.h"
+#include "journal.h"
+#include "pdops.h"
+#include "prog_device.h"
+
+#include "include/util.h"
+
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define _HDR_SIZE 6         // Sync, Type, Seq, Length
+#define _CRC_SIZE 4
+
+#define _MT_BYTE_VAL (0xFF)
+
+/** @brief The size of the input buffer (more than a window of frames doesn't help) */
+#define _RX_BUF_SIZE (2 * ONE_K)
+
+/** @brief Once a frame starts, the rest of it must arrive within this time */
+#define _FRAME_TIMEOUT_US (100 * 1000)
+
+/** @brief During a transfer, a frame must arrive within this time (or a NAK/resend is done) */
+#define _XFER_TIMEOUT_US (500 * 1000)
+
+/** @brief The number of times in a row a transfer can time out before it is ended */
+#define _XFER_RETRIES 10
+
+/** @brief The minimum time between HL_PROGRESS frames */
+#define _PROGRESS_US (250 * 1000)
+
+typedef enum rx_result_ {
+    _RX_FRAME,      // A good frame was received
+    _RX_BAD,        // A frame was received with a bad CRC or length, or it was incomplete
+    _RX_TIMEOUT,    // Nothing was received
+} rx_result_t;
+
+/**
+ * @brief A received frame.
+ */
+typedef struct frame_ {
+    uint8_t type;
+    uint8_t seq;
+    uint16_t len;
+    uint8_t payload[HL_PAYLOAD_MAX];
+} frame_t;
+
+/**
+ * @brief Function prototype for a data source (for a download).
+ *
+ * @param addr The address of the data
+ * @param buf The buffer to fill
+ * @param len The number of bytes
+ * @return hl_status_t HL_OK if the data was read
+ */
+typedef hl_status_t (*data_src_fn)(uint32_t addr, uint8_t* buf, uint32_t len);
+
+/**
+ * @brief The state of a stream (HL_CMD_STREAM) to the device.
+ */
+typedef struct strm_ {
+    uint8_t cmd;            // The command type and sequence (to recognize it being sent again)
+    uint8_t seq;
+    uint8_t expect;         // The next DATA frame
+    uint8_t unacked;        // The frames received since the last CREDIT
+    bool naked;             // A NAK was sent for the current gap
+    uint8_t retries;
+    hl_status_t status;     // Set if the transfer fails (or the host ends it)
+    uint8_t* area;          // The sector buffers
+    uint32_t area_size;     // The size of the sector buffers (1 or 2 sectors)
+    uint32_t len;           // The number of bytes to receive
+    uint32_t received;      // The number of bytes received
+    uint32_t limit;         // The number of bytes there is buffer space for
+    uint32_t crc;           // CRC-32 of the data received
+} strm_t;
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief Input from the host */
+static uint8_t _rxbuf[_RX_BUF_SIZE];
+static uint16_t _rx_in;
+static uint16_t _rx_out;
+static frame_t _frame;
+
+/** @brief The frame being sent (the payload is built in place) */
+static uint8_t _txbuf[_HDR_SIZE + HL_PAYLOAD_MAX + _CRC_SIZE] __attribute__((aligned(4)));
+
+/** @brief Device data being verified */
+static uint8_t _rdbuf[HL_PAYLOAD_MAX] __attribute__((aligned(4)));
+
+/** @brief The last response sent (to resend if the host didn't get it) */
+static uint8_t _last_rsp[2 + 30];
+static uint16_t _last_rsp_len;
+static uint8_t _last_rsp_seq;
+
+static uint32_t _progress_last;
+
+static strm_t _strm;
+
+/** @brief The device data being sent (DUMP), and the data read ahead into `_rdbuf` */
+static uint32_t _dump_end;
+static uint32_t _ahead_addr;
+static uint32_t _ahead_len;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+static inline uint32_t _get_u32(const uint8_t* p) {
+    return (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static inline uint8_t* _put_u32(uint8_t* p, uint32_t v) {
+    *p++ = (uint8_t)v;
+    *p++ = (uint8_t)(v >> 8);
+    *p++ = (uint8_t)(v >> 16);
+    *p++ = (uint8_t)(v >> 24);
+    return (p);
+}
+
+/**
+ * @brief Read what the host has sent into the input buffer.
+ *
+ * @return true Input is available
+ */
+static bool _rx_fill() {
+    if (_rx_out == _rx_in) {
+        _rx_in = _rx_out = 0;
+    }
+    else if (_rx_in == _RX_BUF_SIZE) {
+        memmove(_rxbuf, _rxbuf + _rx_out, _rx_in - _rx_out);
+        _rx_in -= _rx_out;
+        _rx_out = 0;
+    }
+    int n = stdio_usb.in_chars((char*)(_rxbuf + _rx_in), (_RX_BUF_SIZE - _rx_in));
+    if (n > 0) {
+        _rx_in += n;
+    }
+    return (_rx_in != _rx_out);
+}
+
+/**
+ * @brief Read bytes from the host.
+ *
+ * @param dst Where to put the bytes
+ * @param len The number of bytes
+ * @param start The time (`time_us_32`) the timeout is from
+ * @param timeout_us The timeout. 0 to only take what is already available.
+ * @return true The bytes were read. False if it timed out.
+ */
+static bool _rx_read(uint8_t* dst, uint32_t len, uint32_t start, uint32_t timeout_us) {
+    while (len > 0) {
+        if (_rx_out == _rx_in && !_rx_fill()) {
+            if ((time_us_32() - start) >= timeout_us) {
+                return (false);
+            }
+            tight_loop_contents();
+            continue;
+        }
+        uint32_t n = _rx_in - _rx_out;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(dst, _rxbuf + _rx_out, n);
+        _rx_out += n;
+        dst += n;
+        len -= n;
+    }
+    return (true);
+}
+
+/**
+ * @brief Receive a frame.
+ *
+ * Anything before the frame sync is discarded.
+ *
+ * @param f The frame to fill in
+ * @param timeout_us The time to wait for a frame to start. 0 to only check what is available.
+ * @return rx_result_t The result
+ */
+static rx_result_t _frame_recv(frame_t* f, uint32_t timeout_us) {
+    uint32_t start = time_us_32();
+    bool sync = false;
+    uint8_t b;
+    while (!sync) {
+        if (!_rx_read(&b, 1, start, timeout_us)) {
+            return (_RX_TIMEOUT);
+        }
+        while (b == HL_SYNC0 && !sync) {
+            // The rest of the frame should follow right away
+            if (!_rx_read(&b, 1, time_us_32(), _FRAME_TIMEOUT_US)) {
+                return (_RX_BAD);
+            }
+            sync = (b == HL_SYNC1);
+        }
+    }
+    start = time_us_32();
+    uint8_t hdr[_HDR_SIZE - 2];
+    uint8_t crcb[_CRC_SIZE];
+    if (!_rx_read(hdr, sizeof(hdr), start, _FRAME_TIMEOUT_US)) {
+        return (_RX_BAD);
+    }
+    f->type = hdr[0];
+    f->seq = hdr[1];
+    f->len = hdr[2] | (hdr[3] << 8);
+    if (f->len > HL_PAYLOAD_MAX) {
+        return (_RX_BAD);
+    }
+    if (!_rx_read(f->payload, f->len, start, _FRAME_TIMEOUT_US) || !_rx_read(crcb, sizeof(crcb), start, _FRAME_TIMEOUT_US)) {
+        return (_RX_BAD);
+    }
+    uint32_t crc = crc32_update(crc32_update(0, hdr, sizeof(hdr)), f->payload, f->len);
+    return (crc == _get_u32(crcb) ? _RX_FRAME : _RX_BAD);
+}
+
+/**
+ * @brief Send a frame with the payload already in the transmit buffer.
+ *
+ * @param type The frame type
+ * @param seq The sequence number
+ * @param len The payload length
+ */
+static void _frame_send_buf(uint8_t type, uint8_t seq, uint16_t len) {
+    _txbuf[0] = HL_SYNC0;
+    _txbuf[1] = HL_SYNC1;
+    _txbuf[2] = type;
+    _txbuf[3] = seq;
+    _txbuf[4] = (uint8_t)len;
+    _txbuf[5] = (uint8_t)(len >> 8);
+    _put_u32(_txbuf + _HDR_SIZE + len, crc32_update(0, _txbuf + 2, (_HDR_SIZE - 2) + len));
+    stdio_usb.out_chars((const char*)_txbuf, (_HDR_SIZE + len + _CRC_SIZE));
+    stdio_usb.out_flush();
+}
+
+static void _frame_send(uint8_t type, uint8_t seq, const void* payload, uint16_t len) {
+    if (len) {
+        memcpy(_txbuf + _HDR_SIZE, payload, len);
+    }
+    _frame_send_buf(type, seq, len);
+}
+
+/**
+ * @brief Send a command response.
+ *
+ * @param cmd The command
+ * @param seq The command sequence number
+ * @param status The status
+ * @param results The command results (can be NULL)
+ * @param len The length of the results
+ */
+static void _rsp_send(uint8_t cmd, uint8_t seq, hl_status_t status, const void* results, uint16_t len) {
+    _last_rsp[0] = cmd;
+    _last_rsp[1] = (uint8_t)status;
+    if (len) {
+        memcpy(_last_rsp + 2, results, len);
+    }
+    _last_rsp_len = 2 + len;
+    _last_rsp_seq = seq;
+    _frame_send(HL_RSP, seq, _last_rsp, _last_rsp_len);
+}
+
+/**
+ * @brief Send the last response again (the host didn't get it).
+ */
+static void _rsp_resend() {
+    if (_last_rsp_len) {
+        _frame_send(HL_RSP, _last_rsp_seq, _last_rsp, _last_rsp_len);
+    }
+}
+
+static void _progress(uint32_t v) {
+    uint32_t now = time_us_32();
+    if ((now - _progress_last) >= _PROGRESS_US) {
+        _progress_last = now;
+        uint8_t val[4];
+        _put_u32(val, v);
+        _frame_send(HL_PROGRESS, 0, val, sizeof(val));
+    }
+}
+
+/**
+ * @brief Receive data (DATA frames) from the host into the image.
+ *
+ * @param cmd The command frame type (and `seq`) that started the transfer
+ * @param seq The command sequence number
+ * @param addr The image address for the data
+ * @param len The number of bytes
+ * @param crc Set to the CRC-32 of the data received
+ * @return hl_status_t Status
+ */
+static hl_status_t _recv_data(uint8_t cmd, uint8_t seq, uint32_t addr, uint32_t len, uint32_t* crc) {
+    frame_t* f = &_frame;
+    uint32_t offset = 0;
+    uint8_t expect = 0;
+    uint8_t unacked = 0;
+    uint8_t retries = 0;
+    bool naked = false;
+
+    *crc = 0;
+    while (offset < len) {
+        rx_result_t r = _frame_recv(f, _XFER_TIMEOUT_US);
+        if (r == _RX_TIMEOUT) {
+            if (++retries > _XFER_RETRIES) {
+                return (HL_XFER_TIMEOUT);
+            }
+            // Ask for what we are waiting for (an ACK to us might have been lost).
+            _frame_send(HL_NAK, expect, NULL, 0);
+            continue;
+        }
+        if (r == _RX_BAD) {
+            if (!naked) {
+                _frame_send(HL_NAK, expect, NULL, 0);
+                naked = true;
+            }
+            continue;
+        }
+        if (f->type < HL_DATA) {
+            if (f->type == cmd && f->seq == seq) {
+                _rsp_resend();          // The host didn't get the response that started the transfer
+                retries = 0;
+                continue;
+            }
+            return (HL_ABORTED);        // Another command ends the transfer
+        }
+        if (f->type != HL_DATA) {
+            continue;
+        }
+        if (f->seq != expect) {
+            if ((uint8_t)(f->seq - expect) >= 0x80) {
+                // A frame we already have (our ACK was lost). Say where we are.
+                _frame_send(HL_ACK, expect, NULL, 0);
+            }
+            else if (!naked) {
+                // A frame was lost. The host needs to go back to it.
+                _frame_send(HL_NAK, expect, NULL, 0);
+                naked = true;
+            }
+            continue;
+        }
+        if (f->len == 0 || f->len > (len - offset)) {
+            return (HL_BAD_ARG);
+        }
+        if (img_write_at(addr + offset, f->payload, f->len) != IMG_OK) {
+            return (HL_IMG_ERROR);
+        }
+        *crc = crc32_update(*crc, f->payload, f->len);
+        offset += f->len;
+        expect++;
+        naked = false;
+        retries = 0;
+        if (++unacked >= (HL_WINDOW / 2) || offset == len) {
+            _frame_send(HL_ACK, expect, NULL, 0);
+            unacked = 0;
+        }
+    }
+    return (HL_OK);
+}
+
+/**
+ * @brief Send data (DATA frames) to the host.
+ *
+ * The frames that haven't been acknowledged are read from the source again if they
+ * need to be resent.
+ *
+ * @param cmd The command frame type (and `seq`) that started the transfer
+ * @param seq The command sequence number
+ * @param srcfn The data source
+ * @param addr The (source) address of the data
+ * @param len The number of bytes
+ * @param crc Set to the CRC-32 of the data sent
+ * @return hl_status_t Status
+ */
+static hl_status_t _send_data(uint8_t cmd, uint8_t seq, data_src_fn srcfn, uint32_t addr, uint32_t len, uint32_t* crc) {
+    frame_t* f = &_frame;
+    uint8_t base = 0;           // The oldest frame not acknowledged
+    uint32_t base_off = 0;
+    uint8_t next = 0;           // The next frame to send
+    uint32_t next_off = 0;
+    uint8_t hi = 0;             // One past the last frame sent (`next` goes back for a resend)
+    uint32_t crc_off = 0;       // The data included in the CRC
+    uint8_t retries = 0;
+
+    *crc = 0;
+    while (base_off < len) {
+        uint32_t timeout_us = _XFER_TIMEOUT_US;
+        if (next_off < len && (uint8_t)(next - base) < HL_WINDOW) {
+            uint32_t n = len - next_off;
+            if (n > HL_PAYLOAD_MAX) {
+                n = HL_PAYLOAD_MAX;
+            }
+            uint8_t* buf = _txbuf + _HDR_SIZE;
+            hl_status_t st = srcfn(addr + next_off, buf, n);
+            if (st != HL_OK) {
+                return (st);
+            }
+            if (next_off == crc_off) {
+                *crc = crc32_update(*crc, buf, n);
+                crc_off += n;
+            }
+            _frame_send_buf(HL_DATA, next, n);
+            next++;
+            next_off += n;
+            if ((uint8_t)(next - base) > (uint8_t)(hi - base)) {
+                hi = next;
+            }
+            // Take any ACK/NAK that has come in, but don't wait for one.
+            timeout_us = 0;
+        }
+        rx_result_t r = _frame_recv(f, timeout_us);
+        if (r == _RX_TIMEOUT) {
+            if (timeout_us != 0) {
+                if (++retries > _XFER_RETRIES) {
+                    return (HL_XFER_TIMEOUT);
+                }
+                // Go back and resend what hasn't been acknowledged.
+                next = base;
+                next_off = base_off;
+            }
+            continue;
+        }
+        if (r != _RX_FRAME) {
+            continue;
+        }
+        if (f->type < HL_DATA) {
+            if (f->type == cmd && f->seq == seq) {
+                _rsp_resend();          // The host didn't get the response that started the transfer
+                retries = 0;
+                continue;
+            }
+            return (HL_ABORTED);        // Another command ends the transfer
+        }
+        if (f->type != HL_ACK && f->type != HL_NAK) {
+            continue;
+        }
+        uint8_t acked = f->seq - base;
+        if (acked > (uint8_t)(hi - base)) {
+            continue;               // Old news
+        }
+        if (acked) {
+            // An ACK for frames sent before going back moves past the resend.
+            bool passed = ((uint8_t)(next - base) < acked);
+            base = f->seq;
+            base_off += (acked * HL_PAYLOAD_MAX);
+            if (base_off > len) {
+                base_off = len;
+            }
+            if (passed) {
+                next = base;
+                next_off = base_off;
+            }
+            retries = 0;
+        }
+        if (f->type == HL_NAK) {
+            next = base;
+            next_off = base_off;
+        }
+    }
+    return (HL_OK);
+}
+
+static hl_status_t _img_src(uint32_t addr, uint8_t* buf, uint32_t len) {
+    return (img_read_at(addr, buf, len) == IMG_OK ? HL_OK : HL_IMG_ERROR);
+}
+
+/**
+ * @brief Device data source (DUMP). The next frame is read ahead while this one is sent.
+ *
+ * The device stream must be started (`pdo_stream_begin`).
+ */
+static hl_status_t _dev_src(uint32_t addr, uint8_t* buf, uint32_t len) {
+    if (_ahead_len && _ahead_addr == addr && _ahead_len == len) {
+        pdo_stream_read_wait();
+        memcpy(buf, _rdbuf, len);
+    }
+    else {
+        // Not what was read ahead (the frames are being resent). Go back to the address.
+        if (!pdo_stream_begin(addr)) {
+            return (HL_PD_ERROR);
+        }
+        pdo_stream_read(buf, len);
+    }
+    _ahead_len = 0;
+    uint32_t next = addr + len;
+    if (next < _dump_end) {
+        _ahead_addr = next;
+        _ahead_len = ((_dump_end - next) < HL_PAYLOAD_MAX ? (_dump_end - next) : HL_PAYLOAD_MAX);
+        pdo_stream_read_start(_rdbuf, _ahead_len);
+    }
+    return (ERRORNO ? HL_PD_ERROR : HL_OK);
+}
+
+/**
+ * @brief Power the device on and identify it, checking that it matches the image.
+ *
+ * @param info Set to the device info
+ * @return hl_status_t Status. The power is left on (it must be turned off in any case).
+ */
+static hl_status_t _dev_open(const md_info_t** info) {
+    if (!img_is_open()) {
+        return (HL_NO_IMAGE);
+    }
+    if (pd_async_busy()) {
+        return (HL_PD_ERROR);
+    }
+    ERRORNO = 0;
+    pdo_request_pwr_on(true);
+    if (ERRORNO) {
+        return (HL_NO_DEVICE);
+    }
+    *info = pd_info();
+    if (!*info) {
+        return (HL_NO_DEVICE);
+    }
+    if (img_size() != pd_size(*info)) {
+        return (HL_BAD_ARG);
+    }
+    return (HL_OK);
+}
+
+static void _cmd_status(const frame_t* cmd) {
+    hl_status_rsp_t rsp;
+    memset(&rsp, 0, sizeof(rsp));
+    rsp.version = HL_VERSION;
+    rsp.window = HL_WINDOW;
+    rsp.payload_max = HL_PAYLOAD_MAX;
+    rsp.imgsize = (img_is_open() ? img_size() : 0);
+    if (!pd_async_busy()) {
+        ERRORNO = 0;
+        pdo_request_pwr_on(true);
+        const md_info_t* info = (ERRORNO ? NULL : pd_info());
+        if (info) {
+            rsp.mfgid = info->mfgid;
+            rsp.devid = info->devid;
+            rsp.sectcnt = info->sectcnt;
+            rsp.devsize = pd_size(info);
+        }
+        pdo_request_pwr_on(false);
+    }
+    _rsp_send(cmd->type, cmd->seq, HL_OK, &rsp, sizeof(rsp));
+}
+
+static void _cmd_upload(const frame_t* cmd) {
+    uint8_t type = cmd->type;
+    uint8_t seq = cmd->seq;
+    if (cmd->len != 12) {
+        _rsp_send(type, seq, HL_BAD_ARG, NULL, 0);
+        return;
+    }
+    uint32_t imgsize = _get_u32(cmd->payload);
+    uint32_t addr = _get_u32(cmd->payload + 4);
+    uint32_t len = _get_u32(cmd->payload + 8);
+    if (imgsize) {
+        img_status_t istat = img_open(imgsize);
+        if (istat != IMG_OK) {
+            _rsp_send(type, seq, (istat == IMG_TOO_BIG ? HL_BAD_ARG : HL_IMG_ERROR), NULL, 0);
+            return;
+        }
+    }
+    else if (!img_is_open()) {
+        _rsp_send(type, seq, HL_NO_IMAGE, NULL, 0);
+        return;
+    }
+    if (addr > img_size() || len > (img_size() - addr)) {
+        _rsp_send(type, seq, HL_BAD_ARG, NULL, 0);
+        return;
+    }
+    _rsp_send(type, seq, HL_OK, NULL, 0);
+    uint32_t crc;
+    hl_status_t st = _recv_data(type, seq, addr, len, &crc);
+    uint8_t results[8];
+    _put_u32(_put_u32(results, crc), len);
+    _rsp_send(type, seq, st, results, sizeof(results));
+}
+
+static void _cmd_download(const frame_t* cmd) {
+    uint8_t type = cmd->type;
+    uint8_t seq = cmd->seq;
+    if (cmd->len != 8) {
+        _rsp_send(type, seq, HL_BAD_ARG, NULL, 0);
+        return;
+    }
+    uint32_t addr = _get_u32(cmd->payload);
+    uint32_t len = _get_u32(cmd->payload + 4);
+    if (!img_is_open()) {
+        _rsp_send(type, seq, HL_NO_IMAGE, NULL, 0);
+        return;
+    }
+    if (addr > img_size() || len > (img_size() - addr)) {
+        _rsp_send(type, seq, HL_BAD_ARG, NULL, 0);
+        return;
+    }
+    _rsp_send(type, seq, HL_OK, NULL, 0);
+    uint32_t crc;
+    hl_status_t st = _send_data(type, seq, _img_src, addr, len, &crc);
+    uint8_t results[8];
+    _put_u32(_put_u32(results, crc), len);
+    _rsp_send(type, seq, st, results, sizeof(results));
+}
+
+static void _cmd_program(const frame_t* cmd) {
+    uint8_t type = cmd->type;
+    uint8_t seq = cmd->seq;
+    pd_sync_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    uint32_t failaddr = PD_INVALID_ADDR;
+    pd_op_status_t pdstat = PD_OP_OK;
+    const md_info_t* info;
+    hl_status_t st = _dev_open(&info);
+    if (st == HL_OK) {
+        // The image identity (for the journal) is the CRC of the image.
+        uint32_t sectsize = pd_sectsize(info);
+        uint32_t imgid = 0;
+        for (uint8_t sect = 0; sect < info->sectcnt; sect++) {
+            const uint8_t* data = img_sector_ptr(sect, sectsize);
+            if (!data) {
+                st = HL_IMG_ERROR;
+                goto _finally;
+            }
+            imgid = crc32_update(imgid, data, sectsize);
+        }
+        pd_sectmap_t done;
+        int resumed = jnl_open(imgid, img_size(), info, &done);
+        _progress_last = time_us_32();
+        pdstat = pd_sync(info, img_sector_ptr, &done, (resumed >= 0 ? jnl_update : NULL), _progress, &stats, &failaddr);
+        jnl_close(pdstat == PD_OP_OK);
+        if (pdstat != PD_OP_OK) {
+            st = (pdstat == PD_IMG_ERROR ? HL_IMG_ERROR : HL_PD_ERROR);
+        }
+    }
+_finally:
+    pdo_request_pwr_on(false);
+    uint8_t results[21];
+    uint8_t* p = _put_u32(results, failaddr);
+    *p++ = (uint8_t)pdstat;
+    *p++ = stats.clean;
+    *p++ = stats.inplace;
+    *p++ = stats.erased;
+    *p++ = stats.chiperase;
+    p = _put_u32(p, stats.programmed);
+    p = _put_u32(p, stats.skipped);
+    _put_u32(p, stats.elapsed_ms);
+    _rsp_send(type, seq, st, results, sizeof(results));
+}
+
+static void _cmd_verify(const frame_t* cmd) {
+    uint8_t type = cmd->type;
+    uint8_t seq = cmd->seq;
+    uint32_t failaddr = PD_INVALID_ADDR;
+    const md_info_t* info;
+    hl_status_t st = _dev_open(&info);
+    if (st == HL_OK) {
+        uint32_t sectsize = pd_sectsize(info);
+        _progress_last = time_us_32();
+        for (uint8_t sect = 0; sect < info->sectcnt && st == HL_OK; sect++) {
+            const uint8_t* data = img_sector_ptr(sect, sectsize);
+            if (!data) {
+                st = HL_IMG_ERROR;
+                break;
+            }
+            uint32_t sectaddr = pd_sectstart(info, sect);
+            for (uint32_t off = 0; off < sectsize; off += sizeof(_rdbuf)) {
+                if (pd_read_block(info, sectaddr + off, _rdbuf, sizeof(_rdbuf), NULL) != PD_OP_OK) {
+                    st = HL_PD_ERROR;
+                    break;
+                }
+                if (memcmp(_rdbuf, data + off, sizeof(_rdbuf)) != 0) {
+                    uint32_t i = 0;
+                    while (_rdbuf[i] == data[off + i]) {
+                        i++;
+                    }
+                    failaddr = sectaddr + off + i;
+                    st = HL_VERIFY_FAILED;
+                    break;
+                }
+            }
+            _progress(sectaddr + sectsize - 1);
+        }
+    }
+    pdo_request_pwr_on(false);
+    uint8_t results[4];
+    _put_u32(results, failaddr);
+    _rsp_send(type, seq, st, results, sizeof(results));
+}
+
+static void _cmd_dump(const frame_t* cmd) {
+    uint8_t type = cmd->type;
+    uint8_t seq = cmd->seq;
+    uint32_t crc = 0;
+    bool accepted = false;
+    hl_status_t st = HL_OK;
+
+    if (cmd->len != 8) {
+        _rsp_send(type, seq, HL_BAD_ARG, NULL, 0);
+        return;
+    }
+    uint32_t addr = _get_u32(cmd->payload);
+    uint32_t len = _get_u32(cmd->payload + 4);
+    if (pd_async_busy()) {
+        st = HL_PD_ERROR;
+        goto _finally;
+    }
+    ERRORNO = 0;
+    pdo_request_pwr_on(true);
+    const md_info_t* info = (ERRORNO ? NULL : pd_info());
+    if (!info) {
+        st = HL_NO_DEVICE;
+        goto _finally;
+    }
+    uint32_t size = pd_size(info);
+    if (addr > size || len > (size - addr)) {
+        st = HL_BAD_ARG;
+        goto _finally;
+    }
+    if (!pdo_stream_begin(addr)) {
+        st = HL_PD_ERROR;
+        goto _finally;
+    }
+    _dump_end = addr + len;
+    _ahead_len = 0;
+    _rsp_send(type, seq, HL_OK, NULL, 0);
+    accepted = true;
+    st = _send_data(type, seq, _dev_src, addr, len, &crc);
+    pdo_stream_end();
+_finally:
+    pdo_request_pwr_on(false);
+    if (!accepted) {
+        _rsp_send(type, seq, st, NULL, 0);
+        return;
+    }
+    uint8_t results[8];
+    _put_u32(_put_u32(results, crc), len);
+    _rsp_send(type, seq, st, results, sizeof(results));
+}
+
+/**
+ * @brief Send a CREDIT for the stream (acknowledge what was received and allow what there is room for).
+ */
+static void _strm_credit() {
+    strm_t* s = &_strm;
+    uint32_t frames = ((s->limit - s->received) + (HL_PAYLOAD_MAX - 1)) / HL_PAYLOAD_MAX;
+    if (frames > HL_CREDIT_MAX) {
+        frames = HL_CREDIT_MAX;
+    }
+    uint8_t count[2] = { (uint8_t)frames, (uint8_t)(frames >> 8) };
+    _frame_send(HL_CREDIT, s->expect, count, sizeof(count));
+    s->unacked = 0;
+}
+
+/**
+ * @brief Receive a frame for the stream and put the data into the sector buffers.
+ *
+ * @param timeout_us The time to wait for a frame. 0 to only check what is available.
+ * @return rx_result_t The result of receiving a frame
+ */
+static rx_result_t _strm_recv(uint32_t timeout_us) {
+    strm_t* s = &_strm;
+    frame_t* f = &_frame;
+    rx_result_t r = _frame_recv(f, timeout_us);
+    if (r == _RX_BAD && !s->naked) {
+        _frame_send(HL_NAK, s->expect, NULL, 0);
+        s->naked = true;
+    }
+    if (r != _RX_FRAME) {
+        return (r);
+    }
+    if (f->type < HL_DATA) {
+        if (f->type == s->cmd && f->seq == s->seq) {
+            _rsp_resend();              // The host didn't get the response that started the transfer
+            s->retries = 0;
+        }
+        else {
+            s->status = HL_ABORTED;     // Another command ends the transfer
+        }
+        return (r);
+    }
+    if (f->type != HL_DATA) {
+        return (r);
+    }
+    if (f->seq != s->expect) {
+        if ((uint8_t)(f->seq - s->expect) >= 0x80) {
+            _strm_credit();             // A frame we already have (our CREDIT was lost)
+        }
+        else if (!s->naked) {
+            _frame_send(HL_NAK, s->expect, NULL, 0);
+            s->naked = true;
+        }
+        return (r);
+    }
+    uint32_t n = s->len - s->received;
+    if (n > HL_PAYLOAD_MAX) {
+        n = HL_PAYLOAD_MAX;
+    }
+    if (f->len != n) {
+        s->status = HL_BAD_ARG;
+        return (r);
+    }
+    if ((s->received + n) > s->limit) {
+        return (r);                     // The host didn't have credit for it
+    }
+    memcpy(s->area + (s->received % s->area_size), f->payload, n);
+    s->crc = crc32_update(s->crc, f->payload, n);
+    s->received += n;
+    s->expect++;
+    s->naked = false;
+    s->retries = 0;
+    if (++s->unacked >= (HL_WINDOW / 2) || s->received == s->limit) {
+        _strm_credit();
+    }
+    return (r);
+}
+
+/**
+ * @brief Programming progress handler. Receive the frames that have come in (for the next sector).
+ *
+ * @param addr The last address programmed
+ */
+static void _strm_pump(uint32_t addr) {
+    while (_strm.status == HL_OK && _strm_recv(0) != _RX_TIMEOUT) {
+    }
+    _progress(addr);
+}
+
+/**
+ * @brief Start erasing a sector for the stream, unless it is already empty.
+ *
+ * @param info md_info pointer for the device.
+ * @param sect The sector
+ * @param erased Incremented if the erase is started
+ * @return pd_op_status_t Status
+ */
+static pd_op_status_t _strm_erase_start(const md_info_t* info, uint8_t sect, uint8_t* erased) {
+    uint32_t sectsize = pd_sectsize(info);
+    uint32_t saddr = pd_sectstart(info, sect);
+    for (uint32_t off = 0; off < sectsize; off += sizeof(_rdbuf)) {
+        pd_op_status_t ps = pd_read_block(info, saddr + off, _rdbuf, sizeof(_rdbuf), NULL);
+        if (ps != PD_OP_OK) {
+            return (ps);
+        }
+        for (uint32_t i = 0; i < sizeof(_rdbuf); i++) {
+            if (_rdbuf[i] != _MT_BYTE_VAL) {
+                (*erased)++;
+                return (pd_erase_sect_start(info, sect));
+            }
+        }
+    }
+    return (PD_OP_OK);
+}
+
+static void _cmd_stream(const frame_t* cmd) {
+    strm_t* s = &_strm;
+    uint8_t type = cmd->type;
+    uint8_t seq = cmd->seq;
+    uint32_t start = time_us_32();
+    uint32_t failaddr = PD_INVALID_ADDR;
+    pd_op_status_t pdstat = PD_OP_OK;
+    uint8_t erased = 0;
+    bool accepted = false;
+    hl_status_t st = HL_OK;
+
+    memset(s, 0, sizeof(strm_t));
+    s->cmd = type;
+    s->seq = seq;
+    if (cmd->len != 4) {
+        st = HL_BAD_ARG;
+        goto _finally;
+    }
+    s->len = _get_u32(cmd->payload);
+    if (pd_async_busy()) {
+        st = HL_PD_ERROR;
+        goto _finally;
+    }
+    ERRORNO = 0;
+    pdo_request_pwr_on(true);
+    const md_info_t* info = (ERRORNO ? NULL : pd_info());
+    if (!info) {
+        st = HL_NO_DEVICE;
+        goto _finally;
+    }
+    uint32_t sectsize = pd_sectsize(info);
+    if (s->len == 0 || s->len > pd_size(info) || (sectsize % HL_PAYLOAD_MAX) != 0 || sectsize > (IMG_RAM_PAGES * IMG_PAGE_SIZE)) {
+        st = HL_BAD_ARG;
+        goto _finally;
+    }
+    uint32_t area_size;
+    s->area = img_borrow_ram(&area_size);
+    s->area_size = (area_size >= (2 * sectsize) ? (2 * sectsize) : sectsize);
+    s->limit = (s->len < s->area_size ? s->len : s->area_size);
+    uint8_t nsect = (s->len + (sectsize - 1)) / sectsize;
+    // Start erasing the first sector, and then let the host send.
+    pdstat = _strm_erase_start(info, 0, &erased);
+    if (pdstat != PD_OP_OK) {
+        failaddr = 0;
+        st = HL_PD_ERROR;
+        goto _finally;
+    }
+    _rsp_send(type, seq, HL_OK, NULL, 0);
+    accepted = true;
+    _progress_last = time_us_32();
+    _strm_credit();
+    for (uint8_t sect = 0; sect < nsect; sect++) {
+        uint32_t saddr = pd_sectstart(info, sect);
+        uint32_t slen = ((s->len - saddr) < sectsize ? (s->len - saddr) : sectsize);
+        // Receive the rest of the sector while it erases.
+        while (s->status == HL_OK && s->received < (saddr + slen)) {
+            if (_strm_recv(_XFER_TIMEOUT_US) == _RX_TIMEOUT) {
+                if (++s->retries > _XFER_RETRIES) {
+                    s->status = HL_XFER_TIMEOUT;
+                    break;
+                }
+                // Ask for what we are waiting for, and say what can be sent (a NAK or CREDIT might have been lost).
+                _frame_send(HL_NAK, s->expect, NULL, 0);
+                _strm_credit();
+            }
+        }
+        pdstat = pd_erase_wait();
+        if (s->status != HL_OK) {
+            st = s->status;
+            break;
+        }
+        if (pdstat != PD_OP_OK) {
+            failaddr = saddr;
+            st = HL_PD_ERROR;
+            break;
+        }
+        // Program it (receiving the next sector), then give the buffer back and start on the next sector.
+        pdstat = pd_program_block(info, saddr, s->area + (saddr % s->area_size), slen, _strm_pump, &failaddr);
+        if (pdstat != PD_OP_OK) {
+            st = HL_PD_ERROR;
+            break;
+        }
+        if (s->status != HL_OK) {
+            st = s->status;
+            break;
+        }
+        s->limit += sectsize;
+        if (s->limit > s->len) {
+            s->limit = s->len;
+        }
+        if (s->received < s->len) {
+            _strm_credit();
+        }
+        if ((sect + 1) < nsect) {
+            pdstat = _strm_erase_start(info, sect + 1, &erased);
+            if (pdstat != PD_OP_OK) {
+                failaddr = saddr + sectsize;
+                st = HL_PD_ERROR;
+                break;
+            }
+        }
+    }
+_finally:
+    pdo_request_pwr_on(false);
+    if (!accepted) {
+        _rsp_send(type, seq, st, NULL, 0);
+        return;
+    }
+    uint8_t results[18];
+    uint8_t* p = _put_u32(results, s->crc);
+    p = _put_u32(p, s->received);
+    p = _put_u32(p, failaddr);
+    *p++ = (uint8_t)pdstat;
+    *p++ = erased;
+    _put_u32(p, (time_us_32() - start) / 1000);
+    _rsp_send(type, seq, st, results, sizeof(results));
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+bool hl_run(void) {
+    frame_t* f = &_frame;
+    _rx_in = _rx_out = 0;
+    _last_rsp_len = 0;
+    while (true) {
+        rx_result_t r = _frame_recv(f, (HL_IDLE_TIMEOUT_MS * 1000));
+        if (r == _RX_TIMEOUT) {
+            return (false);
+        }
+        if (r != _RX_FRAME) {
+            continue;
+        }
+        switch (f->type) {
+            case HL_CMD_STATUS:
+                _cmd_status(f);
+                break;
+            case HL_CMD_UPLOAD:
+                _cmd_upload(f);
+                break;
+            case HL_CMD_DOWNLOAD:
+                _cmd_download(f);
+                break;
+            case HL_CMD_PROGRAM:
+                _cmd_program(f);
+                break;
+            case HL_CMD_VERIFY:
+                _cmd_verify(f);
+                break;
+            case HL_CMD_STREAM:
+                _cmd_stream(f);
+                break;
+            case HL_CMD_DUMP:
+                _cmd_dump(f);
+                break;
+            case HL_CMD_EXIT:
+                _rsp_send(f->type, f->seq, HL_OK, NULL, 0);
+                return (true);
+            case HL_DATA:
+            case HL_ACK:
+            case HL_NAK:
+            case HL_CREDIT:
+                // Left over from a transfer that has ended. The host didn't get the response
+                // that ended it, so send it again.
+                _rsp_resend();
+                break;
+            default:
+                _rsp_send(f->type, f->seq, HL_BAD_CMD, NULL, 0);
+                break;
+        }
+    }
+}
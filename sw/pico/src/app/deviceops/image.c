@@ -0,0 +1,451 @@
+/**
+ * Programmable Device Image buffer.
+ *
+ * The image is divided into 64KB pages. Each page is either resident in one of the
+ * RAM page slots, packed in the RAM pool, saved in the SD temp file, or has never been
+ * written (and is therefore all 0xFF). When a page that isn't resident is needed, the
+ * least recently used RAM slot is reused. If the page in the slot has been changed it
+ * is packed into the pool first, or if it doesn't fit, written to the temp file.
+ *
+ * The pool is filled from the bottom. When a changed page is packed again its old
+ * data is freed, and the pool is compacted when the free space is needed.
+ *
+ * The SD Card (temp file) operations are run on Core-0, as are the other disk operations.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "image.h"
+
+#include "board.h"
+#include "dskops.h"
+#include "lzpack.h"
+
+#include "ff.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define _PAGES_MAX (IMG_SIZE_MAX / IMG_PAGE_SIZE)
+#define _NO_PAGE (0xFF)
+#define _NO_SLOT (-1)
+#define _MT_BYTE_VAL (0xFF)
+
+typedef enum spill_op_ {
+    SPILL_OPEN,
+    SPILL_CLOSE,
+    SPILL_READ,
+    SPILL_WRITE,
+} spill_op_t;
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+static bool _initialized;
+
+static img_status_t _method_status;
+
+static bool _open;
+static uint32_t _size;
+
+/** @brief The RAM page slots */
+static uint8_t _ram[IMG_RAM_PAGES][IMG_PAGE_SIZE];
+/** @brief The page held by each RAM slot (_NO_PAGE if none) */
+static uint8_t _slot_page[IMG_RAM_PAGES];
+/** @brief The slot has been changed since it was loaded */
+static bool _slot_dirty[IMG_RAM_PAGES];
+/** @brief The use 'time' of each slot (for LRU) */
+static uint32_t _slot_used[IMG_RAM_PAGES];
+static uint32_t _use_tick;
+
+/** @brief The RAM slot holding each page (_NO_SLOT if not resident) */
+static int8_t _page_slot[_PAGES_MAX];
+/** @brief Bit set for each page that has been saved in the temp file */
+static uint32_t _page_saved;
+/** @brief Offset and length of each page packed in the pool (length 0 if not in the pool) */
+static uint32_t _page_poff[_PAGES_MAX];
+static uint32_t _page_plen[_PAGES_MAX];
+
+/** @brief The pool of packed pages */
+static uint8_t _pool[IMG_POOL_SIZE];
+/** @brief The end of the data in the pool (the free space above this is contiguous) */
+static uint32_t _pool_end;
+/** @brief The bytes of the pool holding current page data */
+static uint32_t _pool_used;
+
+static FIL _spill;
+static bool _spill_open;
+static uint32_t _spill_size;
+
+// ====================================================================
+// Local/Private Method Declarations
+// ====================================================================
+
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+/**
+ * @brief Perform a temp file operation (the disk operations are run on Core-0).
+ *
+ * @param op The operation
+ * @param page The page to read or write
+ * @param buf The page data to write, or where to read it
+ * @return true The operation succeeded
+ */
+static bool _spill_op(spill_op_t op, uint8_t page, uint8_t* buf) {
+    UINT bc;
+    FSIZE_t offs = (FSIZE_t)page * IMG_PAGE_SIZE;
+    switch (op) {
+        case SPILL_OPEN:
+            if (dsk_file_open(&_spill, IMG_SPILL_FILE, (FA_CREATE_ALWAYS | FA_READ | FA_WRITE)) != FR_OK) {
+                return (false);
+            }
+            // Preallocate the file, so paging won't fail for lack of space.
+            if (dsk_file_seek(&_spill, _spill_size) != FR_OK || f_tell(&_spill) != _spill_size || dsk_file_sync(&_spill) != FR_OK) {
+                dsk_file_close(&_spill);
+                dsk_file_unlink(IMG_SPILL_FILE);
+                return (false);
+            }
+            return (true);
+        case SPILL_CLOSE:
+            dsk_file_close(&_spill);
+            dsk_file_unlink(IMG_SPILL_FILE);
+            return (true);
+        case SPILL_READ:
+            return (dsk_file_seek(&_spill, offs) == FR_OK
+                && dsk_file_read(&_spill, buf, IMG_PAGE_SIZE, &bc) == FR_OK
+                && bc == IMG_PAGE_SIZE);
+        case SPILL_WRITE:
+            return (dsk_file_seek(&_spill, offs) == FR_OK
+                && dsk_file_write(&_spill, buf, IMG_PAGE_SIZE, &bc) == FR_OK
+                && bc == IMG_PAGE_SIZE);
+    }
+    return (false);
+}
+
+/**
+ * @brief Move the packed pages down so all of the free space is at the end of the pool.
+ */
+static void _pool_compact() {
+    uint32_t end = 0;
+    uint32_t done = 0;  // Bit set for pages that have been moved
+    while (true) {
+        // Find the lowest page that hasn't been moved yet
+        int low = -1;
+        for (int pg = 0; pg < _PAGES_MAX; pg++) {
+            if (_page_plen[pg] > 0 && !(done & (1u << pg)) && (low < 0 || _page_poff[pg] < _page_poff[low])) {
+                low = pg;
+            }
+        }
+        if (low < 0) {
+            break;
+        }
+        if (_page_poff[low] != end) {
+            memmove(&_pool[end], &_pool[_page_poff[low]], _page_plen[low]);
+            _page_poff[low] = end;
+        }
+        end += _page_plen[low];
+        done |= (1u << low);
+    }
+    _pool_end = end;
+}
+
+/**
+ * @brief Free the pool space used by a page (if it is in the pool).
+ */
+static void _pool_free(uint8_t page) {
+    uint32_t len = _page_plen[page];
+    if (len == 0) {
+        return;
+    }
+    _pool_used -= len;
+    if (_page_poff[page] + len == _pool_end) {
+        _pool_end -= len;   // It was the last, so the free space can be reused now
+    }
+    _page_plen[page] = 0;
+}
+
+/**
+ * @brief Pack a page into the pool.
+ *
+ * @return true The page was stored in the pool
+ * @return false The pool doesn't have room for the page
+ */
+static bool _pool_put(uint8_t page, const uint8_t* data) {
+    uint32_t len = lzp_pack(data, IMG_PAGE_SIZE, &_pool[_pool_end], IMG_POOL_SIZE - _pool_end);
+    if (len == 0 && _pool_used < _pool_end) {
+        // Try again with all of the free space
+        _pool_compact();
+        len = lzp_pack(data, IMG_PAGE_SIZE, &_pool[_pool_end], IMG_POOL_SIZE - _pool_end);
+    }
+    if (len == 0) {
+        return (false);
+    }
+    _page_poff[page] = _pool_end;
+    _page_plen[page] = len;
+    _pool_end += len;
+    _pool_used += len;
+    return (true);
+}
+
+/**
+ * @brief Make sure the temp file is open, creating (preallocating) it if needed.
+ *
+ * @return true The temp file is open
+ */
+static bool _spill_open_chk() {
+    if (!_spill_open) {
+        _spill_open = _spill_op(SPILL_OPEN, 0, NULL);
+    }
+    return (_spill_open);
+}
+
+/**
+ * @brief Get a RAM slot to use for a page (a free one, or the least recently used).
+ *
+ * If the slot holds a page that has been changed, it is saved to the temp file.
+ *
+ * @return int Slot number or _NO_SLOT if the page in the slot couldn't be saved.
+ */
+static int _slot_get() {
+    int slot = 0;
+    for (int i = 0; i < IMG_RAM_PAGES; i++) {
+        if (_slot_page[i] == _NO_PAGE) {
+            return (i);
+        }
+        if (_slot_used[i] < _slot_used[slot]) {
+            slot = i;
+        }
+    }
+    uint8_t page = _slot_page[slot];
+    if (_slot_dirty[slot]) {
+        // The saved copies (if any) are out of date
+        _pool_free(page);
+        _page_saved &= ~(1u << page);
+        if (!_pool_put(page, _ram[slot])) {
+            if (!_spill_open_chk() || !_spill_op(SPILL_WRITE, page, _ram[slot])) {
+                return (_NO_SLOT);
+            }
+            _page_saved |= (1u << page);
+        }
+    }
+    _page_slot[page] = _NO_SLOT;
+    _slot_page[slot] = _NO_PAGE;
+    _slot_dirty[slot] = false;
+    return (slot);
+}
+
+/**
+ * @brief Get the RAM for a page, loading it if it isn't resident.
+ *
+ * @param page The page number
+ * @param write True if the page will be changed
+ * @return uint8_t* The page data, or NULL if it couldn't be loaded (_method_status set)
+ */
+static uint8_t* _page_get(uint8_t page, bool write) {
+    int slot = _page_slot[page];
+    if (slot == _NO_SLOT) {
+        slot = _slot_get();
+        if (slot == _NO_SLOT) {
+            _method_status = IMG_SD_ERROR;
+            return (NULL);
+        }
+        if (_page_plen[page] > 0) {
+            if (!lzp_unpack(&_pool[_page_poff[page]], _page_plen[page], _ram[slot], IMG_PAGE_SIZE)) {
+                board_panic("!!! img: Packed page %hu is corrupt !!!", (uint16_t)page);
+            }
+        }
+        else if (_page_saved & (1u << page)) {
+            if (!_spill_op(SPILL_READ, page, _ram[slot])) {
+                _method_status = IMG_SD_ERROR;
+                return (NULL);
+            }
+        }
+        else {
+            // Never written - it is erased
+            memset(_ram[slot], _MT_BYTE_VAL, IMG_PAGE_SIZE);
+        }
+        _slot_page[slot] = page;
+        _page_slot[page] = slot;
+    }
+    _slot_used[slot] = ++_use_tick;
+    if (write) {
+        _slot_dirty[slot] = true;
+    }
+    return (_ram[slot]);
+}
+
+/**
+ * @brief Check that an image is open and the range is within it.
+ *
+ * @return true The range is valid (_method_status is set if not)
+ */
+static bool _range_chk(uint32_t addr, uint32_t len) {
+    if (!_open) {
+        _method_status = IMG_NOT_OPEN;
+        return (false);
+    }
+    if (addr >= _size || len > (_size - addr)) {
+        _method_status = IMG_ADDR_INVALID;
+        return (false);
+    }
+    return (true);
+}
+
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+void img_close() {
+    if (_spill_open) {
+        _spill_op(SPILL_CLOSE, 0, NULL);
+        _spill_open = false;
+    }
+    for (int i = 0; i < IMG_RAM_PAGES; i++) {
+        _slot_page[i] = _NO_PAGE;
+        _slot_dirty[i] = false;
+        _slot_used[i] = 0;
+    }
+    for (int i = 0; i < _PAGES_MAX; i++) {
+        _page_slot[i] = _NO_SLOT;
+        _page_plen[i] = 0;
+    }
+    _page_saved = 0;
+    _pool_end = 0;
+    _pool_used = 0;
+    _use_tick = 0;
+    _size = 0;
+    _open = false;
+}
+
+uint8_t* img_borrow_ram(uint32_t* size) {
+    img_close();
+    *size = sizeof(_ram);
+    return (&_ram[0][0]);
+}
+
+bool img_is_open() {
+    return (_open);
+}
+
+img_status_t img_method_status() {
+    return (_method_status);
+}
+
+img_status_t img_open(uint32_t size) {
+    img_close();
+    if (size == 0 || size > IMG_SIZE_MAX) {
+        _method_status = IMG_TOO_BIG;
+        return (_method_status);
+    }
+    _spill_size = size;
+    _size = size;
+    _open = true;
+    _method_status = IMG_OK;
+    return (_method_status);
+}
+
+img_status_t img_read_at(uint32_t addr, uint8_t* buf, uint32_t len) {
+    if (!_range_chk(addr, len)) {
+        return (_method_status);
+    }
+    while (len > 0) {
+        uint32_t offset = addr % IMG_PAGE_SIZE;
+        uint32_t n = IMG_PAGE_SIZE - offset;
+        n = (n < len ? n : len);
+        const uint8_t* pg = _page_get(addr / IMG_PAGE_SIZE, false);
+        if (!pg) {
+            return (_method_status);
+        }
+        memcpy(buf, pg + offset, n);
+        addr += n;
+        buf += n;
+        len -= n;
+    }
+    _method_status = IMG_OK;
+    return (_method_status);
+}
+
+const uint8_t* img_sector_ptr(uint8_t sect, uint32_t sectsize) {
+    if (sectsize == 0 || sectsize > IMG_PAGE_SIZE || (IMG_PAGE_SIZE % sectsize) != 0) {
+        _method_status = IMG_ADDR_INVALID;
+        return (NULL);
+    }
+    uint32_t addr = sect * sectsize;
+    if (!_range_chk(addr, sectsize)) {
+        return (NULL);
+    }
+    const uint8_t* pg = _page_get(addr / IMG_PAGE_SIZE, false);
+    if (!pg) {
+        return (NULL);
+    }
+    _method_status = IMG_OK;
+    return (pg + (addr % IMG_PAGE_SIZE));
+}
+
+uint32_t img_size() {
+    return (_size);
+}
+
+void img_stats(img_stats_t* stats) {
+    memset(stats, 0, sizeof(img_stats_t));
+    uint8_t pages = (_size + IMG_PAGE_SIZE - 1) / IMG_PAGE_SIZE;
+    for (uint8_t pg = 0; pg < pages; pg++) {
+        if (_page_slot[pg] != _NO_SLOT) {
+            stats->ram_pages++;
+        }
+        else if (_page_plen[pg] > 0) {
+            stats->packed_pages++;
+        }
+        else if (_page_saved & (1u << pg)) {
+            stats->sd_pages++;
+        }
+        else {
+            stats->blank_pages++;
+        }
+    }
+    stats->pool_used = _pool_used;
+}
+
+img_status_t img_write_at(uint32_t addr, const uint8_t* data, uint32_t len) {
+    if (!_range_chk(addr, len)) {
+        return (_method_status);
+    }
+    while (len > 0) {
+        uint32_t offset = addr % IMG_PAGE_SIZE;
+        uint32_t n = IMG_PAGE_SIZE - offset;
+        n = (n < len ? n : len);
+        uint8_t* pg = _page_get(addr / IMG_PAGE_SIZE, true);
+        if (!pg) {
+            return (_method_status);
+        }
+        memcpy(pg + offset, data, n);
+        addr += n;
+        data += n;
+        len -= n;
+    }
+    _method_status = IMG_OK;
+    return (_method_status);
+}
+
+
+// ====================================================================
+// Initialization/Start-Up Methods
+// ====================================================================
+
+void img_minit() {
+    if (_initialized) {
+        board_panic("!!! img_minit: Called more than once !!!");
+    }
+    _initialized = true;
+    _spill_open = false;
+    img_close();
+    _method_status = IMG_OK;
+}
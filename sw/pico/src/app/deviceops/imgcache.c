@@ -0,0 +1,387 @@
+/**
+ * Programmable Device Image cache in the Pico's (QSPI) program Flash.
+ *
+ * While the Flash is being erased or programmed it can't be read (XIP), so neither core
+ * can run code from Flash. The core doing the operation disables its interrupts, and
+ * the other core (Core-0) is parked in a RAM function. Core-0 is parked using a CMT
+ * message (rather than the SDK's multicore lockout), as the inter-core FIFO is used by
+ * `runon_core0`. The Flash is erased and programmed in small pieces, so Core-0 is only
+ * parked for a short time.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "imgcache.h"
+#include "image.h"
+
+#include "board.h"
+#include "cmt.h"
+#include "msgpost.h"
+#include "include/util.h"
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define _HDR_MAGIC          0x43494453  // 'SDIC'
+#define _HDR_PRESENT        0xFFFFFFFF
+#define _PARK_TIMEOUT_US    (500 * 1000)
+
+/**
+ * @brief The header (in the index) of a slot.
+ */
+typedef struct imc_hdr_ {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t erases;
+    uint32_t size;
+    uint32_t crc;
+    uint32_t removed;   // _HDR_PRESENT until the image is removed (then programmed to 0)
+    char name[IMC_NAME_MAX];
+} imc_hdr_t;
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief The end of the firmware in Flash (from the linker) */
+extern char __flash_binary_end;
+
+static bool _initialized;
+static bool _available;
+
+static imc_slot_info_t _index[IMC_SLOTS];
+static uint32_t _next_seq;
+static int _sel_slot;
+
+/** @brief Flash sector size buffer to program from (the data can't be in Flash) */
+static uint8_t _buf[FLASH_SECTOR_SIZE];
+
+static volatile bool _c0_park_req;
+static volatile bool _c0_parked;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+static inline uint32_t _hdr_offs(uint8_t slot) {
+    return (IMC_REGION_START + (slot * FLASH_SECTOR_SIZE));
+}
+
+static inline uint32_t _data_offs(uint8_t slot) {
+    return (IMC_REGION_START + IMC_INDEX_SIZE + (slot * IMC_SLOT_SIZE));
+}
+
+static inline const uint8_t* _xip(uint32_t offs) {
+    return ((const uint8_t*)(XIP_BASE + offs));
+}
+
+/**
+ * @brief Check that the data in a slot matches its CRC.
+ */
+static bool _slot_crc_ok(uint8_t slot) {
+    const imc_slot_info_t* si = &_index[slot];
+    return (crc32_update(0, _xip(_data_offs(slot)), si->size) == si->crc);
+}
+
+/**
+ * @brief Message handler (run on Core-0) that parks Core-0 until released.
+ *
+ * This must run from RAM with interrupts disabled, as the Flash can't be read while parked.
+ */
+static void __not_in_flash_func(_core0_park_hdlr)(cmt_msg_t* msg) {
+    if (!_c0_park_req) {
+        return; // The requestor gave up waiting
+    }
+    uint32_t flags = save_and_disable_interrupts();
+    _c0_parked = true;
+    while (_c0_park_req) {
+        tight_loop_contents();
+    }
+    _c0_parked = false;
+    restore_interrupts_from_disabled(flags);
+}
+
+/**
+ * @brief Park Core-0 (in RAM) so the Flash can be changed.
+ *
+ * @return true Core-0 is parked
+ * @return false Core-0 didn't park in time
+ */
+static bool _core0_park() {
+    _c0_park_req = true;
+    cmt_msg_t msg;
+    cmt_exec_init(&msg, _core0_park_hdlr);
+    postHWRTMsg(&msg);
+    uint32_t start = time_us_32();
+    while (!_c0_parked) {
+        if ((time_us_32() - start) > _PARK_TIMEOUT_US) {
+            _c0_park_req = false;
+            return (false);
+        }
+    }
+    return (true);
+}
+
+static void _core0_release() {
+    _c0_park_req = false;
+    while (_c0_parked) {
+        tight_loop_contents();
+    }
+}
+
+/**
+ * @brief Erase (data == NULL) or program a range of the Flash.
+ *
+ * @return true The operation was done
+ * @return false Core-0 couldn't be parked
+ */
+static bool _flash_op(uint32_t offs, const uint8_t* data, uint32_t len) {
+    if (!_core0_park()) {
+        return (false);
+    }
+    uint32_t flags = save_and_disable_interrupts();
+    if (data) {
+        flash_range_program(offs, data, len);
+    }
+    else {
+        flash_range_erase(offs, len);
+    }
+    restore_interrupts_from_disabled(flags);
+    _core0_release();
+    return (true);
+}
+
+/**
+ * @brief Choose the slot to save a new image to.
+ *
+ * The empty slot that has been erased the least, or if none are empty, the oldest.
+ */
+static uint8_t _slot_choose() {
+    int slot = -1;
+    for (int i = 0; i < IMC_SLOTS; i++) {
+        if (!_index[i].used && (slot < 0 || _index[i].erases < _index[slot].erases)) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        slot = 0;
+        for (int i = 1; i < IMC_SLOTS; i++) {
+            if (_index[i].seq < _index[slot].seq) {
+                slot = i;
+            }
+        }
+    }
+    return ((uint8_t)slot);
+}
+
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+bool imc_available() {
+    return (_available);
+}
+
+int imc_find(const char* name) {
+    for (int i = 0; i < IMC_SLOTS; i++) {
+        if (_index[i].used && strncmp(_index[i].name, name, IMC_NAME_MAX - 1) == 0) {
+            return (i);
+        }
+    }
+    return (-1);
+}
+
+imc_status_t imc_load(uint8_t slot) {
+    if (!_available) {
+        return (IMC_NOT_AVAILABLE);
+    }
+    if (slot >= IMC_SLOTS || !_index[slot].used) {
+        return (IMC_SLOT_INVALID);
+    }
+    if (!_slot_crc_ok(slot)) {
+        return (IMC_CRC_ERROR);
+    }
+    uint32_t size = _index[slot].size;
+    if (img_open(size) != IMG_OK || img_write_at(0, _xip(_data_offs(slot)), size) != IMG_OK) {
+        return (IMC_IMG_ERROR);
+    }
+    return (IMC_OK);
+}
+
+imc_status_t imc_remove(uint8_t slot) {
+    if (!_available) {
+        return (IMC_NOT_AVAILABLE);
+    }
+    if (slot >= IMC_SLOTS || !_index[slot].used) {
+        return (IMC_SLOT_INVALID);
+    }
+    // Program the 'removed' word of the header to 0 (programming the rest with 0xFF leaves it unchanged)
+    memset(_buf, 0xFF, FLASH_PAGE_SIZE);
+    memset(&_buf[offsetof(imc_hdr_t, removed)], 0, sizeof(uint32_t));
+    if (!_flash_op(_hdr_offs(slot), _buf, FLASH_PAGE_SIZE)) {
+        return (IMC_FLASH_ERROR);
+    }
+    _index[slot].used = false;
+    if (_sel_slot == slot) {
+        _sel_slot = -1;
+    }
+    return (IMC_OK);
+}
+
+imc_status_t imc_save(const char* name, uint8_t* slotp) {
+    if (!_available) {
+        return (IMC_NOT_AVAILABLE);
+    }
+    if (!img_is_open()) {
+        return (IMC_NO_IMAGE);
+    }
+    uint32_t size = img_size();
+    uint8_t slot = _slot_choose();
+    imc_slot_info_t* si = &_index[slot];
+    if (_sel_slot == slot) {
+        _sel_slot = -1;
+    }
+    // Erase the index sector first, so the slot is empty if the save doesn't complete.
+    si->used = false;
+    si->erases++;
+    if (!_flash_op(_hdr_offs(slot), NULL, FLASH_SECTOR_SIZE)) {
+        return (IMC_FLASH_ERROR);
+    }
+    uint32_t doffs = _data_offs(slot);
+    for (uint32_t offs = 0; offs < size; offs += FLASH_BLOCK_SIZE) {
+        if (!_flash_op(doffs + offs, NULL, FLASH_BLOCK_SIZE)) {
+            return (IMC_FLASH_ERROR);
+        }
+    }
+    uint32_t crc = 0;
+    for (uint32_t addr = 0; addr < size; addr += sizeof(_buf)) {
+        uint32_t n = size - addr;
+        n = (n < sizeof(_buf) ? n : sizeof(_buf));
+        if (img_read_at(addr, _buf, n) != IMG_OK) {
+            return (IMC_IMG_ERROR);
+        }
+        crc = crc32_update(crc, _buf, n);
+        // Program whole Flash pages
+        uint32_t plen = (n + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+        memset(&_buf[n], 0xFF, plen - n);
+        if (!_flash_op(doffs + addr, _buf, plen)) {
+            return (IMC_FLASH_ERROR);
+        }
+    }
+    si->size = size;
+    si->crc = crc;
+    if (!_slot_crc_ok(slot)) {
+        return (IMC_FLASH_ERROR);
+    }
+    // Write the header to make the slot valid
+    imc_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = _HDR_MAGIC;
+    hdr.seq = _next_seq;
+    hdr.erases = si->erases;
+    hdr.size = size;
+    hdr.crc = crc;
+    hdr.removed = _HDR_PRESENT;
+    strncpy(hdr.name, name, IMC_NAME_MAX - 1);
+    memset(_buf, 0xFF, FLASH_PAGE_SIZE);
+    memcpy(_buf, &hdr, sizeof(hdr));
+    if (!_flash_op(_hdr_offs(slot), _buf, FLASH_PAGE_SIZE)) {
+        return (IMC_FLASH_ERROR);
+    }
+    si->used = true;
+    si->seq = _next_seq++;
+    strcpy(si->name, hdr.name);
+    // Remove the older copy of the image (if there is one)
+    for (int i = 0; i < IMC_SLOTS; i++) {
+        if (i != slot && _index[i].used && strcmp(_index[i].name, si->name) == 0) {
+            imc_remove(i);
+        }
+    }
+    if (slotp) {
+        *slotp = slot;
+    }
+    return (IMC_OK);
+}
+
+const uint8_t* imc_sector_ptr(uint8_t sect, uint32_t sectsize) {
+    if (_sel_slot < 0) {
+        return (NULL);
+    }
+    uint32_t offs = sect * sectsize;
+    if (offs >= _index[_sel_slot].size || sectsize > (_index[_sel_slot].size - offs)) {
+        return (NULL);
+    }
+    return (_xip(_data_offs(_sel_slot) + offs));
+}
+
+imc_status_t imc_select(uint8_t slot) {
+    _sel_slot = -1;
+    if (!_available) {
+        return (IMC_NOT_AVAILABLE);
+    }
+    if (slot >= IMC_SLOTS || !_index[slot].used) {
+        return (IMC_SLOT_INVALID);
+    }
+    if (!_slot_crc_ok(slot)) {
+        return (IMC_CRC_ERROR);
+    }
+    _sel_slot = slot;
+    return (IMC_OK);
+}
+
+const imc_slot_info_t* imc_slot_info(uint8_t slot) {
+    if (slot >= IMC_SLOTS) {
+        return (NULL);
+    }
+    return (&_index[slot]);
+}
+
+
+// ====================================================================
+// Initialization/Start-Up Methods
+// ====================================================================
+
+void imc_minit() {
+    if (_initialized) {
+        board_panic("!!! imc_minit: Called more than once !!!");
+    }
+    _initialized = true;
+    _sel_slot = -1;
+    _next_seq = 1;
+    _available = (IMC_SLOTS > 0 && ((uint32_t)&__flash_binary_end - XIP_BASE) <= IMC_REGION_START);
+    if (!_available) {
+        return;
+    }
+    // Read the index
+    for (int i = 0; i < IMC_SLOTS; i++) {
+        imc_slot_info_t* si = &_index[i];
+        imc_hdr_t hdr;
+        memcpy(&hdr, _xip(_hdr_offs(i)), sizeof(hdr));
+        memset(si, 0, sizeof(imc_slot_info_t));
+        if (hdr.magic != _HDR_MAGIC) {
+            continue;   // Never used (or the save didn't complete)
+        }
+        si->erases = hdr.erases;
+        if (hdr.removed != _HDR_PRESENT || hdr.size > IMC_SLOT_SIZE) {
+            continue;
+        }
+        si->used = true;
+        si->seq = hdr.seq;
+        si->size = hdr.size;
+        si->crc = hdr.crc;
+        memcpy(si->name, hdr.name, IMC_NAME_MAX - 1);
+        si->name[IMC_NAME_MAX - 1] = '\0';
+        if (si->seq >= _next_seq) {
+            _next_seq = si->seq + 1;
+        }
+    }
+}
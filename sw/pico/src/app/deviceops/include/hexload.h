@@ -0,0 +1,30 @@
+/**
+ * Intel HEX format decoder (for the `loader`).
+ *
+ * Record types 00 (Data), 01 (EOF), 02 (Extended Segment Address), 03 (Start Segment
+ * Address), 04 (Extended Linear Address), and 05 (Start Linear Address) are supported.
+ * The record checksums are validated, and the data of each record is written to the
+ * sink once it is validated.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef HEXLOAD_H_
+#define HEXLOAD_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "loader.h"
+
+/**
+ * @brief The Intel HEX decoder.
+ * @ingroup device
+ */
+extern const ld_decoder_t ld_hex_decoder;
+
+#ifdef __cplusplus
+}
+#endif
+#endif // HEXLOAD_H_
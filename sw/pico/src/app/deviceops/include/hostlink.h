@@ -0,0 +1,164 @@
+/**
+ * Host Link - Binary framed transfer protocol over the USB CDC link.
+ *
+ * While the host link runs, the shell is suspended and the USB CDC input and output are
+ * binary frames (all values little-endian):
+ *  Sync (2 bytes): HL_SYNC0, HL_SYNC1
+ *  Type (1 byte): `hl_ftype_t`
+ *  Seq (1 byte): Sequence number (DATA frames), or the command sequence (echoed in the RSP)
+ *  Length (2 bytes): Payload length (0 to HL_PAYLOAD_MAX)
+ *  Payload (Length bytes)
+ *  CRC (4 bytes): CRC-32 of the Type, Seq, Length, and Payload
+ *
+ * A frame with a bad CRC (or anything that isn't a frame, like the echo of the shell
+ * command that started the link) is discarded, and the receiver hunts for the next sync.
+ *
+ * The host sends a command frame (HL_CMD_xxx) and the device answers with an HL_RSP frame
+ * with the command, the status (`hl_status_t`), and the command results. Commands that
+ * transfer data (UPLOAD, DOWNLOAD, STREAM, DUMP) are answered with an HL_RSP when they are accepted,
+ * then the data is transferred in DATA frames, and then a second HL_RSP ends the command.
+ * If the host doesn't get a response it can send the command again (with the same Seq).
+ * During a transfer that gets the first response again, and any other command ends the
+ * transfer. A stray DATA, ACK, or NAK after a transfer gets the last response again.
+ *
+ * DATA frames use a sliding window (go-back-N). The sender can have up to HL_WINDOW frames
+ * that haven't been acknowledged. The receiver sends a (cumulative) ACK with the sequence
+ * number it expects next every half window (and at the end), and a NAK with the sequence
+ * number it expects when a frame is lost or bad. The sender resends from that frame. Each
+ * DATA frame other than the last of a transfer has HL_PAYLOAD_MAX bytes.
+ *
+ * STREAM programs the device directly from the DATA frames (the image isn't used). The
+ * device gives the host credit for the frames it has buffer space for with an HL_CREDIT
+ * (the frames before Seq were received, and the host can send Count frames from Seq). The
+ * credit is given as the sectors are programmed, so the host sends at the programming rate.
+ * A gap is NAKed as above. The host resends the frames that haven't been acknowledged (that
+ * it has credit for) if it doesn't get a CREDIT in time.
+ *
+ * The `sdhost.py` host tool uses the link.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef HOSTLINK_H_
+#define HOSTLINK_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The protocol version (reported by HL_CMD_STATUS).
+ * @ingroup device
+ */
+#define HL_VERSION 2
+
+/**
+ * @brief The frame sync bytes.
+ * @ingroup device
+ */
+#define HL_SYNC0 0xA5
+#define HL_SYNC1 0x5A
+
+/**
+ * @brief The largest frame payload.
+ * @ingroup device
+ */
+#define HL_PAYLOAD_MAX 1024
+
+/**
+ * @brief The number of DATA frames that can be sent without being acknowledged.
+ * @ingroup device
+ */
+#define HL_WINDOW 8
+
+/**
+ * @brief The most DATA frames a HL_CREDIT allows (the frames past the acknowledged Seq).
+ * @ingroup device
+ */
+#define HL_CREDIT_MAX 64
+
+/**
+ * @brief The host link exits if nothing is received from the host for this long.
+ * @ingroup device
+ */
+#define HL_IDLE_TIMEOUT_MS (30 * 1000)
+
+/**
+ * @brief Frame types.
+ * @ingroup device
+ */
+typedef enum hl_ftype_ {
+    // Host to device (commands)
+    HL_CMD_STATUS = 0x01,   // Result: `hl_status_rsp_t`
+    HL_CMD_UPLOAD,          // u32 imgsize, u32 addr, u32 len. Open the image (erased) if imgsize isn't 0,
+                            //  then receive len bytes into it at addr. Result: u32 crc, u32 len
+    HL_CMD_DOWNLOAD,        // u32 addr, u32 len. Send the image data. Result: u32 crc, u32 len
+    HL_CMD_PROGRAM,         // Sync the device to the image. Result: u32 failaddr, `pd_sync_stats_t` fields
+    HL_CMD_VERIFY,          // Compare the device to the image. Result: u32 failaddr
+    HL_CMD_EXIT,            // Leave the host link (return to the shell)
+    HL_CMD_STREAM,          // u32 len. Erase (as needed) and program the device from address 0 with the
+                            //  len bytes that follow, a sector at a time. The image is closed.
+                            //  Result: u32 crc, u32 len, u32 failaddr, u8 pd_op_status, u8 erased, u32 elapsed_ms
+    HL_CMD_DUMP,            // u32 addr, u32 len. Send the device data.
+                            //  Result: u32 crc, u32 len
+    // Either direction
+    HL_DATA = 0x40,         // Transfer data
+    HL_ACK,                 // No payload. The DATA frames before Seq were received
+    HL_NAK,                 // No payload. Resend the DATA frames from Seq
+    HL_CREDIT,              // u16 count. The DATA frames before Seq were received, send up to Seq + count
+    // Device to host
+    HL_RSP = 0x80,          // u8 cmd, u8 status, command results
+    HL_PROGRESS,            // u32 value. Sent during long operations (so the host doesn't time out)
+} hl_ftype_t;
+
+/**
+ * @brief Command status (in the HL_RSP).
+ * @ingroup device
+ */
+typedef enum hl_status_ {
+    HL_OK = 0,
+    HL_BAD_CMD,             // Unknown command
+    HL_BAD_ARG,             // The command arguments are invalid (length, or out of range)
+    HL_NO_IMAGE,            // No image is open
+    HL_IMG_ERROR,           // The image couldn't be opened/read/written
+    HL_NO_DEVICE,           // The device couldn't be selected or identified
+    HL_PD_ERROR,            // A device operation failed
+    HL_VERIFY_FAILED,       // The device doesn't match the image
+    HL_XFER_TIMEOUT,        // A data transfer stalled
+    HL_ABORTED,             // A data transfer was ended by a command from the host
+} hl_status_t;
+
+/**
+ * @brief The HL_CMD_STATUS results.
+ * @ingroup device
+ */
+typedef struct hl_status_rsp_ {
+    uint8_t version;        // HL_VERSION
+    uint8_t window;         // HL_WINDOW
+    uint16_t payload_max;   // HL_PAYLOAD_MAX
+    uint32_t imgsize;       // The image size (0 if no image is open)
+    uint8_t mfgid;          // The device Manufacturer ID (0 if no device)
+    uint8_t devid;          // The device ID
+    uint8_t sectcnt;        // The number of sectors
+    uint8_t reserved;
+    uint32_t devsize;       // The device size
+} hl_status_rsp_t;
+
+/**
+ * @brief Run the host link until the host ends it (or it is idle for HL_IDLE_TIMEOUT_MS).
+ * @ingroup device
+ *
+ * This blocks. The terminal input must be suspended (see `term_input_suspend`) while it runs,
+ * as the frames are read directly from the USB CDC link.
+ *
+ * @return true The host ended the link. False if it timed out.
+ */
+extern bool hl_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // HOSTLINK_H_
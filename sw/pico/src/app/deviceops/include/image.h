@@ -0,0 +1,187 @@
+/**
+ * Programmable Device Image buffer.
+ *
+ * Holds the image of a device (up to 512KB) for the loaders (SD file, host, device
+ * read) and the consumers (program, verify, save). The image is kept in 64KB pages.
+ * A few pages are kept resident (unpacked) in RAM. Pages that aren't in use (LRU) are
+ * packed (`lzpack`) into a RAM pool, so a typical image is held entirely in RAM. Only
+ * when the pool is full are pages saved to a temp file on the SD Card.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef IMAGE_H_
+#define IMAGE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "pico/types.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The largest image supported.
+ * @ingroup device
+ */
+#define IMG_SIZE_MAX (512 * 1024)
+
+/**
+ * @brief The image page size. Also the largest sector `img_sector_ptr` can provide.
+ * @ingroup device
+ */
+#define IMG_PAGE_SIZE (64 * 1024)
+
+/**
+ * @brief The number of (unpacked) pages kept in RAM, and the size of the packed page pool.
+ * @ingroup device
+ */
+#if PICO_RP2350
+#define IMG_RAM_PAGES 2                 // 128KB
+#define IMG_POOL_SIZE (160 * 1024)
+#else
+#define IMG_RAM_PAGES 1                 // 64KB (the RP2040 only has 264KB of RAM)
+#define IMG_POOL_SIZE (32 * 1024)
+#endif
+
+/**
+ * @brief The temp file used to hold the pages that aren't in RAM.
+ * @ingroup device
+ */
+#define IMG_SPILL_FILE "0:/sdpgmr_img.tmp"
+
+/**
+ * @brief Status of Image operations.
+ * @ingroup device
+ */
+typedef enum img_status_ {
+    IMG_OK = 0,
+    IMG_NOT_OPEN,
+    IMG_ADDR_INVALID,   // Address/length outside of the image
+    IMG_TOO_BIG,        // Size larger than IMG_SIZE_MAX
+    IMG_SD_ERROR,       // The SD temp file couldn't be created/read/written
+} img_status_t;
+
+/**
+ * @brief Where the pages of the image are held.
+ * @ingroup device
+ */
+typedef struct img_stats_ {
+    uint8_t ram_pages;      // Pages unpacked in RAM
+    uint8_t blank_pages;    // Pages never written (all 0xFF, not stored)
+    uint8_t packed_pages;   // Pages packed in the RAM pool
+    uint8_t sd_pages;       // Pages saved in the SD temp file
+    uint32_t pool_used;     // Bytes of the pool in use
+} img_stats_t;
+
+/**
+ * @brief Close the image. The contents are discarded.
+ * @ingroup device
+ */
+extern void img_close();
+
+/**
+ * @brief Borrow the image page RAM as a work area. The image is closed (the contents are discarded).
+ * @ingroup device
+ *
+ * For operations that don't use the image (like streaming from the host to the device).
+ * The area can be used until an image is opened.
+ *
+ * @param size Set to the size of the area (IMG_RAM_PAGES * IMG_PAGE_SIZE)
+ * @return uint8_t* The area
+ */
+extern uint8_t* img_borrow_ram(uint32_t* size);
+
+/**
+ * @brief Indicate if an image is open.
+ * @ingroup device
+ *
+ * @return true An image is open
+ */
+extern bool img_is_open();
+
+/**
+ * @brief The status of the last Image method.
+ * @ingroup device
+ *
+ * Can be used to get the status for methods that are not able to return a status.
+ *
+ * @return img_status_t Status of the last operation
+ */
+extern img_status_t img_method_status();
+
+/**
+ * @brief Open (create) an image. The contents are initialized to 0xFF (erased).
+ * @ingroup device
+ *
+ * If an image is open, it is closed first. The SD temp file is only created
+ * (preallocated) if a page doesn't fit in the RAM pool.
+ *
+ * @param size The size of the image in bytes
+ * @return img_status_t Status
+ */
+extern img_status_t img_open(uint32_t size);
+
+/**
+ * @brief Read from the image into a buffer.
+ * @ingroup device
+ *
+ * @param addr The image address to read from
+ * @param buf Buffer to receive the data
+ * @param len Number of bytes to read
+ * @return img_status_t Status
+ */
+extern img_status_t img_read_at(uint32_t addr, uint8_t* buf, uint32_t len);
+
+/**
+ * @brief Get a pointer to a sector of the image.
+ * @ingroup device
+ *
+ * The pointer is valid until the next image method is called. The sector size must
+ * divide IMG_PAGE_SIZE. This can be used as a `pd_sect_data_fn`.
+ *
+ * @param sect The sector number
+ * @param sectsize The size of the sectors
+ * @return const uint8_t* Pointer to the sector data or NULL if not available (see `img_method_status`)
+ */
+extern const uint8_t* img_sector_ptr(uint8_t sect, uint32_t sectsize);
+
+/**
+ * @brief The size of the open image.
+ * @ingroup device
+ *
+ * @return uint32_t Size in bytes (0 if no image is open)
+ */
+extern uint32_t img_size();
+
+/**
+ * @brief Get where the pages of the image are held.
+ * @ingroup device
+ *
+ * @param stats Filled in with the page counts
+ */
+extern void img_stats(img_stats_t* stats);
+
+/**
+ * @brief Write data into the image.
+ * @ingroup device
+ *
+ * @param addr The image address to write to
+ * @param data The data to write
+ * @param len Number of bytes to write
+ * @return img_status_t Status
+ */
+extern img_status_t img_write_at(uint32_t addr, const uint8_t* data, uint32_t len);
+
+/**
+ * @brief Initialize the module. Must be called once/only-once before module use.
+ * @ingroup device
+ */
+extern void img_minit();
+
+#ifdef __cplusplus
+}
+#endif
+#endif // IMAGE_H_
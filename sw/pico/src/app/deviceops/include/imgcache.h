@@ -0,0 +1,183 @@
+/**
+ * Programmable Device Image cache in the Pico's (QSPI) program Flash.
+ *
+ * Images are saved in a region at the top of the program Flash (above the firmware)
+ * so they persist and can be used again without reading them from the SD Card. The
+ * region starts with an index (one Flash sector per slot with the image name, size,
+ * CRC, and the times the slot has been erased) followed by the image slots. A new
+ * image is saved to the empty slot that has been erased the least (or the oldest slot
+ * if none are empty), so the erases are spread across the slots.
+ *
+ * A cached image can be used (through the XIP mapping) as the data for programming a
+ * device without loading it into RAM.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef IMGCACHE_H_
+#define IMGCACHE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "image.h"
+
+#include "pico/types.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The program Flash kept for the firmware (not used for the cache).
+ * @ingroup device
+ */
+#define IMC_FW_RESERVE (1024 * 1024)
+
+/**
+ * @brief The size of an image slot.
+ * @ingroup device
+ */
+#define IMC_SLOT_SIZE IMG_SIZE_MAX
+
+/**
+ * @brief The size of the index (at the start of the region). It holds a Flash sector for each slot.
+ * @ingroup device
+ */
+#define IMC_INDEX_SIZE (64 * 1024)
+
+/**
+ * @brief The number of image slots (what fits, up to the 16 the index can hold).
+ * @ingroup device
+ */
+#define IMC_SLOTS_FIT ((PICO_FLASH_SIZE_BYTES - IMC_FW_RESERVE - IMC_INDEX_SIZE) / IMC_SLOT_SIZE)
+#define IMC_SLOTS (IMC_SLOTS_FIT > 16 ? 16 : IMC_SLOTS_FIT)
+
+/**
+ * @brief The Flash offset of the cache region (the index).
+ * @ingroup device
+ */
+#define IMC_REGION_START (PICO_FLASH_SIZE_BYTES - (IMC_INDEX_SIZE + (IMC_SLOTS * IMC_SLOT_SIZE)))
+
+/**
+ * @brief The longest image name (including the terminator).
+ * @ingroup device
+ */
+#define IMC_NAME_MAX 40
+
+/**
+ * @brief Status of Image Cache operations.
+ * @ingroup device
+ */
+typedef enum imc_status_ {
+    IMC_OK = 0,
+    IMC_NOT_AVAILABLE,  // The cache region overlaps the firmware
+    IMC_SLOT_INVALID,   // The slot number is invalid or the slot is empty
+    IMC_NO_IMAGE,       // No image is open (to save)
+    IMC_CRC_ERROR,      // The data in the slot doesn't match the CRC saved with it
+    IMC_FLASH_ERROR,    // The Flash couldn't be erased/programmed
+    IMC_IMG_ERROR,      // The image couldn't be read or loaded
+} imc_status_t;
+
+/**
+ * @brief Information about an image slot.
+ * @ingroup device
+ */
+typedef struct imc_slot_info_ {
+    bool used;                  // The slot holds an image
+    uint32_t seq;               // The save sequence (higher is newer)
+    uint32_t erases;            // The times the slot has been erased
+    uint32_t size;              // The image size
+    uint32_t crc;               // The CRC-32 of the image
+    char name[IMC_NAME_MAX];
+} imc_slot_info_t;
+
+/**
+ * @brief Indicate if the cache can be used (the region doesn't overlap the firmware).
+ * @ingroup device
+ *
+ * @return true The cache can be used
+ */
+extern bool imc_available();
+
+/**
+ * @brief Find the slot holding an image.
+ * @ingroup device
+ *
+ * @param name The image name
+ * @return int The slot number, or -1 if the image isn't in the cache
+ */
+extern int imc_find(const char* name);
+
+/**
+ * @brief Load a cached image into the image buffer (`image`). The CRC is checked first.
+ * @ingroup device
+ *
+ * @param slot The slot number
+ * @return imc_status_t Status
+ */
+extern imc_status_t imc_load(uint8_t slot);
+
+/**
+ * @brief Remove an image from the cache.
+ * @ingroup device
+ *
+ * @param slot The slot number
+ * @return imc_status_t Status
+ */
+extern imc_status_t imc_remove(uint8_t slot);
+
+/**
+ * @brief Save the image buffer (`image`) in the cache.
+ * @ingroup device
+ *
+ * Another image with the same name is removed once the new one is saved.
+ *
+ * @param name The name to save the image as
+ * @param slot Set to the slot used (can be NULL)
+ * @return imc_status_t Status
+ */
+extern imc_status_t imc_save(const char* name, uint8_t* slot);
+
+/**
+ * @brief Get a pointer to a sector of the selected slot's image (in the XIP mapped Flash).
+ * @ingroup device
+ *
+ * This can be used as a `pd_sect_data_fn`. The pointer remains valid until the cache is changed.
+ *
+ * @param sect The sector number
+ * @param sectsize The size of the sectors
+ * @return const uint8_t* Pointer to the sector data or NULL if not available
+ */
+extern const uint8_t* imc_sector_ptr(uint8_t sect, uint32_t sectsize);
+
+/**
+ * @brief Select the slot used by `imc_sector_ptr`. The CRC is checked.
+ * @ingroup device
+ *
+ * @param slot The slot number
+ * @return imc_status_t Status
+ */
+extern imc_status_t imc_select(uint8_t slot);
+
+/**
+ * @brief Get information about a slot.
+ * @ingroup device
+ *
+ * @param slot The slot number
+ * @return const imc_slot_info_t* The slot info, or NULL if the slot number isn't valid
+ */
+extern const imc_slot_info_t* imc_slot_info(uint8_t slot);
+
+/**
+ * @brief Initialize the module. Must be called once/only-once before module use.
+ * @ingroup device
+ *
+ * Reads the index from Flash.
+ */
+extern void imc_minit();
+
+#ifdef __cplusplus
+}
+#endif
+#endif // IMGCACHE_H_
@@ -0,0 +1,68 @@
+/**
+ * Programming job journal.
+ *
+ * A programming job (sync to an image or .sdpi file) keeps a small journal file on the
+ * SD card with the identity of the image (a hash), the device IDs, and a bitmap of the
+ * sectors that have been verified. The journal is written at sector boundaries. If the
+ * job is interrupted (USB unplugged, power lost) the journal is left on the card, and
+ * the next job for the same image and device skips the sectors that were already verified.
+ * The journal is removed when a job completes.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "prog_device.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The journal file.
+ * @ingroup device
+ */
+#define JNL_FILE "0:/sdpgmr_job.jnl"
+
+/**
+ * @brief Start journaling a programming job.
+ * @ingroup device
+ *
+ * If there is a journal for the same image and device, the sectors it has as verified
+ * are returned in `done`. Otherwise a new journal is started.
+ *
+ * @param imgid The identity (hash) of the image
+ * @param size The image size
+ * @param info md_info pointer for the device.
+ * @param done Set to the sectors that have already been verified
+ * @return int The number of sectors already verified, or -1 if the journal can't be
+ *      written (no SD card). The job can still be done (without a journal).
+ */
+extern int jnl_open(uint32_t imgid, uint32_t size, const md_info_t* info, pd_sectmap_t* done);
+
+/**
+ * @brief Record the sectors that have been verified. Can be used as a `pd_sect_done_fn`.
+ * @ingroup device
+ *
+ * @param done The sectors that have been verified
+ */
+extern void jnl_update(const pd_sectmap_t* done);
+
+/**
+ * @brief End journaling a programming job.
+ * @ingroup device
+ *
+ * @param complete The job completed (the journal is removed). If false, the journal is
+ *      kept so the job can be resumed.
+ */
+extern void jnl_close(bool complete);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // JOURNAL_H_
@@ -0,0 +1,166 @@
+/**
+ * Programmable Device Image file loader.
+ *
+ * Loads a file into the Image (`image`). The file is read (using FatFs through the disk
+ * operations Core-0) in large, aligned chunks and each chunk is passed to the decoder for
+ * the file format. The decoders are streaming (a record can be split across chunks) and
+ * write the data they decode to a common sink. The sink applies the address offset
+ * (remap), checks the range, writes to the image, and keeps the CRC and statistics of the
+ * load, so each format gets the same handling.
+ *
+ * Formats: Binary, Intel HEX (`hexload`), and Motorola S-Record (`srecload`). The format
+ * can be detected from the start of the file.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef LOADER_H_
+#define LOADER_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "prog_device.h"
+
+#include "pico/types.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The size of the chunks the file is read in (a multiple of the SD sector size).
+ * @ingroup device
+ */
+#define LD_READ_CHUNK (4 * 1024)
+
+/**
+ * @brief Value of the start address if the file doesn't have one.
+ * @ingroup device
+ */
+#define LD_NO_START 0xFFFFFFFF
+
+/**
+ * @brief Set in the `ld_hexval` value of the characters that are hex digits.
+ * @ingroup device
+ */
+#define LD_HEX_VALID 0x10
+
+/**
+ * @brief File formats.
+ * @ingroup device
+ */
+typedef enum ld_format_ {
+    LD_FMT_AUTO = 0,        // Detect the format from the start of the file
+    LD_FMT_BIN,
+    LD_FMT_HEX,
+    LD_FMT_SREC,
+} ld_format_t;
+
+/**
+ * @brief Status of load operations.
+ * @ingroup device
+ */
+typedef enum ld_status_ {
+    LD_OK = 0,
+    LD_MORE,                // (decoder) The end record hasn't been reached, more data is needed
+    LD_FILE_ERROR,          // The file couldn't be opened/read
+    LD_SYNTAX_ERROR,        // Invalid character or record format
+    LD_CHECKSUM_ERROR,      // A record checksum didn't match
+    LD_RECTYPE_ERROR,       // Unknown record type
+    LD_ADDR_ERROR,          // Data outside of the image (after the offset is applied)
+    LD_NO_END,              // The file ended without an end record
+    LD_IMG_ERROR,           // No image is open or it couldn't be written
+} ld_status_t;
+
+/**
+ * @brief Results of a load.
+ * @ingroup device
+ */
+typedef struct ld_result_ {
+    ld_format_t format;     // The format loaded (detected if AUTO was requested)
+    uint32_t records;       // Data records (chunks for binary) loaded
+    uint32_t bytes;         // Data bytes loaded
+    uint32_t addr_low;      // The lowest image address loaded
+    uint32_t addr_high;     // The highest image address loaded + 1 (0 if nothing was loaded)
+    uint32_t start_addr;    // The start address from the file (LD_NO_START if none)
+    uint32_t line;          // The line being decoded (the line of the error if there is one)
+    uint32_t crc;           // CRC-32 of the data loaded (in the order it was loaded)
+    uint32_t elapsed_ms;    // The time the load took
+    pd_sectmap_t touched;   // The sectors that data was loaded into
+} ld_result_t;
+
+/**
+ * @brief Where the decoders write the data they decode.
+ * @ingroup device
+ */
+typedef struct ld_sink_ {
+    int32_t offset;         // Added to the file addresses to get the image addresses
+    uint32_t sectsize;      // The sector size for the `touched` map
+    ld_result_t* result;
+} ld_sink_t;
+
+/**
+ * @brief A file format decoder.
+ * @ingroup device
+ */
+typedef struct ld_decoder_ {
+    ld_format_t format;
+    const char* name;
+    /** @brief Indicate if the start of a file is this format */
+    bool (*sniff)(const uint8_t* buf, uint32_t len);
+    /** @brief Start decoding a file (to the sink) */
+    void (*begin)(ld_sink_t* sink);
+    /** @brief Decode a piece of the file. LD_MORE if more is needed, LD_OK at the end record, else an error. */
+    ld_status_t (*feed)(const uint8_t* buf, uint32_t len);
+    /** @brief The end of the file was reached (while the decoder still needed more) */
+    ld_status_t (*end)();
+} ld_decoder_t;
+
+/**
+ * @brief Get the decoder for a format.
+ * @ingroup device
+ *
+ * @param format The format (not AUTO)
+ * @return const ld_decoder_t* The decoder, or NULL
+ */
+extern const ld_decoder_t* ld_decoder(ld_format_t format);
+
+/**
+ * @brief Load a file into the Image. The image must be open.
+ * @ingroup device
+ *
+ * The data is loaded over the current content of the image.
+ *
+ * @param path The file path
+ * @param format The file format (or AUTO to detect it)
+ * @param offset Added to the addresses in the file to get the image addresses
+ * @param sectsize The sector size for the `touched` map
+ * @param result The results (required)
+ * @return ld_status_t Status
+ */
+extern ld_status_t ld_load(const char* path, ld_format_t format, int32_t offset, uint32_t sectsize, ld_result_t* result);
+
+/**
+ * @brief Hex digit values (with LD_HEX_VALID set), indexed by character. 0 for characters
+ * that aren't hex digits. Used by the decoders of the text formats.
+ * @ingroup device
+ */
+extern const uint8_t ld_hexval[256];
+
+/**
+ * @brief Write decoded data to the image (used by the decoders).
+ * @ingroup device
+ *
+ * @param sink The sink
+ * @param addr The file address of the data
+ * @param data The data
+ * @param len The length of the data
+ * @return ld_status_t LD_OK or an error
+ */
+extern ld_status_t ld_sink_write(ld_sink_t* sink, uint32_t addr, const uint8_t* data, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // LOADER_H_
@@ -0,0 +1,64 @@
+/**
+ * Simple LZ/Run-length packing for device images.
+ *
+ * ROM images typically have long runs of 0xFF (erased) or 0x00 and repeated tables.
+ * This packs a block using three kinds of items: fill runs (a byte repeated), matches
+ * (a copy of earlier data in the block), and literals. Unpacking is a single pass
+ * with no tables, so it is fast enough to be done each time a block is needed.
+ *
+ * Packed format (each item starts with a tag byte `T`):
+ *  T 0x00-0x7F: Literals. T+1 bytes follow.
+ *  T 0x80-0xBF: Fill. Length is ((T & 0x3F) << 8 | next) + 4. The fill value follows.
+ *  T 0xC0-0xFF: Match. Length is (T & 0x3F) + 4. A 16 bit (LE) back-offset follows.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef LZPACK_H_
+#define LZPACK_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The largest block that can be packed (matches use a 16 bit back-offset).
+ * @ingroup device
+ */
+#define LZP_BLOCK_MAX (64 * 1024)
+
+/**
+ * @brief Pack a block of data.
+ * @ingroup device
+ *
+ * @param src The data to pack
+ * @param len The length of the data (up to LZP_BLOCK_MAX)
+ * @param dst Buffer for the packed data
+ * @param dstmax The size of the buffer
+ * @return uint32_t The packed length, or 0 if it doesn't fit in `dstmax`
+ */
+extern uint32_t lzp_pack(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t dstmax);
+
+/**
+ * @brief Unpack a block of data.
+ * @ingroup device
+ *
+ * The packed data can be unpacked in place, by putting it at the end of the `dst` buffer,
+ * if the buffer has room for at least (len / 128) + 16 bytes after the unpacked data.
+ *
+ * @param src The packed data
+ * @param srclen The packed length
+ * @param dst Buffer for the unpacked data
+ * @param len The unpacked length
+ * @return true The data unpacked to exactly `len` bytes
+ * @return false The packed data is invalid
+ */
+extern bool lzp_unpack(const uint8_t* src, uint32_t srclen, uint8_t* dst, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // LZPACK_H_
@@ -0,0 +1,169 @@
+/**
+ * Programmable Device Bus engine (PIO + DMA).
+ *
+ * Drives the Programmable Device bus using a PIO state machine. Commands are fed
+ * to the state machine by DMA, and data read from the device is drained from the
+ * state machine by DMA, so a block of the device can be read or written without
+ * the CPU toggling the control signals.
+ *
+ * This is used by `pdops` as an alternative to the bit-banged (GPIO) bus access.
+ * The bus pins are only given to the PIO while an operation is in progress
+ * (between `pdbus_attach` and `pdbus_detach`), and the caller must hold the
+ * Board-Op token for that time.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef PDBUS_H_
+#define PDBUS_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "pico/types.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** @brief Maximum PIO clock (Hz). The strobe widths in the PIO program are in cycles of this clock. */
+#define PDBUS_PIO_CLK_HZ    20000000
+
+/** @brief Max bytes read by a single PIO read command (it can't cross an AddrL page). */
+#define PDBUS_PAGE_SIZE     256
+
+/** @brief Max bytes for `pdbus_read_start` (the read commands must fit in the command buffer). */
+#define PDBUS_READ_START_MAX (8 * 1024)
+
+/** @brief AddrH+Ctrl FRD- bit */
+#define PDBUS_CTRL_FRD      0x80
+/** @brief AddrH+Ctrl FWR- bit */
+#define PDBUS_CTRL_FWR      0x40
+
+/**
+ * @brief Build a PIO read command word.
+ * @ingroup ProgDev
+ *
+ * @param addr The starting address
+ * @param count The number of bytes (1-256). The range must not cross a 256 byte page.
+ * @return uint32_t Command word
+ */
+static inline uint32_t pdbus_cmd_rd(uint32_t addr, uint16_t count) {
+    uint32_t addrH = ((addr & 0x000F0000) >> 16) | PDBUS_CTRL_FWR;  // FRD- Low, FWR- High
+    return ((addrH << 24) | (addr & 0x0000FF00) << 8 | ((count - 1) & 0xFF) << 8 | (~addr & 0xFF));
+}
+
+/**
+ * @brief Build a PIO write command word.
+ * @ingroup ProgDev
+ *
+ * @param addr The address
+ * @param data The data byte
+ * @return uint32_t Command word
+ */
+static inline uint32_t pdbus_cmd_wr(uint32_t addr, uint8_t data) {
+    uint32_t addrH = ((addr & 0x000F0000) >> 16) | PDBUS_CTRL_FRD;  // FRD- High, FWR- Low
+    return ((addrH << 24) | (addr & 0x0000FF00) << 8 | (uint32_t)data << 8 | (~addr & 0xFF));
+}
+
+/**
+ * @brief Give the bus pins to the PIO state machine.
+ * @ingroup ProgDev
+ *
+ * The caller must hold the Board-Op token until `pdbus_detach` is called.
+ */
+extern void pdbus_attach();
+
+/**
+ * @brief Indicate if the bus pins are currently attached to the PIO.
+ * @ingroup ProgDev
+ *
+ * @return true The PIO owns the bus
+ */
+extern bool pdbus_attached();
+
+/**
+ * @brief Wait for outstanding commands to complete and give the bus pins back to SIO (GPIO).
+ * @ingroup ProgDev
+ *
+ * The pins are left in the same idle state that the bit-banged operations use.
+ */
+extern void pdbus_detach();
+
+/**
+ * @brief Execute a list of prepared command words (DMA fed). Blocks until complete.
+ * @ingroup ProgDev
+ *
+ * The list should only contain write commands (`pdbus_cmd_wr`), as data read
+ * by read commands is discarded.
+ *
+ * @param cmds Command words
+ * @param count Number of command words
+ */
+extern void pdbus_exec(const uint32_t* cmds, uint32_t count);
+
+/**
+ * @brief Read a block from the device into a buffer (DMA). Blocks until complete.
+ * @ingroup ProgDev
+ *
+ * @param addr Starting address
+ * @param buf Buffer to receive the data
+ * @param len Number of bytes to read
+ */
+extern void pdbus_read(uint32_t addr, uint8_t* buf, uint32_t len);
+
+/**
+ * @brief Start reading a block from the device into a buffer (DMA), and return.
+ * @ingroup ProgDev
+ *
+ * `pdbus_read_wait` must be called before the buffer is used, and before any other
+ * bus operation.
+ *
+ * @param addr Starting address
+ * @param buf Buffer to receive the data
+ * @param len Number of bytes to read (up to PDBUS_READ_START_MAX)
+ */
+extern void pdbus_read_start(uint32_t addr, uint8_t* buf, uint32_t len);
+
+/**
+ * @brief Wait for a read started with `pdbus_read_start` to complete.
+ * @ingroup ProgDev
+ */
+extern void pdbus_read_wait();
+
+/**
+ * @brief Set the PIO clock so the strobes generated meet the given times.
+ * @ingroup ProgDev
+ *
+ * The PIO clock is the fastest (up to PDBUS_PIO_CLK_HZ) that gives each strobe
+ * at least the time requested. Must not be called while attached.
+ *
+ * @param tacc_ns Device access time
+ * @param twp_ns Device write pulse width
+ * @param tls_ns Latch setup and clock width
+ */
+extern void pdbus_timing_set(uint16_t tacc_ns, uint16_t twp_ns, uint16_t tls_ns);
+
+/**
+ * @brief Write a block of bytes to consecutive device addresses (DMA). Blocks until complete.
+ * @ingroup ProgDev
+ *
+ * This performs raw bus write cycles. It does not perform the Flash command
+ * sequences needed to program a byte.
+ *
+ * @param addr Starting address
+ * @param data Data to write
+ * @param len Number of bytes to write
+ */
+extern void pdbus_write(uint32_t addr, const uint8_t* data, uint32_t len);
+
+/**
+ * @brief Initialize the module. Must be called once/only-once before module use.
+ * @ingroup ProgDev
+ */
+extern void pdbus_minit();
+
+#ifdef __cplusplus
+}
+#endif
+#endif // PDBUS_H_
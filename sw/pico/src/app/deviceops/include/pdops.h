@@ -34,6 +34,50 @@ typedef enum progdev_pwr_mode_ {
     PDPWR_AUTO = 2
 } progdev_pwr_mode_t;
 
+/**
+ * @brief Programmable-Device Bus Backend: GPIO (bit-banged) or PIO (PIO+DMA engine)
+ * @ingroup ProgDev
+ */
+typedef enum pdo_bus_backend_ {
+    PDO_BUS_GPIO = 0,
+    PDO_BUS_PIO = 1
+} pdo_bus_backend_t;
+
+/**
+ * @brief Address latch load statistics.
+ * @ingroup ProgDev
+ *
+ * The GPIO backend keeps a shadow of the value of each address latch and only loads
+ * a latch when its value changes.
+ */
+typedef struct pdo_latch_stats_ {
+    uint32_t loads;     // Latch loads performed
+    uint32_t saved;     // Latch loads skipped (the latch already held the value)
+} pdo_latch_stats_t;
+
+/**
+ * @brief Device bus timing.
+ * @ingroup ProgDev
+ *
+ * The strobe times are applied as CPU cycle delays by the GPIO backend and as the
+ * PIO clock rate by the PIO backend.
+ */
+typedef struct pdo_timing_ {
+    uint16_t tacc_ns;   // Access time (device select to data valid)
+    uint16_t twp_ns;    // Write pulse width
+    uint16_t tls_ns;    // Latch setup and clock width (address and data latches)
+    uint16_t tpwr_us;   // Power-up settle time (before the device is accessed)
+} pdo_timing_t;
+
+/**
+ * @brief A device write cycle (address and data).
+ * @ingroup ProgDev
+ */
+typedef struct pdo_wrcycle_ {
+    uint32_t addr;
+    uint8_t data;
+} pdo_wrcycle_t;
+
 /**
  * @brief Set the device data location address.
  * @ingroup ProgDev
@@ -64,6 +108,52 @@ extern void pdo_addr_set(uint32_t addr);
  */
 extern uint8_t pdo_data_get();
 
+/**
+ * @brief Get the bus backend being used for the device operations.
+ * @ingroup ProgDev
+ *
+ * @return pdo_bus_backend_t The current backend
+ */
+extern pdo_bus_backend_t pdo_bus_backend();
+
+/**
+ * @brief Get the address latch load statistics.
+ * @ingroup ProgDev
+ *
+ * @return const pdo_latch_stats_t* The statistics
+ */
+extern const pdo_latch_stats_t* pdo_latch_stats();
+
+/**
+ * @brief Clear the address latch load statistics.
+ * @ingroup ProgDev
+ */
+extern void pdo_latch_stats_clear();
+
+/**
+ * @brief Set the bus backend to use for the device operations.
+ * @ingroup ProgDev
+ *
+ * The GPIO backend bit-bangs the control signals. The PIO backend uses a PIO
+ * state machine fed by DMA, which is much faster, and allows blocks to be
+ * transferred without CPU involvement.
+ *
+ * @param backend The backend to use
+ */
+extern void pdo_bus_backend_set(pdo_bus_backend_t backend);
+
+/**
+ * @brief Read a block of data from the device into a buffer.
+ * @ingroup ProgDev
+ *
+ * With the PIO backend this is performed by DMA.
+ *
+ * @param addr The starting address
+ * @param buf Buffer to receive the data
+ * @param len The number of bytes to read
+ */
+extern void pdo_data_get_block(uint32_t addr, uint8_t* buf, uint32_t len);
+
 /**
  * @brief Read a byte of data from the device, setting the address first.
  * @ingroup ProgDev
@@ -95,6 +185,128 @@ extern uint8_t pdo_data_get_from(uint32_t addr);
  */
 extern void pdo_data_set(uint8_t data);
 
+/**
+ * @brief Write a block of data to consecutive device addresses.
+ * @ingroup ProgDev
+ *
+ * This performs raw device write cycles (no Flash command sequences). With the PIO
+ * backend this is performed by DMA.
+ *
+ * @param addr The starting address
+ * @param data The data to write
+ * @param len The number of bytes to write
+ */
+extern void pdo_data_set_block(uint32_t addr, const uint8_t* data, uint32_t len);
+
+/**
+ * @brief Begin polling (repeatedly reading) a single address.
+ * @ingroup ProgDev
+ *
+ * This is used to read the status of a Flash operation. The address and the
+ * read control are set once, then each `pdo_poll_read` only selects the device
+ * and captures the data.
+ *
+ * The Board-Op is held until `pdo_poll_end` is called, so no other `pdo_*`
+ * operations can be performed while polling.
+ *
+ * @param addr The address to read
+ * @return true Polling was started
+ * @return false Polling could not be started (the device isn't powered)
+ */
+extern bool pdo_poll_begin(uint32_t addr);
+
+/**
+ * @brief End polling started with `pdo_poll_begin`.
+ * @ingroup ProgDev
+ */
+extern void pdo_poll_end();
+
+/**
+ * @brief Read the address being polled.
+ * @ingroup ProgDev
+ *
+ * @return uint8_t 8-bit byte from the device
+ */
+extern uint8_t pdo_poll_read();
+
+/**
+ * @brief Begin a sequential (streaming) read starting at an address.
+ * @ingroup ProgDev
+ *
+ * The device address is set once, then each call to `pdo_stream_next` reads the
+ * next sequential byte. With the GPIO backend only the LOW address latch is loaded
+ * for each byte (the MID and HIGH latches are loaded when the address rolls over).
+ * With the PIO backend the data is read by DMA in blocks.
+ *
+ * The Board-Op is held until `pdo_stream_end` is called, so no other `pdo_*`
+ * operations can be performed while a stream is in progress.
+ *
+ * @param addr The starting address
+ * @return true The stream was started
+ * @return false The stream could not be started (the device isn't powered)
+ */
+extern bool pdo_stream_begin(uint32_t addr);
+
+/**
+ * @brief End a sequential (streaming) read.
+ * @ingroup ProgDev
+ *
+ * The current address is left as the last address read.
+ */
+extern void pdo_stream_end();
+
+/**
+ * @brief Read the next sequential byte of a stream started with `pdo_stream_begin`.
+ * @ingroup ProgDev
+ *
+ * @return uint8_t 8-bit byte from the device
+ */
+extern uint8_t pdo_stream_next();
+
+/**
+ * @brief Read the next sequential bytes of a stream started with `pdo_stream_begin` into a buffer.
+ * @ingroup ProgDev
+ *
+ * With the PIO backend the data is transferred by DMA directly into the buffer.
+ *
+ * @param buf Buffer to receive the data
+ * @param len The number of bytes to read
+ */
+extern void pdo_stream_read(uint8_t* buf, uint32_t len);
+
+/**
+ * @brief Start reading the next sequential bytes of a stream into a buffer, and return.
+ * @ingroup ProgDev
+ *
+ * With the PIO backend the data is transferred by DMA while the caller does other work
+ * (like sending the previous block to the host). `pdo_stream_read_wait` must be called
+ * before the buffer is used, and before anything else is read from the stream. With the
+ * GPIO backend the read is done before this returns.
+ *
+ * @param buf Buffer to receive the data
+ * @param len The number of bytes to read (up to PDBUS_READ_START_MAX)
+ */
+extern void pdo_stream_read_start(uint8_t* buf, uint32_t len);
+
+/**
+ * @brief Wait for a read started with `pdo_stream_read_start` to complete.
+ * @ingroup ProgDev
+ */
+extern void pdo_stream_read_wait();
+
+/**
+ * @brief Perform a sequence of device write cycles.
+ * @ingroup ProgDev
+ *
+ * This is used for Flash command sequences (unlock, command, data). The power is
+ * checked once for the sequence, and with the PIO backend the cycles are sent to
+ * the bus engine together.
+ *
+ * @param cycles The write cycles
+ * @param count The number of cycles
+ */
+extern void pdo_data_set_seq(const pdo_wrcycle_t* cycles, uint32_t count);
+
 /**
  * @brief Combination of pdo_addr_set and pdo_data_set.
  * @ingroup ProgDev
@@ -143,6 +355,18 @@ extern void pdo_pwr_mode(progdev_pwr_mode_t mode);
  */
 extern progdev_pwr_mode_t pdo_pwr_mode_get();
 
+/**
+ * @brief Hold the Programmable-Device power on (or release it).
+ * @ingroup ProgDev
+ *
+ * The power is held on while an operation runs in the device (a background erase), so
+ * requests to turn it off (in AUTO mode) don't cut the operation short. If the Power Mode
+ * was set to OFF while the power was held, the power is turned off when it is released.
+ *
+ * @param hold True to hold the power on, False to release it
+ */
+extern void pdo_pwr_hold(bool hold);
+
 /**
  * @brief Request that the Programmable-Device be powered ON/OFF.
  * @ingroup ProgDev
@@ -150,7 +374,7 @@ extern progdev_pwr_mode_t pdo_pwr_mode_get();
  * This is a request, because the Power Mode controls what can be done. If the
  * Power Mode is ON or AUTO and the request is ON, the power will be turned ON. If
  * the Power Mode is OFF or AUTO and the request is OFF, the power will be turned
- * OFF.
+ * OFF. A request to turn the power OFF is denied while it is held on (see `pdo_pwr_hold`).
  *
  * @param on true to turn on, false to turn off
  * @return true The request succeeded
@@ -158,6 +382,43 @@ extern progdev_pwr_mode_t pdo_pwr_mode_get();
  */
 extern bool pdo_request_pwr_on(bool on);
 
+/**
+ * @brief The bus timing in use.
+ * @ingroup ProgDev
+ *
+ * This is the 'safe' timing if no device timing is set or the safe timing is forced.
+ *
+ * @return const pdo_timing_t* The timing
+ */
+extern const pdo_timing_t* pdo_timing();
+
+/**
+ * @brief Indicate if the 'safe' bus timing is forced.
+ * @ingroup ProgDev
+ *
+ * @return true The safe timing is used regardless of the device timing
+ */
+extern bool pdo_timing_safe_forced();
+
+/**
+ * @brief Force the use of the conservative 'safe' bus timing.
+ * @ingroup ProgDev
+ *
+ * @param safe True to use the safe timing. False to use the device timing (if set).
+ */
+extern void pdo_timing_safe_force(bool safe);
+
+/**
+ * @brief Set the device bus timing.
+ * @ingroup ProgDev
+ *
+ * The timing is used (unless the safe timing is forced) until it is set again.
+ * The timing object must remain valid while it is set.
+ *
+ * @param timing The device timing, or NULL to use the 'safe' timing (unknown device).
+ */
+extern void pdo_timing_set(const pdo_timing_t* timing);
+
 /**
  * @brief Initialize the module. Must be called once/only-once before module use.
  * @ingroup ProgDev
@@ -14,6 +14,8 @@
 extern "C" {
 #endif
 
+#include "pdops.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -29,6 +31,21 @@ extern "C" {
  */
 #define PD_INVALID_SECT (0xFF)
 
+/**
+ * @brief Maximum number of sectors supported for a device.
+ * @ingroup device
+ */
+#define PD_SECT_MAX (128)
+
+/**
+ * @brief Device flag: Additional sector erase commands can be queued after the first.
+ * @ingroup device
+ *
+ * The device accepts more sector erase commands within the sector erase timeout
+ * (50us) after the first, and then erases all of the queued sectors in one operation.
+ */
+#define PD_FLG_MULTI_SECT_ER (0x01)
+
 /**
  * @brief Status of Programmable Device Operations.
  * @ingroup device
@@ -43,8 +60,20 @@ typedef enum pd_op_status_ {
     PD_NOT_ERASED,
     PD_ADDR_INVALID,
     PD_PROG_FAILED,
+    PD_OP_TIMEOUT,      // Program/Erase operation didn't complete in the device's max time
+    PD_IMG_ERROR,       // The image data couldn't be obtained
 } pd_op_status_t;
 
+/**
+ * @brief Asynchronous operations. Reported in the `op` of the MSG_PD_OP_DONE data.
+ * @ingroup device
+ */
+typedef enum pd_async_op_ {
+    PD_AOP_NONE = 0,
+    PD_AOP_ERASE_DEVICE,
+    PD_AOP_ERASE_SECT,  // The sector number is in the `arg` of the MSG_PD_OP_DONE data
+} pd_async_op_t;
+
 /**
  * @brief Information about a programmable device.
  * @ingroup device
@@ -56,8 +85,72 @@ typedef struct mfg_device_info_s_ {
     uint8_t abm;       // Address Bit Max (ie. 16 for a 128K device)
     const char* mfgs;   // Manufacturer Name (string)
     const char* devs;   // Device Name (string)
+    uint8_t flags;      // Device capability flags (PD_FLG_xxx)
+    uint16_t tprog_us;  // Byte Program time (max) in microseconds
+    uint16_t tsecter_ms; // Sector Erase time (max) in milliseconds
+    uint32_t tchiper_ms; // Chip Erase time (max) in milliseconds
+    pdo_timing_t timing; // Bus timing (access, write pulse, latch, power-up)
 } md_info_t;
 
+/**
+ * @brief Sector bitmap (bit n set for sector n).
+ * @ingroup device
+ */
+typedef struct pd_sectmap_s_ {
+    uint32_t bits[PD_SECT_MAX / 32];
+} pd_sectmap_t;
+
+/**
+ * @brief Function prototype for a sector image data provider.
+ * @ingroup device
+ *
+ * Provides the image data for a sector. The data must remain valid until the
+ * provider is called again.
+ *
+ * @param sect The sector number
+ * @param sectsize The size of the sector (the number of bytes needed)
+ * @return const uint8_t* The image data for the sector, or NULL if it isn't available.
+ */
+typedef const uint8_t* (*pd_sect_data_fn)(uint8_t sect, uint32_t sectsize);
+
+/**
+ * @brief Function prototype for a sector progress recorder.
+ * @ingroup device
+ *
+ * Called by sync operations at sector boundaries with the sectors that are known to
+ * match the image, so the progress can be recorded (see `journal`) and an interrupted
+ * operation resumed.
+ *
+ * @param done The sectors that match the image
+ */
+typedef void (*pd_sect_done_fn)(const pd_sectmap_t* done);
+
+/**
+ * @brief Results of a device sync operation.
+ * @ingroup device
+ */
+typedef struct pd_sync_stats_ {
+    uint8_t clean;          // Sectors that already matched the image (skipped)
+    uint8_t inplace;        // Sectors programmed without erasing (only 1->0 bit changes)
+    uint8_t erased;         // Sectors erased and reprogrammed
+    bool chiperase;         // The device was chip erased (rather than by sectors)
+    uint32_t programmed;    // Bytes programmed
+    uint32_t skipped;       // Bytes that didn't need to be programmed
+    uint32_t elapsed_ms;    // Time the sync took
+} pd_sync_stats_t;
+
+/**
+ * @brief Statistics of a block program operation.
+ * @ingroup device
+ */
+typedef struct pd_prog_stats_ {
+    uint32_t programmed;    // Bytes programmed
+    uint32_t skipped;       // Bytes that didn't need to be programmed (0xFF or already matching)
+    uint32_t mismatches;    // Program operations where the value read at completion didn't match
+    uint32_t retries;       // Program operations retried because of a mismatch
+    uint32_t elapsed_ms;    // Time the operation took
+} pd_prog_stats_t;
+
 /**
  * @brief Function prototype for a progress status handler.
  * @ingroup device
@@ -108,11 +201,105 @@ extern pd_op_status_t pd_erase_device(const md_info_t* info);
  */
 extern pd_op_status_t pd_erase_sect(const md_info_t* info, uint8_t sect);
 
+/**
+ * @brief Indicate if an asynchronous operation is in progress.
+ * @ingroup device
+ *
+ * The device must not be accessed while an asynchronous operation is in progress. The
+ * device operations (and `pd_info`) return PD_NOT_READY, and the device power is held on
+ * (see `pdo_pwr_hold`), until it completes.
+ *
+ * @return true An asynchronous operation has been started and MSG_PD_OP_DONE hasn't been posted.
+ */
+extern bool pd_async_busy();
+
+/**
+ * @brief Borrow the device sector buffer as a work area.
+ * @ingroup device
+ *
+ * The buffer holds the largest device sector. It is used by `pd_sync`, so the contents
+ * are lost if `pd_sync` is called.
+ *
+ * @param size Set to the size of the buffer
+ * @return uint8_t* The buffer
+ */
+extern uint8_t* pd_borrow_sect_buf(uint32_t* size);
+
+/**
+ * @brief Start erasing the device and return without waiting for the erase to complete.
+ * @ingroup device
+ *
+ * The erase completion is polled from the message loop of the calling core, and when
+ * the erase completes (or times out) a MSG_PD_OP_DONE message is posted to the APP core
+ * with the status and the elapsed time. The device power must be kept on until then.
+ *
+ * @param info md_info pointer for the device.
+ * @return pd_op_status_t PD_OP_OK if the erase was started (MSG_PD_OP_DONE will follow),
+ *      otherwise the reason it couldn't be started (and no message will be posted).
+ */
+extern pd_op_status_t pd_erase_device_async(const md_info_t* info);
+
+/**
+ * @brief Start erasing a sector and return without waiting for the erase to complete.
+ * @ingroup device
+ *
+ * @see pd_erase_device_async
+ *
+ * @param info md_info pointer for the device.
+ * @param sect The sector number (0 - (sectcnt - 1))
+ * @return pd_op_status_t PD_OP_OK if the erase was started (MSG_PD_OP_DONE will follow),
+ *      otherwise the reason it couldn't be started (and no message will be posted).
+ */
+extern pd_op_status_t pd_erase_sect_async(const md_info_t* info, uint8_t sect);
+
+/**
+ * @brief Start erasing a sector, to be finished with `pd_erase_wait`.
+ * @ingroup device
+ *
+ * Unlike `pd_erase_sect_async`, the completion isn't polled from the message loop (and
+ * MSG_PD_OP_DONE isn't posted), so this can be used by an operation that keeps the core
+ * busy. The caller can do other work (that doesn't access the device) while the sector
+ * erases, and then wait for it.
+ *
+ * @param info md_info pointer for the device.
+ * @param sect The sector number (0 - (sectcnt - 1))
+ * @return pd_op_status_t PD_OP_OK if the erase was started (`pd_erase_wait` must be called)
+ */
+extern pd_op_status_t pd_erase_sect_start(const md_info_t* info, uint8_t sect);
+
+/**
+ * @brief Wait for the erase started by `pd_erase_sect_start` to complete.
+ * @ingroup device
+ *
+ * The time is from when the erase was started (see `pd_op_elapsed_us`).
+ *
+ * @return pd_op_status_t The erase status (PD_OP_OK if no erase was started)
+ */
+extern pd_op_status_t pd_erase_wait();
+
+/**
+ * @brief Erase multiple sectors.
+ * @ingroup device
+ *
+ * On devices that can queue sector erase commands (PD_FLG_MULTI_SECT_ER) all of the
+ * sectors are erased in one erase operation. On other devices the sectors are erased
+ * one at a time. If every sector is selected, the device is erased with a chip erase.
+ *
+ * @param info md_info pointer for the device.
+ * @param sectmap The sectors to erase
+ * @return pd_op_status_t Operation status
+ */
+extern pd_op_status_t pd_erase_sectors(const md_info_t* info, const pd_sectmap_t* sectmap);
+
 /**
  * @brief Get the info for the current programmable device.
  * @ingroup device
  *
- * @return const md_info_t*
+ * The device ID is read using the 'safe' bus timing. If the device is identified,
+ * its timing is then used for the bus operations.
+ *
+ * @return const md_info_t* NULL if the device isn't identified, or an asynchronous
+ * operation is in progress (the method status is PD_NOT_READY).
  */
 extern const md_info_t* pd_info();
 
@@ -149,6 +336,128 @@ extern bool pd_is_sect_empty(uint8_t sectno);
  */
 extern pd_op_status_t pd_method_status();
 
+/**
+ * @brief Program a block of data into the device.
+ * @ingroup device
+ *
+ * The block is first scanned to make sure that every location to be programmed is
+ * empty. Runs of bytes with the value 0xFF are skipped (they are already in the erased
+ * state). The bytes programmed and skipped are available from `pd_prog_stats`.
+ * Each byte program is polled for completion with a bounded timeout, and is verified
+ * using the value read when the program completes (no separate read-back pass is
+ * needed). A byte that doesn't verify is retried (see `pd_prog_retries_set`).
+ * Calls a progress status function (with the last address programmed) after each 4K,
+ * and after the final (partial) block.
+ *
+ * @param info md_info pointer for the device.
+ * @param addr The starting address
+ * @param buf The data to program
+ * @param len The number of bytes to program
+ * @param progstatfn Progress status handler function to be called (or NULL).
+ * @param failaddr Set to the address that failed (PD_INVALID_ADDR if none). Can be NULL.
+ * @return pd_op_status_t Operation status (PD_NOT_ERASED, PD_PROG_FAILED, ...)
+ */
+extern pd_op_status_t pd_program_block(const md_info_t* info, uint32_t addr, const uint8_t* buf, uint32_t len, const progstat_handler_fn progstatfn, uint32_t* failaddr);
+
+/**
+ * @brief Make the device content match an image, changing only what is needed.
+ * @ingroup device
+ *
+ * The image is compared against the device sector by sector. A sector that matches
+ * is skipped. A sector that only needs 1->0 bit changes is programmed in place. Other
+ * sectors are erased and reprogrammed. If the estimated time (from the device's
+ * erase and program times) is less using a chip erase, the device is chip erased and
+ * all of it is reprogrammed.
+ *
+ * The image provider is called twice for each sector (once to compare and once to
+ * program). It must not return a pointer to the device module's own sector buffer.
+ * Calls a progress status function (with the last address of the sector) after each
+ * sector is compared and after each sector is programmed.
+ *
+ * To resume an interrupted sync, the sectors already known to match can be given
+ * (`donemap`). They aren't compared, and the device isn't chip erased. The sectors that
+ * match are reported to `donefn` before anything is erased and after each sector is
+ * programmed.
+ *
+ * @param info md_info pointer for the device.
+ * @param sectdatafn Image data provider
+ * @param donemap The sectors already known to match the image (can be NULL).
+ * @param donefn Sector progress recorder (can be NULL).
+ * @param progstatfn Progress status handler function to be called (or NULL).
+ * @param stats Filled in with the results (can be NULL).
+ * @param failaddr Set to the address that failed (PD_INVALID_ADDR if none). Can be NULL.
+ * @return pd_op_status_t Operation status
+ */
+extern pd_op_status_t pd_sync(const md_info_t* info, pd_sect_data_fn sectdatafn, const pd_sectmap_t* donemap, pd_sect_done_fn donefn, const progstat_handler_fn progstatfn, pd_sync_stats_t* stats, uint32_t* failaddr);
+
+/**
+ * @brief The number of times a byte that doesn't verify is programmed again.
+ * @ingroup device
+ *
+ * @return uint8_t Retries
+ */
+extern uint8_t pd_prog_retries();
+
+/**
+ * @brief Set the number of times a byte that doesn't verify is programmed again.
+ * @ingroup device
+ *
+ * A byte is only retried if the value read has no bits that are 0 and should be 1.
+ *
+ * @param retries Retries (0 to not retry)
+ */
+extern void pd_prog_retries_set(uint8_t retries);
+
+/**
+ * @brief The statistics of the last `pd_program_block` or `pd_sync` operation.
+ * @ingroup device
+ *
+ * @return const pd_prog_stats_t* The statistics
+ */
+extern const pd_prog_stats_t* pd_prog_stats();
+
+/**
+ * @brief The time that the last program or erase operation took.
+ * @ingroup device
+ *
+ * This is the time from the start of status polling until the operation completed
+ * (or timed out).
+ *
+ * @return uint32_t Elapsed time in microseconds
+ */
+extern uint32_t pd_op_elapsed_us();
+
+/**
+ * @brief Read a block of the device into a buffer.
+ * @ingroup device
+ *
+ * The range is checked once and the device is read using the fastest bus path
+ * available (a DMA transfer directly into the buffer when the PIO bus is in use).
+ * Calls a progress status function (with the last address read) after each 4K read.
+ *
+ * @param info md_info pointer for the device.
+ * @param addr The starting address
+ * @param buf Buffer to receive the data (must hold `len` bytes)
+ * @param len The number of bytes to read
+ * @param progstatfn Progress status handler function to be called (or NULL).
+ * @return pd_op_status_t Operation status
+ */
+extern pd_op_status_t pd_read_block(const md_info_t* info, uint32_t addr, uint8_t* buf, uint32_t len, const progstat_handler_fn progstatfn);
+
+/**
+ * @brief Read a sector of the device into a buffer.
+ * @ingroup device
+ *
+ * @see pd_read_block
+ *
+ * @param info md_info pointer for the device.
+ * @param sect The sector number (0 - (sectcnt - 1))
+ * @param buf Buffer to receive the data (must hold `pd_sectsize` bytes)
+ * @param progstatfn Progress status handler function to be called (or NULL).
+ * @return pd_op_status_t Operation status
+ */
+extern pd_op_status_t pd_read_sect(const md_info_t* info, uint8_t sect, uint8_t* buf, const progstat_handler_fn progstatfn);
+
 /**
  * @brief Read a value from a location of the device.
  * @ingroup device
@@ -171,6 +480,43 @@ static inline uint8_t pd_sect_for_addr(const md_info_t* info, uint32_t addr) {
     return (sect < info->sectcnt ? sect : PD_INVALID_SECT);
 }
 
+/**
+ * @brief Clear all of the sectors in a sector map.
+ * @ingroup device
+ *
+ * @param sectmap The sector map
+ */
+static inline void pd_sectmap_clr(pd_sectmap_t* sectmap) {
+    for (int i = 0; i < (PD_SECT_MAX / 32); i++) {
+        sectmap->bits[i] = 0;
+    }
+}
+
+/**
+ * @brief Indicate if a sector is set in a sector map.
+ * @ingroup device
+ *
+ * @param sectmap The sector map
+ * @param sect The sector number
+ * @return true The sector is set
+ */
+static inline bool pd_sectmap_isset(const pd_sectmap_t* sectmap, uint8_t sect) {
+    return (sect < PD_SECT_MAX && (sectmap->bits[sect / 32] & (1u << (sect % 32))));
+}
+
+/**
+ * @brief Set a sector in a sector map.
+ * @ingroup device
+ *
+ * @param sectmap The sector map
+ * @param sect The sector number
+ */
+static inline void pd_sectmap_set(pd_sectmap_t* sectmap, uint8_t sect) {
+    if (sect < PD_SECT_MAX) {
+        sectmap->bits[sect / 32] |= (1u << (sect % 32));
+    }
+}
+
 /**
  * @brief Get the size of the sectors for the programmable device from the info.
  * @ingroup device
@@ -0,0 +1,182 @@
+/**
+ * SD-Programmer Image container (.sdpi) support.
+ *
+ * An .sdpi file holds a device image with what is needed to program it without having
+ * to scan the image first. The file has (all values little-endian):
+ *  Header (64 bytes): `sdpi_hdr_t`
+ *  Sector bitmap (16 bytes): bit n (byte n/8, bit n%8) set if sector n isn't blank (all 0xFF)
+ *  Sector table (8 bytes per sector): `sdpi_sect_t` (CRC-32 of the sector data, payload length)
+ *  Payloads: the data of each sector that isn't blank, in sector order. A payload with a
+ *      length less than the sector size is packed (`lzpack`).
+ *
+ * The header CRC covers the header (up to the CRC), the bitmap, and the sector table.
+ * The `sdpi.py` host tool converts between binary images and .sdpi files.
+ *
+ * Programming is done a sector at a time as the file is read. A sector with a CRC that
+ * matches the device (or that is blank in both) is skipped without reading its payload.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef SDPI_H_
+#define SDPI_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "prog_device.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The file magic value ('SDPI').
+ * @ingroup device
+ */
+#define SDPI_MAGIC 0x49504453
+
+/**
+ * @brief The file format version.
+ * @ingroup device
+ */
+#define SDPI_VERSION 1
+
+/**
+ * @brief Header flag: Payloads can be packed.
+ * @ingroup device
+ */
+#define SDPI_FLG_PACKED 0x01
+
+/**
+ * @brief The size of the name in the header (including the terminating NUL).
+ * @ingroup device
+ */
+#define SDPI_NAME_MAX 32
+
+/**
+ * @brief The size of the sector bitmap.
+ * @ingroup device
+ */
+#define SDPI_BITMAP_SIZE (PD_SECT_MAX / 8)
+
+/**
+ * @brief The largest sector size supported.
+ * @ingroup device
+ */
+#define SDPI_SECT_MAX (64 * 1024)
+
+/**
+ * @brief Status of .sdpi operations.
+ * @ingroup device
+ */
+typedef enum sdpi_status_ {
+    SDPI_OK = 0,
+    SDPI_FILE_ERROR,        // The file couldn't be opened/read
+    SDPI_FORMAT_ERROR,      // Not an .sdpi file, unsupported version, or the header CRC doesn't match
+    SDPI_DEVICE_MISMATCH,   // The file is for a different device
+    SDPI_PAYLOAD_ERROR,     // A sector payload didn't unpack, or its CRC doesn't match
+    SDPI_PD_ERROR,          // A device operation failed (see `pd_method_status`)
+    SDPI_VERIFY_FAILED,     // A device sector doesn't match the file
+} sdpi_status_t;
+
+/**
+ * @brief The file header.
+ * @ingroup device
+ */
+typedef struct sdpi_hdr_ {
+    uint32_t magic;         // SDPI_MAGIC
+    uint8_t version;        // SDPI_VERSION
+    uint8_t flags;          // SDPI_FLG_xxx
+    uint8_t mfgid;          // The Manufacturer ID of the device (0 for any)
+    uint8_t devid;          // The Device ID of the device (0 for any)
+    uint32_t size;          // The image size
+    uint32_t sectsize;      // The sector size
+    uint16_t sectcnt;       // The number of sectors
+    uint16_t reserved1;
+    uint32_t crc;           // CRC-32 of the full image
+    char name[SDPI_NAME_MAX];
+    uint32_t reserved2;
+    uint32_t hdr_crc;       // CRC-32 of the header (up to here), the bitmap, and the sector table
+} sdpi_hdr_t;
+
+/**
+ * @brief A sector table entry.
+ * @ingroup device
+ */
+typedef struct sdpi_sect_ {
+    uint32_t crc;           // CRC-32 of the sector data
+    uint32_t plen;          // Payload length (0 if blank, the sector size if not packed)
+} sdpi_sect_t;
+
+/**
+ * @brief Information about an .sdpi file.
+ * @ingroup device
+ */
+typedef struct sdpi_info_ {
+    sdpi_hdr_t hdr;
+    pd_sectmap_t nonblank;  // The sectors that aren't blank
+    uint8_t blank;          // The number of blank sectors
+    uint8_t packed;         // The number of packed sectors
+    uint32_t payload;       // The total length of the payloads
+} sdpi_info_t;
+
+/**
+ * @brief Read the header information of an .sdpi file.
+ * @ingroup device
+ *
+ * @param path The file path
+ * @param info Filled in with the information
+ * @return sdpi_status_t Status
+ */
+extern sdpi_status_t sdpi_info(const char* path, sdpi_info_t* info);
+
+/**
+ * @brief Program the device from an .sdpi file, changing only the sectors that need it.
+ * @ingroup device
+ *
+ * Each sector of the device is hashed and compared to the sector CRC from the file.
+ * A sector that matches is skipped. A sector that is blank in the file is erased if it
+ * isn't empty. Other sectors are read from the file, unpacked and checked, erased (if
+ * they aren't empty), programmed, and then verified by hashing the device sector.
+ * Calls a progress status function (with the last address of the sector) after each
+ * sector.
+ *
+ * To resume an interrupted operation, the sectors already known to match can be given
+ * (`donemap`), and they aren't hashed. The sectors that match are reported to `donefn`
+ * after each sector is erased or programmed.
+ *
+ * If the file has packed sectors, the image is closed, as its RAM is used to read them.
+ *
+ * The device power must be on.
+ *
+ * @param path The file path
+ * @param info md_info pointer for the device.
+ * @param donemap The sectors already known to match the file (can be NULL).
+ * @param donefn Sector progress recorder (can be NULL).
+ * @param progstatfn Progress status handler function to be called (or NULL).
+ * @param stats Filled in with the results (can be NULL). `inplace` is the sectors that were
+ *      programmed without needing to be erased (they were empty).
+ * @param failaddr Set to the address that failed (PD_INVALID_ADDR if none). Can be NULL.
+ * @return sdpi_status_t Status
+ */
+extern sdpi_status_t sdpi_program(const char* path, const md_info_t* info, const pd_sectmap_t* donemap, pd_sect_done_fn donefn, const progstat_handler_fn progstatfn, pd_sync_stats_t* stats, uint32_t* failaddr);
+
+/**
+ * @brief Verify the device against an .sdpi file (using the sector CRCs only).
+ * @ingroup device
+ *
+ * The device power must be on.
+ *
+ * @param path The file path
+ * @param info md_info pointer for the device.
+ * @param progstatfn Progress status handler function to be called (or NULL).
+ * @param badmap Set to the sectors that don't match (can be NULL).
+ * @return sdpi_status_t SDPI_OK if the device matches, SDPI_VERIFY_FAILED if not, or an error
+ */
+extern sdpi_status_t sdpi_verify(const char* path, const md_info_t* info, const progstat_handler_fn progstatfn, pd_sectmap_t* badmap);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // SDPI_H_
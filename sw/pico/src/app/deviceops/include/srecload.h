@@ -0,0 +1,30 @@
+/**
+ * Motorola S-Record format decoder (for the `loader`).
+ *
+ * Handles S19 (16 bit address), S28 (24 bit address), and S37 (32 bit address) files.
+ * Record types S0 (Header), S1/S2/S3 (Data), S5/S6 (Count), and S7/S8/S9 (Start
+ * Address/End) are supported. The record checksums are validated, and the data of each
+ * record is written to the sink once it is validated.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef SRECLOAD_H_
+#define SRECLOAD_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "loader.h"
+
+/**
+ * @brief The S-Record decoder.
+ * @ingroup device
+ */
+extern const ld_decoder_t ld_srec_decoder;
+
+#ifdef __cplusplus
+}
+#endif
+#endif // SRECLOAD_H_
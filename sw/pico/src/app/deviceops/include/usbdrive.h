@@ -0,0 +1,104 @@
+/**
+ * USB Drive - The device as a file on a USB Mass Storage drive.
+ *
+ * While the drive runs, the PC sees a (removable) drive with `DEVICE.BIN` (the device
+ * content) and `INFO.TXT` (the device information and the results of the last write).
+ * The volume (FAT16) is generated as it is read. Nothing is stored on the SD card.
+ *
+ * Data written to `DEVICE.BIN` (in place) is programmed into the device. A file copied to
+ * the drive is also programmed into the device, if it is written starting at the first free
+ * cluster, which is where a PC puts a file copied to a freshly mounted (empty) volume.
+ * The file's data isn't programmed until the PC writes its directory entry (with its
+ * size), and the data past its end isn't programmed. If the PC writes more of the data
+ * first than the sector buffers can hold, the file isn't programmed. Hidden and system
+ * files, and names starting with '.' (like the macOS metadata files), aren't programmed.
+ * Data written elsewhere (other than directories) is ignored, and counted in the results.
+ *
+ * The data written is collected a device sector at a time (the image RAM is used, so the
+ * image is closed) and the sectors are synced to the device (see `pd_sync`), so only the
+ * sectors that change are erased and programmed. When the PC stops writing, the drive is
+ * ejected and inserted again, so the PC reads the new device content.
+ *
+ * The USB callbacks run from the USB background task (on Core-0) and only copy data. The
+ * device is read and programmed by `ud_run` (on the core that calls it). When the callbacks
+ * need data that isn't ready, they tell the USB driver to call them again.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef USBDRIVE_H_
+#define USBDRIVE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "prog_device.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The volume label.
+ * @ingroup device
+ */
+#define UD_VOLUME_LABEL "SDPGMR"
+
+/**
+ * @brief The time without writes before the sectors being collected are programmed.
+ * @ingroup device
+ */
+#define UD_WRITE_IDLE_MS 500
+
+/**
+ * @brief The time without writes (after programming) before the drive is inserted again.
+ * @ingroup device
+ */
+#define UD_REMOUNT_IDLE_MS 2000
+
+/**
+ * @brief Status of the drive.
+ * @ingroup device
+ */
+typedef enum ud_status_ {
+    UD_OK = 0,
+    UD_NO_DEVICE,           // No device (or it isn't recognized)
+    UD_PD_BUSY,             // A background device operation is running
+    UD_PD_ERROR,            // Programming failed (the drive was ejected)
+} ud_status_t;
+
+/**
+ * @brief The results of running the drive.
+ * @ingroup device
+ */
+typedef struct ud_result_ {
+    uint32_t written;       // Device data bytes written by the PC
+    uint32_t ignored;       // Bytes written by the PC that weren't device data
+    uint16_t synced;        // Sectors synced (the following are the sectors that...)
+    uint16_t clean;         //  already matched
+    uint16_t inplace;       //  were programmed without erasing
+    uint16_t erased;        //  were erased and programmed
+    uint32_t programmed;    // Bytes programmed
+    uint16_t remounts;      // The number of times the drive was inserted again
+    pd_op_status_t pdstat;  // The status of the last sync
+    uint32_t failaddr;      // The address that failed (PD_INVALID_ADDR if none)
+    uint32_t elapsed_ms;
+} ud_result_t;
+
+/**
+ * @brief Run the USB drive until the PC ejects it or ESC (or Ctrl-C) is received.
+ * @ingroup device
+ *
+ * The terminal input must be suspended while the drive runs (see `term_input_suspend`),
+ * as ESC is read directly from the USB STDIO driver.
+ *
+ * @param readonly True if the drive is write protected (the device isn't programmed)
+ * @param result Filled in with the results
+ * @return ud_status_t Status
+ */
+extern ud_status_t ud_run(bool readonly, ud_result_t* result);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // USBDRIVE_H_
@@ -0,0 +1,103 @@
+/**
+ * XMODEM-1K and YMODEM file transfers over the USB CDC link.
+ *
+ * For transfers using an ordinary terminal program (no host tool needed). Blocks are
+ * 1K (STX) or 128 bytes (SOH) with a CRC-16. Data can be transferred to and from a file
+ * on the SD card or the image.
+ *
+ * The blocks are read directly from the USB STDIO driver into the file write buffer, and
+ * the file is written in large chunks (on Core-0). The terminal input must be suspended
+ * while a transfer runs (see `term_input_suspend`).
+ *
+ * XMODEM doesn't send the length of the data, so a file received with XMODEM is padded
+ * (with SUB) to a multiple of the block size. YMODEM sends the name and length of each
+ * file, so the files are received with their names and exact lengths.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef XMODEM_H_
+#define XMODEM_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The (large) block size.
+ * @ingroup device
+ */
+#define XM_BLOCK_SIZE 1024
+
+/**
+ * @brief The time allowed for the transfer to be started on the terminal.
+ * @ingroup device
+ */
+#define XM_START_TIMEOUT_MS (60 * 1000)
+
+/**
+ * @brief The name a YMODEM send of the image uses.
+ * @ingroup device
+ */
+#define XM_IMG_NAME "image.bin"
+
+/**
+ * @brief Status of a transfer.
+ * @ingroup device
+ */
+typedef enum xm_status_ {
+    XM_OK = 0,
+    XM_CANCELED,            // The other end canceled the transfer (Ctrl-X from the terminal)
+    XM_TIMEOUT,             // The transfer wasn't started, or the other end stopped responding
+    XM_ERRORS,              // Too many errors in a row (or a block out of sequence)
+    XM_FILE_ERROR,          // A file couldn't be opened/read/written
+    XM_NO_IMAGE,            // No image is open
+    XM_IMG_ERROR,           // The data doesn't fit in the image (or it couldn't be read/written)
+} xm_status_t;
+
+/**
+ * @brief The results of a transfer.
+ * @ingroup device
+ */
+typedef struct xm_result_ {
+    uint32_t bytes;         // The number of data bytes transferred
+    uint16_t files;         // The number of files transferred
+    uint16_t errors;        // The number of blocks that had to be sent again
+    uint32_t elapsed_ms;
+} xm_result_t;
+
+/**
+ * @brief Receive data from the terminal (the terminal sends).
+ * @ingroup device
+ *
+ * With XMODEM, the data is written to the file `path`, or into the image (from address 0)
+ * if `path` is NULL. With YMODEM, each file of the batch is written into the directory
+ * `path` (with the name sent), or into the image if `path` is NULL (only one file).
+ * The data received into the image must fit (padding past the end is discarded).
+ *
+ * @param ymodem True for YMODEM, false for XMODEM
+ * @param path The file (XMODEM), or the directory (YMODEM, "" for the current directory).
+ *      NULL for the image.
+ * @param result Filled in with the results
+ * @return xm_status_t Status
+ */
+extern xm_status_t xm_receive(bool ymodem, const char* path, xm_result_t* result);
+
+/**
+ * @brief Send a file or the image to the terminal (the terminal receives).
+ * @ingroup device
+ *
+ * @param ymodem True for YMODEM, false for XMODEM
+ * @param path The file. NULL for the image (YMODEM sends it as XM_IMG_NAME).
+ * @param result Filled in with the results
+ * @return xm_status_t Status
+ */
+extern xm_status_t xm_send(bool ymodem, const char* path, xm_result_t* result);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // XMODEM_H_
@@ -0,0 +1,157 @@
+/**
+ * Programming job journal.
+ *
+ * The journal is a single record that is re-written in place (on Core-0, as are the
+ * other disk operations) and synced each time it is updated. The record has a CRC, so a
+ * record that was only partly written is seen as no journal (the job starts over).
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "journal.h"
+
+#include "dskops.h"
+#include "include/util.h"
+
+#include "ff.h"
+
+#include "pico/stdlib.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define _JNL_MAGIC 0x4C4A4453  // 'SDJL'
+
+/**
+ * @brief The journal record.
+ */
+typedef struct jnl_rec_ {
+    uint32_t magic;
+    uint32_t imgid;
+    uint32_t size;
+    uint8_t mfgid;
+    uint8_t devid;
+    uint8_t sectcnt;
+    uint8_t reserved;
+    uint32_t updates;
+    pd_sectmap_t done;
+    uint32_t crc;           // CRC-32 of the record (up to here)
+} jnl_rec_t;
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief The journal file (open while a job is active) */
+static FIL _fil;
+
+static jnl_rec_t _rec;
+static bool _active;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+/**
+ * @brief Read the record from the file.
+ *
+ * @return true The full record was read
+ */
+static bool _rec_read() {
+    UINT bc;
+    return (dsk_file_seek(&_fil, 0) == FR_OK
+        && dsk_file_read(&_fil, &_rec, sizeof(jnl_rec_t), &bc) == FR_OK
+        && bc == sizeof(jnl_rec_t));
+}
+
+/**
+ * @brief Write the record (in place) to the file and sync it.
+ *
+ * @return true The record was written
+ */
+static bool _rec_write() {
+    UINT bc;
+    return (dsk_file_seek(&_fil, 0) == FR_OK
+        && dsk_file_write(&_fil, &_rec, sizeof(jnl_rec_t), &bc) == FR_OK
+        && bc == sizeof(jnl_rec_t)
+        && dsk_file_sync(&_fil) == FR_OK);
+}
+
+/**
+ * @brief Close and remove the journal file.
+ */
+static void _remove() {
+    dsk_file_close(&_fil);
+    dsk_file_unlink(JNL_FILE);
+}
+
+static uint32_t _rec_crc() {
+    return (crc32_update(0, &_rec, offsetof(jnl_rec_t, crc)));
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+int jnl_open(uint32_t imgid, uint32_t size, const md_info_t* info, pd_sectmap_t* done) {
+    pd_sectmap_clr(done);
+    if (_active) {
+        jnl_close(false);
+    }
+    if (dsk_file_open(&_fil, JNL_FILE, (FA_OPEN_ALWAYS | FA_READ | FA_WRITE)) != FR_OK) {
+        return (-1);
+    }
+    _active = true;
+    int resumed = 0;
+    if (_rec_read() && _rec.magic == _JNL_MAGIC && _rec.crc == _rec_crc()
+        && _rec.imgid == imgid && _rec.size == size
+        && _rec.mfgid == info->mfgid && _rec.devid == info->devid && _rec.sectcnt == info->sectcnt) {
+        // A journal for this job. Resume it.
+        *done = _rec.done;
+        for (uint8_t sect = 0; sect < info->sectcnt; sect++) {
+            resumed += pd_sectmap_isset(done, sect);
+        }
+        return (resumed);
+    }
+    memset(&_rec, 0, sizeof(jnl_rec_t));
+    _rec.magic = _JNL_MAGIC;
+    _rec.imgid = imgid;
+    _rec.size = size;
+    _rec.mfgid = info->mfgid;
+    _rec.devid = info->devid;
+    _rec.sectcnt = info->sectcnt;
+    _rec.crc = _rec_crc();
+    if (!_rec_write()) {
+        _remove();
+        _active = false;
+        return (-1);
+    }
+    return (resumed);
+}
+
+void jnl_update(const pd_sectmap_t* done) {
+    if (!_active || memcmp(done, &_rec.done, sizeof(pd_sectmap_t)) == 0) {
+        return;
+    }
+    _rec.done = *done;
+    _rec.updates++;
+    _rec.crc = _rec_crc();
+    _rec_write();
+}
+
+void jnl_close(bool complete) {
+    if (!_active) {
+        return;
+    }
+    if (complete) {
+        _remove();
+    }
+    else {
+        dsk_file_close(&_fil);
+    }
+    _active = false;
+}
@@ -0,0 +1,195 @@
+/**
+ * Programmable Device Image file loader.
+ *
+ * The file is read (on Core-0, as are the other disk operations) a chunk at a time into
+ * an aligned buffer, and each chunk is passed to the decoder before the next is read.
+ * The binary 'decoder' is here (it just writes the chunks to the sink), the others are
+ * in their own modules.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "loader.h"
+#include "hexload.h"
+#include "image.h"
+#include "srecload.h"
+
+#include "dskops.h"
+#include "include/util.h"
+
+#include "ff.h"
+
+#include "pico/stdlib.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief The file being loaded, and the amount of the last read */
+static FIL _fil;
+static UINT _rdlen;
+/** @brief The file is read into this (aligned, so FatFs can read full sectors directly into it) */
+static uint8_t _chunk[LD_READ_CHUNK] __attribute__((aligned(4)));
+
+static ld_sink_t _sink;
+
+/** @brief The image address (before the offset) of the next binary chunk */
+static uint32_t _bin_pos;
+
+// ====================================================================
+// Local/Private Method Declarations
+// ====================================================================
+
+static void _bin_begin(ld_sink_t* sink);
+static ld_status_t _bin_end();
+static ld_status_t _bin_feed(const uint8_t* buf, uint32_t len);
+static bool _bin_sniff(const uint8_t* buf, uint32_t len);
+
+static const ld_decoder_t _bin_decoder = {
+    LD_FMT_BIN,
+    "BIN",
+    _bin_sniff,
+    _bin_begin,
+    _bin_feed,
+    _bin_end,
+};
+
+/** @brief The decoders, in the order they are checked when detecting the format (binary last) */
+static const ld_decoder_t* _decoders[] = {
+    &ld_hex_decoder,
+    &ld_srec_decoder,
+    &_bin_decoder,
+};
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+static void _bin_begin(ld_sink_t* sink) {
+    _bin_pos = 0;
+}
+
+static ld_status_t _bin_end() {
+    return (LD_OK);
+}
+
+static ld_status_t _bin_feed(const uint8_t* buf, uint32_t len) {
+    ld_status_t status = ld_sink_write(&_sink, _bin_pos, buf, len);
+    _bin_pos += len;
+    return (status == LD_OK ? LD_MORE : status);
+}
+
+/**
+ * @brief Any file can be loaded as binary.
+ */
+static bool _bin_sniff(const uint8_t* buf, uint32_t len) {
+    return (true);
+}
+
+/**
+ * @brief Read the next chunk of the file.
+ *
+ * @return true The read succeeded (`_rdlen` is 0 at the end of the file)
+ */
+static bool _chunk_read() {
+    return (dsk_file_read(&_fil, _chunk, sizeof(_chunk), &_rdlen) == FR_OK);
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+const ld_decoder_t* ld_decoder(ld_format_t format) {
+    for (int i = 0; i < ARRAY_ELEMENT_COUNT(_decoders); i++) {
+        if (_decoders[i]->format == format) {
+            return (_decoders[i]);
+        }
+    }
+    return (NULL);
+}
+
+ld_status_t ld_load(const char* path, ld_format_t format, int32_t offset, uint32_t sectsize, ld_result_t* result) {
+    uint64_t t_start = time_us_64();
+    memset(result, 0, sizeof(ld_result_t));
+    result->format = format;
+    result->start_addr = LD_NO_START;
+    result->line = 1;
+    _sink.offset = offset;
+    _sink.sectsize = (sectsize ? sectsize : 1);
+    _sink.result = result;
+    if (!img_is_open()) {
+        return (LD_IMG_ERROR);
+    }
+    if (dsk_file_open(&_fil, path, FA_READ) != FR_OK) {
+        return (LD_FILE_ERROR);
+    }
+    ld_status_t status = LD_MORE;
+    const ld_decoder_t* decoder = NULL;
+    if (!_chunk_read()) {
+        status = LD_FILE_ERROR;
+    }
+    else {
+        if (format == LD_FMT_AUTO) {
+            // Detect the format from the first chunk
+            for (int i = 0; i < ARRAY_ELEMENT_COUNT(_decoders) && !decoder; i++) {
+                if (_decoders[i]->sniff(_chunk, _rdlen)) {
+                    decoder = _decoders[i];
+                }
+            }
+        }
+        else {
+            decoder = ld_decoder(format);
+        }
+    }
+    if (!decoder) {
+        status = (status == LD_MORE ? LD_SYNTAX_ERROR : status);
+    }
+    else {
+        result->format = decoder->format;
+        decoder->begin(&_sink);
+    }
+    while (status == LD_MORE) {
+        if (_rdlen == 0) {
+            status = decoder->end();
+            break;
+        }
+        status = decoder->feed(_chunk, _rdlen);
+        if (status == LD_MORE && !_chunk_read()) {
+            status = LD_FILE_ERROR;
+        }
+    }
+    dsk_file_close(&_fil);
+    result->elapsed_ms = (uint32_t)((time_us_64() - t_start) / 1000);
+    return (status);
+}
+
+ld_status_t ld_sink_write(ld_sink_t* sink, uint32_t addr, const uint8_t* data, uint32_t len) {
+    ld_result_t* result = sink->result;
+    uint32_t iaddr = addr + (uint32_t)sink->offset;
+    if (iaddr >= img_size() || len > (img_size() - iaddr)) {
+        return (LD_ADDR_ERROR);
+    }
+    if (img_write_at(iaddr, data, len) != IMG_OK) {
+        return (LD_IMG_ERROR);
+    }
+    result->crc = crc32_update(result->crc, data, len);
+    result->records++;
+    result->bytes += len;
+    uint32_t end = iaddr + len;
+    if (result->addr_high == 0 || iaddr < result->addr_low) {
+        result->addr_low = iaddr;
+    }
+    if (end > result->addr_high) {
+        result->addr_high = end;
+    }
+    for (uint32_t s = iaddr / sink->sectsize; s <= (end - 1) / sink->sectsize && s < PD_SECT_MAX; s++) {
+        pd_sectmap_set(&result->touched, s);
+    }
+    return (LD_OK);
+}
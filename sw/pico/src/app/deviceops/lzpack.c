@@ -0,0 +1,175 @@
+/**
+ * Simple LZ/Run-length packing for device images.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "lzpack.h"
+
+#include <string.h>
+
+#define _LIT_MAX        128
+#define _FILL_TAG       0x80
+#define _FILL_MIN       4
+#define _FILL_MAX       (0x3FFF + _FILL_MIN)
+#define _MATCH_TAG      0xC0
+#define _MATCH_MIN      4
+#define _MATCH_MAX      (0x3F + _MATCH_MIN)
+#define _OFFSET_MAX     0xFFFF
+
+#define _HASH_BITS      10
+#define _HASH_SIZE      (1u << _HASH_BITS)
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief The last position a 4 byte sequence (hashed) was seen at */
+static uint16_t _hashtbl[_HASH_SIZE];
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+static inline uint32_t _hash(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ((v * 2654435761u) >> (32 - _HASH_BITS));
+}
+
+/**
+ * @brief Output pending literals.
+ *
+ * @return uint32_t The new output position, or 0 if they don't fit.
+ */
+static uint32_t _lit_flush(const uint8_t* lit, uint32_t cnt, uint8_t* dst, uint32_t o, uint32_t dstmax) {
+    while (cnt > 0) {
+        uint32_t n = (cnt < _LIT_MAX ? cnt : _LIT_MAX);
+        if (o + 1 + n > dstmax) {
+            return (0);
+        }
+        dst[o++] = (uint8_t)(n - 1);
+        memcpy(&dst[o], lit, n);
+        o += n;
+        lit += n;
+        cnt -= n;
+    }
+    return (o);
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+uint32_t lzp_pack(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t dstmax) {
+    if (len == 0 || len > LZP_BLOCK_MAX) {
+        return (0);
+    }
+    memset(_hashtbl, 0, sizeof(_hashtbl));
+    uint32_t o = 0;
+    uint32_t lit = 0;   // Start of the pending literals
+    uint32_t i = 0;
+    while (i < len) {
+        // Fill run?
+        uint32_t r = 1;
+        uint32_t rmax = (len - i < _FILL_MAX ? len - i : _FILL_MAX);
+        while (r < rmax && src[i + r] == src[i]) {
+            r++;
+        }
+        if (r >= _FILL_MIN) {
+            if (i > lit && (o = _lit_flush(&src[lit], i - lit, dst, o, dstmax)) == 0) {
+                return (0);
+            }
+            if (o + 3 > dstmax) {
+                return (0);
+            }
+            uint32_t l = r - _FILL_MIN;
+            dst[o++] = (uint8_t)(_FILL_TAG | (l >> 8));
+            dst[o++] = (uint8_t)(l & 0xFF);
+            dst[o++] = src[i];
+            i += r;
+            lit = i;
+            continue;
+        }
+        // Match with earlier data?
+        if (i + _MATCH_MIN <= len) {
+            uint32_t h = _hash(&src[i]);
+            uint32_t cand = _hashtbl[h];
+            _hashtbl[h] = (uint16_t)i;
+            if (cand < i && (i - cand) <= _OFFSET_MAX && memcmp(&src[cand], &src[i], _MATCH_MIN) == 0) {
+                uint32_t m = _MATCH_MIN;
+                uint32_t mmax = (len - i < _MATCH_MAX ? len - i : _MATCH_MAX);
+                while (m < mmax && src[cand + m] == src[i + m]) {
+                    m++;
+                }
+                if (i > lit && (o = _lit_flush(&src[lit], i - lit, dst, o, dstmax)) == 0) {
+                    return (0);
+                }
+                if (o + 3 > dstmax) {
+                    return (0);
+                }
+                uint32_t off = i - cand;
+                dst[o++] = (uint8_t)(_MATCH_TAG | (m - _MATCH_MIN));
+                dst[o++] = (uint8_t)(off & 0xFF);
+                dst[o++] = (uint8_t)(off >> 8);
+                i += m;
+                lit = i;
+                continue;
+            }
+        }
+        i++;
+    }
+    if (i > lit && (o = _lit_flush(&src[lit], i - lit, dst, o, dstmax)) == 0) {
+        return (0);
+    }
+    return (o);
+}
+
+bool lzp_unpack(const uint8_t* src, uint32_t srclen, uint8_t* dst, uint32_t len) {
+    uint32_t i = 0;
+    uint32_t o = 0;
+    while (i < srclen) {
+        uint8_t t = src[i++];
+        if (t < _FILL_TAG) {
+            uint32_t n = t + 1u;
+            if (i + n > srclen || o + n > len) {
+                return (false);
+            }
+            memmove(&dst[o], &src[i], n);   // (can be unpacked in place)
+            i += n;
+            o += n;
+        }
+        else if (t < _MATCH_TAG) {
+            if (i + 2 > srclen) {
+                return (false);
+            }
+            uint32_t n = ((uint32_t)(t & 0x3F) << 8 | src[i]) + _FILL_MIN;
+            if (o + n > len) {
+                return (false);
+            }
+            memset(&dst[o], src[i + 1], n);
+            i += 2;
+            o += n;
+        }
+        else {
+            if (i + 2 > srclen) {
+                return (false);
+            }
+            uint32_t n = (uint32_t)(t & 0x3F) + _MATCH_MIN;
+            uint32_t off = (uint32_t)src[i] | ((uint32_t)src[i + 1] << 8);
+            i += 2;
+            if (off == 0 || off > o || o + n > len) {
+                return (false);
+            }
+            // Byte copy, as the source can overlap the destination
+            const uint8_t* m = &dst[o - off];
+            for (uint32_t j = 0; j < n; j++) {
+                dst[o + j] = m[j];
+            }
+            o += n;
+        }
+    }
+    return (o == len);
+}
@@ -0,0 +1,270 @@
+/**
+ * Programmable Device Bus engine (PIO + DMA).
+ *
+ * The PIO program (pdbus.pio) performs complete device bus cycles from a single
+ * command word. Command words are fed to the state machine TX FIFO by a DMA
+ * channel and bytes read from the device are drained from the RX FIFO by a second
+ * DMA channel.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "pdbus.h"
+
+#include "board.h"
+#include "dbus.h"
+#include "system_defs.h"
+
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+
+#include "pdbus.pio.h"
+
+#if (OP_DATA_LATCH != (OP8_BIT0 + 3)) || (OP_DATA_WR != (OP_DATA_RD + 1))
+#error "pdbus requires OP8/DATA_LATCH and DATA_RD/DATA_WR to be consecutive GPIOs"
+#endif
+
+#define _SET_PIN_CNT    4       // OP8 Bits 0-2 and the Data Latch
+#define _SET_PINS_MASK  (OP8_BITS_MASK | (1u << OP_DATA_LATCH))
+#define _SIDE_PINS_MASK ((1u << OP_DATA_RD) | (1u << OP_DATA_WR))
+#define _PINS_MASK      (DATA_BUS_MASK | _SET_PINS_MASK | _SIDE_PINS_MASK)
+#define _PINS_IDLE      ((pdbus_OP_NONE << OP8_BITS_SHIFT) | (pdbus_SIDE_IDLE << OP_DATA_RD))
+
+#define _CMDBUF_SIZE    64      // Command words per DMA transfer (64 read commands can read 16K)
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+static volatile bool _initialized;
+
+static PIO _pio = PIO_PDBUS_BLOCK;
+static uint _offset;
+static bool _attached;
+static uint32_t _clk_hz;
+
+static uint _dma_tx;
+static uint _dma_rx;
+static dma_channel_config _dma_tx_cfg;
+static dma_channel_config _dma_rx_cfg;
+
+static uint32_t _cmdbuf[_CMDBUF_SIZE];
+
+// ====================================================================
+// Local/Private Method Declarations
+// ====================================================================
+
+static void _wait_idle();
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+/**
+ * @brief The fastest PIO clock that gives a strobe of `cycles` PIO clocks at least `ns` long.
+ */
+static uint32_t _clk_for(uint32_t cycles, uint16_t ns) {
+    if (ns == 0) {
+        return (PDBUS_PIO_CLK_HZ);
+    }
+    uint64_t hz = ((uint64_t)cycles * 1000000000ull) / ns;
+    return (hz < PDBUS_PIO_CLK_HZ ? (uint32_t)hz : PDBUS_PIO_CLK_HZ);
+}
+
+/**
+ * @brief Build the read commands for as much of a block as fits in the command buffer.
+ *
+ * @param addr Starting address
+ * @param len Number of bytes
+ * @param count Set to the number of command words
+ * @return uint32_t The number of bytes the commands read
+ */
+static uint32_t _read_cmds(uint32_t addr, uint32_t len, uint32_t* count) {
+    // One read command per 256 byte page
+    uint32_t n = 0;
+    uint32_t bytes = 0;
+    while (n < _CMDBUF_SIZE && bytes < len) {
+        uint32_t cnt = PDBUS_PAGE_SIZE - ((addr + bytes) & 0xFF);
+        if (cnt > (len - bytes)) {
+            cnt = len - bytes;
+        }
+        _cmdbuf[n++] = pdbus_cmd_rd(addr + bytes, cnt);
+        bytes += cnt;
+    }
+    *count = n;
+    return (bytes);
+}
+
+static void _dma_rx_start(uint8_t* buf, uint32_t len) {
+    dma_channel_configure(_dma_rx, &_dma_rx_cfg, buf, &_pio->rxf[PIO_PDBUS_SM], len, true);
+}
+
+static void _dma_tx_start(const uint32_t* cmds, uint32_t count) {
+    dma_channel_configure(_dma_tx, &_dma_tx_cfg, &_pio->txf[PIO_PDBUS_SM], cmds, count, true);
+}
+
+/**
+ * @brief Wait for the commands to be sent and the state machine to be waiting for the next command.
+ */
+static void _wait_idle() {
+    dma_channel_wait_for_finish_blocking(_dma_tx);
+    uint32_t stall_mask = 1u << (PIO_FDEBUG_TXSTALL_LSB + PIO_PDBUS_SM);
+    _pio->fdebug = stall_mask;  // Write 1 to clear
+    while (!pio_sm_is_tx_fifo_empty(_pio, PIO_PDBUS_SM) || !(_pio->fdebug & stall_mask)) {
+        tight_loop_contents();
+    }
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+void pdbus_attach() {
+    if (_attached) {
+        return;
+    }
+    pio_sm_set_enabled(_pio, PIO_PDBUS_SM, false);
+    pio_sm_clear_fifos(_pio, PIO_PDBUS_SM);
+    pio_sm_restart(_pio, PIO_PDBUS_SM);
+    // Set the PIO outputs to the idle state before giving the pins to the PIO.
+    pio_sm_set_pins_with_mask(_pio, PIO_PDBUS_SM, _PINS_IDLE, _PINS_MASK);
+    pio_sm_set_pindirs_with_mask(_pio, PIO_PDBUS_SM, _PINS_MASK, _PINS_MASK);
+    pio_sm_exec(_pio, PIO_PDBUS_SM, pio_encode_jmp(_offset + pdbus_offset_start));
+    pio_sm_set_enabled(_pio, PIO_PDBUS_SM, true);
+    for (uint pin = DATA0; pin <= OP_DATA_WR; pin++) {
+        if (_PINS_MASK & (1u << pin)) {
+            pio_gpio_init(_pio, pin);
+        }
+    }
+    _attached = true;
+}
+
+bool pdbus_attached() {
+    return (_attached);
+}
+
+void pdbus_detach() {
+    if (!_attached) {
+        return;
+    }
+    _wait_idle();
+    // Set the SIO outputs to the idle state before taking the pins back.
+    gpio_put_masked((_SET_PINS_MASK | _SIDE_PINS_MASK), _PINS_IDLE);
+    dbus_set_in();
+    for (uint pin = DATA0; pin <= OP_DATA_WR; pin++) {
+        if (_PINS_MASK & (1u << pin)) {
+            gpio_set_function(pin, GPIO_FUNC_SIO);
+        }
+    }
+    pio_sm_set_enabled(_pio, PIO_PDBUS_SM, false);
+    _attached = false;
+}
+
+void pdbus_exec(const uint32_t* cmds, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+    _dma_tx_start(cmds, count);
+    _wait_idle();
+}
+
+void pdbus_read(uint32_t addr, uint8_t* buf, uint32_t len) {
+    while (len > 0) {
+        uint32_t n;
+        uint32_t bytes = _read_cmds(addr, len, &n);
+        _dma_rx_start(buf, bytes);
+        _dma_tx_start(_cmdbuf, n);
+        dma_channel_wait_for_finish_blocking(_dma_rx);
+        addr += bytes;
+        buf += bytes;
+        len -= bytes;
+    }
+    _wait_idle();
+}
+
+void pdbus_read_start(uint32_t addr, uint8_t* buf, uint32_t len) {
+    if (len == 0) {
+        return;
+    }
+    uint32_t n;
+    uint32_t bytes = _read_cmds(addr, len, &n);
+    _dma_rx_start(buf, bytes);
+    _dma_tx_start(_cmdbuf, n);
+}
+
+void pdbus_read_wait() {
+    dma_channel_wait_for_finish_blocking(_dma_rx);
+    _wait_idle();
+}
+
+void pdbus_timing_set(uint16_t tacc_ns, uint16_t twp_ns, uint16_t tls_ns) {
+    uint32_t hz = _clk_for(pdbus_T_ACCESS + 1, tacc_ns);
+    uint32_t whz = _clk_for(pdbus_T_WRPULSE + 1, twp_ns);
+    uint32_t lhz = _clk_for(pdbus_T_LATCH + 1, tls_ns);
+    hz = (whz < hz ? whz : hz);
+    hz = (lhz < hz ? lhz : hz);
+    if (hz == _clk_hz) {
+        return;
+    }
+    _clk_hz = hz;
+    pio_sm_set_clkdiv(_pio, PIO_PDBUS_SM, (float)clock_get_hz(clk_sys) / _clk_hz);
+}
+
+void pdbus_write(uint32_t addr, const uint8_t* data, uint32_t len) {
+    while (len > 0) {
+        uint32_t n = (len < _CMDBUF_SIZE ? len : _CMDBUF_SIZE);
+        // The previous transfer must be done with the command buffer before it is refilled.
+        dma_channel_wait_for_finish_blocking(_dma_tx);
+        for (uint32_t i = 0; i < n; i++) {
+            _cmdbuf[i] = pdbus_cmd_wr(addr++, *data++);
+        }
+        _dma_tx_start(_cmdbuf, n);
+        len -= n;
+    }
+    _wait_idle();
+}
+
+// ====================================================================
+// Initialization/Start-Up Methods
+// ====================================================================
+
+void pdbus_minit() {
+    if (_initialized) {
+        board_panic("!!! pdbus_minit: Called more than once !!!");
+    }
+    _initialized = true;
+
+    pio_sm_claim(_pio, PIO_PDBUS_SM);
+    _offset = pio_add_program(_pio, &pdbus_program);
+    pio_sm_config c = pdbus_program_get_default_config(_offset);
+    sm_config_set_out_pins(&c, DATA0, 8);
+    sm_config_set_in_pins(&c, DATA0);
+    sm_config_set_set_pins(&c, OP8_BIT0, _SET_PIN_CNT);
+    sm_config_set_sideset_pins(&c, OP_DATA_RD);
+    sm_config_set_jmp_pin(&c, DATA6);               // FWR- bit of the AddrH+Ctrl value
+    // Commands shift out LSB first, no autopull (the program pulls each command)
+    sm_config_set_out_shift(&c, true, false, 32);
+    // Bytes shift in to the left and are autopushed (a DMA byte read gets the low byte)
+    sm_config_set_in_shift(&c, false, true, 8);
+    _clk_hz = PDBUS_PIO_CLK_HZ;
+    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / _clk_hz);
+    pio_sm_init(_pio, PIO_PDBUS_SM, _offset + pdbus_offset_start, &c);
+
+    _dma_tx = (uint)dma_claim_unused_channel(true);
+    _dma_tx_cfg = dma_channel_get_default_config(_dma_tx);
+    channel_config_set_transfer_data_size(&_dma_tx_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&_dma_tx_cfg, true);
+    channel_config_set_write_increment(&_dma_tx_cfg, false);
+    channel_config_set_dreq(&_dma_tx_cfg, pio_get_dreq(_pio, PIO_PDBUS_SM, true));
+
+    _dma_rx = (uint)dma_claim_unused_channel(true);
+    _dma_rx_cfg = dma_channel_get_default_config(_dma_rx);
+    channel_config_set_transfer_data_size(&_dma_rx_cfg, DMA_SIZE_8);
+    channel_config_set_read_increment(&_dma_rx_cfg, false);
+    channel_config_set_write_increment(&_dma_rx_cfg, true);
+    channel_config_set_dreq(&_dma_rx_cfg, pio_get_dreq(_pio, PIO_PDBUS_SM, false));
+}
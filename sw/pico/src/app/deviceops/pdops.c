@@ -4,12 +4,17 @@
  * Methods to control the POWER-ENABLE and READ/WRITE-ENABLE signals, and to load the
  * address into the address latches/counters.
  *
+ * The device bus can be driven by bit-banging the GPIOs (the original method) or
+ * by the PIO bus engine (pdbus). The selected backend is used by all of the
+ * `pdo_*` data operations.
+ *
  * Copyright 2023-25 AESilky
  * SPDX-License-Identifier: MIT License
  *
 */
 
 #include "pdops.h"
+#include "pdbus.h"
 
 #include "board.h"
 #include "dbus.h"
@@ -18,6 +23,7 @@
 
 #include "pico/stdlib.h"
 #include "pico/types.h"
+#include "hardware/clocks.h"
 
 typedef enum _frdwrbits {
     _FRW_NONE   = 0x38,
@@ -26,6 +32,19 @@ typedef enum _frdwrbits {
 } _frdwrb_t;
 #define _FRDWR_MASK 0xC0
 
+/** The address latches (index into the shadow values) */
+typedef enum _latch_ {
+    _LATCH_L = 0,
+    _LATCH_M,
+    _LATCH_H,
+    _LATCH_CNT
+} _latch_t;
+
+/** Streaming with the PIO backend reads this many bytes at a time (must divide 256) */
+#define _STRM_PIO_CHUNK 64
+/** Write cycle sequences with the PIO backend are sent in groups of up to this many */
+#define _SEQ_PIO_MAX 8
+
 // ====================================================================
 // Data Section
 // ====================================================================
@@ -37,9 +56,47 @@ static boptkn_t _tkn;
 
 /** The current Power Mode */
 static progdev_pwr_mode_t _pwrmode;
+/** The power is held on (an operation is running on the device) */
+static bool _pwr_hold;
+/** The bus backend in use */
+static pdo_bus_backend_t _backend;
+/** The current address (used by the PIO backend, which loads the address with each access) */
+static uint32_t _addr;
 /** Holds the top 3-bits of the address and the FWR- and FRD- control bits. */
 static uint8_t _addrHctrl;
 
+/** Last value loaded into each address latch (valid if the bit for the latch is set in `_latch_valid`) */
+static uint8_t _latch_shadow[_LATCH_CNT];
+static uint8_t _latch_valid;
+static pdo_latch_stats_t _latch_stats;
+static const boardop_t _latch_op[_LATCH_CNT] = { BDO_ADDR_LOW_LD, BDO_ADDR_MID_LD, BDO_ADDR_HIGH_LD };
+
+/** Conservative timing used for unknown devices (the original fixed 2us strobes) */
+static const pdo_timing_t _timing_safe = {
+    .tacc_ns = 2000,
+    .twp_ns = 2000,
+    .tls_ns = 2000,
+    .tpwr_us = 5000
+};
+/** Device timing (NULL if none) and whether the safe timing is forced */
+static const pdo_timing_t* _timing_dev;
+static bool _timing_safe_forced;
+/** The timing in use, as CPU cycles (for the GPIO backend) */
+static uint32_t _cyc_acc;
+static uint32_t _cyc_wp;
+static uint32_t _cyc_ls;
+
+/** Streaming read in progress */
+static bool _strm_ip;
+/** Address of the next byte to be streamed */
+static uint32_t _strm_addr;
+/** PIO backend stream buffer, position, and length */
+static uint8_t _strm_buf[_STRM_PIO_CHUNK];
+static uint16_t _strm_bufpos;
+static uint16_t _strm_buflen;
+/** PIO backend stream read started (not waited for) */
+static bool _strm_rd_pending;
+
 // ====================================================================
 // Local/Private Method Declarations
 // ====================================================================
@@ -49,6 +106,25 @@ static uint8_t _addrHctrl;
 // Local/Private Method Definitions
 // ====================================================================
 
+/**
+ * @brief Convert a time to the number of CPU cycles that is at least that long.
+ */
+static uint32_t _ns_to_cycles(uint16_t ns) {
+    uint32_t khz = clock_get_hz(clk_sys) / 1000;
+    return ((uint32_t)(((uint64_t)ns * khz + 999999) / 1000000));
+}
+
+/**
+ * @brief Apply the timing in use to the GPIO strobes and the PIO clock.
+ */
+static void _timing_apply() {
+    const pdo_timing_t* t = pdo_timing();
+    _cyc_acc = _ns_to_cycles(t->tacc_ns);
+    _cyc_wp = _ns_to_cycles(t->twp_ns);
+    _cyc_ls = _ns_to_cycles(t->tls_ns);
+    pdbus_timing_set(t->tacc_ns, t->twp_ns, t->tls_ns);
+}
+
 /**
  * @brief Select/deselect the device. Board-Op must be inprogress.
  *
@@ -91,6 +167,38 @@ static bool _pd_pwr_chk() {
     return (true);
 }
 
+/**
+ * @brief Forget the latch shadow values (the latches need to be loaded on next use).
+ *
+ * This is needed when the latches are changed by something other than `_latch_ld`
+ * (the PIO) or they lose their contents (power off).
+ */
+static void _latch_invalidate() {
+    _latch_valid = 0;
+}
+
+/**
+ * @brief Load an address latch if its value is different than the last value loaded.
+ * This must be called from within a Board-OP.
+ *
+ * @param latch The latch to load
+ * @param v The value to load
+ */
+static void _latch_ld(_latch_t latch, uint8_t v) {
+    uint8_t lbit = (1 << latch);
+    if ((_latch_valid & lbit) && _latch_shadow[latch] == v) {
+        _latch_stats.saved++;
+        return;
+    }
+    board_op(_tkn, _latch_op[latch]);   // This takes the Latch CLK low
+    dbus_wr(v);
+    busy_wait_at_least_cycles(_cyc_ls);
+    board_op(_tkn, BDO_NONE);           // This takes the Latch CLK high (clocks data to the output)
+    _latch_shadow[latch] = v;
+    _latch_valid |= lbit;
+    _latch_stats.loads++;
+}
+
 /**
  * @brief Set the given RD&WR bits into the AddrH+Ctrl and write it to the latch.
  * This must be called from within a Board-OP.
@@ -101,10 +209,115 @@ static bool _pd_pwr_chk() {
  */
 static void _pd_rw_set(_frdwrb_t rwbits) {
     _addrHctrl = (_addrHctrl & ~_FRDWR_MASK) | (~rwbits & _FRDWR_MASK);
-    board_op(_tkn, BDO_ADDR_HIGH_LD);   // This takes the Latch CLK low
-    dbus_wr(_addrHctrl);
-    sleep_us(2);
-    board_op(_tkn, BDO_NONE);           // This takes the Latch CLK high (clocks data to the output)
+    _latch_ld(_LATCH_H, _addrHctrl);
+}
+
+
+/**
+ * @brief Load the address latches (GPIO backend). Board-Op must be inprogress.
+ *
+ * @param addr The address
+ */
+static void _gpio_addr_set(uint32_t addr) {
+    uint8_t addrL = addr & 0x000000FF;
+    uint8_t addrM = (addr & 0x0000FF00) >> 8;
+    uint8_t addrH = ((addr & 0x000F0000) >> 16);
+    _addrHctrl = (_addrHctrl & _FRDWR_MASK) | addrH; // Merge the address and the RD/WR ctrl bits
+
+    // Write out each of the address parts to the appropriate latch. Only the latches
+    // whose value changes are loaded.
+    _latch_ld(_LATCH_H, _addrHctrl);
+    _latch_ld(_LATCH_M, addrM);
+    _latch_ld(_LATCH_L, addrL);
+    // Put the P Data Bus back to input
+    dbus_set_in();
+}
+
+/**
+ * @brief Read the device at the address in the latches (GPIO backend). Board-Op must be inprogress.
+ *
+ * @return uint8_t The data
+ */
+static uint8_t _gpio_data_get() {
+    _pd_rw_set(_FRD);
+    _cs(true);
+    // Wait for the device data, then take 'data_latch' low then high to capture it
+    busy_wait_at_least_cycles(_cyc_acc);
+    gpio_put(OP_DATA_LATCH, 0);
+    busy_wait_at_least_cycles(_cyc_ls);
+    gpio_put(OP_DATA_LATCH, 1);
+    _cs(false);
+    // FRD- is left active. The device only drives the bus when selected, and
+    // consecutive reads don't need to reload the AddrH+Ctrl latch.
+    // Enable the output of the data-in latch
+    gpio_put(OP_DATA_RD, 0);
+    // Read the data-in latch
+    uint8_t data = dbus_rd();
+    // Disable the output of the data-in latch
+    gpio_put(OP_DATA_RD, 1);
+
+    return (data);
+}
+
+/**
+ * @brief Write the data to the device at the address in the latches (GPIO backend).
+ * Board-Op must be inprogress.
+ *
+ * @param data The data
+ */
+static void _gpio_data_set(uint8_t data) {
+    dbus_wr(data); // put the data into the output latch
+    // Take 'data_latch' low then high
+    gpio_put(OP_DATA_LATCH, 0);
+    busy_wait_at_least_cycles(_cyc_ls);
+    gpio_put(OP_DATA_LATCH, 1);
+    // Enable the data latch output
+    gpio_put(OP_DATA_WR, 0);
+    // Set /WR on the device
+    _pd_rw_set(_FWR);
+    // Select the device
+    _cs(true);
+    busy_wait_at_least_cycles(_cyc_wp);
+    _cs(false);
+    // FWR- is left active (the write happens on the select). Consecutive writes
+    // don't need to reload the AddrH+Ctrl latch.
+    // Disable the data latch output
+    gpio_put(OP_DATA_WR, 1);
+}
+
+/**
+ * @brief Read the device at the address already in the latches, with FRD- already
+ * active (GPIO backend). Board-Op must be inprogress.
+ *
+ * Only the device select, data latch, and data read signals are used.
+ *
+ * @return uint8_t The data
+ */
+static uint8_t _gpio_latched_read() {
+    dbus_set_in();
+    _cs(true);
+    // Take 'data_latch' low, wait for the device data, then high to capture it
+    gpio_put(OP_DATA_LATCH, 0);
+    busy_wait_at_least_cycles(_cyc_acc);
+    gpio_put(OP_DATA_LATCH, 1);
+    _cs(false);
+    // Read the data-in latch
+    gpio_put(OP_DATA_RD, 0);
+    uint8_t data = dbus_rd();
+    gpio_put(OP_DATA_RD, 1);
+
+    return (data);
+}
+
+static void _pio_op_end() {
+    pdbus_detach();
+    _latch_invalidate();    // The PIO has loaded the latches
+    _op_end();
+}
+
+static void _pio_op_start() {
+    _op_start();
+    pdbus_attach();
 }
 
 
@@ -118,56 +331,65 @@ void pdo_addr_set(uint32_t addr) {
         return;
     }
 
-    uint8_t addrL = addr & 0x000000FF;
-    uint8_t addrM = (addr & 0x0000FF00) >> 8;
-    uint8_t addrH = ((addr & 0x000F0000) >> 16);
-    _addrHctrl = (_addrHctrl & _FRDWR_MASK) | addrH; // Merge the address and the RD/WR ctrl bits
-
-    // Write out each of the address parts to the appropriate latch/counter
-    // This requires three Board Ops, so we start an Op and keep it for all three.
+    _addr = addr;
+    if (_backend == PDO_BUS_PIO) {
+        // The PIO loads the address latches as part of each access.
+        return;
+    }
+    // This requires up to three Board Ops, so we start an Op and keep it for all three.
     _op_start();
-    board_op(_tkn, BDO_ADDR_HIGH_LD);   // This takes the Latch CLK low
-    dbus_wr(_addrHctrl);            // Put the data on the bus
-    sleep_us(2);                        // Technically not needed, but it makes us feel better
-    board_op(_tkn, BDO_ADDR_MID_LD);    // This takes the previous Latch CLK high and this one low
-    dbus_wr(addrM);
-    sleep_us(2);
-    board_op(_tkn, BDO_ADDR_LOW_LD);
-    dbus_wr(addrL);
-    sleep_us(2);
-    board_op(_tkn, BDO_NONE);           // Take the last CLK high
-    // Put the P Data Bus back to input
-    dbus_set_in();
+    _gpio_addr_set(addr);
     _op_end();
 }
 
+const pdo_latch_stats_t* pdo_latch_stats() {
+    return (&_latch_stats);
+}
+
+void pdo_latch_stats_clear() {
+    _latch_stats.loads = 0;
+    _latch_stats.saved = 0;
+}
+
+pdo_bus_backend_t pdo_bus_backend() {
+    return (_backend);
+}
+
+void pdo_bus_backend_set(pdo_bus_backend_t backend) {
+    _backend = backend;
+}
+
 uint8_t pdo_data_get() {
     if (!_pd_pwr_chk()) {
         ERRORNO = -1;
         return (-1);
     }
 
+    if (_backend == PDO_BUS_PIO) {
+        uint8_t data;
+        _pio_op_start();
+        pdbus_read(_addr, &data, 1);
+        _pio_op_end();
+        return (data);
+    }
     _op_start();
-    _pd_rw_set(_FRD);
-    _cs(true);
-    // Take 'data_latch' low then high
-    sleep_us(2);
-    gpio_put(OP_DATA_LATCH, 0);
-    sleep_us(2);
-    gpio_put(OP_DATA_LATCH, 1);
-    _cs(false);
-    _pd_rw_set(_FRW_NONE);
-    // Enable the output of the data-in latch
-    gpio_put(OP_DATA_RD, 0);
-    // Read the data-in latch
-    uint8_t data = dbus_rd();
-    // Disable the output of the data-in latch
-    gpio_put(OP_DATA_RD, 1);
+    uint8_t data = _gpio_data_get();
     _op_end();
 
     return (data);
 }
 
+void pdo_data_get_block(uint32_t addr, uint8_t* buf, uint32_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (!pdo_stream_begin(addr)) {
+        return;
+    }
+    pdo_stream_read(buf, len);
+    pdo_stream_end();
+}
+
 uint8_t pdo_data_get_from(uint32_t addr) {
     ERRORNO = 0;
     pdo_addr_set(addr);
@@ -187,24 +409,231 @@ void pdo_data_set(uint8_t data) {
         return;
     }
 
+    if (_backend == PDO_BUS_PIO) {
+        _pio_op_start();
+        pdbus_write(_addr, &data, 1);
+        _pio_op_end();
+        return;
+    }
     _op_end(); // Just in case something left the device in a command state
     _op_start();
-    dbus_wr(data); // put the data into the output latch
-    // Take 'data_latch' low then high
-    gpio_put(OP_DATA_LATCH, 0);
-    sleep_us(2);
-    gpio_put(OP_DATA_LATCH, 1);
-    // Enable the data latch output
-    gpio_put(OP_DATA_WR, 0);
-    // Set /WR on the device
-    _pd_rw_set(_FWR);
-    // Select the device
-    _cs(true);
-    sleep_us(2);
-    _cs(false);
-    _pd_rw_set(_FRW_NONE);
-    // Disable the data latch output
-    gpio_put(OP_DATA_WR, 1);
+    _gpio_data_set(data);
+    _op_end();
+}
+
+void pdo_data_set_block(uint32_t addr, const uint8_t* data, uint32_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (!_pd_pwr_chk()) {
+        ERRORNO = -1;
+        return;
+    }
+
+    if (_backend == PDO_BUS_PIO) {
+        _pio_op_start();
+        pdbus_write(addr, data, len);
+        _pio_op_end();
+        _addr = addr + (len - 1);  // Same as the GPIO path (the last address accessed)
+        return;
+    }
+    while (len--) {
+        pdo_addr_set(addr++);
+        pdo_data_set(*data++);
+        if (ERRORNO < 0) {
+            return;
+        }
+    }
+}
+
+bool pdo_stream_begin(uint32_t addr) {
+    if (_strm_ip) {
+        pdo_stream_end();
+    }
+    if (!_pd_pwr_chk()) {
+        ERRORNO = -1;
+        return (false);
+    }
+
+    _strm_addr = addr;
+    _strm_ip = true;
+    if (_backend == PDO_BUS_PIO) {
+        _strm_bufpos = 0;
+        _strm_buflen = 0;
+        _pio_op_start();
+        return (true);
+    }
+    // Load the MID and HIGH latches (with FRD- active) once. Then only the LOW latch
+    // needs to be loaded for each byte, until it rolls over.
+    uint8_t addrM = (addr & 0x0000FF00) >> 8;
+    uint8_t addrH = ((addr & 0x000F0000) >> 16);
+    _addrHctrl = (~_FRD & _FRDWR_MASK) | addrH;
+    _op_start();
+    _latch_ld(_LATCH_H, _addrHctrl);
+    _latch_ld(_LATCH_M, addrM);
+
+    return (true);
+}
+
+void pdo_stream_end() {
+    if (!_strm_ip) {
+        return;
+    }
+    pdo_stream_read_wait();
+    _strm_ip = false;
+    _addr = _strm_addr - 1;
+    if (_backend == PDO_BUS_PIO) {
+        _pio_op_end();
+        return;
+    }
+    dbus_set_in();
+    _op_end();
+}
+
+void pdo_stream_read(uint8_t* buf, uint32_t len) {
+    if (!_strm_ip) {
+        ERRORNO = -1;
+        return;
+    }
+    if (_backend == PDO_BUS_PIO) {
+        pdo_stream_read_wait();
+        // Use any bytes already buffered, then DMA the rest directly into the caller's buffer.
+        while (len > 0 && _strm_bufpos < _strm_buflen) {
+            *buf++ = _strm_buf[_strm_bufpos++];
+            _strm_addr++;
+            len--;
+        }
+        if (len > 0) {
+            pdbus_read(_strm_addr, buf, len);
+            _strm_addr += len;
+        }
+        return;
+    }
+    while (len--) {
+        *buf++ = pdo_stream_next();
+    }
+}
+
+void pdo_stream_read_start(uint8_t* buf, uint32_t len) {
+    if (!_strm_ip) {
+        ERRORNO = -1;
+        return;
+    }
+    if (_backend == PDO_BUS_PIO) {
+        pdo_stream_read_wait();
+        while (len > 0 && _strm_bufpos < _strm_buflen) {
+            *buf++ = _strm_buf[_strm_bufpos++];
+            _strm_addr++;
+            len--;
+        }
+        if (len > 0) {
+            pdbus_read_start(_strm_addr, buf, len);
+            _strm_addr += len;
+            _strm_rd_pending = true;
+        }
+        return;
+    }
+    // The GPIO backend reads with the core, so the read is done now.
+    pdo_stream_read(buf, len);
+}
+
+void pdo_stream_read_wait() {
+    if (_strm_rd_pending) {
+        pdbus_read_wait();
+        _strm_rd_pending = false;
+    }
+}
+
+uint8_t pdo_stream_next() {
+    if (!_strm_ip) {
+        ERRORNO = -1;
+        return (-1);
+    }
+    uint32_t addr = _strm_addr++;
+    if (_backend == PDO_BUS_PIO) {
+        if (_strm_bufpos >= _strm_buflen) {
+            pdo_stream_read_wait();
+            // Read up to the next chunk boundary
+            _strm_buflen = _STRM_PIO_CHUNK - (addr % _STRM_PIO_CHUNK);
+            _strm_bufpos = 0;
+            pdbus_read(addr, _strm_buf, _strm_buflen);
+        }
+        return (_strm_buf[_strm_bufpos++]);
+    }
+    if ((addr & 0x0000FFFF) == 0) {
+        // Rolled over into the next 64K
+        _addrHctrl = (_addrHctrl & _FRDWR_MASK) | ((addr & 0x000F0000) >> 16);
+        _latch_ld(_LATCH_H, _addrHctrl);
+    }
+    if ((addr & 0x000000FF) == 0) {
+        // Rolled over into the next 256
+        _latch_ld(_LATCH_M, (addr & 0x0000FF00) >> 8);
+    }
+    _latch_ld(_LATCH_L, (addr & 0x000000FF));
+
+    return (_gpio_latched_read());
+}
+
+bool pdo_poll_begin(uint32_t addr) {
+    if (!pdo_stream_begin(addr)) {
+        return (false);
+    }
+    if (_backend == PDO_BUS_GPIO) {
+        _latch_ld(_LATCH_L, (addr & 0x000000FF));
+    }
+    // Polling doesn't advance the stream. Leave the address as the 'last read'.
+    _strm_addr = addr + 1;
+    return (true);
+}
+
+void pdo_poll_end() {
+    pdo_stream_end();
+}
+
+uint8_t pdo_poll_read() {
+    if (!_strm_ip) {
+        ERRORNO = -1;
+        return (-1);
+    }
+    if (_backend == PDO_BUS_PIO) {
+        uint8_t data;
+        pdbus_read((_strm_addr - 1), &data, 1);
+        return (data);
+    }
+    return (_gpio_latched_read());
+}
+
+void pdo_data_set_seq(const pdo_wrcycle_t* cycles, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (!_pd_pwr_chk()) {
+        ERRORNO = -1;
+        return;
+    }
+
+    _addr = cycles[count - 1].addr;
+    if (_backend == PDO_BUS_PIO) {
+        uint32_t cmds[_SEQ_PIO_MAX];
+        _pio_op_start();
+        while (count > 0) {
+            uint32_t n = (count < _SEQ_PIO_MAX ? count : _SEQ_PIO_MAX);
+            for (uint32_t i = 0; i < n; i++, cycles++) {
+                cmds[i] = pdbus_cmd_wr(cycles->addr, cycles->data);
+            }
+            pdbus_exec(cmds, n);
+            count -= n;
+        }
+        _pio_op_end();
+        return;
+    }
+    _op_end(); // Just in case something left the device in a command state
+    _op_start();
+    while (count--) {
+        _gpio_addr_set(cycles->addr);
+        _gpio_data_set(cycles->data);
+        cycles++;
+    }
     _op_end();
 }
 
@@ -218,6 +647,27 @@ void pdo_data_set_at(uint32_t addr, uint8_t data) {
     return;
 }
 
+const pdo_timing_t* pdo_timing() {
+    return ((_timing_safe_forced || !_timing_dev) ? &_timing_safe : _timing_dev);
+}
+
+bool pdo_timing_safe_forced() {
+    return (_timing_safe_forced);
+}
+
+void pdo_timing_safe_force(bool safe) {
+    _timing_safe_forced = safe;
+    _timing_apply();
+}
+
+void pdo_timing_set(const pdo_timing_t* timing) {
+    if (timing == _timing_dev) {
+        return;
+    }
+    _timing_dev = timing;
+    _timing_apply();
+}
+
 void pdo_pwr_mode(progdev_pwr_mode_t mode) {
     _pwrmode = mode;
     switch (_pwrmode) {
@@ -238,11 +688,22 @@ progdev_pwr_mode_t pdo_pwr_mode_get() {
     return (_pwrmode);
 }
 
+void pdo_pwr_hold(bool hold) {
+    _pwr_hold = hold;
+    if (!hold && _pwrmode == PDPWR_OFF) {
+        // The mode was set to OFF while the power was held.
+        pdo_request_pwr_on(false);
+    }
+}
+
 bool pdo_request_pwr_on(bool on) {
     static bool _1st_pon;
     if (on == pdo_pwr_is_on()) {
         return (true);
     }
+    if (!on && _pwr_hold) {
+        return (false);
+    }
     bool retval = false;
     if (_pwrmode == PDPWR_AUTO || ((_pwrmode == PDPWR_ON && on) || (_pwrmode == PDPWR_OFF && !on))) {
         if (!on) {
@@ -253,12 +714,14 @@ bool pdo_request_pwr_on(bool on) {
             dbus_wr(0);
             // Set DataBus IN
             dbus_set_in();
+            // The latches lose their values
+            _latch_invalidate();
         }
         gpio_put(OP_DEVICE_PWR, on);
         if (on) {
             gpio_put(OP_DATA_WR, 1); // Set HIGH to avoid driving the PD Data Bus
             // Leave the DATA_LATCH, as taking it from LOW to HIGH latches data
-            sleep_ms(5); // Allow the device to have power for a few ms before access
+            sleep_us(pdo_timing()->tpwr_us); // Allow the device to have power before access
             if (!_1st_pon) {
                 // This is our first time powering the device on.
                 _1st_pon = true;
@@ -282,6 +745,13 @@ void pdo_minit() {
     }
     _initialized = true;
 
+    pdbus_minit();
+    _backend = PDO_BUS_GPIO;
+    _timing_dev = NULL;
+    _timing_apply();
+    _latch_invalidate();
+    pdo_latch_stats_clear();
+
     pdo_pwr_mode(PDPWR_OFF);
     _addrHctrl = (~_FRW_NONE);
 }
@@ -18,9 +18,13 @@
 */
 
 #include "prog_device.h"
+#include "image.h"
+#include "imgcache.h"
 #include "pdops.h"
 
 #include "board.h"
+#include "cmt.h"
+#include "debug_support.h"
 #include "msgpost.h"
 #include "include/util.h"
 
@@ -35,14 +39,28 @@
 #define F_CMD_ERASE1 (0x80) // Requires a 2nd part for Sector or Whole Device
 #define F_CMD_ERASEPART (0x10)  // Requires 1st erase cmd, then this as 2nd cmd.
 #define F_CMD_ERASEPARTADDR (0x55555) // Addr to write erase whole part to.
+#define F_CMD_ERASESECT (0x30)  // Requires 1st erase cmd, then this as 2nd cmd (to the sector address).
 
 #define F_CMD_GETID (0x90)
 #define F_CMD_PROG (0xA0)
 
+#define F_UNLOCK1_ADDR (0x55555)
+#define F_UNLOCK1_DATA (0xAA)
+#define F_UNLOCK2_ADDR (0x2AAAA)
+#define F_UNLOCK2_DATA (0x55)
+
+
 // ====================================================================
 // Data Types/Structures
 // ====================================================================
 
+/** @brief What a sync needs to do to a sector */
+typedef enum _sync_sect_ {
+    _SYNC_CLEAN = 0,    // Matches the image
+    _SYNC_PROG,         // Needs only 1->0 bit changes (program in place)
+    _SYNC_DIRTY,        // Needs to be erased and programmed
+} _sync_sect_t;
+
 // ====================================================================
 // Data Section
 // ====================================================================
@@ -51,6 +69,23 @@ static bool _initialized;
 
 static pd_op_status_t _method_status;
 
+/** @brief Elapsed time of the last polled (program/erase) operation */
+static uint32_t _op_elapsed_us;
+/** @brief The final value read by the last polled operation (the settled data) */
+static uint8_t _op_last_value;
+/** @brief The number of times to retry programming a byte that doesn't verify */
+static uint8_t _prog_retries;
+
+/** @brief Statistics of the last block program (or sync) operation */
+static pd_prog_stats_t _prog_stats;
+
+/** @brief Asynchronous operation in progress (PD_AOP_NONE if none) */
+static pd_async_op_t _aop;
+static uint8_t _aop_arg;
+static uint32_t _aop_addr;
+static uint32_t _aop_start;
+static uint32_t _aop_timeout_us;
+
 #define FDMFGID_AMD 0x01
 #define FDMFG_AMD "AMD"
 #define FDMFGID_MicroChp 0xBF
@@ -64,7 +99,12 @@ static md_info_t md_AMD_Am29F040B = {
     .sectcnt = 8,
     .abm = 18,
     .mfgs = FDMFG_AMD,
-    .devs = "Am29F040"
+    .devs = "Am29F040",
+    .flags = (PD_FLG_MULTI_SECT_ER),
+    .tprog_us = 300,
+    .tsecter_ms = 8000,
+    .tchiper_ms = 64000,
+    .timing = { .tacc_ns = 120, .twp_ns = 50, .tls_ns = 25, .tpwr_us = 1000 }
 };
 
 static md_info_t md_MC_SST39SF010 = {
@@ -73,7 +113,12 @@ static md_info_t md_MC_SST39SF010 = {
     .sectcnt = 32,
     .abm = 16,
     .mfgs = FDMFG_MicroChp,
-    .devs = "SST39SF010A"
+    .devs = "SST39SF010A",
+    .flags = 0,
+    .tprog_us = 20,
+    .tsecter_ms = 25,
+    .tchiper_ms = 100,
+    .timing = { .tacc_ns = 70, .twp_ns = 40, .tls_ns = 25, .tpwr_us = 1000 }
 };
 
 static md_info_t md_MC_SST39SF020 = {
@@ -82,7 +127,12 @@ static md_info_t md_MC_SST39SF020 = {
     .sectcnt = 64,
     .abm = 17,
     .mfgs = FDMFG_MicroChp,
-    .devs = "SST39SF020A"
+    .devs = "SST39SF020A",
+    .flags = 0,
+    .tprog_us = 20,
+    .tsecter_ms = 25,
+    .tchiper_ms = 100,
+    .timing = { .tacc_ns = 70, .twp_ns = 40, .tls_ns = 25, .tpwr_us = 1000 }
 };
 
 static md_info_t md_MC_SST39SF040 = {
@@ -91,7 +141,12 @@ static md_info_t md_MC_SST39SF040 = {
     .sectcnt = 128,
     .abm = 18,
     .mfgs = FDMFG_MicroChp,
-    .devs = "SST39SF040"
+    .devs = "SST39SF040",
+    .flags = 0,
+    .tprog_us = 20,
+    .tsecter_ms = 25,
+    .tchiper_ms = 100,
+    .timing = { .tacc_ns = 70, .twp_ns = 40, .tls_ns = 25, .tpwr_us = 1000 }
 };
 
 static md_info_t md_MX_MX29F040 = {
@@ -100,7 +155,12 @@ static md_info_t md_MX_MX29F040 = {
     .sectcnt = 8,
     .abm = 18,
     .mfgs = FDMFG_Micnx,
-    .devs = "MX29F040"
+    .devs = "MX29F040",
+    .flags = (PD_FLG_MULTI_SECT_ER),
+    .tprog_us = 300,
+    .tsecter_ms = 15000,
+    .tchiper_ms = 64000,
+    .timing = { .tacc_ns = 120, .twp_ns = 50, .tls_ns = 25, .tpwr_us = 1000 }
 };
 
 /** @brief The value of a byte that is considered empty */
@@ -108,16 +168,22 @@ static md_info_t md_MX_MX29F040 = {
 
 #define PROG_OP_STATUS_INV 0x80
 #define PROG_OP_STATUS_TGL 0x40
-/** @brief Bit7 and Bit6 are the programming operation status bits */
-#define PROG_OP_STATUS_BITS (PROG_OP_STATUS_INV | PROG_OP_STATUS_TGL)
 
-/** @brief MicroChip Sector Erase sector to address adjust */
-#define PD_MicroChp_SECT_ER_ADJ 12
-#define PD_MicroChp_SECT_ER_CMD 0x30
+/** @brief Interval to poll for the completion of an asynchronous operation */
+#define PD_ASYNC_POLL_MS 2
+
+/** @brief Default number of times to retry programming a byte that doesn't verify */
+#define PD_PROG_RETRIES_DEF 1
+
+/** @brief Block operations call the progress handler after each block of this size */
+#define PD_PROGRESS_BLOCK (4*ONE_K)
 
 /** @brief Image for one sector (largest) of the programmable device */
 static uint8_t _imgbuf[64*ONE_K];
 
+/** @brief Bus cycles for a multi-sector erase (the erase command and a sector erase for each sector) */
+static pdo_wrcycle_t _ersect_cycles[5 + PD_SECT_MAX];
+
 /** @brief The size in bytes of the current device sector */
 static uint32_t _sector_size;
 
@@ -134,6 +200,9 @@ static const md_info_t* mfgdev[] = {
 // Local/Private Method Declarations
 // ====================================================================
 
+static bool _cmd_2nd(uint32_t addr, uint8_t cmd);
+static pd_op_status_t _erase_start(const md_info_t* info, uint8_t sect, uint32_t* polladdr);
+
 
 // ====================================================================
 // Run-After/Delay/Sleep Methods
@@ -167,27 +236,100 @@ static void _handle_housekeeping(cmt_msg_t* msg) {
     cnt++;
 }
 
+/**
+ * @brief Poll for the completion of the asynchronous operation in progress.
+ *
+ * This is scheduled every PD_ASYNC_POLL_MS while the operation is in progress. Each
+ * time, the status is read to see if DQ6 is still toggling. When the operation
+ * completes (or takes longer than the device's maximum time) MSG_PD_OP_DONE is
+ * posted to the APP core.
+ *
+ * @param msg Nothing important in the message.
+ */
+static void _handle_async_poll(cmt_msg_t* msg) {
+    if (_aop == PD_AOP_NONE) {
+        return;
+    }
+    pd_op_status_t status = PD_OP_TIMEOUT;
+    bool done = true;
+    if (!pdo_poll_begin(_aop_addr)) {
+        status = PD_NOT_READY;
+    }
+    else {
+        uint8_t v1 = pdo_poll_read();
+        uint8_t v2 = pdo_poll_read();
+        if (((v1 ^ v2) & PROG_OP_STATUS_TGL) == 0) {
+            // Toggling has stopped. Read again, as the data bits can settle after the status bits.
+            v2 = pdo_poll_read();
+            status = (v2 == MT_BYTE_VAL ? PD_OP_OK : PD_ERASE_FAIL);
+        }
+        else if ((time_us_32() - _aop_start) < _aop_timeout_us) {
+            done = false;
+        }
+        pdo_poll_end();
+    }
+    if (!done) {
+        cmt_msg_t pmsg;
+        cmt_exec_init(&pmsg, _handle_async_poll);
+        schedule_msg_in_ms(PD_ASYNC_POLL_MS, &pmsg);
+        return;
+    }
+    _op_elapsed_us = time_us_32() - _aop_start;
+    _method_status = status;
+    cmt_msg_t dmsg;
+    cmt_msg_init(&dmsg, MSG_PD_OP_DONE);
+    dmsg.data.op_done.op = _aop;
+    dmsg.data.op_done.arg = _aop_arg;
+    dmsg.data.op_done.status = status;
+    dmsg.data.op_done.elapsed_ms = _op_elapsed_us / 1000;
+    _aop = PD_AOP_NONE;
+    pdo_pwr_hold(false);
+    postAPPMsg(&dmsg);
+}
+
 
 // ====================================================================
 // Local/Private Methods
 // ====================================================================
 
-static uint8_t _chk_wr_status(uint8_t expected) {
-    uint8_t v = pdo_data_get();
-    uint8_t sb = (v & PROG_OP_STATUS_BITS);
+/**
+ * @brief Poll the device for the completion of a program or erase operation.
+ *
+ * The address is set once and then read repeatedly. The operation is complete when
+ * DQ6 stops toggling. The final value is then checked against the expected value
+ * (DQ7 is the true data once the operation completes), so a program operation is
+ * verified without a separate read. The time the operation took is recorded (see
+ * `pd_op_elapsed_us`) and the final value is kept in `_op_last_value`.
+ *
+ * @param addr The address to poll (the address programmed or an address within the erase)
+ * @param expected The expected value when complete (0xFF for an erase)
+ * @param timeout_us The maximum time the operation can take
+ * @param failstatus The status to return if the final value isn't the expected value
+ * @return pd_op_status_t PD_OP_OK, PD_OP_TIMEOUT, PD_NOT_READY, or `failstatus`
+ */
+static pd_op_status_t _poll_op(uint32_t addr, uint8_t expected, uint32_t timeout_us, pd_op_status_t failstatus) {
+    uint32_t start = time_us_32();
+    if (!pdo_poll_begin(addr)) {
+        return (PD_NOT_READY);
+    }
+    pd_op_status_t status = PD_OP_TIMEOUT;
+    uint8_t v1 = pdo_poll_read();
     uint8_t v2;
-    uint8_t s2;
     do {
-        v2 = pdo_data_get();
-        s2 = (v2 & PROG_OP_STATUS_BITS);
-        if ((sb & PROG_OP_STATUS_TGL) == (s2 & PROG_OP_STATUS_TGL)) {
+        v2 = pdo_poll_read();
+        if (((v1 ^ v2) & PROG_OP_STATUS_TGL) == 0) {
+            // Toggling has stopped. Read again, as the data bits can settle after the status bits.
+            v2 = pdo_poll_read();
+            status = (v2 == expected ? PD_OP_OK : failstatus);
             break;
         }
-        sb = s2;
-    }
-    while (v2 != expected);
+        v1 = v2;
+    } while ((time_us_32() - start) < timeout_us);
+    _op_elapsed_us = time_us_32() - start;
+    _op_last_value = v2;
+    pdo_poll_end();
 
-    return (v2);
+    return (status);
 }
 
 static void _clr_device_buf() {
@@ -195,41 +337,224 @@ static void _clr_device_buf() {
 }
 
 static bool _cmd_start(uint8_t cmd) {
+    return (_cmd_2nd(F_UNLOCK1_ADDR, cmd));
+}
+
+static bool _cmd_2nd(uint32_t addr, uint8_t cmd) {
+    const pdo_wrcycle_t cycles[] = {
+        { F_UNLOCK1_ADDR, F_UNLOCK1_DATA },
+        { F_UNLOCK2_ADDR, F_UNLOCK2_DATA },
+        { addr, cmd },
+    };
     ERRORNO = 0;
-    pdo_data_set_at(0x55555, 0xAA);
-    if (ERRORNO < 0) {
-        return (false);
+    pdo_data_set_seq(cycles, 3);
+    return (ERRORNO >= 0);
+}
+
+static void _cmd_end() {
+    pdo_data_set_at(0, 0xF0);
+}
+
+/**
+ * @brief Issue the erase command for the device or a sector. Doesn't wait for completion.
+ *
+ * @param info md_info pointer for the device.
+ * @param sect The sector number, or PD_INVALID_SECT to erase the whole device
+ * @param polladdr Set to an address within the area being erased (to poll for completion)
+ * @return pd_op_status_t PD_OP_OK if the erase was started
+ */
+static pd_op_status_t _erase_start(const md_info_t* info, uint8_t sect, uint32_t* polladdr) {
+    uint32_t addr = F_CMD_ERASEPARTADDR;
+    uint8_t cmd = F_CMD_ERASEPART;
+    *polladdr = 0;
+    if (sect != PD_INVALID_SECT) {
+        if (sect >= info->sectcnt) {
+            return (PD_ADDR_INVALID);
+        }
+        addr = sect * pd_sectsize(info);
+        cmd = F_CMD_ERASESECT;
+        *polladdr = addr;
     }
-    pdo_data_set_at(0x2AAAA, 0x55);
-    if (ERRORNO < 0) {
-        return (false);
+    _cmd_end(); // Just in case the device was left in a command state.
+    if (!_cmd_start(F_CMD_ERASE1)) {
+        return (PD_NOT_READY);
     }
-    pdo_data_set_at(0x55555, cmd);
-    if (ERRORNO < 0) {
-        return (false);
+    if (!_cmd_2nd(addr, cmd)) {
+        return (PD_NOT_ERASED);
     }
-    return (true);
+    return (PD_OP_OK);
 }
 
-static bool _cmd_2nd(uint32_t addr, uint8_t cmd) {
+/**
+ * @brief Issue an erase and schedule the polling for its completion.
+ *
+ * @param info md_info pointer for the device.
+ * @param op The asynchronous operation
+ * @param sect The sector number, or PD_INVALID_SECT to erase the whole device
+ * @param timeout_us The maximum time the erase can take
+ * @return pd_op_status_t PD_OP_OK if the erase was started
+ */
+static pd_op_status_t _erase_start_async(const md_info_t* info, pd_async_op_t op, uint8_t sect, uint32_t timeout_us) {
+    if (_aop != PD_AOP_NONE) {
+        return (PD_NOT_READY);
+    }
+    uint32_t polladdr;
+    pd_op_status_t status = _erase_start(info, sect, &polladdr);
+    if (status != PD_OP_OK) {
+        return (status);
+    }
+    _aop = op;
+    pdo_pwr_hold(true);
+    _aop_arg = sect;
+    _aop_addr = polladdr;
+    _aop_timeout_us = timeout_us;
+    _aop_start = time_us_32();
+    cmt_msg_t pmsg;
+    cmt_exec_init(&pmsg, _handle_async_poll);
+    schedule_msg_in_ms(PD_ASYNC_POLL_MS, &pmsg);
+    return (PD_OP_OK);
+}
+
+/**
+ * @brief Program a byte and wait (bounded) for the program operation to complete.
+ *
+ * The unlock, program command, and data are written as one sequence. Completion
+ * is polled for up to the device's maximum byte program time.
+ *
+ * @param info md_info pointer for the device.
+ * @param addr The address to program
+ * @param data The value to program
+ * @return pd_op_status_t PD_OP_OK, PD_NOT_READY, PD_OP_TIMEOUT, or PD_PROG_FAILED
+ */
+static pd_op_status_t _prog_byte(const md_info_t* info, uint32_t addr, uint8_t data) {
+    const pdo_wrcycle_t cycles[] = {
+        { F_UNLOCK1_ADDR, F_UNLOCK1_DATA },
+        { F_UNLOCK2_ADDR, F_UNLOCK2_DATA },
+        { F_UNLOCK1_ADDR, F_CMD_PROG },
+        { addr, data },
+    };
     ERRORNO = 0;
-    pdo_data_set_at(0x55555, 0xAA);
+    pdo_data_set_seq(cycles, 4);
     if (ERRORNO < 0) {
-        return (false);
+        return (PD_NOT_READY);
     }
-    pdo_data_set_at(0x2AAAA, 0x55);
-    if (ERRORNO < 0) {
-        return (false);
+    return (_poll_op(addr, data, info->tprog_us, PD_PROG_FAILED));
+}
+
+/**
+ * @brief Program a byte, verifying it with the value read when the program completes.
+ *
+ * A mismatch is counted and logged. If the value read only has bits that still
+ * need to go 1->0, the byte is programmed again (up to the number of retries set).
+ *
+ * @param info md_info pointer for the device.
+ * @param addr The address to program
+ * @param data The value to program
+ * @return pd_op_status_t PD_OP_OK, PD_NOT_READY, PD_OP_TIMEOUT, or PD_PROG_FAILED
+ */
+static pd_op_status_t _prog_byte_verified(const md_info_t* info, uint32_t addr, uint8_t data) {
+    pd_op_status_t ps = _prog_byte(info, addr, data);
+    uint8_t retry = 0;
+    while (ps == PD_PROG_FAILED) {
+        _prog_stats.mismatches++;
+        debug_printf("PD verify %05lX: wrote %02X read %02X\n", addr, data, _op_last_value);
+        if (retry >= _prog_retries || (_op_last_value & data) != data) {
+            // Out of retries, or a bit is 0 that should be 1 (programming can't fix it).
+            break;
+        }
+        retry++;
+        _prog_stats.retries++;
+        ps = _prog_byte(info, addr, data);
     }
-    pdo_data_set_at(addr, cmd);
-    if (ERRORNO < 0) {
-        return (false);
+    return (ps);
+}
+
+
+/**
+ * @brief Find the next byte that isn't 0xFF (the erased value).
+ *
+ * The buffer is scanned a word at a time where possible.
+ *
+ * @param buf The buffer
+ * @param i The index to start at
+ * @param end The index to stop at
+ * @return uint32_t The index of the next non-0xFF byte or `end` if there isn't one
+ */
+static uint32_t _next_not_erased(const uint8_t* buf, uint32_t i, uint32_t end) {
+    while (i < end && ((uintptr_t)(buf + i) & 3) != 0) {
+        if (buf[i] != MT_BYTE_VAL) {
+            return (i);
+        }
+        i++;
     }
-    return (true);
+    while ((end - i) >= 4) {
+        uint32_t w;
+        memcpy(&w, (buf + i), 4);   // Aligned, so this is a single word load
+        if (w != 0xFFFFFFFF) {
+            break;
+        }
+        i += 4;
+    }
+    while (i < end && buf[i] == MT_BYTE_VAL) {
+        i++;
+    }
+    return (i);
 }
 
-static void _cmd_end() {
-    pdo_data_set_at(0, 0xF0);
+/**
+ * @brief Program the bytes of a block that differ from the current device content.
+ *
+ * The caller must have checked that each byte can be programmed (only 1->0 bit changes).
+ * When the block is erased, the data is scanned for runs of non-0xFF bytes and
+ * only those are programmed. The bytes programmed and skipped are added to the
+ * programming statistics.
+ *
+ * @param info md_info pointer for the device.
+ * @param addr The starting address
+ * @param buf The data to program
+ * @param cur The current device content, or NULL if the block is erased (all 0xFF)
+ * @param len The number of bytes
+ * @param progstatfn Progress status handler function to be called (or NULL).
+ * @param failaddr Set to the address that failed. Can be NULL.
+ * @return pd_op_status_t Operation status
+ */
+static pd_op_status_t _program_bytes(const md_info_t* info, uint32_t addr, const uint8_t* buf, const uint8_t* cur, uint32_t len, const progstat_handler_fn progstatfn, uint32_t* failaddr) {
+    _cmd_end(); // Just in case the device was left in a command state.
+    uint32_t nprog = 0;
+    for (uint32_t blk = 0; blk < len; blk += PD_PROGRESS_BLOCK) {
+        uint32_t end = (len - blk > PD_PROGRESS_BLOCK ? blk + PD_PROGRESS_BLOCK : len);
+        uint32_t i = blk;
+        while (i < end) {
+            if (!cur) {
+                // Only the runs of non-0xFF bytes need to be programmed.
+                i = _next_not_erased(buf, i, end);
+                if (i >= end) {
+                    break;
+                }
+            }
+            uint8_t data = buf[i];
+            if (data != (cur ? cur[i] : MT_BYTE_VAL)) {
+                pd_op_status_t ps = _prog_byte_verified(info, addr + i, data);
+                if (ps != PD_OP_OK) {
+                    _cmd_end();
+                    if (failaddr) {
+                        *failaddr = addr + i;
+                    }
+                    _prog_stats.programmed += nprog;
+                    _prog_stats.skipped += (i - nprog);
+                    return (ps);
+                }
+                nprog++;
+            }
+            i++;
+        }
+        if (progstatfn) {
+            progstatfn(addr + end - 1);
+        }
+    }
+    _prog_stats.programmed += nprog;
+    _prog_stats.skipped += (len - nprog);
+    return (PD_OP_OK);
 }
 
 
@@ -237,51 +562,173 @@ static void _cmd_end() {
 // Public Methods
 // ====================================================================
 
+bool pd_async_busy() {
+    return (_aop != PD_AOP_NONE);
+}
+
+uint8_t* pd_borrow_sect_buf(uint32_t* size) {
+    *size = sizeof(_imgbuf);
+    return (_imgbuf);
+}
+
 pd_op_status_t pd_erase_device(const md_info_t* info) {
-    if (info->mfgid != FDMFGID_MicroChp) {
-        _method_status = PD_DEV_NOSUP; // Currently, only support MicroChip
-        return (_method_status);
-    }
-    _cmd_end(); // Just in case the device was left in a command state.
-    if (!_cmd_start(F_CMD_ERASE1)) {
+    if (_aop != PD_AOP_NONE) {
         _method_status = PD_NOT_READY;
         return (_method_status);
     }
-    if (!_cmd_2nd(F_CMD_ERASEPARTADDR, F_CMD_ERASEPART)) {
-        _method_status = PD_NOT_ERASED;
+    uint32_t polladdr;
+    _method_status = _erase_start(info, PD_INVALID_SECT, &polladdr);
+    if (_method_status != PD_OP_OK) {
         return (_method_status);
     }
-    pdo_addr_set(0);
-    uint8_t sv = _chk_wr_status(MT_BYTE_VAL);
-    _method_status = (sv == MT_BYTE_VAL ? PD_OP_OK : PD_ERASE_FAIL);
+    _method_status = _poll_op(polladdr, MT_BYTE_VAL, (info->tchiper_ms * 1000), PD_ERASE_FAIL);
+    return (_method_status);
+}
+
+pd_op_status_t pd_erase_device_async(const md_info_t* info) {
+    _method_status = _erase_start_async(info, PD_AOP_ERASE_DEVICE, PD_INVALID_SECT, (info->tchiper_ms * 1000));
     return (_method_status);
 }
 
 pd_op_status_t pd_erase_sect(const md_info_t* info, uint8_t sect) {
-    if (info->mfgid != FDMFGID_MicroChp) {
-        _method_status = PD_DEV_NOSUP; // Currently, only support MicroChip
+    if (_aop != PD_AOP_NONE) {
+        _method_status = PD_NOT_READY;
         return (_method_status);
     }
-    if (sect >= info->sectcnt) {
+    if (sect == PD_INVALID_SECT) {
         _method_status = PD_ADDR_INVALID;
         return (_method_status);
     }
+    uint32_t polladdr;
+    _method_status = _erase_start(info, sect, &polladdr);
+    if (_method_status != PD_OP_OK) {
+        return (_method_status);
+    }
+    _method_status = _poll_op(polladdr, MT_BYTE_VAL, (info->tsecter_ms * 1000), PD_ERASE_FAIL);
+    return (_method_status);
+}
+
+pd_op_status_t pd_erase_sectors(const md_info_t* info, const pd_sectmap_t* sectmap) {
+    if (_aop != PD_AOP_NONE) {
+        _method_status = PD_NOT_READY;
+        return (_method_status);
+    }
+    uint8_t cnt = 0;
+    for (uint8_t sect = 0; sect < info->sectcnt; sect++) {
+        if (pd_sectmap_isset(sectmap, sect)) {
+            cnt++;
+        }
+    }
+    if (cnt == 0) {
+        _op_elapsed_us = 0;
+        _method_status = PD_OP_OK;
+        return (_method_status);
+    }
+    if (cnt == info->sectcnt) {
+        // Everything - a single chip erase.
+        return (pd_erase_device(info));
+    }
+    if (!(info->flags & PD_FLG_MULTI_SECT_ER)) {
+        // Erase them one at a time.
+        uint32_t elapsed = 0;
+        for (uint8_t sect = 0; sect < info->sectcnt; sect++) {
+            if (pd_sectmap_isset(sectmap, sect)) {
+                pd_erase_sect(info, sect);
+                elapsed += _op_elapsed_us;
+                if (_method_status != PD_OP_OK) {
+                    break;
+                }
+            }
+        }
+        _op_elapsed_us = elapsed;
+        return (_method_status);
+    }
+    // Queue all of the sectors in one erase. The sector erase commands following the
+    // first must each be written within the sector erase timeout (50us) of the previous,
+    // so they are all written as one sequence.
+    pdo_wrcycle_t* cycles = _ersect_cycles;
+    const pdo_wrcycle_t start[] = {
+        { F_UNLOCK1_ADDR, F_UNLOCK1_DATA },
+        { F_UNLOCK2_ADDR, F_UNLOCK2_DATA },
+        { F_UNLOCK1_ADDR, F_CMD_ERASE1 },
+        { F_UNLOCK1_ADDR, F_UNLOCK1_DATA },
+        { F_UNLOCK2_ADDR, F_UNLOCK2_DATA },
+    };
+    memcpy(cycles, start, sizeof(start));
+    uint32_t n = 5;
+    uint32_t sectsize = pd_sectsize(info);
+    for (uint8_t sect = 0; sect < info->sectcnt; sect++) {
+        if (pd_sectmap_isset(sectmap, sect)) {
+            cycles[n].addr = sect * sectsize;
+            cycles[n].data = F_CMD_ERASESECT;
+            n++;
+        }
+    }
     _cmd_end(); // Just in case the device was left in a command state.
-    uint32_t seaddr = ((uint32_t)sect << PD_MicroChp_SECT_ER_ADJ);
-    if (!_cmd_start(F_CMD_ERASE1)) {
+    ERRORNO = 0;
+    pdo_data_set_seq(cycles, n);
+    if (ERRORNO < 0) {
         _method_status = PD_NOT_READY;
         return (_method_status);
     }
-    if (!_cmd_2nd(seaddr, PD_MicroChp_SECT_ER_CMD)) {
-        _method_status = PD_NOT_ERASED;
+    // The device's max erase time is per sector, so allow that for each of the sectors.
+    _method_status = _poll_op(cycles[5].addr, MT_BYTE_VAL, (info->tsecter_ms * 1000 * cnt), PD_ERASE_FAIL);
+    return (_method_status);
+}
+
+pd_op_status_t pd_erase_sect_async(const md_info_t* info, uint8_t sect) {
+    if (sect == PD_INVALID_SECT) {
+        _method_status = PD_ADDR_INVALID;
+        return (_method_status);
+    }
+    _method_status = _erase_start_async(info, PD_AOP_ERASE_SECT, sect, (info->tsecter_ms * 1000));
+    return (_method_status);
+}
+
+pd_op_status_t pd_erase_sect_start(const md_info_t* info, uint8_t sect) {
+    if (_aop != PD_AOP_NONE) {
+        _method_status = PD_NOT_READY;
+        return (_method_status);
+    }
+    if (sect == PD_INVALID_SECT) {
+        _method_status = PD_ADDR_INVALID;
+        return (_method_status);
+    }
+    uint32_t polladdr;
+    _method_status = _erase_start(info, sect, &polladdr);
+    if (_method_status != PD_OP_OK) {
+        return (_method_status);
+    }
+    // Mark the device busy (like an async erase), but don't schedule the polling.
+    _aop = PD_AOP_ERASE_SECT;
+    pdo_pwr_hold(true);
+    _aop_arg = sect;
+    _aop_addr = polladdr;
+    _aop_timeout_us = (info->tsecter_ms * 1000);
+    _aop_start = time_us_32();
+    return (_method_status);
+}
+
+pd_op_status_t pd_erase_wait() {
+    if (_aop == PD_AOP_NONE) {
+        _method_status = PD_OP_OK;
         return (_method_status);
     }
-    uint8_t sv = _chk_wr_status(MT_BYTE_VAL);
-    _method_status = (sv == MT_BYTE_VAL ? PD_OP_OK : PD_ERASE_FAIL);
+    uint32_t elapsed = time_us_32() - _aop_start;
+    uint32_t remaining = (elapsed < _aop_timeout_us ? _aop_timeout_us - elapsed : 0);
+    _method_status = _poll_op(_aop_addr, MT_BYTE_VAL, remaining, PD_ERASE_FAIL);
+    _op_elapsed_us = time_us_32() - _aop_start;
+    _aop = PD_AOP_NONE;
+    pdo_pwr_hold(false);
     return (_method_status);
 }
 
 const md_info_t* pd_info() {
+    if (_aop != PD_AOP_NONE) {
+        _method_status = PD_NOT_READY;
+        return (NULL);
+    }
+    pdo_timing_set(NULL);   // Use the safe timing until the device is known
     _cmd_end(); // Just in case the device was left in a command state.
     if (!_cmd_start(F_CMD_GETID)) {
         _method_status = PD_NOT_READY;
@@ -309,6 +756,9 @@ const md_info_t* pd_info() {
         }
         indx++;
     }
+    if (info) {
+        pdo_timing_set(&info->timing);
+    }
     _method_status = (info ? PD_OP_OK : PD_NOT_IDENTIFIED);
     return (info);
 }
@@ -322,11 +772,17 @@ bool pd_is_empty(const progstat_handler_fn progstatfn) {
     // Get the size (one more than the max address)
     uint32_t size = pd_size(info);
     // Scan the device looking for a non-empty byte
+    if (!pdo_stream_begin(0)) {
+        _method_status = PD_NOT_READY;
+        return (false);
+    }
     uint32_t addr = 0;
     while (addr < size) {
         for (uint32_t i = 0; i < ONE_K && addr < size; i++) {
-            uint8_t v = pdo_data_get_from(addr++);
+            uint8_t v = pdo_stream_next();
+            addr++;
             if (v != MT_BYTE_VAL) {
+                pdo_stream_end();
                 _method_status = PD_NOT_ERASED;
                 return (false);
             }
@@ -335,6 +791,7 @@ bool pd_is_empty(const progstat_handler_fn progstatfn) {
             progstatfn(addr - 1);
         }
     }
+    pdo_stream_end();
     _method_status = PD_OP_OK;
     return (true);
 }
@@ -351,14 +808,19 @@ bool pd_is_sect_empty(uint8_t sect) {
     if (saddr == PD_INVALID_ADDR) {
         return false;
     }
-    uint32_t end = saddr + sectsize;
-    for (uint32_t i = saddr; i < end; i++) {
-        uint8_t v = pdo_data_get_from(i);
+    if (!pdo_stream_begin(saddr)) {
+        _method_status = PD_NOT_READY;
+        return (false);
+    }
+    for (uint32_t i = 0; i < sectsize; i++) {
+        uint8_t v = pdo_stream_next();
         if (v != MT_BYTE_VAL) {
+            pdo_stream_end();
             _method_status = PD_NOT_ERASED;
             return (false);
         }
     }
+    pdo_stream_end();
     _method_status = PD_OP_OK;
     return (true);
 }
@@ -367,6 +829,253 @@ pd_op_status_t pd_method_status() {
     return _method_status;
 }
 
+uint8_t pd_prog_retries() {
+    return (_prog_retries);
+}
+
+void pd_prog_retries_set(uint8_t retries) {
+    _prog_retries = retries;
+}
+
+const pd_prog_stats_t* pd_prog_stats() {
+    return (&_prog_stats);
+}
+
+uint32_t pd_op_elapsed_us() {
+    return (_op_elapsed_us);
+}
+
+pd_op_status_t pd_read_block(const md_info_t* info, uint32_t addr, uint8_t* buf, uint32_t len, const progstat_handler_fn progstatfn) {
+    if (_aop != PD_AOP_NONE) {
+        _method_status = PD_NOT_READY;
+        return (_method_status);
+    }
+    uint32_t size = pd_size(info);
+    if (addr >= size || len > (size - addr)) {
+        _method_status = PD_ADDR_INVALID;
+        return (_method_status);
+    }
+    if (!pdo_stream_begin(addr)) {
+        _method_status = PD_NOT_READY;
+        return (_method_status);
+    }
+    while (len > 0) {
+        uint32_t n = (progstatfn && len > PD_PROGRESS_BLOCK ? PD_PROGRESS_BLOCK : len);
+        pdo_stream_read(buf, n);
+        buf += n;
+        addr += n;
+        len -= n;
+        if (progstatfn) {
+            progstatfn(addr - 1);
+        }
+    }
+    pdo_stream_end();
+    _method_status = PD_OP_OK;
+    return (_method_status);
+}
+
+pd_op_status_t pd_read_sect(const md_info_t* info, uint8_t sect, uint8_t* buf, const progstat_handler_fn progstatfn) {
+    if (sect >= info->sectcnt) {
+        _method_status = PD_ADDR_INVALID;
+        return (_method_status);
+    }
+    uint32_t sectsize = pd_sectsize(info);
+    return (pd_read_block(info, (sect * sectsize), buf, sectsize, progstatfn));
+}
+
+pd_op_status_t pd_program_block(const md_info_t* info, uint32_t addr, const uint8_t* buf, uint32_t len, const progstat_handler_fn progstatfn, uint32_t* failaddr) {
+    uint32_t start = time_us_32();
+    memset(&_prog_stats, 0, sizeof(_prog_stats));
+    uint32_t size = pd_size(info);
+    if (failaddr) {
+        *failaddr = PD_INVALID_ADDR;
+    }
+    if (_aop != PD_AOP_NONE) {
+        _method_status = PD_NOT_READY;
+        return (_method_status);
+    }
+    if (addr >= size || len > (size - addr)) {
+        _method_status = PD_ADDR_INVALID;
+        return (_method_status);
+    }
+    // Pre-scan the block. Every location that will be programmed must be empty.
+    if (!pdo_stream_begin(addr)) {
+        _method_status = PD_NOT_READY;
+        return (_method_status);
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t v = pdo_stream_next();
+        if (buf[i] != MT_BYTE_VAL && v != MT_BYTE_VAL) {
+            pdo_stream_end();
+            if (failaddr) {
+                *failaddr = addr + i;
+            }
+            _method_status = PD_NOT_ERASED;
+            return (_method_status);
+        }
+    }
+    pdo_stream_end();
+    // Program the block. Bytes that are 0xFF are already in the erased state.
+    _method_status = _program_bytes(info, addr, buf, NULL, len, progstatfn, failaddr);
+    _prog_stats.elapsed_ms = (time_us_32() - start) / 1000;
+    return (_method_status);
+}
+
+pd_op_status_t pd_sync(const md_info_t* info, pd_sect_data_fn sectdatafn, const pd_sectmap_t* donemap, pd_sect_done_fn donefn, const progstat_handler_fn progstatfn, pd_sync_stats_t* stats, uint32_t* failaddr) {
+    uint32_t start = time_us_32();
+    pd_sync_stats_t st;
+    memset(&st, 0, sizeof(st));
+    memset(&_prog_stats, 0, sizeof(_prog_stats));
+    if (failaddr) {
+        *failaddr = PD_INVALID_ADDR;
+    }
+    pd_op_status_t status = PD_OP_OK;
+    uint8_t state[PD_SECT_MAX];
+    pd_sectmap_t dirtymap;
+    pd_sectmap_clr(&dirtymap);
+    pd_sectmap_t done;
+    pd_sectmap_clr(&done);
+    bool resume = false;
+    uint8_t ndirty = 0;
+    uint32_t sectsize = pd_sectsize(info);
+    uint32_t nprog_sect = 0;    // Bytes to program if erasing by sector
+    uint32_t nprog_chip = 0;    // Bytes to program if chip erasing
+    if (_aop != PD_AOP_NONE) {
+        status = PD_NOT_READY;
+        goto _finally;
+    }
+    //
+    // Compare the image with the device and classify each sector.
+    for (uint8_t sect = 0; sect < info->sectcnt; sect++) {
+        uint32_t saddr = sect * sectsize;
+        if (donemap && pd_sectmap_isset(donemap, sect)) {
+            // Already known to match (resuming)
+            state[sect] = _SYNC_CLEAN;
+            pd_sectmap_set(&done, sect);
+            resume = true;
+            if (progstatfn) {
+                progstatfn(saddr + sectsize - 1);
+            }
+            continue;
+        }
+        const uint8_t* img = sectdatafn(sect, sectsize);
+        if (!img) {
+            status = PD_IMG_ERROR;
+            goto _finally;
+        }
+        status = pd_read_block(info, saddr, _imgbuf, sectsize, NULL);
+        if (status != PD_OP_OK) {
+            goto _finally;
+        }
+        uint32_t ndiff = 0;
+        uint32_t nset = 0;
+        bool dirty = false;
+        for (uint32_t i = 0; i < sectsize; i++) {
+            uint8_t d = _imgbuf[i];
+            uint8_t v = img[i];
+            if (v != MT_BYTE_VAL) {
+                nset++;
+            }
+            if (d != v) {
+                ndiff++;
+                if ((d & v) != v) {
+                    dirty = true;   // A bit needs to go 0->1
+                }
+            }
+        }
+        if (dirty) {
+            state[sect] = _SYNC_DIRTY;
+            pd_sectmap_set(&dirtymap, sect);
+            ndirty++;
+            nprog_sect += nset;
+        }
+        else {
+            state[sect] = (ndiff ? _SYNC_PROG : _SYNC_CLEAN);
+            nprog_sect += ndiff;
+            if (!ndiff) {
+                pd_sectmap_set(&done, sect);
+            }
+        }
+        nprog_chip += nset;
+        if (progstatfn) {
+            progstatfn(saddr + sectsize - 1);
+        }
+    }
+    //
+    // Cost model. Estimate the time using the device's erase and program times.
+    // The sector erase time applies to each sector (even if they are queued).
+    uint64_t cost_sect = ((uint64_t)ndirty * info->tsecter_ms * 1000) + ((uint64_t)nprog_sect * info->tprog_us);
+    uint64_t cost_chip = ((uint64_t)info->tchiper_ms * 1000) + ((uint64_t)nprog_chip * info->tprog_us);
+    // A resumed sync doesn't chip erase (that would undo the sectors already done).
+    st.chiperase = (!resume && ndirty > 0 && cost_chip < cost_sect);
+    if (st.chiperase) {
+        pd_sectmap_clr(&done);
+    }
+    if (donefn) {
+        donefn(&done);
+    }
+    if (st.chiperase) {
+        status = pd_erase_device(info);
+        for (uint8_t sect = 0; sect < info->sectcnt; sect++) {
+            state[sect] = _SYNC_DIRTY;
+        }
+    }
+    else if (ndirty > 0) {
+        status = pd_erase_sectors(info, &dirtymap);
+    }
+    if (status != PD_OP_OK) {
+        goto _finally;
+    }
+    //
+    // Program the sectors that need it.
+    for (uint8_t sect = 0; sect < info->sectcnt; sect++) {
+        uint32_t saddr = sect * sectsize;
+        if (state[sect] == _SYNC_CLEAN) {
+            st.clean++;
+            _prog_stats.skipped += sectsize;
+            continue;
+        }
+        const uint8_t* img = sectdatafn(sect, sectsize);
+        if (!img) {
+            status = PD_IMG_ERROR;
+            goto _finally;
+        }
+        const uint8_t* cur = NULL;
+        if (state[sect] == _SYNC_PROG) {
+            status = pd_read_block(info, saddr, _imgbuf, sectsize, NULL);
+            if (status != PD_OP_OK) {
+                goto _finally;
+            }
+            cur = _imgbuf;
+            st.inplace++;
+        }
+        else {
+            st.erased++;
+        }
+        status = _program_bytes(info, saddr, img, cur, sectsize, NULL, failaddr);
+        if (status != PD_OP_OK) {
+            goto _finally;
+        }
+        pd_sectmap_set(&done, sect);
+        if (donefn) {
+            donefn(&done);
+        }
+        if (progstatfn) {
+            progstatfn(saddr + sectsize - 1);
+        }
+    }
+_finally:
+    _prog_stats.elapsed_ms = (time_us_32() - start) / 1000;
+    st.programmed = _prog_stats.programmed;
+    st.skipped = _prog_stats.skipped;
+    st.elapsed_ms = _prog_stats.elapsed_ms;
+    if (stats) {
+        *stats = st;
+    }
+    _method_status = status;
+    return (_method_status);
+}
+
 uint8_t pd_read_value(const md_info_t* info, uint32_t addr) {
     uint32_t maxaddr = pd_addrmax(info);
     if (addr > maxaddr) {
@@ -389,6 +1098,10 @@ uint32_t pd_sectstart(const md_info_t* info, uint8_t sect) {
 }
 
 pd_op_status_t pd_write_value(const md_info_t* info, uint32_t addr, uint8_t value) {
+    if (_aop != PD_AOP_NONE) {
+        _method_status = PD_NOT_READY;
+        return (_method_status);
+    }
     uint32_t maxaddr = pd_addrmax(info);
     if (addr > maxaddr) {
         _method_status = PD_ADDR_INVALID;
@@ -400,16 +1113,10 @@ pd_op_status_t pd_write_value(const md_info_t* info, uint32_t addr, uint8_t valu
         return (_method_status);
     }
     _cmd_end(); // Just in case the device was left in a command state.
-    if (!_cmd_start(F_CMD_PROG)) {
-        _method_status = PD_NOT_READY;
-        return (_method_status);
+    _method_status = _prog_byte_verified(info, addr, value);
+    if (_method_status != PD_OP_OK) {
+        _cmd_end();
     }
-    // If the power was on for the `_cmd_start` call, we'll assume that
-    // it remains on.
-    pdo_data_set_at(addr, value);
-    // Get the device status
-    uint8_t v2 = _chk_wr_status(value);
-    _method_status = (v2 == value ? PD_OP_OK : PD_PROG_FAILED);
 
     return (_method_status);
 }
@@ -423,6 +1130,10 @@ void pd_minit() {
         board_panic("!!! pd_module_init: Called more than once !!!");
     }
     _clr_device_buf();
+    _aop = PD_AOP_NONE;
+    _prog_retries = PD_PROG_RETRIES_DEF;
     pdo_minit();
+    img_minit();
+    imc_minit();
     _method_status = PD_OP_OK;
 }
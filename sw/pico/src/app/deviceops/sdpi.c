@@ -0,0 +1,338 @@
+/**
+ * SD-Programmer Image container (.sdpi) support.
+ *
+ * The file is read (on Core-0, as are the other disk operations) a piece at a time. The
+ * header, bitmap, and sector table are read first and checked, then the payloads are
+ * read as the sectors that need them are programmed. No RAM is kept for this. The sector
+ * buffer (used to hash and program a sector) is the device sector buffer, and a packed
+ * payload is read into the image RAM (the image is closed) and unpacked from there.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "sdpi.h"
+#include "image.h"
+#include "lzpack.h"
+
+#include "dskops.h"
+#include "include/util.h"
+
+#include "ff.h"
+
+#include "pico/stdlib.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define _MT_BYTE_VAL (0xFF)
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief The open file */
+static FIL _fil;
+
+/** @brief The header, bitmap, and sector table of the open file */
+static sdpi_hdr_t _hdr;
+static uint8_t _bitmap[SDPI_BITMAP_SIZE];
+static sdpi_sect_t _table[PD_SECT_MAX];
+
+/** @brief A sector (the device sector buffer is borrowed). Used for the payloads and for hashing. */
+static uint8_t* _sectbuf;
+
+/** @brief A packed payload (the image RAM is borrowed while programming a packed file) */
+static uint8_t* _packbuf;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+/**
+ * @brief Read from the file (the full length must be read).
+ */
+static bool _file_read(void* buf, uint32_t len) {
+    UINT rlen;
+    return (dsk_file_read(&_fil, buf, len, &rlen) == FR_OK && rlen == len);
+}
+
+static inline bool _nonblank(uint8_t sect) {
+    return (_bitmap[sect / 8] & (1u << (sect % 8)));
+}
+
+/**
+ * @brief Open a file and read and check the header, bitmap, and sector table.
+ *
+ * If successful, the file is left open.
+ */
+static sdpi_status_t _open_file(const char* path) {
+    if (dsk_file_open(&_fil, path, FA_READ) != FR_OK) {
+        return (SDPI_FILE_ERROR);
+    }
+    sdpi_status_t status = SDPI_OK;
+    if (!_file_read(&_hdr, sizeof(sdpi_hdr_t)) || !_file_read(_bitmap, sizeof(_bitmap))) {
+        status = SDPI_FILE_ERROR;
+        goto _finally;
+    }
+    if (_hdr.magic != SDPI_MAGIC || _hdr.version != SDPI_VERSION
+        || _hdr.sectcnt == 0 || _hdr.sectcnt > PD_SECT_MAX
+        || _hdr.sectsize == 0 || _hdr.sectsize > SDPI_SECT_MAX
+        || _hdr.size != (_hdr.sectsize * _hdr.sectcnt)) {
+        status = SDPI_FORMAT_ERROR;
+        goto _finally;
+    }
+    if (!_file_read(_table, _hdr.sectcnt * sizeof(sdpi_sect_t))) {
+        status = SDPI_FILE_ERROR;
+        goto _finally;
+    }
+    uint32_t crc = crc32_update(0, &_hdr, offsetof(sdpi_hdr_t, hdr_crc));
+    crc = crc32_update(crc, _bitmap, sizeof(_bitmap));
+    crc = crc32_update(crc, _table, _hdr.sectcnt * sizeof(sdpi_sect_t));
+    if (crc != _hdr.hdr_crc) {
+        status = SDPI_FORMAT_ERROR;
+        goto _finally;
+    }
+    for (uint8_t sect = 0; sect < _hdr.sectcnt; sect++) {
+        uint32_t plen = _table[sect].plen;
+        bool packed = (plen < _hdr.sectsize);
+        if ((_nonblank(sect) != (plen != 0)) || plen > _hdr.sectsize || (packed && plen && !(_hdr.flags & SDPI_FLG_PACKED))) {
+            status = SDPI_FORMAT_ERROR;
+            goto _finally;
+        }
+    }
+    _hdr.name[SDPI_NAME_MAX - 1] = '\0';
+_finally:
+    if (status != SDPI_OK) {
+        dsk_file_close(&_fil);
+    }
+    return (status);
+}
+
+/**
+ * @brief Check that the open file is for a device.
+ */
+static sdpi_status_t _check_device(const md_info_t* info) {
+    if (_hdr.sectcnt != info->sectcnt || _hdr.sectsize != pd_sectsize(info)
+        || (_hdr.mfgid && _hdr.mfgid != info->mfgid) || (_hdr.devid && _hdr.devid != info->devid)) {
+        return (SDPI_DEVICE_MISMATCH);
+    }
+    return (SDPI_OK);
+}
+
+/**
+ * @brief Hash a sector of the device. The sector is read into the sector buffer.
+ *
+ * @param crc Set to the CRC-32 of the sector
+ * @param blank Set to true if the sector is empty
+ */
+static pd_op_status_t _dev_sect_hash(const md_info_t* info, uint8_t sect, uint32_t* crc, bool* blank) {
+    uint32_t sectsize = pd_sectsize(info);
+    pd_op_status_t status = pd_read_block(info, sect * sectsize, _sectbuf, sectsize, NULL);
+    if (status != PD_OP_OK) {
+        return (status);
+    }
+    bool mt = true;
+    for (uint32_t i = 0; mt && i < sectsize; i++) {
+        mt = (_sectbuf[i] == _MT_BYTE_VAL);
+    }
+    *crc = crc32_update(0, _sectbuf, sectsize);
+    *blank = mt;
+    return (PD_OP_OK);
+}
+
+/**
+ * @brief Read the payload of a sector into the sector buffer (unpacking it if needed).
+ *
+ * @param pos The file position of the payload
+ */
+static sdpi_status_t _read_sect(uint8_t sect, uint32_t pos) {
+    uint32_t sectsize = _hdr.sectsize;
+    uint32_t plen = _table[sect].plen;
+    if (dsk_file_seek(&_fil, pos) != FR_OK) {
+        return (SDPI_FILE_ERROR);
+    }
+    if (plen == sectsize) {
+        if (!_file_read(_sectbuf, sectsize)) {
+            return (SDPI_FILE_ERROR);
+        }
+    }
+    else {
+        if (!_file_read(_packbuf, plen)) {
+            return (SDPI_FILE_ERROR);
+        }
+        if (!lzp_unpack(_packbuf, plen, _sectbuf, sectsize)) {
+            return (SDPI_PAYLOAD_ERROR);
+        }
+    }
+    if (crc32_update(0, _sectbuf, sectsize) != _table[sect].crc) {
+        return (SDPI_PAYLOAD_ERROR);
+    }
+    return (SDPI_OK);
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+sdpi_status_t sdpi_info(const char* path, sdpi_info_t* info) {
+    memset(info, 0, sizeof(sdpi_info_t));
+    sdpi_status_t status = _open_file(path);
+    if (status != SDPI_OK) {
+        return (status);
+    }
+    dsk_file_close(&_fil);
+    info->hdr = _hdr;
+    for (uint8_t sect = 0; sect < _hdr.sectcnt; sect++) {
+        uint32_t plen = _table[sect].plen;
+        if (plen == 0) {
+            info->blank++;
+            continue;
+        }
+        pd_sectmap_set(&info->nonblank, sect);
+        if (plen < _hdr.sectsize) {
+            info->packed++;
+        }
+        info->payload += plen;
+    }
+    return (SDPI_OK);
+}
+
+sdpi_status_t sdpi_program(const char* path, const md_info_t* info, const pd_sectmap_t* donemap, pd_sect_done_fn donefn, const progstat_handler_fn progstatfn, pd_sync_stats_t* stats, uint32_t* failaddr) {
+    uint32_t start = time_us_32();
+    pd_sync_stats_t st;
+    memset(&st, 0, sizeof(st));
+    if (failaddr) {
+        *failaddr = PD_INVALID_ADDR;
+    }
+    sdpi_status_t status = _open_file(path);
+    if (status != SDPI_OK) {
+        return (status);
+    }
+    status = _check_device(info);
+    if (status != SDPI_OK) {
+        goto _finally;
+    }
+    // A packed payload is shorter than a sector, so it fits in either work area.
+    uint32_t size;
+    _sectbuf = pd_borrow_sect_buf(&size);
+    _packbuf = ((_hdr.flags & SDPI_FLG_PACKED) ? img_borrow_ram(&size) : NULL);
+    pd_sectmap_t done;
+    pd_sectmap_clr(&done);
+    uint32_t sectsize = _hdr.sectsize;
+    uint32_t pos = sizeof(sdpi_hdr_t) + sizeof(_bitmap) + (_hdr.sectcnt * sizeof(sdpi_sect_t));
+    for (uint8_t sect = 0; sect < _hdr.sectcnt; sect++) {
+        uint32_t saddr = sect * sectsize;
+        uint32_t plen = _table[sect].plen;
+        uint32_t crc;
+        bool blank;
+        if (donemap && pd_sectmap_isset(donemap, sect)) {
+            // Already known to match (resuming)
+            st.clean++;
+            st.skipped += sectsize;
+            pd_sectmap_set(&done, sect);
+        }
+        else if (_dev_sect_hash(info, sect, &crc, &blank) != PD_OP_OK) {
+            status = SDPI_PD_ERROR;
+            goto _finally;
+        }
+        else if ((plen == 0 && blank) || (plen != 0 && crc == _table[sect].crc)) {
+            st.clean++;
+            st.skipped += sectsize;
+            pd_sectmap_set(&done, sect);
+        }
+        else {
+            if (plen) {
+                // Read the payload before erasing, so the device isn't erased for a bad file.
+                status = _read_sect(sect, pos);
+                if (status != SDPI_OK) {
+                    goto _finally;
+                }
+            }
+            if (!blank) {
+                if (pd_erase_sect(info, sect) != PD_OP_OK) {
+                    status = SDPI_PD_ERROR;
+                    goto _finally;
+                }
+                st.erased++;
+            }
+            else {
+                st.inplace++;
+            }
+            if (plen) {
+                if (pd_program_block(info, saddr, _sectbuf, sectsize, NULL, failaddr) != PD_OP_OK) {
+                    status = SDPI_PD_ERROR;
+                    goto _finally;
+                }
+                st.programmed += pd_prog_stats()->programmed;
+                st.skipped += pd_prog_stats()->skipped;
+                if (_dev_sect_hash(info, sect, &crc, &blank) != PD_OP_OK) {
+                    status = SDPI_PD_ERROR;
+                    goto _finally;
+                }
+                if (crc != _table[sect].crc) {
+                    if (failaddr) {
+                        *failaddr = saddr;
+                    }
+                    status = SDPI_VERIFY_FAILED;
+                    goto _finally;
+                }
+            }
+            pd_sectmap_set(&done, sect);
+            if (donefn) {
+                donefn(&done);
+            }
+        }
+        pos += plen;
+        if (progstatfn) {
+            progstatfn(saddr + sectsize - 1);
+        }
+    }
+_finally:
+    dsk_file_close(&_fil);
+    st.elapsed_ms = (time_us_32() - start) / 1000;
+    if (stats) {
+        *stats = st;
+    }
+    return (status);
+}
+
+sdpi_status_t sdpi_verify(const char* path, const md_info_t* info, const progstat_handler_fn progstatfn, pd_sectmap_t* badmap) {
+    if (badmap) {
+        pd_sectmap_clr(badmap);
+    }
+    sdpi_status_t status = _open_file(path);
+    if (status != SDPI_OK) {
+        return (status);
+    }
+    // Only the header and sector table are needed.
+    dsk_file_close(&_fil);
+    status = _check_device(info);
+    if (status != SDPI_OK) {
+        return (status);
+    }
+    uint32_t size;
+    _sectbuf = pd_borrow_sect_buf(&size);
+    uint32_t sectsize = _hdr.sectsize;
+    for (uint8_t sect = 0; sect < _hdr.sectcnt; sect++) {
+        uint32_t crc;
+        bool blank;
+        if (_dev_sect_hash(info, sect, &crc, &blank) != PD_OP_OK) {
+            return (SDPI_PD_ERROR);
+        }
+        bool match = (_table[sect].plen == 0 ? blank : (crc == _table[sect].crc));
+        if (!match) {
+            status = SDPI_VERIFY_FAILED;
+            if (badmap) {
+                pd_sectmap_set(badmap, sect);
+            }
+        }
+        if (progstatfn) {
+            progstatfn((sect * sectsize) + sectsize - 1);
+        }
+    }
+    return (status);
+}
@@ -0,0 +1,191 @@
+/**
+ * Motorola S-Record format decoder (for the `loader`).
+ *
+ * The text is decoded as a stream (there is no line buffer) and the hex digits are
+ * decoded using a lookup table. Only the bytes of the current record are held until
+ * the record checksum is validated.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "srecload.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define _ST_MARK    0   // Waiting for the 'S' that starts a record
+#define _ST_TYPE    1   // Waiting for the record type digit
+#define _ST_REC     2   // Decoding the bytes of a record
+#define _ST_DONE    3   // The end (S7/S8/S9) record has been decoded
+
+/**
+ * @brief Decoder state.
+ */
+typedef struct srec_decoder_ {
+    uint8_t state;
+    uint8_t type;
+    bool hiheld;            // The high nibble of the byte being decoded has been decoded
+    uint8_t hinib;          // The high nibble of the byte being decoded
+    uint16_t idx;           // Index of the byte being decoded in the record
+    uint8_t count;          // The count of the bytes after the count (address, data, and checksum)
+    uint8_t sum;
+    ld_sink_t* sink;
+    uint8_t data[256];      // The bytes (address, data, and checksum) of the record being decoded
+} srec_decoder_t;
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief The address length for each record type (0 for invalid types) */
+static const uint8_t _addrlen[10] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+
+static srec_decoder_t _dec;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+/**
+ * @brief Process a record that has been decoded (and the checksum validated).
+ */
+static ld_status_t _rec_process() {
+    uint8_t alen = _addrlen[_dec.type];
+    if (_dec.count < (alen + 1)) {
+        return (LD_SYNTAX_ERROR);
+    }
+    uint32_t addr = 0;
+    for (int i = 0; i < alen; i++) {
+        addr = (addr << 8) | _dec.data[i];
+    }
+    uint8_t len = _dec.count - (alen + 1);
+    switch (_dec.type) {
+        case 0: // Header
+        case 5: // Count
+        case 6:
+            break;
+        case 1: // Data
+        case 2:
+        case 3:
+            if (len == 0) {
+                break;
+            }
+            return (ld_sink_write(_dec.sink, addr, &_dec.data[alen], len));
+        case 7: // Start address (end)
+        case 8:
+        case 9:
+            _dec.sink->result->start_addr = addr;
+            _dec.state = _ST_DONE;
+            break;
+        default:
+            return (LD_RECTYPE_ERROR);
+    }
+    return (LD_OK);
+}
+
+static void _begin(ld_sink_t* sink) {
+    memset(&_dec, 0, sizeof(srec_decoder_t));
+    _dec.state = _ST_MARK;
+    _dec.sink = sink;
+}
+
+static ld_status_t _end() {
+    return (LD_NO_END);
+}
+
+static ld_status_t _feed(const uint8_t* buf, uint32_t len) {
+    const uint8_t* p = buf;
+    const uint8_t* end = p + len;
+    while (p < end) {
+        uint8_t c = *p++;
+        if (_dec.state == _ST_REC) {
+            uint8_t v = ld_hexval[c];
+            if (!(v & LD_HEX_VALID)) {
+                return (LD_SYNTAX_ERROR);
+            }
+            if (!_dec.hiheld) {
+                _dec.hinib = (uint8_t)(v << 4);
+                _dec.hiheld = true;
+                continue;
+            }
+            _dec.hiheld = false;
+            uint8_t b = _dec.hinib | (v & 0x0F);
+            _dec.sum += b;
+            uint16_t i = _dec.idx++;
+            if (i == 0) {
+                _dec.count = b;
+                if (b == 0) {
+                    return (LD_SYNTAX_ERROR);
+                }
+                continue;
+            }
+            _dec.data[i - 1] = b;
+            if (i == _dec.count) {
+                // Checksum (the sum of all of the bytes, including the checksum, is 0xFF)
+                if (_dec.sum != 0xFF) {
+                    return (LD_CHECKSUM_ERROR);
+                }
+                _dec.state = _ST_MARK;
+                ld_status_t status = _rec_process();
+                if (status != LD_OK) {
+                    return (status);
+                }
+                if (_dec.state == _ST_DONE) {
+                    return (LD_OK);
+                }
+            }
+        }
+        else if (_dec.state == _ST_MARK) {
+            if (c == 'S') {
+                _dec.state = _ST_TYPE;
+            }
+            else if (c == '\n') {
+                _dec.sink->result->line++;
+            }
+            else if (c != '\r' && c != ' ' && c != '\t') {
+                return (LD_SYNTAX_ERROR);
+            }
+        }
+        else if (_dec.state == _ST_TYPE) {
+            if (c < '0' || c > '9' || _addrlen[c - '0'] == 0) {
+                return (LD_RECTYPE_ERROR);
+            }
+            _dec.type = c - '0';
+            _dec.state = _ST_REC;
+            _dec.idx = 0;
+            _dec.hiheld = false;
+            _dec.sum = 0;
+        }
+        else {
+            return (LD_OK);     // Anything after the end record is ignored
+        }
+    }
+    return (_dec.state == _ST_DONE ? LD_OK : LD_MORE);
+}
+
+/**
+ * @brief An S-Record file starts with an 'S' followed by a digit (after any whitespace).
+ */
+static bool _sniff(const uint8_t* buf, uint32_t len) {
+    uint32_t i = 0;
+    while (i < len && (buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\r' || buf[i] == '\n')) {
+        i++;
+    }
+    return ((i + 1) < len && buf[i] == 'S' && buf[i + 1] >= '0' && buf[i + 1] <= '9');
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+const ld_decoder_t ld_srec_decoder = {
+    LD_FMT_SREC,
+    "SREC",
+    _sniff,
+    _begin,
+    _feed,
+    _end,
+};
@@ -0,0 +1,970 @@
+/**
+ * USB Drive - The device as a file on a USB Mass Storage drive.
+ *
+ * The volume is FAT16 with 512 byte clusters. Nothing of it is stored. Each block is
+ * generated when it is read: the boot sector, the FATs (DEVICE.BIN and INFO.TXT are
+ * contiguous), the root directory, and the file data. The rest of the volume is free.
+ *
+ * DEVICE.BIN data is read from the device through two read-ahead windows. When the PC
+ * reads from one window, the next window is read (while the PC is being sent the data).
+ *
+ * Data written is collected in sector buffers (loaded with the device content, so a
+ * partial sector can be written). A sector is synced when the PC moves on to the next
+ * sector, when the PC stops writing for a while, or when the PC asks for the cache to be
+ * synced. With room for two sector buffers, the PC writes into one while the other is
+ * programmed. The read windows and the sector buffers share the image RAM. If it isn't
+ * big enough for both (large sectors on the RP2040), the read windows aren't used while
+ * a sector is being collected.
+ *
+ * A file copied to the drive is recognized by its data being written to the first free
+ * cluster. Its data is mapped to the device from there. Directory blocks the PC writes
+ * there (folders it makes for itself) and the PC's metadata files are ignored. The data
+ * is held in the sector buffers (not programmed) until the PC writes a root directory
+ * entry for the file: an ordinary file starting at that cluster, with its size. If the
+ * buffers fill first, the file isn't programmed. The data past the end of the file (the
+ * PC pads the last cluster, and other files can follow it) isn't programmed.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "usbdrive.h"
+#include "image.h"
+#include "pdops.h"
+#include "prog_device.h"
+
+#include "include/util.h"
+#include "rtc_support.h"
+
+#include "tusb.h"
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define _BLK_SIZE 512
+
+// Volume layout (in blocks). A cluster is one block.
+#define _CLUSTERS 8192              // Enough to be FAT16 (more than 4084)
+#define _RSVD_BLKS 1
+#define _FAT_CNT 2
+#define _FAT_BLKS ((((_CLUSTERS + 2) * 2) + (_BLK_SIZE - 1)) / _BLK_SIZE)
+#define _ROOT_ENTS 512
+#define _ROOT_BLKS ((_ROOT_ENTS * 32) / _BLK_SIZE)
+#define _FAT_LBA (_RSVD_BLKS)
+#define _ROOT_LBA (_FAT_LBA + (_FAT_CNT * _FAT_BLKS))
+#define _DATA_LBA (_ROOT_LBA + _ROOT_BLKS)
+#define _TOTAL_BLKS (_DATA_LBA + _CLUSTERS)
+
+#define _DIR_ATTR_HIDDEN 0x02
+#define _DIR_ATTR_SYSTEM 0x04
+#define _DIR_ATTR_VOLUME 0x08
+#define _DIR_ATTR_DIR 0x10
+#define _DIR_ATTR_LFN 0x0F
+#define _DIR_DELETED 0xE5
+
+#define _SCSI_CMD_SYNC_CACHE10 0x35
+
+/** @brief The size of a read-ahead window (and the number of them) */
+#define _RD_WIN (8 * ONE_K)
+#define _RD_WINS 2
+
+#define _WR_BUFS_MAX 2
+
+/** @brief The most blocks in a device sector */
+#define _SECT_BLKS_MAX ((64 * ONE_K) / _BLK_SIZE)
+
+/** @brief The time the drive stays ejected before it is inserted again */
+#define _EJECTED_MS 1000
+
+/** @brief How often the terminal is checked for ESC */
+#define _TERM_POLL_US (50 * 1000)
+
+#define _ESC 0x1B
+#define _CTRL_C 0x03
+
+typedef enum req_ {
+    _REQ_NONE,
+    _REQ_READ,          // Device data (a read window) is needed
+    _REQ_WRITE,         // A sector buffer is needed
+} req_t;
+
+typedef enum wb_state_ {
+    _WB_EMPTY,
+    _WB_LOADING,        // Being loaded with the device content
+    _WB_COLLECT,        // Data from the PC is being written into it
+    _WB_SYNCING,        // Being synced to the device
+} wb_state_t;
+
+typedef enum drop_state_ {
+    _DROP_NONE,         // No file has been copied to the drive
+    _DROP_HELD,         // File data is being written (it is held until the directory entry is written)
+    _DROP_FILE,         // The directory entry of the file has been written (the data is programmed)
+    _DROP_IGNORED,      // The data isn't a file to program (or it couldn't be held)
+} drop_state_t;
+
+/**
+ * @brief A sector buffer.
+ */
+typedef struct wrbuf_ {
+    volatile wb_state_t state;
+    uint8_t sect;
+    bool drop;              // Some of the data is from a copied file
+    uint32_t dropblks[_SECT_BLKS_MAX / 32];     // The blocks with data from a copied file
+    volatile uint32_t stamp;    // When data was last written into it (us)
+    uint8_t* data;
+} wrbuf_t;
+
+/**
+ * @brief A read-ahead window.
+ */
+typedef struct rdwin_ {
+    volatile bool valid;
+    uint32_t addr;
+    uint8_t* data;
+} rdwin_t;
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief Protects the buffers between the USB callbacks (Core-0) and `ud_run` */
+static critical_section_t _cs;
+
+/** @brief The drive state as seen by the PC */
+static volatile bool _present;
+static volatile bool _attention;
+static volatile bool _eject;
+static volatile bool _sync_req;
+static bool _readonly;
+
+/** @brief What the USB callbacks are waiting for */
+static volatile req_t _req;
+static volatile uint32_t _req_addr;
+
+static const md_info_t* _info;
+static uint32_t _devsize;
+static uint32_t _devblks;
+static uint32_t _sectsize;
+static uint32_t _info_lba;
+static uint32_t _drop_lba;
+
+static wrbuf_t _wb[_WR_BUFS_MAX];
+static uint8_t _nwb;
+static rdwin_t _rw[_RD_WINS];
+static volatile uint8_t _rw_last;
+/** @brief The address to read ahead (the window after the one the PC is reading) */
+static volatile uint32_t _rd_next;
+/** @brief The read windows share the memory of the sector buffers */
+static bool _shared;
+
+/** @brief A file copied to the drive: its state, size, and name (from its directory entry) */
+static volatile drop_state_t _drop_state;
+static volatile uint32_t _drop_size;
+static char _drop_name[11];
+
+static volatile uint32_t _last_write_us;
+static volatile uint32_t _nwritten;
+static volatile uint32_t _nignored;
+/** @brief The PC's view of the volume is out of date (it is inserted again when the PC stops writing) */
+static bool _stale;
+
+/** @brief The sector being synced (for the data provider) */
+static uint8_t _sync_sect;
+static const uint8_t* _sync_data;
+
+static char _info_txt[_BLK_SIZE];
+static uint32_t _vol_serial;
+static uint16_t _fdate;
+static uint16_t _ftime;
+
+static ud_result_t* _result;
+
+// ====================================================================
+// Local/Private Method Declarations
+// ====================================================================
+
+static bool _dev_read(uint32_t addr, uint8_t* buf);
+static bool _dev_write(uint32_t addr, const uint8_t* buf, bool drop);
+static wrbuf_t* _wb_find(uint8_t sect);
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+static void _put_u16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void _put_u32(uint8_t* p, uint32_t v) {
+    _put_u16(p, (uint16_t)v);
+    _put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint16_t _get_u16(const uint8_t* p) {
+    return (p[0] | (p[1] << 8));
+}
+
+static uint32_t _get_u32(const uint8_t* p) {
+    return (_get_u16(p) | ((uint32_t)_get_u16(p + 2) << 16));
+}
+
+static uint16_t _cluster(uint32_t lba) {
+    return ((uint16_t)(lba - _DATA_LBA + 2));
+}
+
+static void _boot_blk(uint8_t* b) {
+    static const uint8_t jmp[] = { 0xEB, 0x3C, 0x90 };
+    memcpy(b, jmp, sizeof(jmp));
+    memcpy(&b[3], "MSDOS5.0", 8);
+    _put_u16(&b[11], _BLK_SIZE);
+    b[13] = 1;                          // Blocks per cluster
+    _put_u16(&b[14], _RSVD_BLKS);
+    b[16] = _FAT_CNT;
+    _put_u16(&b[17], _ROOT_ENTS);
+    _put_u16(&b[19], _TOTAL_BLKS);
+    b[21] = 0xF8;                       // Media (fixed)
+    _put_u16(&b[22], _FAT_BLKS);
+    _put_u16(&b[24], 63);               // Blocks per track
+    _put_u16(&b[26], 255);              // Heads
+    b[36] = 0x80;                       // Drive number
+    b[38] = 0x29;                       // Extended boot signature
+    _put_u32(&b[39], _vol_serial);
+    memset(&b[43], ' ', 11);
+    memcpy(&b[43], UD_VOLUME_LABEL, strlen(UD_VOLUME_LABEL));
+    memcpy(&b[54], "FAT16   ", 8);
+    b[510] = 0x55;
+    b[511] = 0xAA;
+}
+
+static void _fat_blk(uint32_t blk, uint8_t* b) {
+    uint16_t dev_end = _cluster(_DATA_LBA + _devblks);  // First cluster after DEVICE.BIN
+    uint16_t info = _cluster(_info_lba);
+    uint32_t n = blk * (_BLK_SIZE / 2);
+    for (int i = 0; i < _BLK_SIZE; i += 2, n++) {
+        uint16_t v = 0;
+        if (n == 0) {
+            v = 0xFFF8;
+        }
+        else if (n == 1 || n == (dev_end - 1) || n == info) {
+            v = 0xFFFF;
+        }
+        else if (n >= 2 && n < dev_end) {
+            v = (uint16_t)(n + 1);
+        }
+        _put_u16(&b[i], v);
+    }
+}
+
+static void _dirent(uint8_t* e, const char* name, uint8_t attr, uint16_t cluster, uint32_t size) {
+    memset(e, ' ', 11);
+    memcpy(e, name, strlen(name));
+    e[11] = attr;
+    _put_u16(&e[14], _ftime);           // Created
+    _put_u16(&e[16], _fdate);
+    _put_u16(&e[18], _fdate);           // Accessed
+    _put_u16(&e[22], _ftime);           // Written
+    _put_u16(&e[24], _fdate);
+    _put_u16(&e[26], cluster);
+    _put_u32(&e[28], size);
+}
+
+static void _root_blk(uint32_t blk, uint8_t* b) {
+    if (blk == 0) {
+        _dirent(&b[0], UD_VOLUME_LABEL, _DIR_ATTR_VOLUME, 0, 0);
+        _dirent(&b[32], "DEVICE  BIN", 0, _cluster(_DATA_LBA), _devsize);
+        _dirent(&b[64], "INFO    TXT", 0, _cluster(_info_lba), strlen(_info_txt));
+    }
+}
+
+/**
+ * @brief Look at a root directory block written by the PC for a file copied to the drive.
+ *
+ * The first ordinary file (not hidden, system, or a name starting with '.') that starts
+ * at the first free cluster, with a size, is the file. After that, only its entry (the
+ * same name) is looked at for the size. If the entry starting there is a metadata file,
+ * the data written there isn't programmed.
+ *
+ * @param b The block
+ */
+static void _root_scan(const uint8_t* b) {
+    uint16_t drop_cluster = _cluster(_drop_lba);
+    bool dot = false;       // The long name of the next entry starts with '.'
+    for (int i = 0; i < _BLK_SIZE; i += 32) {
+        const uint8_t* e = &b[i];
+        if (e[0] == 0) {
+            break;
+        }
+        if (e[0] == _DIR_DELETED) {
+            dot = false;
+            continue;
+        }
+        if (e[11] == _DIR_ATTR_LFN) {
+            if ((e[0] & 0x1F) == 1) {
+                dot = (e[1] == '.' && e[2] == 0);   // The part with the start of the name
+            }
+            continue;
+        }
+        bool meta = (dot || e[0] == '.' || (e[11] & (_DIR_ATTR_HIDDEN | _DIR_ATTR_SYSTEM)));
+        dot = false;
+        if ((e[11] & (_DIR_ATTR_VOLUME | _DIR_ATTR_DIR)) || _get_u16(&e[26]) != drop_cluster) {
+            continue;
+        }
+        uint32_t size = _get_u32(&e[28]);
+        switch (_drop_state) {
+            case _DROP_NONE:
+            case _DROP_HELD:
+                if (meta) {
+                    _drop_state = _DROP_IGNORED;
+                }
+                else if (size > 0) {
+                    memcpy(_drop_name, e, sizeof(_drop_name));
+                    _drop_size = size;
+                    _drop_state = _DROP_FILE;
+                }
+                break;
+            case _DROP_FILE:
+                if (memcmp(_drop_name, e, sizeof(_drop_name)) == 0) {
+                    _drop_size = size;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Indicate if a block is the start of a directory (a folder the PC made for itself).
+ */
+static bool _is_dir_blk(const uint8_t* b) {
+    return (memcmp(b, ".          ", 11) == 0 && (b[11] & _DIR_ATTR_DIR));
+}
+
+/**
+ * @brief Indicate if a block is the start of a metadata file (macOS AppleDouble '._' or '.DS_Store').
+ */
+static bool _is_meta_blk(const uint8_t* b) {
+    static const uint8_t appledouble[] = { 0x00, 0x05, 0x16, 0x07 };
+    static const uint8_t dsstore[] = { 0x00, 0x00, 0x00, 0x01, 'B', 'u', 'd', '1' };
+    return (memcmp(b, appledouble, sizeof(appledouble)) == 0 || memcmp(b, dsstore, sizeof(dsstore)) == 0);
+}
+
+/**
+ * @brief Generate a block of the volume (or get it from the device).
+ *
+ * @param lba The block
+ * @param buf The buffer to fill
+ * @return true The block was generated
+ * @return false The device data isn't ready (a request has been made for it)
+ */
+static bool _read_blk(uint32_t lba, uint8_t* buf) {
+    if (lba >= _DATA_LBA) {
+        uint32_t k = lba - _DATA_LBA;
+        if (k < _devblks) {
+            return (_dev_read(k * _BLK_SIZE, buf));
+        }
+        if (lba >= _drop_lba && (_drop_state == _DROP_HELD || _drop_state == _DROP_FILE)) {
+            k = lba - _drop_lba;
+            if (k < _devblks) {
+                return (_dev_read(k * _BLK_SIZE, buf));
+            }
+        }
+    }
+    memset(buf, 0, _BLK_SIZE);
+    if (lba < _FAT_LBA) {
+        _boot_blk(buf);
+    }
+    else if (lba < _ROOT_LBA) {
+        _fat_blk((lba - _FAT_LBA) % _FAT_BLKS, buf);
+    }
+    else if (lba < _DATA_LBA) {
+        _root_blk(lba - _ROOT_LBA, buf);
+    }
+    else if (lba == _info_lba) {
+        memcpy(buf, _info_txt, strlen(_info_txt));
+    }
+    return (true);
+}
+
+/**
+ * @brief Take a block written by the PC.
+ *
+ * @param lba The block
+ * @param buf The data
+ * @return true The block was taken
+ * @return false A sector buffer isn't ready for it (a request has been made for one)
+ */
+static bool _write_blk(uint32_t lba, const uint8_t* buf) {
+    if (lba < _ROOT_LBA) {
+        return (true);          // The boot block and FATs are generated
+    }
+    if (lba < _DATA_LBA) {
+        _root_scan(buf);
+        return (true);
+    }
+    uint32_t k = lba - _DATA_LBA;
+    if (k < _devblks) {
+        return (_dev_write(k * _BLK_SIZE, buf, false));
+    }
+    if (lba >= _drop_lba && !_is_dir_blk(buf)) {
+        k = lba - _drop_lba;
+        drop_state_t ds = _drop_state;
+        if (ds == _DROP_NONE && k == 0 && !_is_meta_blk(buf)) {
+            ds = _DROP_HELD;            // The start of a file
+        }
+        if (k < _devblks && (ds == _DROP_HELD || (ds == _DROP_FILE && (k * _BLK_SIZE) < _drop_size))) {
+            if (!_dev_write(k * _BLK_SIZE, buf, true)) {
+                return (false);
+            }
+            _drop_state = ds;
+            return (true);
+        }
+        _nignored += _BLK_SIZE;
+    }
+    return (true);
+}
+
+/**
+ * @brief Get a block of device data from a sector buffer or a read window.
+ */
+static bool _dev_read(uint32_t addr, uint8_t* buf) {
+    bool ok = false;
+    critical_section_enter_blocking(&_cs);
+    wrbuf_t* wb = _wb_find(addr / _sectsize);
+    if (wb && (wb->state == _WB_COLLECT || wb->state == _WB_SYNCING)) {
+        memcpy(buf, wb->data + (addr % _sectsize), _BLK_SIZE);
+        ok = true;
+    }
+    else {
+        for (uint8_t i = 0; i < _RD_WINS; i++) {
+            rdwin_t* w = &_rw[i];
+            if (w->valid && addr >= w->addr && addr < (w->addr + _RD_WIN)) {
+                memcpy(buf, w->data + (addr - w->addr), _BLK_SIZE);
+                _rw_last = i;
+                _rd_next = w->addr + _RD_WIN;
+                ok = true;
+                break;
+            }
+        }
+    }
+    if (!ok && _req == _REQ_NONE) {
+        _req_addr = addr;
+        _req = _REQ_READ;
+    }
+    critical_section_exit(&_cs);
+    return (ok);
+}
+
+/**
+ * @brief Put a block of device data into its sector buffer.
+ */
+static bool _dev_write(uint32_t addr, const uint8_t* buf, bool drop) {
+    bool ok = false;
+    critical_section_enter_blocking(&_cs);
+    wrbuf_t* wb = _wb_find(addr / _sectsize);
+    if (wb && wb->state == _WB_COLLECT) {
+        uint32_t offset = addr % _sectsize;
+        memcpy(wb->data + offset, buf, _BLK_SIZE);
+        wb->stamp = time_us_32();
+        if (drop) {
+            uint32_t blk = offset / _BLK_SIZE;
+            wb->dropblks[blk / 32] |= (1u << (blk % 32));
+            wb->drop = true;
+        }
+        _nwritten += _BLK_SIZE;
+        ok = true;
+    }
+    else if (!wb && _req == _REQ_NONE) {
+        _req_addr = addr;
+        _req = _REQ_WRITE;
+    }
+    critical_section_exit(&_cs);
+    return (ok);
+}
+
+/**
+ * @brief Find the (non-empty) sector buffer for a sector.
+ */
+static wrbuf_t* _wb_find(uint8_t sect) {
+    for (uint8_t i = 0; i < _nwb; i++) {
+        if (_wb[i].state != _WB_EMPTY && _wb[i].sect == sect) {
+            return (&_wb[i]);
+        }
+    }
+    return (NULL);
+}
+
+/**
+ * @brief Indicate if a sector buffer is holding data of a copied file that can't be programmed (yet).
+ */
+static bool _wb_held(const wrbuf_t* wb) {
+    return (wb->drop && _drop_state != _DROP_FILE);
+}
+
+/**
+ * @brief Discard the sector buffers holding data of a copied file that isn't programmed.
+ */
+static void _wb_discard_held() {
+    critical_section_enter_blocking(&_cs);
+    for (uint8_t i = 0; i < _nwb; i++) {
+        wrbuf_t* wb = &_wb[i];
+        if (wb->state == _WB_COLLECT && _wb_held(wb)) {
+            uint32_t n = 0;
+            for (int j = 0; j < (_SECT_BLKS_MAX / 32); j++) {
+                n += __builtin_popcount(wb->dropblks[j]) * _BLK_SIZE;
+            }
+            _nwritten -= n;
+            _nignored += n;
+            wb->state = _WB_EMPTY;
+            _stale = true;
+        }
+    }
+    critical_section_exit(&_cs);
+}
+
+/**
+ * @brief Stop holding the data of a copied file (it isn't programmed).
+ */
+static void _drop_abandon() {
+    if (_drop_state == _DROP_HELD) {
+        _drop_state = _DROP_IGNORED;
+    }
+    _wb_discard_held();
+}
+
+static bool _wb_all_empty() {
+    for (uint8_t i = 0; i < _nwb; i++) {
+        if (_wb[i].state != _WB_EMPTY) {
+            return (false);
+        }
+    }
+    return (true);
+}
+
+static void _rw_invalidate(uint32_t addr, uint32_t len) {
+    critical_section_enter_blocking(&_cs);
+    for (uint8_t i = 0; i < _RD_WINS; i++) {
+        rdwin_t* w = &_rw[i];
+        if (w->addr < (addr + len) && addr < (w->addr + _RD_WIN)) {
+            w->valid = false;
+        }
+    }
+    critical_section_exit(&_cs);
+}
+
+static pd_op_status_t _rw_fill(uint8_t i, uint32_t addr) {
+    rdwin_t* w = &_rw[i];
+    critical_section_enter_blocking(&_cs);
+    w->valid = false;
+    critical_section_exit(&_cs);
+    uint32_t len = ((_devsize - addr) < _RD_WIN ? (_devsize - addr) : _RD_WIN);
+    pd_op_status_t ps = pd_read_block(_info, addr, w->data, len, NULL);
+    critical_section_enter_blocking(&_cs);
+    w->addr = addr;
+    w->valid = (ps == PD_OP_OK);
+    critical_section_exit(&_cs);
+    return (ps);
+}
+
+static const uint8_t* _sync_data_fn(uint8_t sect, uint32_t sectsize) {
+    return (sect == _sync_sect ? _sync_data : NULL);
+}
+
+/**
+ * @brief Sync a sector buffer to the device (only what changed is erased/programmed).
+ *
+ * @param wb The sector buffer (in the COLLECT state)
+ * @return pd_op_status_t Status of the sync
+ */
+static pd_op_status_t _wb_sync(wrbuf_t* wb) {
+    critical_section_enter_blocking(&_cs);
+    wb->state = _WB_SYNCING;
+    critical_section_exit(&_cs);
+    uint32_t saddr = wb->sect * _sectsize;
+    pd_op_status_t ps = PD_OP_OK;
+    // Put back the device content in the blocks of a copied file past its end.
+    uint32_t eof = _drop_size;
+    for (uint32_t blk = 0; wb->drop && blk < (_sectsize / _BLK_SIZE) && ps == PD_OP_OK; blk++) {
+        uint32_t addr = saddr + (blk * _BLK_SIZE);
+        if ((wb->dropblks[blk / 32] & (1u << (blk % 32))) && (addr + _BLK_SIZE) > eof) {
+            uint32_t from = (eof > addr ? eof : addr);
+            ps = pd_read_block(_info, from, wb->data + (from - saddr), (addr + _BLK_SIZE) - from, NULL);
+        }
+    }
+    if (ps == PD_OP_OK) {
+        pd_sectmap_t done;
+        pd_sectmap_clr(&done);
+        for (uint8_t sect = 0; sect < _info->sectcnt; sect++) {
+            if (sect != wb->sect) {
+                pd_sectmap_set(&done, sect);
+            }
+        }
+        _sync_sect = wb->sect;
+        _sync_data = wb->data;
+        pd_sync_stats_t stats;
+        ps = pd_sync(_info, _sync_data_fn, &done, NULL, NULL, &stats, &_result->failaddr);
+        _result->synced++;
+        _result->clean += stats.clean;
+        _result->inplace += stats.inplace;
+        _result->erased += stats.erased;
+        _result->programmed += stats.programmed;
+    }
+    _result->pdstat = ps;
+    _rw_invalidate(saddr, _sectsize);
+    critical_section_enter_blocking(&_cs);
+    wb->state = _WB_EMPTY;
+    critical_section_exit(&_cs);
+    _stale = true;
+    return (ps);
+}
+
+/**
+ * @brief Sync the sector buffers that are done with (or all of them).
+ *
+ * A buffer is done with when another sector has been written since, or when it hasn't
+ * been written for a while. Buffers holding data of a copied file that can't be
+ * programmed yet are left.
+ *
+ * @param all True to sync all of them
+ * @return pd_op_status_t Status of the last sync
+ */
+static pd_op_status_t _wb_sync_done(bool all) {
+    wrbuf_t* newest = NULL;
+    for (uint8_t i = 0; i < _nwb; i++) {
+        wrbuf_t* wb = &_wb[i];
+        if (wb->state == _WB_COLLECT && !_wb_held(wb) && (!newest || (int32_t)(wb->stamp - newest->stamp) > 0)) {
+            newest = wb;
+        }
+    }
+    uint32_t now = time_us_32();
+    for (uint8_t i = 0; i < _nwb; i++) {
+        wrbuf_t* wb = &_wb[i];
+        if (wb->state == _WB_COLLECT && !_wb_held(wb) && (all || wb != newest || (now - wb->stamp) > (UD_WRITE_IDLE_MS * 1000))) {
+            pd_op_status_t ps = _wb_sync(wb);
+            if (ps != PD_OP_OK) {
+                return (ps);
+            }
+        }
+    }
+    return (PD_OP_OK);
+}
+
+/**
+ * @brief Do what the USB callbacks are waiting for.
+ *
+ * @return pd_op_status_t Status of the device operation
+ */
+static pd_op_status_t _service_req() {
+    req_t req = _req;
+    uint32_t addr = _req_addr;
+    pd_op_status_t ps = PD_OP_OK;
+    if (req == _REQ_READ) {
+        if (_shared && !_wb_all_empty()) {
+            // The read windows use the sector buffer memory, so held file data can't be kept.
+            _drop_abandon();
+            ps = _wb_sync_done(true);
+        }
+        if (ps == PD_OP_OK) {
+            uint8_t i = (_rw_last + 1) % _RD_WINS;
+            ps = _rw_fill(i, addr - (addr % _RD_WIN));
+            _rw_last = i;
+        }
+    }
+    else if (req == _REQ_WRITE && !_wb_find(addr / _sectsize)) {
+        wrbuf_t* wb = NULL;
+        for (uint8_t i = 0; i < _nwb && !wb; i++) {
+            if (_wb[i].state == _WB_EMPTY) {
+                wb = &_wb[i];
+            }
+        }
+        if (!wb) {
+            // Sync the oldest one (that isn't holding file data) to make room.
+            for (uint8_t i = 0; i < _nwb; i++) {
+                if (!_wb_held(&_wb[i]) && (!wb || (int32_t)(_wb[i].stamp - wb->stamp) < 0)) {
+                    wb = &_wb[i];
+                }
+            }
+            if (wb) {
+                ps = _wb_sync(wb);
+            }
+            else {
+                // They are all holding the data of a file with no directory entry yet.
+                _drop_abandon();
+                wb = &_wb[0];
+            }
+        }
+        if (ps == PD_OP_OK) {
+            if (_shared) {
+                _rw_invalidate(0, _devsize);
+            }
+            critical_section_enter_blocking(&_cs);
+            wb->sect = addr / _sectsize;
+            wb->drop = false;
+            memset(wb->dropblks, 0, sizeof(wb->dropblks));
+            wb->state = _WB_LOADING;
+            critical_section_exit(&_cs);
+            ps = pd_read_block(_info, wb->sect * _sectsize, wb->data, _sectsize, NULL);
+            critical_section_enter_blocking(&_cs);
+            wb->stamp = time_us_32();
+            wb->state = (ps == PD_OP_OK ? _WB_COLLECT : _WB_EMPTY);
+            critical_section_exit(&_cs);
+        }
+    }
+    critical_section_enter_blocking(&_cs);
+    _req = _REQ_NONE;
+    critical_section_exit(&_cs);
+    return (ps);
+}
+
+/**
+ * @brief Read the window after the one the PC is reading.
+ */
+static void _read_ahead() {
+    uint32_t next = _rd_next;
+    if (next >= _devsize || (_shared && !_wb_all_empty())) {
+        return;
+    }
+    for (uint8_t i = 0; i < _RD_WINS; i++) {
+        if (_rw[i].valid && _rw[i].addr == next) {
+            return;
+        }
+    }
+    _rw_fill((_rw_last + 1) % _RD_WINS, next);
+}
+
+static void _info_build() {
+    int n = snprintf(_info_txt, sizeof(_info_txt),
+        "SD Flash Programmer\r\n\r\n"
+        "Device: %s %s (%02X/%02X)\r\n"
+        "Size: %lu bytes (%hu sectors of %lu bytes)\r\n\r\n"
+        "DEVICE.BIN is the device content. Data written to it, or a file\r\n"
+        "copied to the drive, is programmed into the device.\r\n",
+        _info->mfgs, _info->devs, _info->mfgid, _info->devid, _devsize, (uint16_t)_info->sectcnt, _sectsize);
+    if (_result->synced > 0 && n > 0 && n < sizeof(_info_txt)) {
+        n += snprintf(&_info_txt[n], sizeof(_info_txt) - n,
+            "\r\nWritten: %lu bytes. Sectors synced: %hu (%hu erased). Status: %d\r\n",
+            _nwritten, _result->synced, _result->erased, _result->pdstat);
+    }
+    if (_nignored > 0 && n > 0 && n < sizeof(_info_txt)) {
+        snprintf(&_info_txt[n], sizeof(_info_txt) - n,
+            "Ignored: %lu bytes (not a file copied to the first free cluster, past its end,\r\n"
+            "or too big to hold until its directory entry was written)\r\n", _nignored);
+    }
+}
+
+/**
+ * @brief Present the drive to the PC (again).
+ */
+static void _mount() {
+    _drop_state = _DROP_NONE;
+    _drop_size = 0;
+    _rd_next = _devsize;
+    _rw_invalidate(0, _devsize);
+    _stale = false;
+    _vol_serial = time_us_32();
+    datetime_t t;
+    if (rtc_get_datetime(&t) && t.year >= 1980) {
+        _fdate = (uint16_t)(((t.year - 1980) << 9) | (t.month << 5) | t.day);
+        _ftime = (uint16_t)((t.hour << 11) | (t.min << 5) | (t.sec / 2));
+    }
+    else {
+        _fdate = (uint16_t)(((2025 - 1980) << 9) | (1 << 5) | 1);
+        _ftime = 0;
+    }
+    _info_build();
+    _attention = true;
+    _present = true;
+}
+
+// ====================================================================
+// TinyUSB MSC Callbacks
+// ====================================================================
+
+void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4]) {
+    memcpy(vendor_id, "SilkyDSN", 8);
+    memcpy(product_id, "Flash Programmer", 16);
+    memcpy(product_rev, "1.0 ", 4);
+}
+
+bool tud_msc_test_unit_ready_cb(uint8_t lun) {
+    if (!_present) {
+        tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x3A, 0x00);   // Medium not present
+        return (false);
+    }
+    if (_attention) {
+        _attention = false;
+        tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00);  // Medium may have changed
+        return (false);
+    }
+    return (true);
+}
+
+void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count, uint16_t* block_size) {
+    *block_count = _TOTAL_BLKS;
+    *block_size = _BLK_SIZE;
+}
+
+bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject) {
+    if (load_eject && !start) {
+        _present = false;
+        _eject = true;
+    }
+    return (true);
+}
+
+bool tud_msc_is_writable_cb(uint8_t lun) {
+    return (!_readonly);
+}
+
+int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
+    if (!_present) {
+        tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x3A, 0x00);
+        return (-1);
+    }
+    // The buffer size is a multiple of the block size, so the offset is always 0.
+    uint32_t n = 0;
+    while (n < bufsize && _read_blk(lba + (n / _BLK_SIZE), (uint8_t*)buffer + n)) {
+        n += _BLK_SIZE;
+    }
+    // 0 (nothing ready) has TinyUSB call again.
+    return (n);
+}
+
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
+    if (!_present) {
+        tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x3A, 0x00);
+        return (-1);
+    }
+    if (_readonly) {
+        tud_msc_set_sense(lun, SCSI_SENSE_DATA_PROTECT, 0x27, 0x00);   // Write protected
+        return (-1);
+    }
+    uint32_t n = 0;
+    while (n < bufsize && _write_blk(lba + (n / _BLK_SIZE), buffer + n)) {
+        n += _BLK_SIZE;
+    }
+    if (n > 0) {
+        _last_write_us = time_us_32();
+    }
+    return (n);
+}
+
+int32_t tud_msc_scsi_cb(uint8_t lun, const uint8_t scsi_cmd[16], void* buffer, uint16_t bufsize) {
+    switch (scsi_cmd[0]) {
+        case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
+            return (0);
+        case _SCSI_CMD_SYNC_CACHE10:
+            _sync_req = true;
+            return (0);
+        default:
+            tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);  // Invalid command
+            return (-1);
+    }
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+ud_status_t ud_run(bool readonly, ud_result_t* result) {
+    uint32_t start = time_us_32();
+    memset(result, 0, sizeof(ud_result_t));
+    result->failaddr = PD_INVALID_ADDR;
+    _result = result;
+    ud_status_t st = UD_OK;
+    if (pd_async_busy()) {
+        return (UD_PD_BUSY);
+    }
+    ERRORNO = 0;
+    pdo_request_pwr_on(true);
+    _info = (ERRORNO ? NULL : pd_info());
+    if (!_info) {
+        st = UD_NO_DEVICE;
+        goto _finally;
+    }
+    if (!critical_section_is_initialized(&_cs)) {
+        critical_section_init(&_cs);
+    }
+    _readonly = readonly;
+    _devsize = pd_size(_info);
+    _devblks = _devsize / _BLK_SIZE;
+    _sectsize = pd_sectsize(_info);
+    _info_lba = _DATA_LBA + _devblks;
+    _drop_lba = _info_lba + 1;
+    // Split the image RAM into the sector buffers and the read windows.
+    uint32_t area_size;
+    uint8_t* area = img_borrow_ram(&area_size);
+    uint32_t rdsize = (_RD_WINS * _RD_WIN);
+    _nwb = (area_size >= ((2 * _sectsize) + rdsize) ? 2 : 1);
+    _shared = (area_size < (_sectsize + rdsize));
+    for (uint8_t i = 0; i < _nwb; i++) {
+        _wb[i].state = _WB_EMPTY;
+        _wb[i].data = area + (i * _sectsize);
+    }
+    for (uint8_t i = 0; i < _RD_WINS; i++) {
+        _rw[i].valid = false;
+        _rw[i].data = area + (_shared ? 0 : (_nwb * _sectsize)) + (i * _RD_WIN);
+    }
+    _req = _REQ_NONE;
+    _eject = false;
+    _sync_req = false;
+    _nwritten = 0;
+    _nignored = 0;
+    _last_write_us = time_us_32();
+    _mount();
+
+    uint32_t term_poll = time_us_32();
+    while (!_eject) {
+        pd_op_status_t ps = _service_req();
+        if (ps == PD_OP_OK) {
+            if (_drop_state == _DROP_IGNORED) {
+                _wb_discard_held();
+            }
+            bool all = _sync_req;
+            _sync_req = false;
+            ps = _wb_sync_done(all);
+        }
+        if (ps != PD_OP_OK) {
+            st = UD_PD_ERROR;
+            break;
+        }
+        _read_ahead();
+        uint32_t now = time_us_32();
+        if (_stale && _req == _REQ_NONE && _wb_all_empty() && (now - _last_write_us) > (UD_REMOUNT_IDLE_MS * 1000)) {
+            // Eject and insert the drive, so the PC reads the new device content.
+            _present = false;
+            sleep_ms(_EJECTED_MS);
+            _mount();
+            result->remounts++;
+        }
+        if (_req == _REQ_NONE && (now - term_poll) > _TERM_POLL_US) {
+            term_poll = now;
+            char c;
+            if (stdio_usb.in_chars(&c, 1) == 1 && (c == _ESC || c == _CTRL_C)) {
+                break;
+            }
+        }
+    }
+    _present = false;
+    if (st == UD_OK) {
+        _wb_sync_done(true);
+    }
+    _wb_discard_held();
+    if (result->pdstat != PD_OP_OK) {
+        st = UD_PD_ERROR;
+    }
+_finally:
+    _present = false;
+    pdo_request_pwr_on(false);
+    result->written = _nwritten;
+    result->ignored = _nignored;
+    result->elapsed_ms = (time_us_32() - start) / 1000;
+    return (st);
+}
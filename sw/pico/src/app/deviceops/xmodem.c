@@ -0,0 +1,683 @@
+/**
+ * XMODEM-1K and YMODEM file transfers over the USB CDC link.
+ *
+ * The input is read directly through the USB STDIO driver (not the STDIO functions), so it
+ * isn't taken by the terminal and the output isn't copied to the UART or translated (CR/LF).
+ *
+ * A block being received is read directly into the file buffer at the position its data
+ * goes, so an accepted block isn't copied. The buffer is written to the file (or the image)
+ * when it is full, while the sender sends the next block. A file being sent is read into
+ * the buffer in large chunks and the blocks are built from it.
+ *
+ * The file buffer isn't kept for transfers. A transfer borrows the device sector buffer.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "xmodem.h"
+#include "image.h"
+#include "prog_device.h"
+
+#include "dskops.h"
+
+#include "crc.h"
+#include "ff.h"
+
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _SOH 0x01
+#define _STX 0x02
+#define _EOT 0x04
+#define _ACK 0x06
+#define _NAK 0x15
+#define _CAN 0x18
+#define _SUB 0x1A
+#define _CRC_START 'C'
+
+#define _SHORT_BLOCK_SIZE 128
+
+/** @brief Once a block starts, all of it must arrive within this time */
+#define _BLOCK_READ_TIMEOUT_US (1000 * 1000)
+
+/** @brief During a transfer, the next block (or the response to a block) must arrive within this time */
+#define _BLOCK_TIMEOUT_US (10 * 1000 * 1000)
+
+/** @brief While waiting for the other end to start, the start is requested this often */
+#define _START_POKE_US (3 * 1000 * 1000)
+
+/** @brief The number of times in a row a block can fail before the transfer is canceled */
+#define _RETRIES 10
+
+/** @brief Input is discarded until nothing has arrived for this time */
+#define _PURGE_US (250 * 1000)
+
+/** @brief No length was sent (XMODEM, or a YMODEM header without one) */
+#define _NO_SIZE 0xFFFFFFFF
+
+typedef enum blk_result_ {
+    _BLK_TIMEOUT = -1,      // Nothing was received
+    _BLK_BAD = -2,          // A bad block (or noise) was received
+    _BLK_EOT = -3,          // End of the file
+    _BLK_CAN = -4,          // The other end canceled
+} blk_result_t;
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief The file being received or sent */
+static FIL _fil;
+
+/** @brief File data (borrowed for the transfer), its size, the amount in it, and the position in it (when sending) */
+static uint8_t* _buf;
+static uint32_t _bufsize;
+static uint32_t _fill;
+static uint32_t _bufpos;
+
+/** @brief True if the data goes to/comes from the image (not a file) */
+static bool _img;
+/** @brief The file/image position of the data in `_buf` (receive), or of the next block (send) */
+static uint32_t _pos;
+
+/** @brief A block being sent: Start, Number, ~Number, data, CRC */
+static uint8_t _blk[3 + XM_BLOCK_SIZE + 2];
+
+/** @brief The path of a file received with YMODEM */
+static char _ypath[256];
+
+static xm_result_t* _result;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+/**
+ * @brief Read bytes from the other end.
+ *
+ * @param dst Where to put the bytes
+ * @param len The number of bytes
+ * @param start The time (`time_us_32`) the timeout is from
+ * @param timeout_us The time allowed (from `start`) for all of the bytes
+ * @return true The bytes were read. False if it timed out.
+ */
+static bool _rx_read(uint8_t* dst, uint32_t len, uint32_t start, uint32_t timeout_us) {
+    while (len > 0) {
+        int n = stdio_usb.in_chars((char*)dst, len);
+        if (n > 0) {
+            dst += n;
+            len -= n;
+            continue;
+        }
+        if ((time_us_32() - start) >= timeout_us) {
+            return (false);
+        }
+        tight_loop_contents();
+    }
+    return (true);
+}
+
+/**
+ * @brief Read a byte from the other end.
+ *
+ * @param timeout_us The time to wait
+ * @return int The byte, or -1 if it timed out
+ */
+static int _rx_byte(uint32_t timeout_us) {
+    uint8_t b;
+    return (_rx_read(&b, 1, time_us_32(), timeout_us) ? b : -1);
+}
+
+/**
+ * @brief Discard input until the other end stops sending.
+ */
+static void _rx_purge() {
+    uint8_t discard[64];
+    uint32_t last = time_us_32();
+    while ((time_us_32() - last) < _PURGE_US) {
+        if (stdio_usb.in_chars((char*)discard, sizeof(discard)) > 0) {
+            last = time_us_32();
+        }
+    }
+}
+
+static void _tx(const uint8_t* buf, uint32_t len) {
+    stdio_usb.out_chars((const char*)buf, len);
+    stdio_usb.out_flush();
+}
+
+static void _tx_byte(uint8_t c) {
+    _tx(&c, 1);
+}
+
+/**
+ * @brief Cancel the transfer (tell the other end, and discard what it is sending).
+ */
+static void _cancel() {
+    static const uint8_t _cans[] = { _CAN, _CAN, _CAN, _CAN, _CAN };
+    _tx(_cans, sizeof(_cans));
+    _rx_purge();
+}
+
+/**
+ * @brief Receive a block.
+ *
+ * @param dst Where to put the data (must have room for XM_BLOCK_SIZE bytes)
+ * @param len Set to the length of the data
+ * @param timeout_us The time to wait for the block to start
+ * @return int The block number (0-255) if a good block was received, otherwise a `blk_result_t`
+ */
+static int _recv_block(uint8_t* dst, uint16_t* len, uint32_t timeout_us) {
+    int c = _rx_byte(timeout_us);
+    if (c < 0) {
+        return (_BLK_TIMEOUT);
+    }
+    if (c == _EOT) {
+        return (_BLK_EOT);
+    }
+    if (c == _CAN) {
+        return (_rx_byte(_BLOCK_READ_TIMEOUT_US) == _CAN ? _BLK_CAN : _BLK_BAD);
+    }
+    if (c != _SOH && c != _STX) {
+        return (_BLK_BAD);
+    }
+    *len = (c == _STX ? XM_BLOCK_SIZE : _SHORT_BLOCK_SIZE);
+    uint8_t num[2];
+    uint8_t crcb[2];
+    uint32_t start = time_us_32();
+    if (!_rx_read(num, sizeof(num), start, _BLOCK_READ_TIMEOUT_US)
+        || !_rx_read(dst, *len, start, _BLOCK_READ_TIMEOUT_US)
+        || !_rx_read(crcb, sizeof(crcb), start, _BLOCK_READ_TIMEOUT_US)) {
+        return (_BLK_BAD);
+    }
+    if ((uint8_t)(num[0] ^ num[1]) != 0xFF || crc16((const char*)dst, *len) != ((crcb[0] << 8) | crcb[1])) {
+        return (_BLK_BAD);
+    }
+    return (num[0]);
+}
+
+/**
+ * @brief Write the data in the buffer to the file or the image.
+ *
+ * @return xm_status_t Status
+ */
+static xm_status_t _flush() {
+    xm_status_t status = XM_OK;
+    if (_fill == 0) {
+        return (status);
+    }
+    if (_img) {
+        uint32_t size = img_size();
+        uint32_t n = (_pos >= size ? 0 : size - _pos);
+        if (n > _fill) {
+            n = _fill;
+        }
+        // Anything past the end of the image must be padding.
+        for (uint32_t i = n; i < _fill; i++) {
+            if (_buf[i] != _SUB) {
+                status = XM_IMG_ERROR;
+                break;
+            }
+        }
+        if (n > 0 && img_write_at(_pos, _buf, n) != IMG_OK) {
+            status = XM_IMG_ERROR;
+        }
+    }
+    else {
+        UINT bw;
+        if (dsk_file_write(&_fil, _buf, _fill, &bw) != FR_OK || bw != _fill) {
+            status = XM_FILE_ERROR;
+        }
+    }
+    _pos += _fill;
+    _fill = 0;
+    return (status);
+}
+
+/**
+ * @brief Receive a YMODEM file header (block 0). It isn't acknowledged.
+ *
+ * @param size Set to the file size (_NO_SIZE if it wasn't sent)
+ * @return xm_status_t Status. The file name (empty at the end of the batch) is in `_buf`.
+ */
+static xm_status_t _recv_header(uint32_t* size) {
+    uint32_t start = time_us_32();
+    uint8_t retries = 0;
+    uint16_t len;
+    _tx_byte(_CRC_START);
+    while (true) {
+        int blk = _recv_block(_buf, &len, _START_POKE_US);
+        if (blk == 0) {
+            break;
+        }
+        if (blk == _BLK_CAN) {
+            return (XM_CANCELED);
+        }
+        if (blk == _BLK_TIMEOUT) {
+            if ((time_us_32() - start) >= (XM_START_TIMEOUT_MS * 1000)) {
+                _cancel();
+                return (XM_TIMEOUT);
+            }
+        }
+        else if (blk == _BLK_EOT) {
+            // The sender didn't get the ACK for the end of the last file.
+            _tx_byte(_ACK);
+            continue;
+        }
+        else {
+            _rx_purge();
+            if (++retries > _RETRIES) {
+                _cancel();
+                return (XM_ERRORS);
+            }
+        }
+        _tx_byte(_CRC_START);
+    }
+    // Name, NUL, Length (decimal), and other optional fields
+    _buf[len - 1] = '\0';
+    const char* p = (const char*)_buf + strlen((const char*)_buf) + 1;
+    *size = (isdigit((unsigned char)*p) ? strtoul(p, NULL, 10) : _NO_SIZE);
+    return (XM_OK);
+}
+
+/**
+ * @brief Receive the data blocks of a file (to the end of the file).
+ *
+ * @param ymodem True for YMODEM (confirm the end of the file)
+ * @param size The length of the file (_NO_SIZE to keep all of the data)
+ * @return xm_status_t Status
+ */
+static xm_status_t _recv_data(bool ymodem, uint32_t size) {
+    uint32_t start = time_us_32();
+    uint32_t remaining = size;
+    uint8_t expect = 1;
+    uint8_t retries = 0;
+    bool started = false;
+    bool eot = false;
+    xm_status_t status;
+
+    _fill = 0;
+    _pos = 0;
+    _tx_byte(_CRC_START);
+    while (true) {
+        if ((_fill + XM_BLOCK_SIZE) > _bufsize) {
+            status = _flush();
+            if (status != XM_OK) {
+                _cancel();
+                return (status);
+            }
+        }
+        uint16_t len;
+        int blk = _recv_block(_buf + _fill, &len, (started ? _BLOCK_TIMEOUT_US : _START_POKE_US));
+        if (blk == _BLK_TIMEOUT) {
+            if (!started) {
+                if ((time_us_32() - start) >= (XM_START_TIMEOUT_MS * 1000)) {
+                    _cancel();
+                    return (XM_TIMEOUT);
+                }
+                _tx_byte(_CRC_START);
+                continue;
+            }
+            if (++retries > _RETRIES) {
+                _cancel();
+                return (XM_TIMEOUT);
+            }
+            _tx_byte(_NAK);
+            continue;
+        }
+        if (blk == _BLK_CAN) {
+            return (XM_CANCELED);
+        }
+        if (blk == _BLK_BAD) {
+            _rx_purge();
+            if (++retries > _RETRIES) {
+                _cancel();
+                return (XM_ERRORS);
+            }
+            _result->errors++;
+            _tx_byte(started ? _NAK : _CRC_START);
+            continue;
+        }
+        if (blk == _BLK_EOT) {
+            if (ymodem && !eot) {
+                // NAK the first EOT, so noise can't end the file.
+                eot = true;
+                _tx_byte(_NAK);
+                continue;
+            }
+            status = _flush();
+            if (status != XM_OK) {
+                _cancel();
+                return (status);
+            }
+            _tx_byte(_ACK);
+            return (XM_OK);
+        }
+        if (blk == expect) {
+            uint32_t n = (len < remaining ? len : remaining);
+            remaining -= n;
+            _fill += n;
+            _result->bytes += n;
+            expect++;
+            retries = 0;
+            started = true;
+            _tx_byte(_ACK);
+        }
+        else if (blk == (uint8_t)(expect - 1)) {
+            _tx_byte(_ACK);         // Sent again (our ACK was lost)
+        }
+        else {
+            _cancel();              // Out of sequence (can't be recovered)
+            return (XM_ERRORS);
+        }
+    }
+}
+
+/**
+ * @brief Wait for the receiver to ask for the transfer (or the next part of it) to start.
+ *
+ * @param crc Set to true if the receiver wants CRC-16, false for a checksum
+ * @return xm_status_t Status
+ */
+static xm_status_t _send_wait_start(bool* crc) {
+    uint32_t start = time_us_32();
+    while ((time_us_32() - start) < (XM_START_TIMEOUT_MS * 1000)) {
+        int c = _rx_byte(_START_POKE_US);
+        if (c == _CRC_START || c == _NAK) {
+            *crc = (c == _CRC_START);
+            return (XM_OK);
+        }
+        if (c == _CAN && _rx_byte(_BLOCK_READ_TIMEOUT_US) == _CAN) {
+            return (XM_CANCELED);
+        }
+    }
+    _cancel();
+    return (XM_TIMEOUT);
+}
+
+/**
+ * @brief Wait for the receiver to acknowledge what was sent.
+ *
+ * @return int _ACK, _NAK (send again), _CAN (canceled), or -1 if it timed out
+ */
+static int _send_wait_ack() {
+    while (true) {
+        int c = _rx_byte(_BLOCK_TIMEOUT_US);
+        if (c < 0 || c == _ACK || c == _NAK) {
+            return (c);
+        }
+        if (c == _CRC_START) {
+            return (_NAK);          // The receiver didn't get the first block
+        }
+        if (c == _CAN && _rx_byte(_BLOCK_READ_TIMEOUT_US) == _CAN) {
+            return (_CAN);
+        }
+    }
+}
+
+/**
+ * @brief Send the block in `_blk` (the data is filled in) until it is acknowledged.
+ *
+ * @param num The block number
+ * @param len The data length (XM_BLOCK_SIZE or 128)
+ * @param crc True to send a CRC-16, false for a checksum
+ * @return xm_status_t Status
+ */
+static xm_status_t _send_block(uint8_t num, uint16_t len, bool crc) {
+    _blk[0] = (len == XM_BLOCK_SIZE ? _STX : _SOH);
+    _blk[1] = num;
+    _blk[2] = ~num;
+    uint32_t total = 3 + len;
+    if (crc) {
+        uint16_t c = crc16((const char*)_blk + 3, len);
+        _blk[total++] = (uint8_t)(c >> 8);
+        _blk[total++] = (uint8_t)c;
+    }
+    else {
+        uint8_t sum = 0;
+        for (uint16_t i = 0; i < len; i++) {
+            sum += _blk[3 + i];
+        }
+        _blk[total++] = sum;
+    }
+    int c = -1;
+    for (uint8_t retries = 0; retries <= _RETRIES; retries++) {
+        if (retries) {
+            _result->errors++;
+        }
+        _tx(_blk, total);
+        c = _send_wait_ack();
+        if (c == _ACK) {
+            return (XM_OK);
+        }
+        if (c == _CAN) {
+            return (XM_CANCELED);
+        }
+    }
+    _cancel();
+    return (c < 0 ? XM_TIMEOUT : XM_ERRORS);
+}
+
+/**
+ * @brief Send the end of the file until it is acknowledged.
+ *
+ * @return xm_status_t Status
+ */
+static xm_status_t _send_eot() {
+    int c = -1;
+    for (uint8_t retries = 0; retries <= _RETRIES; retries++) {
+        _tx_byte(_EOT);
+        c = _send_wait_ack();
+        if (c == _ACK) {
+            return (XM_OK);
+        }
+        if (c == _CAN) {
+            return (XM_CANCELED);
+        }
+    }
+    _cancel();
+    return (c < 0 ? XM_TIMEOUT : XM_ERRORS);
+}
+
+/**
+ * @brief Send a YMODEM header (block 0).
+ *
+ * @param name The file name (NULL for the end of the batch)
+ * @param size The file size
+ * @return xm_status_t Status
+ */
+static xm_status_t _send_header(const char* name, uint32_t size) {
+    bool crc;
+    xm_status_t status = _send_wait_start(&crc);
+    if (status != XM_OK) {
+        return (status);
+    }
+    memset(_blk + 3, 0, _SHORT_BLOCK_SIZE);
+    if (name) {
+        int n = snprintf((char*)_blk + 3, (_SHORT_BLOCK_SIZE - 12), "%s", name);
+        if (n > (_SHORT_BLOCK_SIZE - 13)) {
+            n = (_SHORT_BLOCK_SIZE - 13);
+        }
+        snprintf((char*)_blk + 3 + n + 1, 11, "%lu", (unsigned long)size);
+    }
+    return (_send_block(0, _SHORT_BLOCK_SIZE, crc));
+}
+
+/**
+ * @brief Read the next data to send from the file or the image.
+ *
+ * @param dst Where to put the data
+ * @param len The number of bytes
+ * @return xm_status_t Status
+ */
+static xm_status_t _src_read(uint8_t* dst, uint32_t len) {
+    if (_img) {
+        return (img_read_at(_pos, dst, len) == IMG_OK ? XM_OK : XM_IMG_ERROR);
+    }
+    while (len > 0) {
+        if (_bufpos == _fill) {
+            UINT br;
+            if (dsk_file_read(&_fil, _buf, _bufsize, &br) != FR_OK || br == 0) {
+                return (XM_FILE_ERROR);
+            }
+            _fill = br;
+            _bufpos = 0;
+        }
+        uint32_t n = _fill - _bufpos;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(dst, _buf + _bufpos, n);
+        _bufpos += n;
+        dst += n;
+        len -= n;
+    }
+    return (XM_OK);
+}
+
+/**
+ * @brief The name part of a path.
+ */
+static const char* _basename(const char* path) {
+    const char* name = path;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/' || *p == '\\' || *p == ':') {
+            name = p + 1;
+        }
+    }
+    return (name);
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+xm_status_t xm_receive(bool ymodem, const char* path, xm_result_t* result) {
+    uint32_t start = time_us_32();
+    xm_status_t status = XM_OK;
+    memset(result, 0, sizeof(xm_result_t));
+    _result = result;
+    _img = (path == NULL);
+    if (_img && !img_is_open()) {
+        return (XM_NO_IMAGE);
+    }
+    _buf = pd_borrow_sect_buf(&_bufsize);
+    while (status == XM_OK) {
+        uint32_t size = _NO_SIZE;
+        if (ymodem) {
+            status = _recv_header(&size);
+            if (status != XM_OK) {
+                break;
+            }
+            if (_buf[0] == '\0') {
+                _tx_byte(_ACK);         // The end of the batch
+                break;
+            }
+            if (_img && (result->files > 0 || (size != _NO_SIZE && size > img_size()))) {
+                _cancel();
+                status = XM_IMG_ERROR;
+                break;
+            }
+            if (!_img) {
+                snprintf(_ypath, sizeof(_ypath), "%s%s%s", path, (*path ? "/" : ""), _basename((const char*)_buf));
+            }
+        }
+        if (!_img) {
+            if (dsk_file_open(&_fil, (ymodem ? _ypath : path), (FA_CREATE_ALWAYS | FA_WRITE)) != FR_OK) {
+                _cancel();
+                status = XM_FILE_ERROR;
+                break;
+            }
+        }
+        if (ymodem) {
+            _tx_byte(_ACK);             // Accept the file
+        }
+        status = _recv_data(ymodem, size);
+        if (!_img && dsk_file_close(&_fil) != FR_OK && status == XM_OK) {
+            status = XM_FILE_ERROR;
+        }
+        if (status == XM_OK) {
+            result->files++;
+        }
+        if (!ymodem) {
+            break;
+        }
+    }
+    result->elapsed_ms = (time_us_32() - start) / 1000;
+    return (status);
+}
+
+xm_status_t xm_send(bool ymodem, const char* path, xm_result_t* result) {
+    uint32_t start = time_us_32();
+    xm_status_t status = XM_OK;
+    uint32_t size;
+    bool crc = true;
+    memset(result, 0, sizeof(xm_result_t));
+    _result = result;
+    _img = (path == NULL);
+    if (_img) {
+        if (!img_is_open()) {
+            return (XM_NO_IMAGE);
+        }
+        size = img_size();
+    }
+    else {
+        if (dsk_file_open(&_fil, path, FA_READ) != FR_OK) {
+            return (XM_FILE_ERROR);
+        }
+        size = f_size(&_fil);
+    }
+    _buf = pd_borrow_sect_buf(&_bufsize);
+    _pos = 0;
+    _fill = 0;
+    _bufpos = 0;
+    if (ymodem) {
+        status = _send_header((_img ? XM_IMG_NAME : _basename(path)), size);
+    }
+    if (status == XM_OK) {
+        status = _send_wait_start(&crc);
+    }
+    uint8_t num = 1;
+    while (status == XM_OK && _pos < size) {
+        // Short blocks are used for the end of the data if it fits.
+        uint32_t n = size - _pos;
+        uint16_t len = (n <= _SHORT_BLOCK_SIZE ? _SHORT_BLOCK_SIZE : XM_BLOCK_SIZE);
+        if (n > len) {
+            n = len;
+        }
+        status = _src_read(_blk + 3, n);
+        if (status != XM_OK) {
+            _cancel();
+            break;
+        }
+        memset(_blk + 3 + n, _SUB, len - n);
+        status = _send_block(num++, len, crc);
+        _pos += n;
+        if (status == XM_OK) {
+            result->bytes += n;
+        }
+    }
+    if (status == XM_OK) {
+        status = _send_eot();
+    }
+    if (status == XM_OK) {
+        result->files++;
+        if (ymodem) {
+            status = _send_header(NULL, 0);   // The end of the batch
+        }
+    }
+    if (!_img) {
+        dsk_file_close(&_fil);
+    }
+    result->elapsed_ms = (time_us_32() - start) / 1000;
+    return (status);
+}
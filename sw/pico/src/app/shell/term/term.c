@@ -316,6 +316,18 @@ void term_input_buf_clear(void) {
     _input_buf_overflow = false;
 }
 
+void term_input_suspend(bool suspend) {
+    if (suspend) {
+        // Stop taking the input, so it can be read directly from the STDIO driver.
+        stdio_set_chars_available_callback(NULL, NULL);
+    }
+    else {
+        // Anything that arrived while suspended wasn't for us.
+        term_input_buf_clear();
+        stdio_set_chars_available_callback(_stdio_chars_available, NULL);
+    }
+}
+
 bool term_input_overflow() {
     bool retval = _input_buf_overflow;
     _input_buf_overflow = false;
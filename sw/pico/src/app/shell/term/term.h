@@ -447,6 +447,18 @@ extern void term_input_buf_clear(void);
  */
 extern bool term_input_overflow(void);
 
+/**
+ * @brief Suspend (or resume) taking input from the terminal.
+ * @ingroup term
+ *
+ * While suspended, input isn't read into the input buffer and input notifications
+ * aren't made, so another module can read the STDIO input directly (for example, a binary
+ * protocol). The input buffer is cleared when input is resumed.
+ *
+ * @param suspend True to suspend input, false to resume it.
+ */
+extern void term_input_suspend(bool suspend);
+
 /**
  * @brief Initialize the Term library and send initial configuration to the terminal.
  * @ingroup term
@@ -55,6 +55,7 @@ typedef enum MSG_ID_ {
     MSG_CMD_INIT_TERMINAL,
     MSG_DISPLAY_MESSAGE,
     MSG_INPUT_CHAR_READY,
+    MSG_PD_OP_DONE,         // A Programmable Device async operation completed (data.op_done)
 } msg_id_t;
 #define MSG_ID_CNT (0x100)
 
@@ -69,6 +70,19 @@ typedef struct cmt_sleep_data_ {
     void* user_data;
 } cmt_sleep_data_t;
 
+/**
+ * @brief Data for an operation completed message.
+ * @ingroup cmt
+ *
+ * The meaning of the `op`, `arg`, and `status` values are defined by the sender.
+ */
+typedef struct op_done_data_ {
+    uint8_t op;             // The operation that completed
+    uint8_t arg;            // Operation argument (for example, the sector number)
+    int16_t status;         // The completion status
+    uint32_t elapsed_ms;    // The time the operation took
+} op_done_data_t;
+
 // Declare the CMT Message structure so that we can declare the handler function.
 struct CMT_MSG_;
 
@@ -97,6 +111,7 @@ union MSG_DATA_VALUE_ {
     int32_t status;
     uint32_t value32u;
     switch_action_data_t sw_action;
+    op_done_data_t op_done;
     FRESULT fr;
     char* str;
     void* ptr;
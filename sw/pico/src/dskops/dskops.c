@@ -29,6 +29,31 @@
 #include <stdint.h>
 #include <stddef.h>
 
+typedef enum file_op_ {
+    FOP_OPEN,
+    FOP_READ,
+    FOP_WRITE,
+    FOP_SEEK,
+    FOP_SYNC,
+    FOP_CLOSE,
+    FOP_UNLINK,
+} file_op_t;
+
+/**
+ * @brief A file operation for Core-0 to perform (and its result).
+ */
+typedef struct file_op_req_ {
+    file_op_t op;
+    FIL* fp;
+    const char* path;   // OPEN, UNLINK
+    BYTE mode;          // OPEN
+    void* buf;          // READ, WRITE
+    UINT len;           // READ, WRITE
+    UINT* bc;           // READ, WRITE: Set to the number of bytes transferred
+    FSIZE_t ofs;        // SEEK
+    FRESULT fr;
+} file_op_req_t;
+
 // ====================================================================
 // Data Section
 // ====================================================================
@@ -83,16 +108,105 @@ static void _handle_housekeeping(cmt_msg_t* msg) {
     cnt++;
 }
 
+/**
+ * @brief Perform a file operation. Must be run on Core-0.
+ *
+ * @param msg The data `ptr` is the file operation request.
+ */
+static void _handle_file_op(cmt_msg_t* msg) {
+    file_op_req_t* req = (file_op_req_t*)msg->data.ptr;
+    switch (req->op) {
+        case FOP_OPEN:
+            req->fr = dsk_mount_sd();
+            if (req->fr == FR_OK) {
+                req->fr = f_open(req->fp, req->path, req->mode);
+            }
+            break;
+        case FOP_READ:
+            req->fr = f_read(req->fp, req->buf, req->len, req->bc);
+            break;
+        case FOP_WRITE:
+            req->fr = f_write(req->fp, req->buf, req->len, req->bc);
+            break;
+        case FOP_SEEK:
+            req->fr = f_lseek(req->fp, req->ofs);
+            break;
+        case FOP_SYNC:
+            req->fr = f_sync(req->fp);
+            break;
+        case FOP_CLOSE:
+            req->fr = f_close(req->fp);
+            break;
+        case FOP_UNLINK:
+            req->fr = f_unlink(req->path);
+            break;
+    }
+}
+
 
 // ====================================================================
 // Local/Private Methods
 // ====================================================================
 
+/**
+ * @brief Perform a file operation on Core-0 (directly if called on Core-0).
+ *
+ * @param req The file operation request
+ * @return FRESULT The result of the operation
+ */
+static FRESULT _file_op(file_op_req_t* req) {
+    cmt_msg_t msg;
+    cmt_exec_init(&msg, _handle_file_op);
+    msg.data.ptr = req;
+    if (get_core_num() == 0) {
+        _handle_file_op(&msg);
+    }
+    else {
+        runon_core0(&msg);
+    }
+    return (req->fr);
+}
+
 
 // ====================================================================
 // Public Methods
 // ====================================================================
 
+FRESULT dsk_file_close(FIL* fp) {
+    file_op_req_t req = { .op = FOP_CLOSE, .fp = fp };
+    return (_file_op(&req));
+}
+
+FRESULT dsk_file_open(FIL* fp, const char* path, BYTE mode) {
+    file_op_req_t req = { .op = FOP_OPEN, .fp = fp, .path = path, .mode = mode };
+    return (_file_op(&req));
+}
+
+FRESULT dsk_file_read(FIL* fp, void* buf, UINT len, UINT* br) {
+    file_op_req_t req = { .op = FOP_READ, .fp = fp, .buf = buf, .len = len, .bc = br };
+    return (_file_op(&req));
+}
+
+FRESULT dsk_file_seek(FIL* fp, FSIZE_t ofs) {
+    file_op_req_t req = { .op = FOP_SEEK, .fp = fp, .ofs = ofs };
+    return (_file_op(&req));
+}
+
+FRESULT dsk_file_sync(FIL* fp) {
+    file_op_req_t req = { .op = FOP_SYNC, .fp = fp };
+    return (_file_op(&req));
+}
+
+FRESULT dsk_file_unlink(const char* path) {
+    file_op_req_t req = { .op = FOP_UNLINK, .path = path };
+    return (_file_op(&req));
+}
+
+FRESULT dsk_file_write(FIL* fp, const void* buf, UINT len, UINT* bw) {
+    file_op_req_t req = { .op = FOP_WRITE, .fp = fp, .buf = (void*)buf, .len = len, .bc = bw };
+    return (_file_op(&req));
+}
+
 char* dsk_get_shared_path_buf() {
     *_filepath = '\0';
 
@@ -14,6 +14,10 @@
  * is performed. If the caller intends to keep the result for an extended period (possibly
  * across disk/file method calls) a different buffer should be used.
  *
+ * The FATFS (and SD Card) operations must be run on Core-0. The `dsk_file_...` methods
+ * perform a file operation on Core-0 for a caller on either core (directly if called on
+ * Core-0, or by having Core-0 run it if called on Core-1).
+ *
  * Copyright 2023-25 AESilky
  * SPDX-License-Identifier: MIT License
  *
@@ -30,6 +34,72 @@ extern "C" {
 /** @brief As on 'classic' DOS = 260 */
 #define MAX_PATH 260
 
+/**
+ * @brief Close a file (on Core-0).
+ *
+ * @param fp The file
+ * @return FRESULT The FATFS result
+ */
+extern FRESULT dsk_file_close(FIL* fp);
+
+/**
+ * @brief Open a file (on Core-0). The SD card is mounted first if it isn't mounted.
+ *
+ * @param fp The file object to use
+ * @param path The file path
+ * @param mode The FATFS access mode (FA_READ, FA_WRITE, FA_CREATE_ALWAYS, ...)
+ * @return FRESULT The FATFS result
+ */
+extern FRESULT dsk_file_open(FIL* fp, const char* path, BYTE mode);
+
+/**
+ * @brief Read from a file (on Core-0).
+ *
+ * @param fp The file
+ * @param buf Where to put the data
+ * @param len The number of bytes to read
+ * @param br Set to the number of bytes read (less than `len` at the end of the file)
+ * @return FRESULT The FATFS result
+ */
+extern FRESULT dsk_file_read(FIL* fp, void* buf, UINT len, UINT* br);
+
+/**
+ * @brief Move the file position (on Core-0). Moving past the end of a file opened
+ * for writing expands the file.
+ *
+ * @param fp The file
+ * @param ofs The new position
+ * @return FRESULT The FATFS result
+ */
+extern FRESULT dsk_file_seek(FIL* fp, FSIZE_t ofs);
+
+/**
+ * @brief Flush the cached data of a file being written (on Core-0).
+ *
+ * @param fp The file
+ * @return FRESULT The FATFS result
+ */
+extern FRESULT dsk_file_sync(FIL* fp);
+
+/**
+ * @brief Remove a file (on Core-0). The file must not be open.
+ *
+ * @param path The file path
+ * @return FRESULT The FATFS result
+ */
+extern FRESULT dsk_file_unlink(const char* path);
+
+/**
+ * @brief Write to a file (on Core-0).
+ *
+ * @param fp The file
+ * @param buf The data
+ * @param len The number of bytes to write
+ * @param bw Set to the number of bytes written (less than `len` if the disk is full)
+ * @return FRESULT The FATFS result
+ */
+extern FRESULT dsk_file_write(FIL* fp, const void* buf, UINT len, UINT* bw);
+
 /**
  * @brief Get the module supplied File Name/Path buffer.
  *
@@ -0,0 +1,42 @@
+/**
+ * TinyUSB Configuration.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+ * The USB device is a composite of a CDC (the STDIO console, host link, and XMODEM
+ * transfers), a Mass Storage class (the USB drive, see `usbdrive`), and the SDK's reset
+ * interface (its driver is in `usb_descriptors.c`). As the application links TinyUSB
+ * itself, the SDK's STDIO USB driver uses this configuration and the descriptors in
+ * `usb_descriptors.c` (rather than its own).
+ *
+*/
+#ifndef TUSB_CONFIG_H_
+#define TUSB_CONFIG_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CFG_TUSB_RHPORT0_MODE       (OPT_MODE_DEVICE)
+
+#define CFG_TUD_ENDPOINT0_SIZE      (64)
+
+// Device classes
+#define CFG_TUD_CDC                 (1)
+#define CFG_TUD_MSC                 (1)
+#define CFG_TUD_HID                 (0)
+#define CFG_TUD_MIDI                (0)
+#define CFG_TUD_VENDOR              (0)
+
+// CDC FIFO sizes (the same as the SDK's STDIO USB defaults)
+#define CFG_TUD_CDC_RX_BUFSIZE      (256)
+#define CFG_TUD_CDC_TX_BUFSIZE      (256)
+
+// MSC transfer buffer. A READ10/WRITE10 is passed to the callbacks in pieces this size.
+// One block: the callbacks only copy to/from the drive's buffers (in the image RAM).
+#define CFG_TUD_MSC_EP_BUFSIZE      (512)
+
+#ifdef __cplusplus
+}
+#endif
+#endif // TUSB_CONFIG_H_
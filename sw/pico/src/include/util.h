@@ -133,6 +133,20 @@ extern "C" {
      */
     extern bool bool_from_str(const char* str);
 
+    /**
+     * @brief Update a CRC-32 (IEEE 802.3, as used by zip/PNG) with more data.
+     * @ingroup util
+     *
+     * Start with a CRC of 0. The value returned is the CRC of all of the data so far,
+     * so the CRC of data can be computed in pieces.
+     *
+     * @param crc The CRC of the previous data (0 to start)
+     * @param data The data
+     * @param len The length of the data
+     * @return uint32_t The CRC
+     */
+    extern uint32_t crc32_update(uint32_t crc, const void* data, uint32_t len);
+
     /**
      * @brief Get the number of days in a month.
      * @ingroup util
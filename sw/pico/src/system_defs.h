@@ -98,6 +98,8 @@ extern "C" {
 #define PIO_ROTARY_SM            0              // State Machine 0 is used for the rotary quad decode
 #define PIO_ROTARY_IRQ          PIO1_IRQ_0      // PIO IRQ to use for Rotary reading change
 #define PIO_ROTARY_IRQ_IDX       0              // PIO IRQ index for the Rotary reading change
+#define PIO_PDBUS_BLOCK         pio0            // PIO Block 0 is used to drive the Programmable Device bus
+#define PIO_PDBUS_SM             0              // State Machine 0 is used for the Programmable Device bus
 
 // Rotary Encoder Input
 // This is a A/B quadrature encoder that can be decoded using a PIO (must be sequential)
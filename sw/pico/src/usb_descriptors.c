@@ -0,0 +1,248 @@
+/**
+ * USB Descriptors.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+ * The device is a composite of a CDC (interfaces 0 and 1, used by the SDK's STDIO USB
+ * driver), a Mass Storage class (interface 2, see `usbdrive`), and the SDK's reset
+ * interface (interface 3). The CDC is first, so the STDIO driver (which uses CDC 0) works
+ * as it does with the SDK's descriptors.
+ *
+ * As the application links TinyUSB itself, the SDK doesn't add its reset interface driver,
+ * so it is here. It lets `picotool` reboot the device (to BOOTSEL, or to the application)
+ * without pressing the BOOTSEL button.
+ *
+ * The USB IDs are set by the build (USBD_VID and USBD_PID). The defaults are the pid.codes
+ * test IDs, for development only. A build to be distributed must set the IDs allocated for
+ * the device (with `-DUSBD_VID=... -DUSBD_PID=...`).
+ *
+*/
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+
+#include "hardware/watchdog.h"
+#include "pico/bootrom.h"
+#include "pico/stdio_usb.h"
+#include "pico/unique_id.h"
+#include "pico/usb_reset_interface.h"
+
+#include <string.h>
+
+#ifndef USBD_VID
+#define USBD_VID            (0x1209)    // pid.codes
+#endif
+#ifndef USBD_PID
+#define USBD_PID            (0x0001)    // pid.codes test PID (development only)
+#endif
+#define _USBD_BCD           (0x0100)
+
+#define _USBD_MAX_POWER_MA  (250)
+
+#define _ITF_CDC            (0)
+#define _ITF_CDC_DATA       (1)
+#define _ITF_MSC            (2)
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+#define _ITF_RESET          (3)
+#define _ITF_COUNT          (4)
+#define _RESET_DESC_LEN     (9)
+#else
+#define _ITF_COUNT          (3)
+#define _RESET_DESC_LEN     (0)
+#endif
+
+#define _EP_CDC_NOTIF       (0x81)
+#define _EP_CDC_OUT         (0x02)
+#define _EP_CDC_IN          (0x82)
+#define _EP_MSC_OUT         (0x03)
+#define _EP_MSC_IN          (0x83)
+
+#define _CDC_NOTIF_SIZE     (8)
+#define _CDC_EP_SIZE        (64)
+#define _MSC_EP_SIZE        (64)
+
+#define _CONFIG_LEN         (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MSC_DESC_LEN + _RESET_DESC_LEN)
+
+/** @brief The reset interface: vendor specific, with no endpoints (the requests use the control endpoint) */
+#define _RESET_DESCRIPTOR(_itfnum, _stridx) \
+    9, TUSB_DESC_INTERFACE, _itfnum, 0, 0, TUSB_CLASS_VENDOR_SPECIFIC, RESET_INTERFACE_SUBCLASS, RESET_INTERFACE_PROTOCOL, _stridx
+
+typedef enum str_idx_ {
+    _STR_LANGID = 0,
+    _STR_MANUFACTURER,
+    _STR_PRODUCT,
+    _STR_SERIAL,
+    _STR_CDC,
+    _STR_MSC,
+    _STR_RESET,
+    _STR_COUNT,
+} str_idx_t;
+
+#define _DESC_STR_MAX       (32)
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+static const tusb_desc_device_t _desc_device = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = 0x0200,
+    // Use the Interface Association Descriptor (IAD) for the CDC
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = USBD_VID,
+    .idProduct = USBD_PID,
+    .bcdDevice = _USBD_BCD,
+    .iManufacturer = _STR_MANUFACTURER,
+    .iProduct = _STR_PRODUCT,
+    .iSerialNumber = _STR_SERIAL,
+    .bNumConfigurations = 1,
+};
+
+static const uint8_t _desc_config[_CONFIG_LEN] = {
+    TUD_CONFIG_DESCRIPTOR(1, _ITF_COUNT, 0, _CONFIG_LEN, 0, _USBD_MAX_POWER_MA),
+    TUD_CDC_DESCRIPTOR(_ITF_CDC, _STR_CDC, _EP_CDC_NOTIF, _CDC_NOTIF_SIZE, _EP_CDC_OUT, _EP_CDC_IN, _CDC_EP_SIZE),
+    TUD_MSC_DESCRIPTOR(_ITF_MSC, _STR_MSC, _EP_MSC_OUT, _EP_MSC_IN, _MSC_EP_SIZE),
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+    _RESET_DESCRIPTOR(_ITF_RESET, _STR_RESET),
+#endif
+};
+
+/** @brief The serial number (the flash unique ID), filled in the first time it is asked for */
+static char _serial[(2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES) + 1];
+
+static const char* const _desc_strings[_STR_COUNT] = {
+    NULL,                           // Language (handled separately)
+    "SilkyDESIGN",                  // Manufacturer
+    "SD Flash Programmer",          // Product
+    _serial,                        // Serial
+    "SD Flash Programmer Console",  // CDC
+    "SD Flash Programmer Drive",    // MSC
+    "Reset",                        // Reset
+};
+
+static uint16_t _desc_str[_DESC_STR_MAX + 1];
+
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+/** @brief The reset interface number (set when the host opens it) */
+static uint8_t _reset_itf;
+#endif
+
+// ====================================================================
+// Reset Interface Driver
+// ====================================================================
+
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+static void _resetd_init(void) {
+}
+
+static void _resetd_reset(uint8_t rhport) {
+    (void)rhport;
+    _reset_itf = 0;
+}
+
+static uint16_t _resetd_open(uint8_t rhport, const tusb_desc_interface_t* itf_desc, uint16_t max_len) {
+    (void)rhport;
+    if (itf_desc->bInterfaceClass != TUSB_CLASS_VENDOR_SPECIFIC
+        || itf_desc->bInterfaceSubClass != RESET_INTERFACE_SUBCLASS
+        || itf_desc->bInterfaceProtocol != RESET_INTERFACE_PROTOCOL
+        || max_len < sizeof(tusb_desc_interface_t)) {
+        return (0);
+    }
+    _reset_itf = itf_desc->bInterfaceNumber;
+    return (sizeof(tusb_desc_interface_t));
+}
+
+static bool _resetd_control_xfer_cb(uint8_t rhport, uint8_t stage, const tusb_control_request_t* request) {
+    (void)rhport;
+    if (stage != CONTROL_STAGE_SETUP) {
+        return (true);
+    }
+    if (request->wIndex != _reset_itf) {
+        return (false);
+    }
+#if PICO_STDIO_USB_RESET_INTERFACE_SUPPORT_RESET_TO_BOOTSEL
+    if (request->bRequest == RESET_REQUEST_BOOTSEL) {
+        // The low bits of the value can disable the BOOTSEL interfaces (mass storage/PICOBOOT).
+        reset_usb_boot(0, (request->wValue & 0x7F) | PICO_STDIO_USB_RESET_BOOTSEL_INTERFACE_DISABLE_MASK);
+        // Doesn't return
+    }
+#endif
+#if PICO_STDIO_USB_RESET_INTERFACE_SUPPORT_RESET_TO_FLASH_BOOT
+    if (request->bRequest == RESET_REQUEST_FLASH) {
+        watchdog_reboot(0, 0, PICO_STDIO_USB_RESET_RESET_TO_FLASH_DELAY_MS);
+        return (true);
+    }
+#endif
+    return (false);
+}
+
+static bool _resetd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes) {
+    (void)rhport;
+    (void)ep_addr;
+    (void)result;
+    (void)xferred_bytes;
+    return (true);
+}
+
+static const usbd_class_driver_t _resetd_driver = {
+    .init = _resetd_init,
+    .reset = _resetd_reset,
+    .open = _resetd_open,
+    .control_xfer_cb = _resetd_control_xfer_cb,
+    .xfer_cb = _resetd_xfer_cb,
+    .sof = NULL,
+};
+#endif
+
+
+// ====================================================================
+// TinyUSB Callbacks
+// ====================================================================
+
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+const usbd_class_driver_t* usbd_app_driver_get_cb(uint8_t* driver_count) {
+    *driver_count = 1;
+    return (&_resetd_driver);
+}
+#endif
+
+const uint8_t* tud_descriptor_device_cb(void) {
+    return ((const uint8_t*)&_desc_device);
+}
+
+const uint8_t* tud_descriptor_configuration_cb(uint8_t index) {
+    (void)index;
+    return (_desc_config);
+}
+
+const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    (void)langid;
+    uint8_t len;
+    if (index == _STR_LANGID) {
+        _desc_str[1] = 0x0409; // English
+        len = 1;
+    }
+    else {
+        if (index >= _STR_COUNT) {
+            return (NULL);
+        }
+        if (index == _STR_SERIAL && !_serial[0]) {
+            pico_get_unique_board_id_string(_serial, sizeof(_serial));
+        }
+        const char* str = _desc_strings[index];
+        len = (uint8_t)strlen(str);
+        if (len > _DESC_STR_MAX) {
+            len = _DESC_STR_MAX;
+        }
+        for (int i = 0; i < len; i++) {
+            _desc_str[1 + i] = str[i];
+        }
+    }
+    // The first word is the length (in bytes, including it) and the descriptor type.
+    _desc_str[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 * len + 2));
+    return (_desc_str);
+}
@@ -97,6 +97,22 @@ bool bool_from_str(const char* str) {
     return (false);
 }
 
+uint32_t crc32_update(uint32_t crc, const void* data, uint32_t len) {
+    // Nibble table (small, and fast enough)
+    static const uint32_t _tbl[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ _tbl[crc & 0x0F];
+        crc = (crc >> 4) ^ _tbl[crc & 0x0F];
+    }
+    return (~crc);
+}
+
 int8_t days_in_month(int8_t month, int16_t year) {
     int8_t days = DAYS_IN_MONTH[month + 1];
 
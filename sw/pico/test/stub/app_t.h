@@ -0,0 +1,11 @@
+/**
+ * Host test stub for the application types (nothing is needed by the modules tested).
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef APP_T_H_
+#define APP_T_H_
+
+#endif // APP_T_H_
@@ -0,0 +1,17 @@
+/**
+ * Host test stub for the Pico SDK types.
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef PICO_TYPES_H_
+#define PICO_TYPES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+#endif // PICO_TYPES_H_
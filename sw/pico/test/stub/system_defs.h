@@ -0,0 +1,20 @@
+/**
+ * Host test stub for the system definitions (only what the headers of the modules
+ * tested need).
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+#ifndef SYSTEM_DEFS_H_
+#define SYSTEM_DEFS_H_
+
+#include "pico/types.h"
+
+#define OP_DEVICE_PWR 0
+
+static inline bool gpio_get(uint gpio) {
+    return (false);
+}
+
+#endif // SYSTEM_DEFS_H_
@@ -0,0 +1,268 @@
+/**
+ * Host test and benchmark of the Intel HEX decoder.
+ *
+ * HEX files are generated from random images (with Extended Linear Address records at
+ * the 64K boundaries, as the tools write them) and fed to the decoder in random chunk
+ * sizes, like the loader does with the pieces it reads from the file. The decoded data
+ * is written to a test image by the sink and compared with the source image.
+ *
+ *     test_hexload            Run the tests
+ *     test_hexload --bench    Time decoding large generated files
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "hexload.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define _IMG_SIZE (512 * 1024)
+
+/** @brief Room for the HEX text of a full image (44 characters for each 16 data bytes) */
+#define _HEX_MAX ((_IMG_SIZE / 16) * 48 + 4096)
+
+#define CHECK(cond) _check((cond), #cond, __FILE__, __LINE__)
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+static uint8_t _src[_IMG_SIZE];
+static uint8_t _img[_IMG_SIZE];
+static char _hex[_HEX_MAX];
+
+static int _failures;
+static int _checks;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+static void _check(bool ok, const char* what, const char* file, int line) {
+    _checks++;
+    if (!ok) {
+        _failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+static double _now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/**
+ * @brief Append a record to the HEX text.
+ *
+ * @return uint32_t The new length of the text
+ */
+static uint32_t _rec_put(uint32_t pos, uint8_t type, uint16_t offset, const uint8_t* data, uint8_t len, bool crlf) {
+    uint8_t sum = len + (offset >> 8) + (offset & 0xFF) + type;
+    pos += sprintf(_hex + pos, ":%02X%04X%02X", len, offset, type);
+    for (int i = 0; i < len; i++) {
+        pos += sprintf(_hex + pos, "%02X", data[i]);
+        sum += data[i];
+    }
+    pos += sprintf(_hex + pos, "%02X%s", (uint8_t)(-sum), (crlf ? "\r\n" : "\n"));
+    return (pos);
+}
+
+/**
+ * @brief Generate the HEX text for `size` bytes of the source image.
+ *
+ * Runs of 0xFF (erased) are left out, as tools that write HEX files often do, so the
+ * decoder sees gaps as well as the address records.
+ *
+ * @return uint32_t The length of the text
+ */
+static uint32_t _hex_gen(uint32_t size, uint8_t reclen, bool crlf, bool skip_ff) {
+    uint32_t pos = 0;
+    uint32_t base = 0xFFFFFFFF;
+    for (uint32_t addr = 0; addr < size; addr += reclen) {
+        uint8_t len = (size - addr < reclen ? (uint8_t)(size - addr) : reclen);
+        if (skip_ff) {
+            bool ff = true;
+            for (int i = 0; i < len && ff; i++) {
+                ff = (_src[addr + i] == 0xFF);
+            }
+            if (ff) {
+                continue;
+            }
+        }
+        if ((addr >> 16) != base) {
+            base = addr >> 16;
+            uint8_t ela[2] = { (uint8_t)(base >> 8), (uint8_t)base };
+            pos = _rec_put(pos, 0x04, 0, ela, 2, crlf);
+        }
+        pos = _rec_put(pos, 0x00, (uint16_t)addr, &_src[addr], len, crlf);
+    }
+    uint8_t start[4] = { 0x00, 0x00, 0x12, 0x34 };
+    pos = _rec_put(pos, 0x05, 0, start, 4, crlf);
+    pos = _rec_put(pos, 0x01, 0, NULL, 0, crlf);
+    return (pos);
+}
+
+/**
+ * @brief Fill the source image: random data with some runs of 0xFF.
+ */
+static void _src_fill(uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        _src[i] = (uint8_t)rand();
+    }
+    for (int r = 0; r < 16; r++) {
+        uint32_t at = (uint32_t)rand() % size;
+        uint32_t n = (uint32_t)rand() % 4096;
+        memset(&_src[at], 0xFF, (n < size - at ? n : size - at));
+    }
+}
+
+/**
+ * @brief Decode the HEX text, feeding it in chunks.
+ *
+ * @param chunk The chunk size, or 0 for random sizes (1 to 8K)
+ * @return ld_status_t The status of the decode
+ */
+static ld_status_t _decode(uint32_t len, uint32_t chunk, ld_result_t* result) {
+    ld_sink_t sink = { 0, 1, result };
+    memset(result, 0, sizeof(ld_result_t));
+    result->start_addr = LD_NO_START;
+    result->line = 1;
+    memset(_img, 0xFF, sizeof(_img));
+    ld_hex_decoder.begin(&sink);
+    ld_status_t status = LD_MORE;
+    uint32_t pos = 0;
+    while (status == LD_MORE) {
+        if (pos == len) {
+            return (ld_hex_decoder.end());
+        }
+        uint32_t n = (chunk ? chunk : 1 + ((uint32_t)rand() % (8 * 1024)));
+        if (n > len - pos) {
+            n = len - pos;
+        }
+        status = ld_hex_decoder.feed((const uint8_t*)_hex + pos, n);
+        pos += n;
+    }
+    return (status);
+}
+
+static void _test_roundtrip() {
+    const uint32_t sizes[] = { 1, 15, 16, 17, 4096, 65536 + 100, _IMG_SIZE };
+    const uint8_t reclens[] = { 16, 32, 255 };
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (unsigned r = 0; r < sizeof(reclens) / sizeof(reclens[0]); r++) {
+            uint32_t size = sizes[s];
+            _src_fill(size);
+            memset(_src + size, 0xFF, _IMG_SIZE - size);
+            bool crlf = (r & 1);
+            uint32_t len = _hex_gen(size, reclens[r], crlf, (s & 1));
+            uint32_t chunks[] = { 0, 0, 1, 4096 };
+            for (unsigned c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+                ld_result_t result;
+                ld_status_t status = _decode(len, chunks[c], &result);
+                CHECK(status == LD_OK);
+                CHECK(memcmp(_img, _src, _IMG_SIZE) == 0);
+                CHECK(result.start_addr == 0x1234);
+                CHECK(result.addr_high <= size);
+            }
+        }
+    }
+}
+
+static void _test_errors() {
+    ld_result_t result;
+    _src_fill(64);
+    uint32_t len = _hex_gen(64, 16, false, false);
+
+    // A bad checksum (the last digit of the first data record)
+    char* nl = strchr(strchr(_hex, '\n') + 1, '\n');
+    char save = nl[-1];
+    nl[-1] = (save == '0' ? '1' : '0');
+    CHECK(_decode(len, 0, &result) == LD_CHECKSUM_ERROR);
+    CHECK(result.line == 2);
+    nl[-1] = save;
+
+    // A character that isn't a hex digit
+    save = _hex[20];
+    _hex[20] = 'G';
+    CHECK(_decode(len, 0, &result) == LD_SYNTAX_ERROR);
+    _hex[20] = save;
+
+    // No EOF record
+    uint32_t noeof = (uint32_t)(strstr(_hex, ":00000001FF") - _hex);
+    CHECK(_decode(noeof, 0, &result) == LD_NO_END);
+
+    // An unknown record type
+    len = _rec_put(0, 0x07, 0, NULL, 0, false);
+    CHECK(_decode(len, 0, &result) == LD_RECTYPE_ERROR);
+
+    // Data past the end of the image
+    uint8_t ela[2] = { 0x00, 0x08 };
+    len = _rec_put(0, 0x04, 0, ela, 2, false);
+    len = _rec_put(len, 0x00, 0, _src, 16, false);
+    CHECK(_decode(len, 0, &result) == LD_ADDR_ERROR);
+
+    // Detection
+    CHECK(ld_hex_decoder.sniff((const uint8_t*)"\r\n  :10000000", 13));
+    CHECK(!ld_hex_decoder.sniff((const uint8_t*)"S00F0000", 8));
+    CHECK(!ld_hex_decoder.sniff((const uint8_t*)":", 1));
+}
+
+static void _bench() {
+    _src_fill(_IMG_SIZE);
+    uint32_t len = _hex_gen(_IMG_SIZE, 16, true, false);
+    printf("HEX decode of a %u KB image (%u KB of text, 16 byte records)\n", _IMG_SIZE / 1024, len / 1024);
+    const uint32_t chunks[] = { 4096, 512, 64, 0 };
+    for (unsigned c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        const int reps = 20;
+        ld_result_t result;
+        double t = _now();
+        for (int i = 0; i < reps; i++) {
+            _decode(len, chunks[c], &result);
+        }
+        t = (_now() - t) / reps;
+        char what[16];
+        snprintf(what, sizeof(what), (chunks[c] ? "%u" : "random"), chunks[c]);
+        printf("  chunk %-7s %7.2f ms  %7.1f MB/s text  %6.1f MB/s data\n",
+            what, t * 1000, (len / t) / 1e6, (_IMG_SIZE / t) / 1e6);
+    }
+}
+
+// ====================================================================
+// Test Sink
+// ====================================================================
+
+/**
+ * @brief Write decoded data to the test image (in place of the loader's sink).
+ */
+ld_status_t ld_sink_write(ld_sink_t* sink, uint32_t addr, const uint8_t* data, uint32_t len) {
+    ld_result_t* result = sink->result;
+    uint32_t iaddr = addr + (uint32_t)sink->offset;
+    if (iaddr >= _IMG_SIZE || len > (_IMG_SIZE - iaddr)) {
+        return (LD_ADDR_ERROR);
+    }
+    memcpy(&_img[iaddr], data, len);
+    result->records++;
+    result->bytes += len;
+    if (iaddr + len > result->addr_high) {
+        result->addr_high = iaddr + len;
+    }
+    return (LD_OK);
+}
+
+int main(int argc, char** argv) {
+    srand(1);
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        _bench();
+        return (0);
+    }
+    _test_roundtrip();
+    _test_errors();
+    printf("test_hexload: %d checks, %d failed\n", _checks, _failures);
+    return (_failures ? 1 : 0);
+}
@@ -0,0 +1,234 @@
+/**
+ * Host test of unpacking the .sdpi files written by the host tool (`sw/host/sdpi.py`).
+ *
+ * Images (random, all 0xFF, sparse, and repetitive) are written to temp files and packed
+ * with the host tool. The .sdpi files are then read with the firmware's structures and each
+ * packed payload is unpacked in place (at the end of a buffer with the margin `lzpack.h`
+ * asks for) by the firmware's `lzp_unpack`, and compared with the image. Payloads packed by
+ * the firmware's `lzp_pack` are checked the same way.
+ *
+ *     test_lzpack path/to/sdpi.py
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "lzpack.h"
+#include "sdpi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _IMG_SIZE (512 * 1024)
+#define _SECT_MAX (64 * 1024)
+
+/** @brief The room `lzp_unpack` needs after the data to unpack in place */
+#define _MARGIN(len) (((len) / 128) + 16)
+
+#define CHECK(cond) _check((cond), #cond, __FILE__, __LINE__)
+
+typedef enum img_kind_ {
+    IMG_RANDOM,
+    IMG_BLANK,
+    IMG_SPARSE,
+    IMG_REPETITIVE,
+    IMG_MOSTLY_RANDOM,
+    IMG_KIND_CNT,
+} img_kind_t;
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+static const char* const _kind_names[IMG_KIND_CNT] = { "random", "blank", "sparse", "repetitive", "mostly-rnd" };
+
+static uint8_t _img[_IMG_SIZE];
+static uint8_t _sdpi[_IMG_SIZE + (_IMG_SIZE / 8) + 4096];
+static uint8_t _work[_SECT_MAX + _MARGIN(_SECT_MAX)];
+static uint8_t _packed[_SECT_MAX + _MARGIN(_SECT_MAX)];
+
+static int _failures;
+static int _checks;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+static void _check(bool ok, const char* what, const char* file, int line) {
+    _checks++;
+    if (!ok) {
+        _failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+static uint32_t _crc32(const uint8_t* data, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return (~crc);
+}
+
+static void _img_fill(img_kind_t kind, uint32_t size) {
+    switch (kind) {
+        case IMG_RANDOM:
+            for (uint32_t i = 0; i < size; i++) {
+                _img[i] = (uint8_t)rand();
+            }
+            break;
+        case IMG_BLANK:
+            memset(_img, 0xFF, size);
+            break;
+        case IMG_SPARSE:
+            // Mostly erased, with some short random runs and some zero fill.
+            memset(_img, 0xFF, size);
+            for (int r = 0; r < 64; r++) {
+                uint32_t at = (uint32_t)rand() % size;
+                uint32_t n = 1 + (uint32_t)rand() % 300;
+                for (uint32_t i = at; i < at + n && i < size; i++) {
+                    _img[i] = (r & 1 ? 0x00 : (uint8_t)rand());
+                }
+            }
+            break;
+        case IMG_REPETITIVE:
+            // A table repeated with small changes (like code with repeated structures).
+            for (uint32_t i = 0; i < size; i++) {
+                _img[i] = (uint8_t)((i % 251) ^ ((i / 4096) & 0x0F));
+            }
+            break;
+        case IMG_MOSTLY_RANDOM:
+            // Packs to just under the sector size, where unpacking in place needs the margin.
+            for (uint32_t i = 0; i < size; i++) {
+                _img[i] = ((i % 1024) < 24 ? 0 : (uint8_t)rand());
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Unpack a payload in place (at the end of the work buffer) and check it.
+ */
+static bool _unpack_check(const uint8_t* payload, uint32_t plen, const uint8_t* expect, uint32_t sectsize) {
+    uint32_t room = sectsize + _MARGIN(sectsize);
+    uint8_t* src = &_work[room - plen];
+    memmove(src, payload, plen);
+    if (!lzp_unpack(src, plen, _work, sectsize)) {
+        return (false);
+    }
+    return (memcmp(_work, expect, sectsize) == 0);
+}
+
+/**
+ * @brief Pack an image with the host tool and check the file.
+ */
+static void _test_host_file(const char* tool, img_kind_t kind, uint32_t sectcnt, uint32_t sectsize) {
+    uint32_t size = sectcnt * sectsize;
+    _img_fill(kind, size);
+    char binpath[] = "/tmp/test_lzpack_XXXXXX";
+    int fd = mkstemp(binpath);
+    if (fd < 0) {
+        CHECK(fd >= 0);
+        return;
+    }
+    FILE* f = fdopen(fd, "wb");
+    fwrite(_img, 1, size, f);
+    fclose(f);
+    char sdpipath[sizeof(binpath) + 8];
+    snprintf(sdpipath, sizeof(sdpipath), "%s.sdpi", binpath);
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "python3 '%s' pack '%s' '%s' --sectors %u > /dev/null", tool, binpath, sdpipath, sectcnt);
+    int rc = system(cmd);
+    CHECK(rc == 0);
+    f = fopen(sdpipath, "rb");
+    uint32_t flen = (f ? (uint32_t)fread(_sdpi, 1, sizeof(_sdpi), f) : 0);
+    if (f) {
+        fclose(f);
+    }
+    remove(binpath);
+    remove(sdpipath);
+
+    sdpi_hdr_t hdr;
+    uint32_t tpos = sizeof(sdpi_hdr_t) + SDPI_BITMAP_SIZE;
+    CHECK(flen >= tpos + (sectcnt * sizeof(sdpi_sect_t)));
+    if (flen < tpos + (sectcnt * sizeof(sdpi_sect_t))) {
+        return;
+    }
+    memcpy(&hdr, _sdpi, sizeof(hdr));
+    CHECK(hdr.magic == SDPI_MAGIC);
+    CHECK(hdr.version == SDPI_VERSION);
+    CHECK(hdr.size == size && hdr.sectsize == sectsize && hdr.sectcnt == sectcnt);
+    CHECK(hdr.crc == _crc32(_img, size));
+    uint32_t pos = tpos + (sectcnt * sizeof(sdpi_sect_t));
+    int packed = 0;
+    for (uint32_t s = 0; s < sectcnt; s++) {
+        sdpi_sect_t st;
+        memcpy(&st, &_sdpi[tpos + (s * sizeof(sdpi_sect_t))], sizeof(st));
+        const uint8_t* expect = &_img[s * sectsize];
+        CHECK(st.crc == _crc32(expect, sectsize));
+        CHECK(pos + st.plen <= flen);
+        if (pos + st.plen > flen) {
+            return;
+        }
+        if (st.plen == 0) {
+            bool blank = true;
+            for (uint32_t i = 0; i < sectsize && blank; i++) {
+                blank = (expect[i] == 0xFF);
+            }
+            CHECK(blank);
+        }
+        else if (st.plen == sectsize) {
+            CHECK(memcmp(&_sdpi[pos], expect, sectsize) == 0);
+        }
+        else {
+            packed++;
+            CHECK(_unpack_check(&_sdpi[pos], st.plen, expect, sectsize));
+        }
+        pos += st.plen;
+    }
+    CHECK(pos == flen);
+    if (kind == IMG_SPARSE || kind == IMG_REPETITIVE || kind == IMG_MOSTLY_RANDOM) {
+        CHECK(packed > 0);
+    }
+    printf("  %-10s %3u x %2uK: %6u bytes, %d packed\n", _kind_names[kind], sectcnt, sectsize / 1024, flen, packed);
+}
+
+/**
+ * @brief Pack each sector with the firmware's packer and check that it unpacks in place.
+ */
+static void _test_firmware_pack(img_kind_t kind, uint32_t sectsize) {
+    _img_fill(kind, sectsize);
+    uint32_t plen = lzp_pack(_img, sectsize, _packed, sectsize);
+    if (plen == 0) {
+        // Doesn't pack smaller (it would be stored unpacked)
+        CHECK(kind == IMG_RANDOM);
+        return;
+    }
+    CHECK(_unpack_check(_packed, plen, _img, sectsize));
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s path/to/sdpi.py\n", argv[0]);
+        return (2);
+    }
+    srand(1);
+    printf("Host tool files (unpacked in place):\n");
+    for (int k = 0; k < IMG_KIND_CNT; k++) {
+        _test_host_file(argv[1], (img_kind_t)k, 8, 64 * 1024);
+        _test_host_file(argv[1], (img_kind_t)k, 32, 4 * 1024);
+    }
+    for (int k = 0; k < IMG_KIND_CNT; k++) {
+        _test_firmware_pack((img_kind_t)k, 64 * 1024);
+        _test_firmware_pack((img_kind_t)k, 4 * 1024);
+    }
+    printf("test_lzpack: %d checks, %d failed\n", _checks, _failures);
+    return (_failures ? 1 : 0);
+}
@@ -0,0 +1,301 @@
+/**
+ * Host test of the Motorola S-Record decoder.
+ *
+ * S-Record files are generated from random images (S1, S2, and S3 data records, with the
+ * S7, S8, or S9 end record that goes with them) and fed to the decoder in random chunk
+ * sizes, like the loader does with the pieces it reads from the file. The decoded data
+ * is written to a test image by the sink (with the load offset applied) and compared
+ * with the source image.
+ *
+ *     test_srecload
+ *
+ * Copyright 2023-25 AESilky
+ * SPDX-License-Identifier: MIT License
+ *
+*/
+
+#include "srecload.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _IMG_SIZE (512 * 1024)
+
+/** @brief Room for the text of a full image (at most 50 characters for each 16 data bytes) */
+#define _SREC_MAX ((_IMG_SIZE / 16) * 52 + 4096)
+
+#define CHECK(cond) _check((cond), #cond, __FILE__, __LINE__)
+
+// ====================================================================
+// Data Section
+// ====================================================================
+
+/** @brief The address length for each record type (as the decoder has it) */
+static const uint8_t _addrlen[10] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+
+static uint8_t _src[_IMG_SIZE];
+static uint8_t _img[_IMG_SIZE];
+static char _srec[_SREC_MAX];
+
+static int _failures;
+static int _checks;
+
+// ====================================================================
+// Local/Private Methods
+// ====================================================================
+
+static void _check(bool ok, const char* what, const char* file, int line) {
+    _checks++;
+    if (!ok) {
+        _failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+/**
+ * @brief Append a record to the S-Record text.
+ *
+ * @return uint32_t The new length of the text
+ */
+static uint32_t _rec_put(uint32_t pos, uint8_t type, uint32_t addr, const uint8_t* data, uint8_t len, bool crlf) {
+    uint8_t alen = _addrlen[type];
+    uint8_t count = alen + len + 1;
+    uint8_t sum = count;
+    pos += sprintf(_srec + pos, "S%u%02X", type, count);
+    for (int i = alen - 1; i >= 0; i--) {
+        uint8_t b = (uint8_t)(addr >> (8 * i));
+        pos += sprintf(_srec + pos, "%02X", b);
+        sum += b;
+    }
+    for (int i = 0; i < len; i++) {
+        pos += sprintf(_srec + pos, "%02X", data[i]);
+        sum += data[i];
+    }
+    pos += sprintf(_srec + pos, "%02X%s", (uint8_t)(~sum), (crlf ? "\r\n" : "\n"));
+    return (pos);
+}
+
+/**
+ * @brief Generate the S-Record text for `size` bytes of the source image at `base`.
+ *
+ * The file has a header (S0), the data records of `type` (1, 2, or 3), a count (S5) if
+ * there are few enough records, and the end record that goes with the data records (S9,
+ * S8, or S7) with a start address of `base + 0x1234`. Runs of 0xFF (erased) can be left
+ * out, as tools that write S-Record files often do.
+ *
+ * @return uint32_t The length of the text
+ */
+static uint32_t _srec_gen(uint32_t size, uint8_t type, uint32_t base, uint8_t reclen, bool crlf, bool skip_ff) {
+    const uint8_t hdr[] = { 'T', 'E', 'S', 'T' };
+    uint32_t pos = _rec_put(0, 0, 0, hdr, sizeof(hdr), crlf);
+    uint32_t nrec = 0;
+    for (uint32_t addr = 0; addr < size; addr += reclen) {
+        uint8_t len = (size - addr < reclen ? (uint8_t)(size - addr) : reclen);
+        if (skip_ff) {
+            bool ff = true;
+            for (int i = 0; i < len && ff; i++) {
+                ff = (_src[addr + i] == 0xFF);
+            }
+            if (ff) {
+                continue;
+            }
+        }
+        pos = _rec_put(pos, type, base + addr, &_src[addr], len, crlf);
+        nrec++;
+    }
+    if (nrec <= 0xFFFF) {
+        pos = _rec_put(pos, 5, nrec, NULL, 0, crlf);
+    }
+    pos = _rec_put(pos, 10 - type, base + 0x1234, NULL, 0, crlf);
+    return (pos);
+}
+
+/**
+ * @brief Fill the source image: random data with some runs of 0xFF.
+ */
+static void _src_fill(uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        _src[i] = (uint8_t)rand();
+    }
+    for (int r = 0; r < 16; r++) {
+        uint32_t at = (uint32_t)rand() % size;
+        uint32_t n = (uint32_t)rand() % 4096;
+        memset(&_src[at], 0xFF, (n < size - at ? n : size - at));
+    }
+}
+
+/**
+ * @brief Decode the S-Record text, feeding it in chunks.
+ *
+ * @param offset The load offset (added to the file addresses by the sink)
+ * @param chunk The chunk size, or 0 for random sizes (1 to 8K)
+ * @return ld_status_t The status of the decode
+ */
+static ld_status_t _decode(uint32_t len, int32_t offset, uint32_t chunk, ld_result_t* result) {
+    ld_sink_t sink = { offset, 1, result };
+    memset(result, 0, sizeof(ld_result_t));
+    result->start_addr = LD_NO_START;
+    result->line = 1;
+    memset(_img, 0xFF, sizeof(_img));
+    ld_srec_decoder.begin(&sink);
+    ld_status_t status = LD_MORE;
+    uint32_t pos = 0;
+    while (status == LD_MORE) {
+        if (pos == len) {
+            return (ld_srec_decoder.end());
+        }
+        uint32_t n = (chunk ? chunk : 1 + ((uint32_t)rand() % (8 * 1024)));
+        if (n > len - pos) {
+            n = len - pos;
+        }
+        status = ld_srec_decoder.feed((const uint8_t*)_srec + pos, n);
+        pos += n;
+    }
+    return (status);
+}
+
+/**
+ * @brief Check that the image has the source data at `at` and is erased elsewhere.
+ */
+static bool _img_check(uint32_t at, uint32_t size) {
+    if (memcmp(&_img[at], _src, size) != 0) {
+        return (false);
+    }
+    for (uint32_t i = 0; i < _IMG_SIZE; i++) {
+        if ((i < at || i >= at + size) && _img[i] != 0xFF) {
+            return (false);
+        }
+    }
+    return (true);
+}
+
+static void _test_roundtrip() {
+    const uint32_t sizes[] = { 1, 15, 16, 17, 4096, 65536, 65536 + 100, _IMG_SIZE };
+    const uint8_t reclens[] = { 16, 32, 250 };
+    for (uint8_t type = 1; type <= 3; type++) {
+        for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            uint32_t size = sizes[s];
+            if (type == 1 && size > 65536) {
+                continue;   // S1 only has 16 bit addresses
+            }
+            for (unsigned r = 0; r < sizeof(reclens) / sizeof(reclens[0]); r++) {
+                _src_fill(size);
+                bool crlf = (r & 1);
+                uint32_t len = _srec_gen(size, type, 0, reclens[r], crlf, (s & 1));
+                uint32_t chunks[] = { 0, 0, 1, 4096 };
+                for (unsigned c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+                    ld_result_t result;
+                    ld_status_t status = _decode(len, 0, chunks[c], &result);
+                    CHECK(status == LD_OK);
+                    CHECK(_img_check(0, size));
+                    CHECK(result.start_addr == 0x1234);
+                    CHECK(result.addr_high <= size);
+                }
+            }
+        }
+    }
+}
+
+static void _test_offset() {
+    ld_result_t result;
+    uint32_t size = 4096 + 100;
+    _src_fill(size);
+
+    // Data at 0 loaded higher in the image
+    uint32_t len = _srec_gen(size, 1, 0, 32, false, false);
+    CHECK(_decode(len, 0x70000, 0, &result) == LD_OK);
+    CHECK(_img_check(0x70000, size));
+    CHECK(result.addr_high == 0x70000 + size);
+    CHECK(result.start_addr == 0x1234);     // The start address isn't offset
+
+    // Data at a high address (as a linker puts it) loaded at the start of the image
+    len = _srec_gen(size, 3, 0x08000000, 32, true, false);
+    CHECK(_decode(len, -0x08000000, 0, &result) == LD_OK);
+    CHECK(_img_check(0, size));
+    CHECK(result.start_addr == 0x08001234);
+    len = _srec_gen(size, 2, 0x010000, 250, false, false);
+    CHECK(_decode(len, -0x8000, 0, &result) == LD_OK);
+    CHECK(_img_check(0x8000, size));
+
+    // An offset that puts the data past the end of the image
+    len = _srec_gen(size, 2, 0x010000, 32, false, false);
+    CHECK(_decode(len, _IMG_SIZE - 0x010000 - 16, 0, &result) == LD_ADDR_ERROR);
+}
+
+static void _test_errors() {
+    ld_result_t result;
+    _src_fill(64);
+    uint32_t len = _srec_gen(64, 2, 0, 16, false, false);
+
+    // A bad checksum (the last digit of the first data record)
+    char* nl = strchr(strchr(_srec, '\n') + 1, '\n');
+    char save = nl[-1];
+    nl[-1] = (save == '0' ? '1' : '0');
+    CHECK(_decode(len, 0, 0, &result) == LD_CHECKSUM_ERROR);
+    CHECK(result.line == 2);
+    nl[-1] = save;
+
+    // A character that isn't a hex digit
+    save = _srec[25];
+    _srec[25] = 'G';
+    CHECK(_decode(len, 0, 0, &result) == LD_SYNTAX_ERROR);
+    _srec[25] = save;
+
+    // No end record
+    uint32_t noend = (uint32_t)(strstr(_srec, "\nS8") + 1 - _srec);
+    CHECK(_decode(noend, 0, 0, &result) == LD_NO_END);
+
+    // An unknown record type
+    CHECK(_decode((uint32_t)sprintf(_srec, "S4030000FC\n"), 0, 0, &result) == LD_RECTYPE_ERROR);
+
+    // A count too short for the address
+    CHECK(_decode((uint32_t)sprintf(_srec, "S30200FD\n"), 0, 0, &result) == LD_SYNTAX_ERROR);
+
+    // Data past the end of the image
+    len = _rec_put(0, 3, _IMG_SIZE - 8, _src, 16, false);
+    CHECK(_decode(len, 0, 0, &result) == LD_ADDR_ERROR);
+
+    // Anything after the end record is ignored
+    _src_fill(16);
+    len = _srec_gen(16, 1, 0, 16, false, false);
+    len += (uint32_t)sprintf(_srec + len, "garbage\n");
+    CHECK(_decode(len, 0, 0, &result) == LD_OK);
+    CHECK(_img_check(0, 16));
+
+    // Detection
+    CHECK(ld_srec_decoder.sniff((const uint8_t*)"\r\n  S00F0000", 12));
+    CHECK(!ld_srec_decoder.sniff((const uint8_t*)":10000000", 9));
+    CHECK(!ld_srec_decoder.sniff((const uint8_t*)"S", 1));
+}
+
+// ====================================================================
+// Test Sink
+// ====================================================================
+
+/**
+ * @brief Write decoded data to the test image (in place of the loader's sink).
+ */
+ld_status_t ld_sink_write(ld_sink_t* sink, uint32_t addr, const uint8_t* data, uint32_t len) {
+    ld_result_t* result = sink->result;
+    uint32_t iaddr = addr + (uint32_t)sink->offset;
+    if (iaddr >= _IMG_SIZE || len > (_IMG_SIZE - iaddr)) {
+        return (LD_ADDR_ERROR);
+    }
+    memcpy(&_img[iaddr], data, len);
+    result->records++;
+    result->bytes += len;
+    if (iaddr + len > result->addr_high) {
+        result->addr_high = iaddr + len;
+    }
+    return (LD_OK);
+}
+
+int main(int argc, char** argv) {
+    srand(1);
+    _test_roundtrip();
+    _test_offset();
+    _test_errors();
+    printf("test_srecload: %d checks, %d failed\n", _checks, _failures);
+    return (_failures ? 1 : 0);
+}